@@ -0,0 +1,110 @@
+#include "vk_image_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks the vectorized image kernels against their scalar references and measures both. The vector path only
+// covers groups of four destination pixels, so odd sizes and every remainder of the width are compared too.
+// Returns 1 if any kernel does not match its reference.
+
+namespace
+{
+	void fill_random(std::vector<uint8_t>& pixels, std::mt19937& random)
+	{
+		std::uniform_int_distribution<int> distribution(0, 255);
+		for (uint8_t& value : pixels)
+		{
+			value = static_cast<uint8_t>(distribution(random));
+		}
+	}
+
+	size_t get_destination_size(int width, int height)
+	{
+		return static_cast<size_t>(std::max(1, width >> 1)) * std::max(1, height >> 1) * 4;
+	}
+
+	bool verify(int width, int height, std::mt19937& random)
+	{
+		std::vector<uint8_t> src(static_cast<size_t>(width) * height * 4);
+		fill_random(src, random);
+
+		// Poisoned so a pixel the kernel forgets to write does not match by chance
+		std::vector<uint8_t> expected(get_destination_size(width, height), 0xAB);
+		std::vector<uint8_t> result(expected.size(), 0xCD);
+		vkimage::reference::downsample_rgba8(src.data(), width, height, expected.data());
+		vkimage::downsample_rgba8(src.data(), width, height, result.data());
+
+		if (memcmp(expected.data(), result.data(), expected.size()) != 0)
+		{
+			std::cout << "[ERROR] downsample_rgba8 does not match the reference at " << width << "x" << height << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	typedef void (*DownsampleKernel)(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst);
+
+	// Source megapixels per second, best of a few runs so the first touch of the memory is not counted
+	double measure(DownsampleKernel kernel, const std::vector<uint8_t>& src, int width, int height, std::vector<uint8_t>& dst)
+	{
+		const int runs = 10;
+		double best = 0.0;
+		for (int run = 0; run < runs; run++)
+		{
+			const auto start = std::chrono::high_resolution_clock::now();
+			kernel(src.data(), width, height, dst.data());
+			const std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+			best = std::max(best, static_cast<double>(width) * height / 1000000.0 / seconds.count());
+		}
+		return best;
+	}
+
+	void benchmark(int width, int height, std::mt19937& random)
+	{
+		std::vector<uint8_t> src(static_cast<size_t>(width) * height * 4);
+		fill_random(src, random);
+		std::vector<uint8_t> dst(get_destination_size(width, height));
+
+		const double reference = measure(vkimage::reference::downsample_rgba8, src, width, height, dst);
+		const double vectorized = measure(vkimage::downsample_rgba8, src, width, height, dst);
+		const double srgb = measure(vkimage::downsample_rgba8_srgb, src, width, height, dst);
+
+		std::cout << width << "x" << height << ": reference " << reference << " MP/s, " << vkimage::get_simd_name() << " "
+			<< vectorized << " MP/s (" << vectorized / reference << "x), sRGB " << srgb << " MP/s" << std::endl;
+	}
+}
+
+int main()
+{
+	std::mt19937 random(1234);
+
+	std::cout << "Image kernels compiled with " << vkimage::get_simd_name() << std::endl;
+
+	// Every small size covers the single pixel wide or high images and all the remainders of the vector loop
+	bool matches = true;
+	for (int height = 1; height <= 20; height++)
+	{
+		for (int width = 1; width <= 40; width++)
+		{
+			matches = verify(width, height, random) && matches;
+		}
+	}
+	for (int size : { 255, 256, 257, 1023, 1024, 1025 })
+	{
+		matches = verify(size, size, random) && matches;
+		matches = verify(size, size + 1, random) && matches;
+	}
+	std::cout << (matches ? "All sizes match the reference" : "[ERROR] Some sizes do not match the reference") << std::endl;
+
+	// Even and odd sizes of typical textures, the sRGB kernel is scalar and only measured for comparison
+	for (int size : { 256, 257, 1024, 1025, 2048, 2049, 4096 })
+	{
+		benchmark(size, size, random);
+	}
+
+	return matches ? 0 : 1;
+}
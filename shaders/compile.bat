@@ -2,13 +2,17 @@ C:\Tools\glslang\bin\glslangValidator.exe default_lit.frag -o default_lit.frag.s
 C:\Tools\glslang\bin\glslangValidator.exe tri_mesh.vert -o tri_mesh.vert.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe textured_lit.frag -o textured_lit.frag.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe deferred.vert -o deferred.vert.spv --target-env vulkan1.2
+C:\Tools\glslang\bin\glslangValidator.exe deferred.vert -DQUANTIZED_VERTICES -o deferred_quantized.vert.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe deferred.frag -o deferred.frag.spv --target-env vulkan1.2
+C:\Tools\glslang\bin\glslangValidator.exe impostor.vert -o impostor.vert.spv --target-env vulkan1.2
+C:\Tools\glslang\bin\glslangValidator.exe impostor.frag -o impostor.frag.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe skybox.vert -o skybox.vert.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe skybox.frag -o skybox.frag.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe light.vert -o light.vert.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe light.frag -o light.frag.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe pospo.frag -o pospo.frag.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe flat.vert -o flat.vert.spv --target-env vulkan1.2
+C:\Tools\glslang\bin\glslangValidator.exe flat.vert -DQUANTIZED_VERTICES -o flat_quantized.vert.spv --target-env vulkan1.2
 C:\Tools\glslang\bin\glslangValidator.exe flat.frag -o flat.frag.spv --target-env vulkan1.2
 
 C:\Tools\glslang\bin\glslangValidator.exe raygen.rgen -o raygen.rgen.spv --target-env vulkan1.2
@@ -1,6 +1,7 @@
 //glsl version 4.5
 #version 450
 #extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_GOOGLE_include_directive : require
 
 struct ClipPositions
 {
@@ -34,6 +35,10 @@ layout( push_constant, std140 ) uniform ObjectIndices {
 
 layout(set = 1, binding = 0) buffer Materials { Material m[]; } materials;
 layout(set = 1, binding = 1) uniform sampler2D textures[];
+layout(set = 1, binding = 2) uniform sampler2DArray textureArrays[]; // the packed foliage textures
+
+#define MATERIAL_TEXTURES_FRAGMENT
+#include "materialTextures.h"
 
 float near = 0.1;
 float far = 100.0;
@@ -52,7 +57,7 @@ void main()
 	int textureIndex = int(materials.m[matIndex].roughness_metallic_tilling_color_factors.w);
 
 	int occlusionTextureIdx = int(material.emissive_metRough_occlusion_normal_indices.z);
-	vec3 occlusionTexture = texture(textures[occlusionTextureIdx], texCoord).xyz;
+	vec3 occlusionTexture = sampleMaterialTexture(occlusionTextureIdx, texCoord).xyz;
 	
 	if(occlusionTextureIdx >= 0 && occlusionTexture.x < 0.001 && occlusionTexture.y < 0.001 && occlusionTexture.z < 0.001)
 	{
@@ -70,7 +75,7 @@ void main()
 	}
 	else
 	{
-		color = texture(textures[textureIndex], uv).xyz;
+		color = sampleMaterialTexture(textureIndex, uv).xyz;
 	}
 
 	vec2 position = clipPositions.currentFrame.xy / clipPositions.currentFrame.w * 0.5f + 0.5f;
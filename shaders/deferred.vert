@@ -1,9 +1,16 @@
 #version 460
 
+// QUANTIZED_VERTICES builds the variant for QuantizedVertex, the dequantization is part of the model matrix
+#ifdef QUANTIZED_VERTICES
+layout (location = 0) in vec4 vPosition;
+layout (location = 1) in vec2 vNormal;
+layout (location = 3) in vec2 vTexCoord;
+#else
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 layout (location = 3) in vec2 vTexCoord;
+#endif
 
 struct ClipPositions
 {
@@ -28,16 +35,37 @@ layout( push_constant, std140 ) uniform ModelMatrix {
   	vec4 matIndex; // currently using only x component to pass the primitive material index
 } objectPushConstant;
 
+#ifdef QUANTIZED_VERTICES
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if(v.z < 0.0)
+	{
+		v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(v);
+}
+#endif
+
 void main() 
 {	
 	mat4 modelMatrix = objectPushConstant.modelMatrix;
 
-	clipPositions.lastFrame = cameraData.viewproj_lastFrame * modelMatrix * vec4(vPosition, 1.0f);
-	clipPositions.currentFrame = cameraData.viewproj * modelMatrix * vec4(vPosition, 1.0f);
+#ifdef QUANTIZED_VERTICES
+	vec3 position = vPosition.xyz;
+	vec3 normal = decodeOctahedral(vNormal);
+#else
+	vec3 position = vPosition;
+	vec3 normal = vNormal;
+#endif
+
+	clipPositions.lastFrame = cameraData.viewproj_lastFrame * modelMatrix * vec4(position, 1.0f);
+	clipPositions.currentFrame = cameraData.viewproj * modelMatrix * vec4(position, 1.0f);
 
 	gl_Position = clipPositions.currentFrame;
 
-	outPosition = vec3(modelMatrix * vec4(vPosition, 1.0));
-	outNormal = mat3(transpose(inverse(modelMatrix))) * vNormal;
+	outPosition = vec3(modelMatrix * vec4(position, 1.0));
+	// The dequantization scale is uniform, normalizing is enough to undo it
+	outNormal = normalize(mat3(transpose(inverse(modelMatrix))) * normal);
 	texCoord = vTexCoord;
 }
\ No newline at end of file
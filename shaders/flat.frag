@@ -1,6 +1,7 @@
 #version 460
 
 #extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_GOOGLE_include_directive : require
 
 precision highp int;
 
@@ -20,8 +21,12 @@ layout( push_constant, std140 ) uniform ObjectIndices {
 
 layout(set = 1, binding = 0) buffer Materials { Material m[]; } materials;
 layout(set = 1, binding = 1) uniform sampler2D textures[];
+layout(set = 1, binding = 2) uniform sampler2DArray textureArrays[]; // the packed foliage textures
 layout(set = 2, binding = 0, rgba32ui) uniform uimage2D deepShadowImage;
 
+#define MATERIAL_TEXTURES_FRAGMENT
+#include "materialTextures.h"
+
 float near = -500.0;
 float far = 0.1;
 
@@ -115,7 +120,7 @@ void main()
 	opacity = MAX_8UINT - opacity & 0x000000FF;
 
 	int occlusionTextureIdx = int(material.emissive_metRough_occlusion_normal_indices.z);
-	vec3 occlusionTexture = texture(textures[occlusionTextureIdx], texCoord).xyz;
+	vec3 occlusionTexture = sampleMaterialTexture(occlusionTextureIdx, texCoord).xyz;
 	
 	if(occlusionTextureIdx >= 0 && occlusionTexture.x < 0.001 && occlusionTexture.y < 0.001 && occlusionTexture.z < 0.001)
 	{
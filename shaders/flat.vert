@@ -1,9 +1,16 @@
 #version 460
 
+// QUANTIZED_VERTICES builds the variant for QuantizedVertex, the dequantization is part of the model matrix
+#ifdef QUANTIZED_VERTICES
+layout (location = 0) in vec4 vPosition;
+layout (location = 1) in vec2 vNormal;
+layout (location = 3) in vec2 vTexCoord;
+#else
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 layout (location = 3) in vec2 vTexCoord;
+#endif
 
 layout (location = 0) out vec2 texCoord;
 
@@ -23,6 +30,6 @@ void main()
 {
 	mat4 modelMatrix = objectPushConstant.modelMatrix;
 
-	gl_Position = cameraData.viewproj * modelMatrix * vec4(vPosition, 1.0f);
+	gl_Position = cameraData.viewproj * modelMatrix * vec4(vPosition.xyz, 1.0f);
 	texCoord = vTexCoord;
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+//glsl version 4.5
+#version 450
+#extension GL_EXT_nonuniform_qualifier : enable
+
+struct ClipPositions
+{
+	vec4 lastFrame;
+	vec4 currentFrame;
+};
+
+//shader input
+layout (location = 0) in vec3 inPosition;
+layout (location = 1) in vec2 atlasCoord;
+layout (location = 2) flat in vec3 frameDirection;
+layout (location = 3) in ClipPositions clipPositions;
+
+//output write, the same G-buffers as deferred.frag
+layout (location = 0) out vec4 outPosition;
+layout (location = 1) out vec4 outNormal;
+layout (location = 2) out vec4 outFragColor;
+layout (location = 3) out vec4 outMotionVector;
+
+layout( push_constant, std140 ) uniform ImpostorConstants {
+	mat4 modelMatrix;
+	vec4 center_radius;
+	vec4 textures_frames_material; // x albedo texture, y normal texture, z frames per side, w material index
+} impostorPushConstant;
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+void main() 
+{	
+	int albedoIndex = int(impostorPushConstant.textures_frames_material.x);
+	int normalIndex = int(impostorPushConstant.textures_frames_material.y);
+	int matIndex = int(impostorPushConstant.textures_frames_material.w);
+	mat4 modelMatrix = impostorPushConstant.modelMatrix;
+
+	vec4 albedo = texture(textures[nonuniformEXT(albedoIndex)], atlasCoord);
+	if(albedo.a < 0.5)
+	{
+		discard;
+	}
+
+	// Normal and depth were baked in prefab space, depth in bounding radii towards the view
+	vec4 normalDepth = texture(textures[nonuniformEXT(normalIndex)], atlasCoord);
+	vec3 normal = normalize(mat3(transpose(inverse(modelMatrix))) * (normalDepth.xyz * 2.0 - 1.0));
+	vec3 position = inPosition + frameDirection * (normalDepth.w * 2.0 - 1.0) * impostorPushConstant.center_radius.w;
+
+	vec2 screenPosition = clipPositions.currentFrame.xy / clipPositions.currentFrame.w * 0.5f + 0.5f;
+	vec2 lastFramePosition = clipPositions.lastFrame.xy / clipPositions.lastFrame.w * 0.5f + 0.5f;
+
+	outPosition = modelMatrix * vec4(position, 1.0);
+	outNormal = vec4(normal, 1.0) * 0.5 + vec4(0.5);
+	outFragColor = vec4(albedo.rgb, float(matIndex) / 100.0);
+	outMotionVector = vec4((screenPosition - lastFramePosition) * 0.5f + 0.5f, 0.0, 1.0);
+}
@@ -0,0 +1,75 @@
+#version 460
+
+struct ClipPositions
+{
+	vec4 lastFrame;
+	vec4 currentFrame;
+};
+
+layout (location = 0) out vec3 outPosition; // on the quad, in prefab space
+layout (location = 1) out vec2 outAtlasCoord;
+layout (location = 2) flat out vec3 outFrameDirection;
+layout (location = 3) out ClipPositions clipPositions;
+
+layout(set = 0, binding = 0) uniform CameraBuffer {
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	mat4 viewproj_lastFrame;
+} cameraData;
+
+layout( push_constant, std140 ) uniform ImpostorConstants {
+	mat4 modelMatrix;
+	vec4 center_radius;
+	vec4 textures_frames_material; // x albedo texture, y normal texture, z frames per side, w material index
+} impostorPushConstant;
+
+const vec2 corners[6] = vec2[](
+	vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+	vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+);
+
+// Hemi-octahedral mapping of the upper hemisphere, vkimpostor::encode_direction and get_frame_direction
+vec2 encodeDirection(vec3 d)
+{
+	d.y = max(d.y, 0.0);
+	vec2 p = d.xz / max(abs(d.x) + d.y + abs(d.z), 1e-6);
+	return vec2(p.x + p.y, p.x - p.y);
+}
+
+vec3 decodeDirection(vec2 e)
+{
+	vec2 p = vec2(e.x + e.y, e.x - e.y) * 0.5;
+	return normalize(vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y));
+}
+
+void main() 
+{	
+	mat4 modelMatrix = impostorPushConstant.modelMatrix;
+	vec3 center = impostorPushConstant.center_radius.xyz;
+	float radius = impostorPushConstant.center_radius.w;
+	float framesPerSide = impostorPushConstant.textures_frames_material.z;
+
+	// The closest baked view to the camera, found in prefab space
+	vec3 cameraPosition = inverse(cameraData.view)[3].xyz;
+	vec3 localCamera = vec3(inverse(modelMatrix) * vec4(cameraPosition, 1.0));
+	vec2 frame = clamp(floor((encodeDirection(normalize(localCamera - center)) * 0.5 + 0.5) * framesPerSide), vec2(0.0), vec2(framesPerSide - 1.0));
+	vec3 direction = decodeDirection((frame + 0.5) / framesPerSide * 2.0 - 1.0);
+
+	// Same axes as vkimpostor::get_frame_axes
+	vec3 reference = direction.y > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(reference, direction));
+	vec3 up = cross(direction, right);
+
+	vec2 corner = corners[gl_VertexIndex];
+	vec3 position = center + (corner.x * right + corner.y * up) * radius;
+
+	clipPositions.lastFrame = cameraData.viewproj_lastFrame * modelMatrix * vec4(position, 1.0f);
+	clipPositions.currentFrame = cameraData.viewproj * modelMatrix * vec4(position, 1.0f);
+
+	gl_Position = clipPositions.currentFrame;
+
+	outPosition = position;
+	outAtlasCoord = (frame + vec2(corner.x * 0.5 + 0.5, 0.5 - corner.y * 0.5)) / framesPerSide;
+	outFrameDirection = direction;
+}
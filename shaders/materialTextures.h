@@ -0,0 +1,55 @@
+// Sampling of the texture indices of the materials, shared by the raster and ray tracing shaders. Include it after
+// the textures[] and textureArrays[] descriptor arrays, fragment shaders define MATERIAL_TEXTURES_FRAGMENT first.
+#ifndef VK_ENGINE_MATERIAL_TEXTURES_H
+#define VK_ENGINE_MATERIAL_TEXTURES_H
+
+// Same values as the engine. Indices from MAX_TEXTURES up address array * MAX_TEXTURE_ARRAY_LAYERS + layer, the
+// packed foliage textures, the ones below are slots of textures[].
+const int MAX_TEXTURES = 256;
+const int MAX_TEXTURE_ARRAY_LAYERS = 64;
+
+bool isArrayTexture(int index)
+{
+	return index >= MAX_TEXTURES;
+}
+
+int getTextureArray(int index)
+{
+	return (index - MAX_TEXTURES) / MAX_TEXTURE_ARRAY_LAYERS;
+}
+
+float getTextureLayer(int index)
+{
+	return float((index - MAX_TEXTURES) % MAX_TEXTURE_ARRAY_LAYERS);
+}
+
+ivec2 materialTextureSize(int index)
+{
+	if(isArrayTexture(index))
+	{
+		return textureSize(textureArrays[nonuniformEXT(getTextureArray(index))], 0).xy;
+	}
+	return textureSize(textures[nonuniformEXT(max(index, 0))], 0);
+}
+
+vec4 sampleMaterialTextureLod(int index, vec2 uv, float lod)
+{
+	if(isArrayTexture(index))
+	{
+		return textureLod(textureArrays[nonuniformEXT(getTextureArray(index))], vec3(uv, getTextureLayer(index)), lod);
+	}
+	return textureLod(textures[nonuniformEXT(max(index, 0))], uv, lod);
+}
+
+#ifdef MATERIAL_TEXTURES_FRAGMENT
+vec4 sampleMaterialTexture(int index, vec2 uv)
+{
+	if(isArrayTexture(index))
+	{
+		return texture(textureArrays[nonuniformEXT(getTextureArray(index))], vec3(uv, getTextureLayer(index)));
+	}
+	return texture(textures[nonuniformEXT(max(index, 0))], uv);
+}
+#endif
+
+#endif
@@ -28,10 +28,20 @@ struct ShadowRayPayload
 	bool hardShadowed;
 };
 
+// Same layout as the engine Vertex, only valid inside scalar blocks
 struct Vertex {
-	vec4 position;
-	vec4 normal;
-	vec4 uv;
+	vec3 position;
+	vec3 normal;
+	vec3 color;
+	vec2 uv;
+};
+
+// Same layout as the engine QuantizedVertex, read as plain uints so no 16 bit storage feature is needed
+struct QuantizedVertex {
+	uint position_xy; // snorm16 x2
+	uint position_zw; // snorm16 x2, w is padding
+	uint normal;      // octahedral encoded, snorm16 x2
+	uint uv;          // half x2
 };
 
 struct Light {
@@ -40,8 +50,11 @@ struct Light {
     vec4 properties_type;
 };
 
+// First index and vertex count from the start of the geometry arenas
 struct Primitive {
-	vec4 firstIdx_rndIdx_matIdx_transIdx;
+	uvec4 firstIdx_rndIdx_matIdx_transIdx;
+	vec4 dequantization; // xyz offset, w scale. w is 0 when the vertices are not quantized
+	uvec4 firstVtx_idxSize; // y is 2 for 16 bit indices and 4 for 32 bit ones
 };
 
 struct Material {
@@ -51,6 +64,37 @@ struct Material {
 	vec4 emissive_metRough_occlusion_normal_indices; // Indices to material textures
 };
 
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if(v.z < 0.0)
+	{
+		v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(v);
+}
+
+// Index buffers are bound as uint arrays, 16 bit indices are packed two per word
+uint readIndex(const in uint word, const in uint element, const in bool shortIndices)
+{
+	return shortIndices ? (word >> ((element & 1u) * 16u)) & 0xFFFFu : word;
+}
+
+uint indexWord(const in uint element, const in bool shortIndices)
+{
+	return shortIndices ? element >> 1u : element;
+}
+
+Vertex decodeQuantizedVertex(const in QuantizedVertex q, const in vec4 dequantization)
+{
+	Vertex v;
+	v.position = vec3(unpackSnorm2x16(q.position_xy), unpackSnorm2x16(q.position_zw).x) * dequantization.w + dequantization.xyz;
+	v.normal = decodeOctahedral(unpackSnorm2x16(q.normal));
+	v.color = vec3(1.0);
+	v.uv = unpackHalf2x16(q.uv);
+	return v;
+}
+
 float D_GGX(const in float NoH, const in float linearRoughness)
 {
 	float a2 = linearRoughness * linearRoughness;
@@ -189,4 +233,19 @@ vec3 getConeSample(inout uint rngState, vec3 direction, float coneAngle) {
     return R * vec3(x, y, z);
 }
 
+// Angle covered by one pixel of a 1080p frame with a 60 degree fov, used when the ray does not come from the camera
+#define DEFAULT_PIXEL_SPREAD_ANGLE 0.00107
+
+// Texture lod for a ray cone of the given width hitting a triangle (ray cones from "Texture Level of Detail
+// Strategies for Real-Time Ray Tracing"). Hit shaders have no derivatives, so texture() would always read mip 0.
+float rayConeTextureLod(vec3 p0, vec3 p1, vec3 p2, vec2 uv0, vec2 uv1, vec2 uv2, ivec2 texSize, float coneWidth, vec3 normal, vec3 rayDirection)
+{
+	float worldArea = length(cross(p1 - p0, p2 - p0));
+	float uvArea = abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv2.x - uv0.x) * (uv1.y - uv0.y)) * float(texSize.x * texSize.y);
+
+	float lod = 0.5 * log2(max(uvArea, 1e-10) / max(worldArea, 1e-10));
+	lod += log2(max(coneWidth, 1e-10) / max(abs(dot(normal, rayDirection)), 0.05));
+	return max(lod, 0.0);
+}
+
 #endif
\ No newline at end of file
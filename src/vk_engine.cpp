@@ -5,6 +5,8 @@
 #include "vk_textures.h"
 #include "vk_material.h"
 #include "vk_utils.h"
+#include "vk_thread_pool.h"
+#include "vk_profiler.h"
 
 #include <SDL.h>
 #include <SDL_vulkan.h>
@@ -49,9 +51,8 @@ void VulkanEngine::init()
 
 	//load_meshes();
 
-	VKE::Texture* texture = VKE::Texture::sTexturesLoaded["default"];
+	VKE::Texture* texture = VKE::Texture::get("default");
 	VKE::Material* defaultMaterial = new VKE::Material(texture);
-	defaultMaterial->_id = VKE::Material::sMaterials.size();
 	defaultMaterial->register_material("default");
 
 	scene = new Scene();
@@ -59,6 +60,13 @@ void VulkanEngine::init()
 	scene->generate_sample_scene();
 	//scene->generate_random_sample_scene();
 
+	// Everything the scene loaded is queued on the upload batcher, make sure it reached the GPU before the first frame
+	RenderEngine::_uploadBatcher.flush_and_wait();
+
+	vkprofile::print();
+	vkprofile::write_json("import_profile.json");
+	vkprofile::write_csv("import_profile.csv");
+
 	renderer->currentScene = scene;
 
 	//everything went fine
@@ -68,6 +76,7 @@ void VulkanEngine::init()
 void VulkanEngine::cleanup()
 {	
 	renderer->cleanup();
+	vkjobs::shutdown();
 }
 
 void VulkanEngine::run()
@@ -217,6 +226,24 @@ void VulkanEngine::render_debug_GUI()
 	if (ImGui::Button("Use wait idle"))
 		renderer->_isUsingWaitIdle = !renderer->_isUsingWaitIdle;
 
+	// Import stages of everything loaded so far
+	if (ImGui::TreeNode("Import profile"))
+	{
+		for (int i = 0; i < IMPORT_STAGE_COUNT; i++)
+		{
+			ImportStage stage = static_cast<ImportStage>(i);
+			ImportStageStatistics statistics = vkprofile::get_statistics(stage);
+			ImGui::Text("%-20s %9.2f ms %9.2f MB %9.1f MB/s %6llu calls", vkprofile::get_stage_name(stage), statistics.seconds * 1000.0,
+				statistics.bytes / (1024.0 * 1024.0), statistics.get_throughput(), static_cast<unsigned long long>(statistics.calls));
+		}
+		if (ImGui::Button("Write report"))
+		{
+			vkprofile::write_json("import_profile.json");
+			vkprofile::write_csv("import_profile.csv");
+		}
+		ImGui::TreePop();
+	}
+
 	// Lights
 	for(int i = 0; i < scene->_lights.size(); i++)
 	{
@@ -310,187 +337,92 @@ void VulkanEngine::load_meshes()
 void VulkanEngine::load_images()
 {
 	VKE::Texture* defaultTexture = new VKE::Texture();
-
-	vkutil::load_image_from_file(&std::string("../assets/plain.jpg"), defaultTexture->_image);
-
-	VkImageViewCreateInfo imageinfo = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, defaultTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &imageinfo, nullptr, &defaultTexture->_imageView);
-
-	defaultTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/plain.jpg", TEXTURE_ROLE_COLOR, *defaultTexture);
 	defaultTexture->register_texture("default");
 
 
 	VKE::Texture* grassTexture = new VKE::Texture();
-
-	vkutil::load_image_from_file(&std::string("../assets/grass.jpg"), grassTexture->_image);
-
-	VkImageViewCreateInfo imageinfo2 = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, grassTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &imageinfo2, nullptr, &grassTexture->_imageView);
-
-	grassTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/grass.jpg", TEXTURE_ROLE_COLOR, *grassTexture);
 	grassTexture->register_texture("grass");
 
 	// Maple tree
 
 	VKE::Texture* mapleBarkTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/maple/maple_bark.png"), mapleBarkTexture->_image);
-	VkImageViewCreateInfo mapleBarkTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, mapleBarkTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &mapleBarkTexView, nullptr, &mapleBarkTexture->_imageView);
-	mapleBarkTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/maple/maple_bark.png", TEXTURE_ROLE_COLOR, *mapleBarkTexture);
 	mapleBarkTexture->register_texture("maple_bark");
 
 	VKE::Texture* mapleLeavesTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/maple/maple_leaf.png"), mapleLeavesTexture->_image);
-	VkImageViewCreateInfo mapleLeavesTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, mapleLeavesTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &mapleLeavesTexView, nullptr, &mapleLeavesTexture->_imageView);
-	mapleLeavesTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/maple/maple_leaf.png", TEXTURE_ROLE_COLOR, *mapleLeavesTexture);
 	mapleLeavesTexture->register_texture("maple_leaf");
 
 	VKE::Texture* mapleLeavesOcclusionTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/maple/maple_leaf_Mask.jpg"), mapleLeavesOcclusionTexture->_image);
-	VkImageViewCreateInfo mapleLeavesOcclusionView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, mapleLeavesOcclusionTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &mapleLeavesOcclusionView, nullptr, &mapleLeavesOcclusionTexture->_imageView);
-	mapleLeavesOcclusionTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/maple/maple_leaf_Mask.jpg", TEXTURE_ROLE_MASK, *mapleLeavesOcclusionTexture);
 	mapleLeavesOcclusionTexture->register_texture("maple_leaf_occlusion");
 
 	// Oak tree
 
 	VKE::Texture* oakBarkTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/oak/bark_tree.jpg"), oakBarkTexture->_image);
-	VkImageViewCreateInfo oakBarkTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, oakBarkTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &oakBarkTexView, nullptr, &oakBarkTexture->_imageView);
-	oakBarkTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/oak/bark_tree.jpg", TEXTURE_ROLE_COLOR, *oakBarkTexture);
 	oakBarkTexture->register_texture("oak_bark");
 
 	VKE::Texture* oakLeavesTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/oak/leaves_01.jpg"), oakLeavesTexture->_image);
-	VkImageViewCreateInfo oakLeavesTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, oakLeavesTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &oakLeavesTexView, nullptr, &oakLeavesTexture->_imageView);
-	oakLeavesTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/oak/leaves_01.jpg", TEXTURE_ROLE_COLOR, *oakLeavesTexture);
 	oakLeavesTexture->register_texture("oak_leaf");
 
 	VKE::Texture* oakLeavesOcclusionTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/oak/leaves_alpha_inverted.jpg"), oakLeavesOcclusionTexture->_image);
-	VkImageViewCreateInfo oakLeavesOcclusionView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, oakLeavesOcclusionTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &oakLeavesOcclusionView, nullptr, &oakLeavesOcclusionTexture->_imageView);
-	oakLeavesOcclusionTexture->_id = VKE::Texture::sTexturesLoaded.size();
-	oakLeavesTexture->register_texture("oak_leaf_occlusion");
+	vkutil::load_texture_from_file("../assets/vegetation/oak/leaves_alpha_inverted.jpg", TEXTURE_ROLE_MASK, *oakLeavesOcclusionTexture);
+	oakLeavesOcclusionTexture->register_texture("oak_leaf_occlusion");
 
 	// Broadleaf tree
 
 	VKE::Texture* broadleafBarkTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/broadleaf/bark.png"), broadleafBarkTexture->_image);
-	VkImageViewCreateInfo broadleafBarkTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, broadleafBarkTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &broadleafBarkTexView, nullptr, &broadleafBarkTexture->_imageView);
-	broadleafBarkTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/broadleaf/bark.png", TEXTURE_ROLE_COLOR, *broadleafBarkTexture);
 	broadleafBarkTexture->register_texture("broadleaf_bark");
 
 	VKE::Texture* broadleafLeavesTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/broadleaf/leaf.png"), broadleafLeavesTexture->_image);
-	VkImageViewCreateInfo broadleafLeavesTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, broadleafLeavesTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &broadleafLeavesTexView, nullptr, &broadleafLeavesTexture->_imageView);
-	broadleafLeavesTexture->_id = VKE::Texture::sTexturesLoaded.size();
-	broadleafBarkTexture->register_texture("broadleaf_leaf");
+	vkutil::load_texture_from_file("../assets/vegetation/broadleaf/leaf.png", TEXTURE_ROLE_COLOR, *broadleafLeavesTexture);
+	broadleafLeavesTexture->register_texture("broadleaf_leaf");
 
 	// Rainforest tree
 
 	VKE::Texture* rainforestBarkTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/rainforest_tree/bark.jpg"), rainforestBarkTexture->_image);
-	VkImageViewCreateInfo rainforestBarkTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, rainforestBarkTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &rainforestBarkTexView, nullptr, &rainforestBarkTexture->_imageView);
-	rainforestBarkTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/rainforest_tree/bark.jpg", TEXTURE_ROLE_COLOR, *rainforestBarkTexture);
 	rainforestBarkTexture->register_texture("rainforest_bark");
 
 	VKE::Texture* rainforestLeavesTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/rainforest_tree/leaves_winter.png"), rainforestLeavesTexture->_image);
-	VkImageViewCreateInfo rainforestLeavesTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, rainforestLeavesTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &rainforestLeavesTexView, nullptr, &rainforestLeavesTexture->_imageView);
-	rainforestLeavesTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/rainforest_tree/leaves_winter.png", TEXTURE_ROLE_COLOR, *rainforestLeavesTexture);
 	rainforestLeavesTexture->register_texture("rainforest_leaf");
 
 	// Random trees
 	VKE::Texture* walnutTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Walnut_L.jpg"), walnutTexture->_image);
-	VkImageViewCreateInfo walnutTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, walnutTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &walnutTexView, nullptr, &walnutTexture->_imageView);
-	walnutTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Walnut_L.jpg", TEXTURE_ROLE_COLOR, *walnutTexture);
 	walnutTexture->register_texture("walnut");
 
 	VKE::Texture* mossyTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Mossy_Tr.jpg"), mossyTexture->_image);
-	VkImageViewCreateInfo mossyTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, mossyTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &mossyTexView, nullptr, &mossyTexture->_imageView);
-	mossyTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Mossy_Tr.jpg", TEXTURE_ROLE_COLOR, *mossyTexture);
 	mossyTexture->register_texture("mossy");
 
 	VKE::Texture* bark_STexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Bark___S.jpg"), bark_STexture->_image);
-	VkImageViewCreateInfo bark_STexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, bark_STexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &bark_STexView, nullptr, &bark_STexture->_imageView);
-	bark_STexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Bark___S.jpg", TEXTURE_ROLE_COLOR, *bark_STexture);
 	bark_STexture->register_texture("bark_s");
 
 	VKE::Texture* bark_0Texture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Bark___0.jpg"), bark_0Texture->_image);
-	VkImageViewCreateInfo bark_0TexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, bark_0Texture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &bark_0TexView, nullptr, &bark_0Texture->_imageView);
-	bark_0Texture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Bark___0.jpg", TEXTURE_ROLE_COLOR, *bark_0Texture);
 	bark_0Texture->register_texture("bark_0");
 
 	VKE::Texture* bottom_TTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Bottom_T.jpg"), bottom_TTexture->_image);
-	VkImageViewCreateInfo bottom_TTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, bottom_TTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &bottom_TTexView, nullptr, &bottom_TTexture->_imageView);
-	bottom_TTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Bottom_T.jpg", TEXTURE_ROLE_COLOR, *bottom_TTexture);
 	bottom_TTexture->register_texture("bottom_t");
 
 	VKE::Texture* sonneratTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Sonnerat.jpg"), sonneratTexture->_image);
-	VkImageViewCreateInfo sonneratTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, sonneratTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &sonneratTexView, nullptr, &sonneratTexture->_imageView);
-	sonneratTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Sonnerat.jpg", TEXTURE_ROLE_COLOR, *sonneratTexture);
 	sonneratTexture->register_texture("sonnerat");
 
 	VKE::Texture* bark_1Texture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Bark___1.jpg"), bark_1Texture->_image);
-	VkImageViewCreateInfo bark_1TexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, bark_1Texture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &bark_1TexView, nullptr, &bark_1Texture->_imageView);
-	bark_1Texture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Bark___1.jpg", TEXTURE_ROLE_COLOR, *bark_1Texture);
 	bark_1Texture->register_texture("bark_1");
 
 	VKE::Texture* oak_LTexture = new VKE::Texture();
-	vkutil::load_image_from_file(&std::string("../assets/vegetation/trees/Texture/Oak_Leav.jpg"), oak_LTexture->_image);
-	VkImageViewCreateInfo oak_LTexView = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, oak_LTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(RenderEngine::_device, &oak_LTexView, nullptr, &oak_LTexture->_imageView);
-	oak_LTexture->_id = VKE::Texture::sTexturesLoaded.size();
+	vkutil::load_texture_from_file("../assets/vegetation/trees/Texture/Oak_Leav.jpg", TEXTURE_ROLE_COLOR, *oak_LTexture);
 	oak_LTexture->register_texture("oak_l");
-
-
-	RenderEngine::_mainDeletionQueue.push_function([=]() {
-		vkDestroyImageView(RenderEngine::_device, defaultTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, grassTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, mapleBarkTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, mapleLeavesTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, mapleLeavesOcclusionTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, oakBarkTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, oakLeavesTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, oakLeavesOcclusionTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, broadleafBarkTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, broadleafLeavesTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, rainforestBarkTexture->_imageView, nullptr);
-		vkDestroyImageView(RenderEngine::_device, rainforestLeavesTexture->_imageView, nullptr);
-
-		vmaDestroyImage(RenderEngine::_allocator, defaultTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, grassTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, mapleBarkTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, mapleLeavesTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, mapleLeavesOcclusionTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, oakBarkTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, oakLeavesTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, oakLeavesOcclusionTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, broadleafBarkTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, broadleafLeavesTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, rainforestBarkTexture->_image._image, nullptr);
-		vmaDestroyImage(RenderEngine::_allocator, rainforestLeavesTexture->_image._image, nullptr);
-		});
 }
@@ -0,0 +1,246 @@
+#include "vk_geometry_arena.h"
+#include "vk_render_engine.h"
+#include "vk_utils.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+void FreeListAllocator::init(VkDeviceSize capacity)
+{
+	_capacity = capacity;
+	_used = 0;
+	_blocksByOffset.clear();
+	_blocksBySize.clear();
+
+	if (capacity > 0)
+	{
+		insert_block(0, capacity);
+	}
+}
+
+bool FreeListAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset)
+{
+	if (size == 0 || alignment == 0)
+	{
+		return false;
+	}
+
+	// Smallest block first, the padding of the alignment may still make a block too small
+	for (auto it = _blocksBySize.lower_bound(size); it != _blocksBySize.end(); ++it)
+	{
+		const VkDeviceSize blockSize = it->first;
+		const VkDeviceSize blockOffset = it->second;
+		const VkDeviceSize offset = (blockOffset + alignment - 1) / alignment * alignment;
+		const VkDeviceSize padding = offset - blockOffset;
+		if (padding + size > blockSize)
+		{
+			continue;
+		}
+
+		erase_block(_blocksByOffset.find(blockOffset));
+		if (padding > 0)
+		{
+			insert_block(blockOffset, padding);
+		}
+		if (padding + size < blockSize)
+		{
+			insert_block(offset + size, blockSize - padding - size);
+		}
+
+		_used += size;
+		outOffset = offset;
+		return true;
+	}
+
+	return false;
+}
+
+void FreeListAllocator::free(VkDeviceSize offset, VkDeviceSize size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	_used -= size;
+	add_free_range(offset, size);
+}
+
+void FreeListAllocator::grow(VkDeviceSize capacity)
+{
+	if (capacity <= _capacity)
+	{
+		return;
+	}
+
+	const VkDeviceSize oldCapacity = _capacity;
+	_capacity = capacity;
+	add_free_range(oldCapacity, capacity - oldCapacity);
+}
+
+VkDeviceSize FreeListAllocator::get_largest_free() const
+{
+	return _blocksBySize.empty() ? 0 : _blocksBySize.rbegin()->first;
+}
+
+void FreeListAllocator::add_free_range(VkDeviceSize offset, VkDeviceSize size)
+{
+	auto next = _blocksByOffset.lower_bound(offset);
+	if (next != _blocksByOffset.end() && offset + size == next->first)
+	{
+		size += next->second;
+		erase_block(next);
+	}
+
+	next = _blocksByOffset.lower_bound(offset);
+	if (next != _blocksByOffset.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			size += previous->second;
+			erase_block(previous);
+		}
+	}
+
+	insert_block(offset, size);
+}
+
+void FreeListAllocator::insert_block(VkDeviceSize offset, VkDeviceSize size)
+{
+	_blocksByOffset[offset] = size;
+	_blocksBySize.insert(std::make_pair(size, offset));
+}
+
+void FreeListAllocator::erase_block(std::map<VkDeviceSize, VkDeviceSize>::iterator block)
+{
+	auto range = _blocksBySize.equal_range(block->second);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == block->first)
+		{
+			_blocksBySize.erase(it);
+			break;
+		}
+	}
+	_blocksByOffset.erase(block);
+}
+
+void GeometryArena::init(const char* name, VkBufferUsageFlags usage, VkDeviceSize capacity)
+{
+	_name = name;
+	// The arena copies itself when it grows and the acceleration structures are built from it
+	_usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+
+	_buffer = create_buffer(capacity);
+	_deviceAddress = vkutil::get_buffer_device_address(RenderEngine::_device, _buffer._buffer);
+	_allocator.init(capacity);
+}
+
+void GeometryArena::destroy()
+{
+	release_unused();
+
+	vmaDestroyBuffer(RenderEngine::_allocator, _buffer._buffer, _buffer._allocation);
+	_buffer = AllocatedBuffer{};
+	_deviceAddress = 0;
+	_allocator.init(0);
+}
+
+bool GeometryArena::allocate(VkDeviceSize size, VkDeviceSize alignment, GeometryRange& outRange)
+{
+	// Whole words, the hit shaders read the indices a uint at a time
+	size = vkutil::get_aligned_size(static_cast<size_t>(size), sizeof(uint32_t));
+
+	VkDeviceSize offset;
+	if (!_allocator.allocate(size, alignment, offset))
+	{
+		if (!grow(_allocator.get_capacity() + size + alignment) || !_allocator.allocate(size, alignment, offset))
+		{
+			std::cout << "[ERROR] The " << _name << " arena could not fit " << size << " bytes" << std::endl;
+			return false;
+		}
+	}
+
+	outRange.offset = offset;
+	outRange.size = size;
+	return true;
+}
+
+void GeometryArena::free(const GeometryRange& range)
+{
+	if (range.is_valid())
+	{
+		_pendingFrees.push_back(range);
+	}
+}
+
+void GeometryArena::release_unused()
+{
+	for (const GeometryRange& range : _pendingFrees)
+	{
+		_allocator.free(range.offset, range.size);
+	}
+	_pendingFrees.clear();
+
+	for (const AllocatedBuffer& buffer : _retiredBuffers)
+	{
+		vmaDestroyBuffer(RenderEngine::_allocator, buffer._buffer, buffer._allocation);
+	}
+	_retiredBuffers.clear();
+}
+
+void GeometryArena::print_statistics() const
+{
+	std::cout << "Geometry arena " << _name << ": " << _allocator.get_used() / 1024 << " of " << _allocator.get_capacity() / 1024
+		<< " KB used, " << _allocator.get_free_block_count() << " free blocks, the largest of " << _allocator.get_largest_free() / 1024
+		<< " KB" << std::endl;
+}
+
+AllocatedBuffer GeometryArena::create_buffer(VkDeviceSize capacity)
+{
+	return vkutil::create_buffer(RenderEngine::_allocator, static_cast<size_t>(capacity), _usage, VMA_MEMORY_USAGE_GPU_ONLY);
+}
+
+bool GeometryArena::grow(VkDeviceSize minCapacity)
+{
+	const VkDeviceSize oldCapacity = _allocator.get_capacity();
+	const VkDeviceSize capacity = std::max(oldCapacity * 2, minCapacity);
+
+	AllocatedBuffer buffer = create_buffer(capacity);
+	if (buffer._buffer == VK_NULL_HANDLE)
+	{
+		return false;
+	}
+
+	// Recorded after the uploads queued so far, the batcher makes them visible to the copy. The copies queued
+	// after it may write to the same bytes, so they wait for it.
+	const VkBuffer source = _buffer._buffer;
+	const VkBuffer destination = buffer._buffer;
+	RenderEngine::_uploadBatcher.record([=](VkCommandBuffer cmd) {
+		VkBufferCopy copyRegion{};
+		copyRegion.size = oldCapacity;
+		vkCmdCopyBuffer(cmd, source, destination, 1, &copyRegion);
+
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+			1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	});
+
+	// Frames already recorded may still draw from the old buffer
+	_retiredBuffers.push_back(_buffer);
+	_buffer = buffer;
+	_deviceAddress = vkutil::get_buffer_device_address(RenderEngine::_device, _buffer._buffer);
+	_allocator.grow(capacity);
+	_generation++;
+
+	std::cout << "Geometry arena " << _name << " grown to " << capacity / (1024 * 1024) << " MB" << std::endl;
+	return true;
+}
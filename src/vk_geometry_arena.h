@@ -0,0 +1,86 @@
+#pragma once
+
+#include "vk_types.h"
+#include <map>
+#include <vector>
+
+// Bytes of a geometry arena given to a prefab or a mesh
+struct GeometryRange
+{
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+
+	bool is_valid() const { return size > 0; }
+};
+
+// Best fit free list over a range of bytes, it only does the bookkeeping and never touches the device.
+// Freed ranges are merged with their free neighbours so loading and unloading does not fragment it over time.
+class FreeListAllocator
+{
+public:
+	void init(VkDeviceSize capacity);
+
+	// Alignment does not need to be a power of two, vertices are aligned to their own size
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset);
+	void free(VkDeviceSize offset, VkDeviceSize size);
+
+	// Appends free space at the end
+	void grow(VkDeviceSize capacity);
+
+	VkDeviceSize get_capacity() const { return _capacity; }
+	VkDeviceSize get_used() const { return _used; }
+	VkDeviceSize get_largest_free() const;
+	size_t get_free_block_count() const { return _blocksByOffset.size(); }
+
+private:
+	// Adds a range to the free list, merged with the free ranges it touches
+	void add_free_range(VkDeviceSize offset, VkDeviceSize size);
+	void insert_block(VkDeviceSize offset, VkDeviceSize size);
+	void erase_block(std::map<VkDeviceSize, VkDeviceSize>::iterator block);
+
+	VkDeviceSize _capacity = 0;
+	VkDeviceSize _used = 0;
+	std::map<VkDeviceSize, VkDeviceSize> _blocksByOffset; // offset -> size, to merge neighbours
+	std::multimap<VkDeviceSize, VkDeviceSize> _blocksBySize; // size -> offset, to find the best fit
+};
+
+// A single device local buffer the geometry of every prefab is suballocated from, so the raster passes bind it
+// once and the hit shaders index it with per primitive offsets. It grows by copying itself to a bigger buffer on
+// the upload batcher, the buffer it replaces and the ranges freed since are only released by release_unused once
+// the device is idle. Only the main thread may use it.
+class GeometryArena
+{
+public:
+	void init(const char* name, VkBufferUsageFlags usage, VkDeviceSize capacity);
+	void destroy();
+
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, GeometryRange& outRange);
+	void free(const GeometryRange& range);
+
+	// Call it when nothing on the device uses the arena as it was before the last call
+	void release_unused();
+
+	VkBuffer get_buffer() const { return _buffer._buffer; }
+	uint64_t get_device_address() const { return _deviceAddress; }
+	VkDeviceSize get_capacity() const { return _allocator.get_capacity(); }
+	VkDeviceSize get_used() const { return _allocator.get_used(); }
+
+	// Changes every time the buffer is replaced, descriptors and recorded commands that use it have to be updated
+	uint32_t get_generation() const { return _generation; }
+
+	void print_statistics() const;
+
+private:
+	AllocatedBuffer create_buffer(VkDeviceSize capacity);
+	bool grow(VkDeviceSize minCapacity);
+
+	const char* _name = "";
+	VkBufferUsageFlags _usage = 0;
+	AllocatedBuffer _buffer{};
+	uint64_t _deviceAddress = 0;
+	uint32_t _generation = 0;
+	FreeListAllocator _allocator;
+
+	std::vector<AllocatedBuffer> _retiredBuffers;
+	std::vector<GeometryRange> _pendingFrees;
+};
@@ -0,0 +1,214 @@
+#define CGLTF_IMPLEMENTATION
+#include "cgltf.h"
+#include "vk_gltf_file.h"
+#include "vk_profiler.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+	std::string get_base_directory(const std::string& filename)
+	{
+		size_t slashpos = filename.find_last_of("/\\");
+		return slashpos != std::string::npos ? filename.substr(0, slashpos + 1) : std::string();
+	}
+
+	// Decodes a base64 data URI, the size is what the glTF declares or what the encoded length gives
+	void* decode_data_uri(const char* uri, size_t size, size_t& outSize)
+	{
+		const char* base64 = strstr(uri, ";base64,");
+		if (!base64)
+		{
+			return nullptr;
+		}
+		base64 += strlen(";base64,");
+
+		if (size == 0)
+		{
+			const size_t length = strlen(base64);
+			size = length / 4 * 3;
+			if (length >= 1 && base64[length - 1] == '=') size--;
+			if (length >= 2 && base64[length - 2] == '=') size--;
+		}
+
+		cgltf_options options = {};
+		void* decoded = nullptr;
+		if (cgltf_load_buffer_base64(&options, size, base64, &decoded) != cgltf_result_success)
+		{
+			return nullptr;
+		}
+
+		outSize = size;
+		return decoded;
+	}
+
+	const unsigned char* map_external_file(const std::string& filename, GltfFile& outFile, size_t& outSize)
+	{
+		MappedFile* mapped = new MappedFile();
+		if (!mapped->open(filename))
+		{
+			delete mapped;
+			return nullptr;
+		}
+
+		outFile.externalFiles.push_back(mapped);
+		outSize = mapped->size;
+		return mapped->data;
+	}
+
+	bool is_data_uri(const char* uri)
+	{
+		return strncmp(uri, "data:", 5) == 0;
+	}
+}
+
+GltfFile::~GltfFile()
+{
+	if (data)
+	{
+		// The buffers point into the mappings or into decodedData, cgltf must not free them
+		for (cgltf_size i = 0; i < data->buffers_count; i++)
+		{
+			data->buffers[i].data = nullptr;
+		}
+		cgltf_free(data);
+	}
+
+	for (MappedFile* mapped : externalFiles)
+	{
+		delete mapped;
+	}
+
+	for (void* decoded : decodedData)
+	{
+		free(decoded);
+	}
+}
+
+bool vkgltf::load_gltf_file(const std::string& filename, GltfFile& outFile)
+{
+	if (!outFile.file.open(filename))
+	{
+		std::cout << "[ERROR] Could not open " << filename << std::endl;
+		return false;
+	}
+
+	cgltf_options options = {};
+	{
+		ImportStageScope profile(IMPORT_STAGE_JSON_PARSE);
+		if (cgltf_parse(&options, outFile.file.data, outFile.file.size, &outFile.data) != cgltf_result_success)
+		{
+			std::cout << "[ERROR] Could not parse " << filename << std::endl;
+			return false;
+		}
+		profile.bytes = outFile.data->json_size;
+	}
+
+	cgltf_data* data = outFile.data;
+	const std::string baseDirectory = get_base_directory(filename);
+
+	// Where every buffer is in a file, images in buffer views are read from there when they are loaded later
+	std::vector<std::string> bufferFiles(data->buffers_count);
+	std::vector<size_t> bufferOffsets(data->buffers_count, 0);
+
+	for (cgltf_size i = 0; i < data->buffers_count; i++)
+	{
+		cgltf_buffer& buffer = data->buffers[i];
+
+		const unsigned char* bytes = nullptr;
+		size_t size = 0;
+		if (!buffer.uri)
+		{
+			// The binary chunk of a .glb, already in the mapping
+			bytes = static_cast<const unsigned char*>(data->bin);
+			size = data->bin_size;
+			if (bytes)
+			{
+				bufferFiles[i] = filename;
+				bufferOffsets[i] = static_cast<size_t>(bytes - outFile.file.data);
+			}
+		}
+		else if (is_data_uri(buffer.uri))
+		{
+			void* decoded = decode_data_uri(buffer.uri, buffer.size, size);
+			if (decoded)
+			{
+				outFile.decodedData.push_back(decoded);
+			}
+			bytes = static_cast<const unsigned char*>(decoded);
+		}
+		else
+		{
+			bufferFiles[i] = baseDirectory + buffer.uri;
+			bytes = map_external_file(bufferFiles[i], outFile, size);
+		}
+
+		if (!bytes || size < buffer.size)
+		{
+			std::cout << "[ERROR] Buffer " << i << " of " << filename << " is missing or truncated" << std::endl;
+			return false;
+		}
+
+		buffer.data = const_cast<unsigned char*>(bytes);
+	}
+
+	// Accessors and buffer views outside of their buffers would read past the mappings
+	if (cgltf_validate(data) != cgltf_result_success)
+	{
+		std::cout << "[ERROR] " << filename << " is not a valid glTF file" << std::endl;
+		return false;
+	}
+
+	outFile.imageData.resize(data->images_count, nullptr);
+	outFile.imageSizes.resize(data->images_count, 0);
+	outFile.imageFiles.resize(data->images_count);
+	outFile.imageOffsets.resize(data->images_count, 0);
+	for (cgltf_size i = 0; i < data->images_count; i++)
+	{
+		const cgltf_image& image = data->images[i];
+
+		if (image.buffer_view)
+		{
+			outFile.imageData[i] = get_view_data(image.buffer_view);
+			outFile.imageSizes[i] = image.buffer_view->size;
+
+			const size_t buffer = static_cast<size_t>(image.buffer_view->buffer - data->buffers);
+			outFile.imageFiles[i] = bufferFiles[buffer];
+			outFile.imageOffsets[i] = bufferOffsets[buffer] + image.buffer_view->offset;
+		}
+		else if (image.uri && is_data_uri(image.uri))
+		{
+			void* decoded = decode_data_uri(image.uri, 0, outFile.imageSizes[i]);
+			if (decoded)
+			{
+				outFile.decodedData.push_back(decoded);
+			}
+			outFile.imageData[i] = static_cast<const unsigned char*>(decoded);
+		}
+		else if (image.uri)
+		{
+			outFile.imageFiles[i] = baseDirectory + image.uri;
+			outFile.imageData[i] = map_external_file(outFile.imageFiles[i], outFile, outFile.imageSizes[i]);
+		}
+
+		// Textures using an image that could not be read fall back to a white pixel
+		if (!outFile.imageData[i])
+		{
+			std::cout << "[ERROR] Could not read image " << i << " of " << filename << std::endl;
+			outFile.imageSizes[i] = 0;
+		}
+	}
+
+	return true;
+}
+
+const unsigned char* vkgltf::get_view_data(const cgltf_buffer_view* view)
+{
+	if (!view || !view->buffer->data)
+	{
+		return nullptr;
+	}
+	return static_cast<const unsigned char*>(view->buffer->data) + view->offset;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vk_utils.h"
+#include <string>
+#include <vector>
+
+struct cgltf_data;
+struct cgltf_buffer_view;
+
+// A .gltf or .glb parsed in place from its mapping. Buffers are never copied, the binary chunk of a .glb and the
+// external .bin files stay mapped and buffer views are spans into them. Only data URIs are decoded to memory.
+struct GltfFile
+{
+	MappedFile file;
+	cgltf_data* data = nullptr;
+
+	// Encoded bytes of every image, in a buffer view or a file of its own
+	std::vector<const unsigned char*> imageData;
+	std::vector<size_t> imageSizes;
+
+	// File and offset the bytes of every image can be read from again once the glTF is closed, no file for the
+	// images decoded from data URIs
+	std::vector<std::string> imageFiles;
+	std::vector<size_t> imageOffsets;
+
+	// External .bin and image files, mapped as long as the glTF file
+	std::vector<MappedFile*> externalFiles;
+	std::vector<void*> decodedData;
+
+	~GltfFile();
+};
+
+namespace vkgltf {
+
+	bool load_gltf_file(const std::string& filename, GltfFile& outFile);
+
+	// Bytes of a buffer view, nullptr when it has no data
+	const unsigned char* get_view_data(const cgltf_buffer_view* view);
+}
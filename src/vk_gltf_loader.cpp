@@ -1,8 +1,7 @@
-#define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
-#define TINYGLTF_NO_STB_IMAGE_WRITE
-#define STBI_MSC_SECURE_CRT
-#include "tiny_gltf.h"
+#include <stb_image.h>
+#include "cgltf.h"
+#include "vk_gltf_file.h"
 #include "vk_prefab.h"
 #include "vk_material.h"
 #include "vk_mesh.h"
@@ -15,303 +14,204 @@
 #include <cassert>
 #include "vk_gltf_loader.h"
 #include "vk_prefab.h"
-
+#include "vk_prefab_cache.h"
+#include "vk_thread_pool.h"
+#include "vk_mesh_optimizer.h"
+#include "vk_mesh_simplifier.h"
+#include "vk_profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+// One per thread, prefabs loaded asynchronously are imported on the worker threads
 struct sgltfData 
 {
     std::vector<VKE::Node*> nodes;
     std::vector<VKE::Texture*> textures;
     std::vector<VKE::Material*> materials;
-} loadedData;
-
-void update_texture_id(int* id)
+    std::vector<Primitive*> primitives;
+    std::vector<const cgltf_primitive*> sources; // glTF primitive each of the primitives is read from
+    uint32_t vertexCount = 0;
+    MeshOptimizationReport optimization;
+};
+thread_local sgltfData loadedData;
+
+// Vertices converted by one job, big primitives are split so they still spread over every worker
+const uint32_t VERTEX_CHUNK_SIZE = 64 * 1024;
+
+// Reads vertex attributes as floats whatever their component type is, KHR_mesh_quantization allows
+// positions, normals and texture coordinates to be stored as normalized or plain integers
+struct AccessorReader
 {
-    int ID = *id;
-    int size = VKE::Texture::sTexturesLoaded.size();
+    const unsigned char* data = nullptr;
+    size_t stride = 0;
+    cgltf_component_type componentType = cgltf_component_type_r_32f;
+    bool normalized = false;
 
-    if (ID > size) 
-    { 
-        return; 
+    // Reads in place from the buffer view, the accessor must have one
+    AccessorReader(const cgltf_accessor& accessor)
+    {
+        data = vkgltf::get_view_data(accessor.buffer_view) + accessor.offset;
+        stride = accessor.stride;
+        componentType = accessor.component_type;
+        normalized = accessor.normalized != 0;
     }
 
-    *id = VKE::Texture::sTexturesLoaded.size();
-}
+    float read_component(size_t index, int component) const
+    {
+        const unsigned char* element = data + index * stride;
 
-void update_material_id(int* id)
-{
-    int ID = *id;
-    int size = VKE::Material::sMaterials.size();
+        switch(componentType)
+        {
+        case cgltf_component_type_r_8: {
+            float value = static_cast<float>(reinterpret_cast<const int8_t*>(element)[component]);
+            return normalized ? std::max(value / 127.0f, -1.0f) : value;
+        }
+        case cgltf_component_type_r_8u: {
+            float value = static_cast<float>(element[component]);
+            return normalized ? value / 255.0f : value;
+        }
+        case cgltf_component_type_r_16: {
+            float value = static_cast<float>(reinterpret_cast<const int16_t*>(element)[component]);
+            return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+        }
+        case cgltf_component_type_r_16u: {
+            float value = static_cast<float>(reinterpret_cast<const uint16_t*>(element)[component]);
+            return normalized ? value / 65535.0f : value;
+        }
+        default:
+            return reinterpret_cast<const float*>(element)[component];
+        }
+    }
 
-    if (ID > size) 
+    glm::vec3 read_vec3(size_t index) const
     {
-        return; 
+        return glm::vec3(read_component(index, 0), read_component(index, 1), read_component(index, 2));
     }
 
-    *id = VKE::Material::sMaterials.size();
-}
+    glm::vec2 read_vec2(size_t index) const
+    {
+        return glm::vec2(read_component(index, 0), read_component(index, 1));
+    }
+};
 
-void texture_from_glTF_image(tinygltf::Image& gltfimage)
+// cgltf leaves the names that are not in the file null
+const char* get_name(const char* name)
 {
-    VKE::Texture* texture = new VKE::Texture();
-
-	unsigned char* buffer = nullptr;
-	VkDeviceSize bufferSize = 0;
-	bool deleteBuffer = false;
-
-	// Convert to rgba if it is rgb
-	if (gltfimage.component == 3)
-	{
-		bufferSize = gltfimage.width * gltfimage.height * 4;
-		buffer = new unsigned char[bufferSize];
-		unsigned char* rgba = buffer;
-		unsigned char* rgb = &gltfimage.image[0];
-		for (int32_t i = 0; i < gltfimage.width * gltfimage.height; ++i)
-		{
-			for (int32_t j = 0; j < 3; ++j)
-			{
-				rgba[j] = rgb[j];
-			}
-			rgba += 4;
-			rgb += 3;
-		}
-		deleteBuffer = true;
-	}
-	else
-	{
-		buffer = &gltfimage.image[0];
-		bufferSize = gltfimage.image.size();
-	}
-
-	VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-
-	AllocatedBuffer stagingBuffer = vkutil::create_buffer(RenderEngine::_allocator, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-	
-	void* data;
-	vmaMapMemory(RenderEngine::_allocator, stagingBuffer._allocation, &data);
-	memcpy(data, buffer, bufferSize);
-	vmaUnmapMemory(RenderEngine::_allocator, stagingBuffer._allocation);
-   
-	VkExtent3D imageExtent;
-	imageExtent.width = gltfimage.width;
-	imageExtent.height = gltfimage.height;
-	imageExtent.depth = 1;
-
-	VkImageCreateInfo image_create_info = vkinit::image_create_info(format, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageExtent);
-
-	VmaAllocationCreateInfo image_alloc_info = {};
-	image_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-	vmaCreateImage(RenderEngine::_allocator, &image_create_info, &image_alloc_info, &texture->_image._image, &texture->_image._allocation, nullptr);
-
-    vkupload::immediate_submit([&](VkCommandBuffer cmd) {
-        VkImageSubresourceRange range;
-        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        range.baseMipLevel = 0;
-        range.levelCount = 1;
-        range.baseArrayLayer = 0;
-        range.layerCount = 1;
-
-        VkImageMemoryBarrier imageBarrier_toTransfer = {};
-        imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toTransfer.image = texture->_image._image;
-        imageBarrier_toTransfer.subresourceRange = range;
-        imageBarrier_toTransfer.srcAccessMask = 0;
-        imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &imageBarrier_toTransfer);
-
-        VkBufferImageCopy copyRegion = {};
-        copyRegion.bufferOffset = 0;
-        copyRegion.bufferRowLength = 0;
-        copyRegion.bufferImageHeight = 0;
-        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        copyRegion.imageSubresource.mipLevel = 0;
-        copyRegion.imageSubresource.baseArrayLayer = 0;
-        copyRegion.imageSubresource.layerCount = 1;
-        copyRegion.imageExtent = imageExtent;
-
-        vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, texture->_image._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-
-        VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
-        imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &imageBarrier_toReadable);
-        });
+    return name ? name : "";
+}
 
-    VkImageViewCreateInfo image_view_info = vkinit::imageview_create_info(format, texture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-    vkCreateImageView(RenderEngine::_device, &image_view_info, nullptr, &texture->_imageView);
+// Index of the texture a material refers to, -1 without one
+int get_texture_index(const cgltf_data& data, const cgltf_texture_view& view)
+{
+    return view.texture ? static_cast<int>(view.texture - data.textures) : -1;
+}
 
-    texture->_name = gltfimage.name;
-    loadedData.textures.push_back(texture);
-    
-    RenderEngine::_mainDeletionQueue.push_function([=]() {
-        vkDestroyImageView(RenderEngine::_device, texture->_imageView, nullptr);
-        vmaDestroyImage(RenderEngine::_allocator, texture->_image._image, texture->_image._allocation);
-        });
+int get_image_index(const cgltf_data& data, const cgltf_texture& texture)
+{
+    return texture.image ? static_cast<int>(texture.image - data.images) : -1;
+}
 
-    vmaDestroyBuffer(RenderEngine::_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+// First set of the attribute, nullptr when the primitive does not have it
+const cgltf_accessor* find_attribute(const cgltf_primitive& primitive, cgltf_attribute_type type)
+{
+    for(size_t i = 0; i < primitive.attributes_count; i++)
+    {
+        if(primitive.attributes[i].type == type && primitive.attributes[i].index == 0)
+        {
+            return primitive.attributes[i].data;
+        }
+    }
+    return nullptr;
 }
 
-void load_node(VKE::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex, const tinygltf::Model &model, 
-    std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, std::vector<rtVertex>& rtVertexBuffer, float globalScale)
+// First pass, builds the node tree and places every primitive in the prefab buffers from its accessor counts.
+// No vertex is read until the buffers the primitives are converted into are allocated.
+void load_node(VKE::Node *parent, const cgltf_node &node, const cgltf_data &data, float globalScale)
 {
     VKE::Node* newNode = new VKE::Node();
     newNode->_parent = parent;
-    newNode->_name = node.name;
+    newNode->_name = get_name(node.name);
     newNode->_model = glm::mat4(1.0f);
 
     // Generate local node matrix
     glm::vec3 translation = glm::vec3(0.0f);
-    if(node.translation.size() == 3) {
-        translation = glm::make_vec3(node.translation.data());
+    if(node.has_translation) {
+        translation = glm::make_vec3(node.translation);
         newNode->_model = glm::translate(newNode->_model, translation);
     }
     glm::mat4 rotation = glm::mat4(1.0f);
-    if(node.rotation.size() == 4) {
-        glm::quat q = glm::make_quat(node.rotation.data());
+    if(node.has_rotation) {
+        glm::quat q = glm::make_quat(node.rotation);
         newNode->_model *= glm::mat4(q);
     }
     glm::vec3 scale = glm::vec3(1.9f);
-    if(node.scale.size() == 3) {
-        scale = glm::make_vec3(node.scale.data());
+    if(node.has_scale) {
+        scale = glm::make_vec3(node.scale);
         newNode->_model = glm::scale(newNode->_model, scale);
     }
-    if(node.matrix.size() == 16) {
-        newNode->_model = glm::make_mat4x4(node.matrix.data());
+    if(node.has_matrix) {
+        newNode->_model = glm::make_mat4x4(node.matrix);
     }
 
     // Node with children
-    if(node.children.size() > 0) {
-        for(size_t i = 0; i < node.children.size(); i++) {
-            load_node(newNode, model.nodes[node.children[i]], node.children[i], model, indexBuffer, vertexBuffer, rtVertexBuffer, globalScale);
+    if(node.children_count > 0) {
+        for(size_t i = 0; i < node.children_count; i++) {
+            load_node(newNode, *node.children[i], data, globalScale);
         }
     }
 
     // Node contains mesh data
-    if (node.mesh > -1) {
-        const tinygltf::Mesh mesh = model.meshes[node.mesh];
+    if (node.mesh) {
+        const cgltf_mesh& mesh = *node.mesh;
         VKE::Mesh* newMesh = new VKE::Mesh();
-        for(size_t j = 0; j < mesh.primitives.size(); j++) 
+        for(size_t j = 0; j < mesh.primitives_count; j++) 
         {
-            const tinygltf::Primitive& primitive = mesh.primitives[j];
-            uint32_t indexStart = static_cast<uint32_t>(indexBuffer.size());
-            uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
-            uint32_t indexCount = 0;
-            uint32_t vertexCount = 0;
-            glm::vec3 posMin{};
-            glm::vec3 posMax{};
-            bool hasIndices = primitive.indices > -1;
-            // Vertices
+            const cgltf_primitive& primitive = mesh.primitives[j];
+
+            // Position attribute is required
+            const cgltf_accessor* posAccessor = find_attribute(primitive, cgltf_attribute_type_position);
+            if(!posAccessor || !posAccessor->buffer_view)
             {
-                const float* bufferPos = nullptr;
-                const float* bufferNormals = nullptr;
-                const float* bufferTexCoordSet0 = nullptr;
-
-                int posByteStride;
-                int normByteStride;
-                int uv0ByteStride;
-
-                // Position attribute is required
-                assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
-                
-                const tinygltf::Accessor& posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
-                const tinygltf::BufferView& posView = model.bufferViews[posAccessor.bufferView];
-                bufferPos = reinterpret_cast<const float*>(&model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]);
-                posMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
-                posMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
-                vertexCount = static_cast<uint32_t>(posAccessor.count);
-                posByteStride = posAccessor.ByteStride(posView) ? (posAccessor.ByteStride(posView) / sizeof(float)) : TINYGLTF_TYPE_VEC3 * 4;
-            
-                if(primitive.attributes.find("NORMAL") != primitive.attributes.end())
-                {
-                    const tinygltf::Accessor& normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-                    const tinygltf::BufferView& normView = model.bufferViews[normAccessor.bufferView];
-                    bufferNormals = reinterpret_cast<const float*>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
-                    normByteStride = normAccessor.ByteStride(normView) ? (normAccessor.ByteStride(normView) / sizeof(float)) : TINYGLTF_TYPE_VEC3 * 4;
-                }
+                std::cout << "[ERROR] Primitive without positions in mesh " << get_name(mesh.name) << std::endl;
+                continue;
+            }
 
-                if(primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end())
+            uint32_t indexCount = 0;
+            if(primitive.indices)
+            {
+                const cgltf_accessor& accessor = *primitive.indices;
+                if(!accessor.buffer_view ||
+                    (accessor.component_type != cgltf_component_type_r_32u &&
+                    accessor.component_type != cgltf_component_type_r_16u &&
+                    accessor.component_type != cgltf_component_type_r_8u))
                 {
-                    const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-                    const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-                    bufferTexCoordSet0 = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-                    uv0ByteStride = uvAccessor.ByteStride(uvView) ? (uvAccessor.ByteStride(uvView) / sizeof(float)) : TINYGLTF_TYPE_VEC2 * 4;
+                    std::cerr << "Index component type" << accessor.component_type << " not suported!" << std::endl;
+                    continue;
                 }
+                indexCount = static_cast<uint32_t>(accessor.count);
+            }
 
-                for(size_t v = 0; v < posAccessor.count; v++)
-                {
-                    Vertex vert{};
-                    rtVertex rtv{};
-
-                    vert.position = glm::vec4(glm::make_vec3(&bufferPos[v * posByteStride]), 1.0f);
-                    vert.normal = glm::normalize(glm::vec3(bufferNormals ? glm::make_vec3(&bufferNormals[v * normByteStride]) : glm::vec3(0.0f)));
-                    vert.uv = bufferTexCoordSet0 ? glm::make_vec2(&bufferTexCoordSet0[v * uv0ByteStride]) : glm::vec3(0.0f);
+            const uint32_t vertexCount = static_cast<uint32_t>(posAccessor->count);
 
-                    rtv.position = glm::vec4(vert.position, 1.0f);
-                    rtv.normal = glm::vec4(vert.normal, 1.0f);
-                    rtv.uv = glm::vec4(vert.uv, 1.0f, 1.0f);
+            // Indices are relative to the primitive, most of them fit in 16 bits whatever the size of the prefab.
+            // Their place in the index data is only known once the LOD chains are built, see layout_indices.
+            Primitive* newPrimitive = new Primitive(loadedData.vertexCount, 0, indexCount, vertexCount, primitive.material ? *loadedData.materials[primitive.material - data.materials] : *loadedData.materials.back());
+            newPrimitive->indexType = vkutil::select_index_type(vertexCount);
+            newMesh->_primitives.push_back(newPrimitive);
+            loadedData.primitives.push_back(newPrimitive);
+            loadedData.sources.push_back(&primitive);
 
-                    rtVertexBuffer.push_back(rtv);
-                    vertexBuffer.push_back(vert);
-                }
-            }
+            loadedData.vertexCount += vertexCount;
 
-            // Indices
-            if(hasIndices)
+            // Index count each LOD aims for, levels that cannot be simplified enough are dropped when the chain is built
+            if(primitive.type == cgltf_primitive_type_triangles)
             {
-                const tinygltf::Accessor& accessor = model.accessors[primitive.indices > -1 ? primitive.indices : 0];
-                const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-                const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
-
-                indexCount = static_cast<uint32_t>(accessor.count);
-                const void* dataPtr = &(buffer.data[accessor.byteOffset + bufferView.byteOffset]);
-
-                switch(accessor.componentType)
+                for(uint32_t target : vkmeshopt::get_lod_targets(indexCount))
                 {
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-                    const uint32_t* buf = static_cast<const uint32_t*>(dataPtr);
-                    for(size_t index = 0; index < accessor.count; index++) {
-                        indexBuffer.push_back(buf[index] + vertexStart);
-                    }
-                    break;
-                }
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-                    const uint16_t* buf = static_cast<const uint16_t*>(dataPtr);
-                    for(size_t index = 0; index < accessor.count; index++) {
-                        indexBuffer.push_back(buf[index] + vertexStart);
-                    }
-                    break;
-                }
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-                    const uint8_t* buf = static_cast<const uint8_t*>(dataPtr);
-                    for(size_t index = 0; index < accessor.count; index++) {
-                        indexBuffer.push_back(buf[index] + vertexStart);
-                    }
-                    break;
-                }
-                default:
-                    std::cerr << "Index component type" << accessor.componentType << " not suported!" << std::endl;
-                    return;
+                    newPrimitive->lods.push_back(PrimitiveLod{ 0, target, 0.0f });
                 }
             }
-
-            Primitive* newPrimitive = new Primitive(vertexStart, indexStart, indexCount, vertexCount, primitive.material > -1 ? *loadedData.materials[primitive.material] : *loadedData.materials.back());
-            newMesh->_primitives.push_back(newPrimitive);
         }
 
         newNode->_mesh = newMesh;
@@ -327,222 +227,664 @@ void load_node(VKE::Node *parent, const tinygltf::Node &node, uint32_t nodeIndex
     }
 }
 
-void load_textures(tinygltf::Model &gltfModel)
+template<typename T, typename U>
+void copy_indices(const void* source, size_t count, U* outIndices)
 {
-    for(tinygltf::Texture &tex : gltfModel.textures) 
+    const T* buf = static_cast<const T*>(source);
+    for(size_t index = 0; index < count; index++) {
+        outIndices[index] = static_cast<U>(buf[index]);
+    }
+}
+
+// Indices of a primitive or of one of its LODs at their place in the index data
+void write_indices(const std::vector<uint32_t>& indices, uint32_t firstIndex, VkIndexType indexType, unsigned char* indexData)
+{
+    if(indexType == VK_INDEX_TYPE_UINT16)
     {
-        if (gltfModel.images.size() <= 0) continue;
-        tinygltf::Image image = gltfModel.images[tex.source];
-        
-        texture_from_glTF_image(image);
+        copy_indices<uint32_t>(indices.data(), indices.size(), reinterpret_cast<uint16_t*>(indexData) + firstIndex);
+    }
+    else
+    {
+        copy_indices<uint32_t>(indices.data(), indices.size(), reinterpret_cast<uint32_t*>(indexData) + firstIndex);
+    }
+}
+
+// Indices of a primitive and of its LOD levels, kept apart until the chains are built and their ranges are known
+struct PrimitiveIndices
+{
+    std::vector<uint32_t> indices;
+    std::vector<std::vector<uint32_t>> levels;
+};
+
+// Second pass, converts the vertices [first, first + count) of a primitive straight from the mapped file. outVertices
+// points to the first vertex of the primitive in the converted vertices, every range can be converted on its own thread.
+void convert_vertices(const cgltf_primitive& primitive, uint32_t first, uint32_t count, Vertex* outVertices)
+{
+    ImportStageScope profile(IMPORT_STAGE_ACCESSOR_CONVERSION, count * sizeof(Vertex));
+    AccessorReader positions(*find_attribute(primitive, cgltf_attribute_type_position));
+
+    const AccessorReader* normals = nullptr;
+    const AccessorReader* texCoordSet0 = nullptr;
+
+    std::vector<AccessorReader> readers;
+    readers.reserve(2);
+
+    const cgltf_accessor* normalAccessor = find_attribute(primitive, cgltf_attribute_type_normal);
+    if(normalAccessor && normalAccessor->buffer_view)
+    {
+        readers.emplace_back(*normalAccessor);
+        normals = &readers.back();
+    }
+
+    const cgltf_accessor* texCoordAccessor = find_attribute(primitive, cgltf_attribute_type_texcoord);
+    if(texCoordAccessor && texCoordAccessor->buffer_view)
+    {
+        readers.emplace_back(*texCoordAccessor);
+        texCoordSet0 = &readers.back();
+    }
+
+    for(size_t v = first; v < size_t(first) + count; v++)
+    {
+        Vertex& vert = outVertices[v];
+
+        vert.position = positions.read_vec3(v);
+        vert.normal = normals ? glm::normalize(normals->read_vec3(v)) : glm::vec3(0.0f);
+        vert.uv = texCoordSet0 ? texCoordSet0->read_vec2(v) : glm::vec2(0.0f);
+
+        // glTF has no color here and the output is not always cleared, the bytes end up on the GPU and in the cooked file
+        vert.color = glm::vec3(0.0f);
     }
 }
 
-void load_materials(tinygltf::Model &gltfModel)
+// Third pass, once all the vertices of the primitive are converted. Reorders them with the triangles, which is why
+// it runs on the whole primitive, and builds the LOD chain. The LODs of the target keep the levels that were built.
+void convert_indices(const cgltf_primitive& primitive, Primitive& target, Vertex* vertices, PrimitiveIndices& outIndices, MeshOptimizationReport& outReport)
 {
-    for(tinygltf::Material &mat : gltfModel.materials)
+    // Indices, relative to the first vertex of the primitive as in the file
+    if(target.indexCount > 0)
     {
-        VKE::Material* material = new VKE::Material();
-        if(mat.values.find("baseColorTexture") != mat.values.end()) {
-            material->_color_texture = loadedData.textures[mat.values["baseColorTexture"].TextureIndex()];
+        const cgltf_accessor& accessor = *primitive.indices;
+        const void* dataPtr = vkgltf::get_view_data(accessor.buffer_view) + accessor.offset;
+
+        std::vector<uint32_t>& indices = outIndices.indices;
+        indices.resize(target.indexCount);
+
+        ImportStageScope profile(IMPORT_STAGE_ACCESSOR_CONVERSION, target.indexCount * sizeof(uint32_t));
+        switch(accessor.component_type)
+        {
+        case cgltf_component_type_r_32u:
+            copy_indices<uint32_t>(dataPtr, target.indexCount, indices.data());
+            break;
+        case cgltf_component_type_r_16u:
+            copy_indices<uint16_t>(dataPtr, target.indexCount, indices.data());
+            break;
+        default:
+            copy_indices<uint8_t>(dataPtr, target.indexCount, indices.data());
+            break;
         }
-        if(mat.values.find("metallicRoughnessTexture") != mat.values.end()) {
-            material->_metallic_roughness_texture = loadedData.textures[mat.values["metallicRoughnessTexture"].TextureIndex()];
+
+        // Triangles and vertices are reordered in the order the GPU processes them best, strips and fans keep theirs
+        if(primitive.type == cgltf_primitive_type_triangles)
+        {
+            outReport = vkmeshopt::optimize_mesh(vertices, target.vertexCount, indices.data(), indices.size());
         }
-        if(mat.values.find("roughnessFactor") != mat.values.end()) {
-            material->_roughness_factor = static_cast<float>(mat.values["roughnessFactor"].Factor());
+
+        // The chain keeps the levels that got close enough to their target, with the count they ended up with
+        if(!target.lods.empty())
+        {
+            std::vector<uint32_t> targets;
+            for(const PrimitiveLod& lod : target.lods)
+            {
+                targets.push_back(lod.indexCount);
+            }
+
+            std::vector<float> errors;
+            vkmeshopt::build_lod_chain(indices.data(), indices.size(), vertices, target.vertexCount, targets, outIndices.levels, errors);
+
+            target.lods.resize(outIndices.levels.size());
+            for(size_t level = 0; level < outIndices.levels.size(); level++)
+            {
+                target.lods[level].indexCount = static_cast<uint32_t>(outIndices.levels[level].size());
+                target.lods[level].error = errors[level];
+            }
         }
-        if(mat.values.find("metallicFactor") != mat.values.end()) {
-            material->_metallic_factor = static_cast<float>(mat.values["metallicFactor"].Factor());
+    }
+}
+
+// Gives every primitive, and right after it each of its LOD levels, a range of the index data as large as it turned
+// out after the optimization. Returns the size of the index data in bytes.
+size_t layout_indices(const std::vector<Primitive*>& primitives)
+{
+    size_t indexDataSize = 0;
+    for(Primitive* primitive : primitives)
+    {
+        const uint32_t indexSize = primitive->get_index_size();
+        indexDataSize = vkutil::get_aligned_size(indexDataSize, indexSize);
+
+        primitive->firstIndex = static_cast<uint32_t>(indexDataSize / indexSize);
+        indexDataSize += size_t(primitive->indexCount) * indexSize;
+
+        for(PrimitiveLod& lod : primitive->lods)
+        {
+            lod.firstIndex = static_cast<uint32_t>(indexDataSize / indexSize);
+            indexDataSize += size_t(lod.indexCount) * indexSize;
         }
-        if(mat.values.find("baseColorFactor") != mat.values.end()) {
-            material->_color = glm::make_vec4(mat.values["baseColorFactor"].ColorFactor().data());
+    }
+    return indexDataSize;
+}
+
+// Calls visit(textureIndex, role) for every texture a material of the file refers to, the same slots load_materials reads
+void for_each_material_texture(const cgltf_data &data, const std::function<void(size_t, TextureRole)>& visit)
+{
+    auto visit_view = [&](const cgltf_texture_view& view, TextureRole role) {
+        int textureIndex = get_texture_index(data, view);
+        if(textureIndex < 0 || static_cast<size_t>(textureIndex) >= data.textures_count) return;
+        visit(static_cast<size_t>(textureIndex), role);
+    };
+
+    for(size_t i = 0; i < data.materials_count; i++)
+    {
+        const cgltf_material& mat = data.materials[i];
+        if(mat.has_pbr_metallic_roughness) {
+            visit_view(mat.pbr_metallic_roughness.base_color_texture, TEXTURE_ROLE_COLOR);
+            visit_view(mat.pbr_metallic_roughness.metallic_roughness_texture, TEXTURE_ROLE_COLOR);
         }
-        if(mat.additionalValues.find("normalTexture") != mat.additionalValues.end()) {
-            material->_normal_texture = loadedData.textures[mat.additionalValues["normalTexture"].TextureIndex()];
+        visit_view(mat.emissive_texture, TEXTURE_ROLE_COLOR);
+        visit_view(mat.normal_texture, TEXTURE_ROLE_NORMAL);
+        visit_view(mat.occlusion_texture, TEXTURE_ROLE_MASK);
+    }
+}
+
+// Role of every texture, one used as color anywhere stays color so it keeps all its channels
+std::vector<TextureRole> get_texture_roles(const cgltf_data &data)
+{
+    std::vector<int> roles(data.textures_count, -1);
+    for_each_material_texture(data, [&](size_t textureIndex, TextureRole role) {
+        if(roles[textureIndex] == -1 || role == TEXTURE_ROLE_COLOR) roles[textureIndex] = role;
+    });
+
+    std::vector<TextureRole> textureRoles(roles.size());
+    for(size_t i = 0; i < roles.size(); i++)
+    {
+        textureRoles[i] = roles[i] == -1 ? TEXTURE_ROLE_COLOR : static_cast<TextureRole>(roles[i]);
+    }
+    return textureRoles;
+}
+
+// Decodes an image of a deferred texture and creates its image
+bool upload_encoded_image(const unsigned char* encoded, size_t size, bool srgb, VKE::Texture& target)
+{
+    int width, height, channels;
+    stbi_uc* pixels = nullptr;
+    {
+        ImportStageScope profile(IMPORT_STAGE_IMAGE_DECODE);
+        pixels = stbi_load_from_memory(encoded, static_cast<int>(size), &width, &height, &channels, STBI_rgb_alpha);
+        if(!pixels)
+        {
+            return false;
         }
-        if(mat.additionalValues.find("occlusionTexture") != mat.additionalValues.end()) {
-            material->_occlusion_texture = loadedData.textures[mat.additionalValues["occlusionTexture"].TextureIndex()];
+        profile.bytes = static_cast<uint64_t>(width) * height * 4;
+    }
+
+    ImageUploadData upload{ pixels, width, height, VK_FORMAT_R8G8B8A8_UNORM };
+    upload.srgb = srgb;
+    const bool uploaded = vkutil::upload_texture(upload, target);
+    stbi_image_free(pixels);
+    return uploaded;
+}
+
+// A texture no material of the file uses remembers where its encoded image is, it is read, decoded and uploaded if
+// one ever does. Only the images of data URIs have no file to go back to and keep a copy of their bytes.
+VKE::Texture* create_deferred_texture(const GltfFile &file, int source, const std::string& name, bool srgb)
+{
+    VKE::Texture* texture = new VKE::Texture();
+    texture->_name = name;
+    if(source < 0 || !file.imageData[source])
+    {
+        return texture;
+    }
+
+    const size_t size = file.imageSizes[source];
+    if(file.imageFiles[source].empty())
+    {
+        std::vector<unsigned char> encoded(file.imageData[source], file.imageData[source] + size);
+        texture->_pendingUpload = [encoded, srgb](VKE::Texture& target) {
+            return upload_encoded_image(encoded.data(), encoded.size(), srgb, target);
+        };
+        return texture;
+    }
+
+    const std::string filename = file.imageFiles[source];
+    const size_t offset = file.imageOffsets[source];
+    const int64_t timestamp = vkutil::get_file_timestamp(filename);
+    texture->_pendingUpload = [filename, offset, size, timestamp, srgb](VKE::Texture& target) {
+        // The offset is only valid in the file as it was when the glTF was loaded
+        MappedFile mapped;
+        if(vkutil::get_file_timestamp(filename) != timestamp || !mapped.open(filename) || offset > mapped.size || size > mapped.size - offset)
+        {
+            std::cout << "[ERROR] Image of texture " << target._name << " changed in " << filename << " since it was loaded" << std::endl;
+            return false;
         }
-        if(mat.additionalValues.find("emissiveFactor") != mat.additionalValues.end()) {
-            material->_emissive_factor = glm::vec4(glm::make_vec3(mat.additionalValues["emissiveFactor"].ColorFactor().data()), 1.0f);
-            material->_emissive_factor = glm::vec4(0.0f);
+        return upload_encoded_image(mapped.data + offset, size, srgb, target);
+    };
+    return texture;
+}
+
+void load_textures(const GltfFile &file, PrefabCookData* cookData, bool createImages)
+{
+    struct DecodedImage
+    {
+        int width = 0;
+        int height = 0;
+        stbi_uc* pixels = nullptr;
+        uint64_t contentHash = 0;
+    };
+
+    const cgltf_data& data = *file.data;
+
+    // Only the textures of the materials are decoded now, the cook keeps every one of them
+    std::vector<bool> referenced(data.textures_count, false);
+    for_each_material_texture(data, [&](size_t textureIndex, TextureRole) {
+        referenced[textureIndex] = true;
+    });
+
+    std::vector<DecodedImage> decodedImages(data.images_count);
+    std::vector<size_t> usedImages;
+    for(size_t i = 0; i < data.textures_count; i++)
+    {
+        const int source = get_image_index(data, data.textures[i]);
+        if(!referenced[i] && !cookData) continue;
+
+        if(source > -1 && std::find(usedImages.begin(), usedImages.end(), static_cast<size_t>(source)) == usedImages.end())
+        {
+            usedImages.push_back(static_cast<size_t>(source));
         }
+    }
 
-        material->_name = mat.name.c_str();
-        loadedData.materials.push_back(material);
+    // Decode the images on the worker threads straight from the mapped file, stb already expands them to rgba
+    vkjobs::parallel_for(usedImages.size(), [&](size_t i) {
+        const size_t imageIndex = usedImages[i];
+        if(!file.imageData[imageIndex]) return;
+
+        DecodedImage& decoded = decodedImages[imageIndex];
+        int channels;
+        {
+            ImportStageScope profile(IMPORT_STAGE_IMAGE_DECODE);
+            decoded.pixels = stbi_load_from_memory(file.imageData[imageIndex], static_cast<int>(file.imageSizes[imageIndex]), &decoded.width, &decoded.height, &channels, STBI_rgb_alpha);
+            profile.bytes = decoded.pixels ? static_cast<uint64_t>(decoded.width) * decoded.height * 4 : 0;
+        }
+
+        // Hashed here as well, while the pixels are still in the cache
+        if(decoded.pixels && createImages)
+        {
+            decoded.contentHash = vkutil::hash_image(decoded.pixels, static_cast<size_t>(decoded.width) * decoded.height * 4, decoded.width, decoded.height, VK_FORMAT_R8G8B8A8_UNORM);
+        }
+    });
+
+    // Textures whose image failed to decode get a white pixel so the material indices stay valid
+    static const unsigned char whitePixel[4] = { 255, 255, 255, 255 };
+
+    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+
+    const uint64_t whitePixelHash = vkutil::hash_image(whitePixel, sizeof(whitePixel), 1, 1, format);
+
+    // Color is sRGB encoded, its missing mips are filtered in linear light
+    const std::vector<TextureRole> roles = get_texture_roles(data);
+
+    std::vector<ImageUploadData> uploads;
+    std::vector<std::string> names;
+    std::vector<uint64_t> contentHashes;
+    for(size_t i = 0; i < data.textures_count; i++)
+    {
+        if (data.images_count <= 0) continue;
+
+        ImageUploadData upload{ whitePixel, 1, 1, format };
+        upload.srgb = i < roles.size() && roles[i] == TEXTURE_ROLE_COLOR;
+        uint64_t contentHash = whitePixelHash;
+        std::string name;
+        const int source = get_image_index(data, data.textures[i]);
+        if(source > -1)
+        {
+            const DecodedImage& decoded = decodedImages[source];
+            if(decoded.pixels)
+            {
+                upload.pixels = decoded.pixels;
+                upload.width = decoded.width;
+                upload.height = decoded.height;
+                contentHash = decoded.contentHash;
+            }
+            else if(referenced[i] || cookData)
+            {
+                std::cout << "[ERROR] Could not decode image " << get_name(data.images[source].name) << std::endl;
+            }
+            name = get_name(data.images[source].name);
+        }
+
+        uploads.push_back(upload);
+        names.push_back(name);
+        contentHashes.push_back(contentHash);
+    }
+
+    // Images already on the GPU, loaded by another prefab or used twice in this one, are not uploaded again
+    std::vector<VKE::Texture*> newTextures;
+    std::vector<ImageUploadData> newUploads;
+    for(size_t i = 0; i < uploads.size(); i++)
+    {
+        if(createImages && !referenced[i])
+        {
+            loadedData.textures.push_back(create_deferred_texture(file, get_image_index(data, data.textures[i]), names[i], uploads[i].srgb));
+            continue;
+        }
+
+        VKE::Texture* texture = createImages ? VKE::Texture::sTexturesByContent.find(contentHashes[i]) : nullptr;
+        if(texture && !vkutil::has_texture_description(uploads[i], *texture))
+        {
+            texture = nullptr;
+        }
+        if(!texture)
+        {
+            texture = new VKE::Texture();
+            texture->_name = names[i];
+
+            // Without images the textures are only handles the cooked materials refer to. The description is set
+            // now so the same image used again in this model is checked against it before the upload.
+            if(createImages)
+            {
+                texture->_contentHash = contentHashes[i];
+                vkutil::set_texture_description(uploads[i], *texture);
+                VKE::Texture::sTexturesByContent.insert(contentHashes[i], texture);
+                newTextures.push_back(texture);
+                newUploads.push_back(uploads[i]);
+            }
+        }
+        loadedData.textures.push_back(texture);
+    }
+
+    // All the new textures of the model are uploaded together once every image is decoded
+    std::vector<AllocatedImage> images;
+    if(createImages)
+    {
+        vkutil::create_images_from_pixels(newUploads, images);
+    }
+
+    for(size_t i = 0; i < newTextures.size(); i++)
+    {
+        VKE::Texture* texture = newTextures[i];
+        texture->_image = images[i];
+        vkutil::set_texture_description(newUploads[i], *texture);
+
+        VkImageViewCreateInfo image_view_info = vkinit::imageview_create_info(format, texture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+        vkCreateImageView(RenderEngine::_device, &image_view_info, nullptr, &texture->_imageView);
+
+        RenderEngine::_mainDeletionQueue.push_function([=]() {
+            vkDestroyImageView(RenderEngine::_device, texture->_imageView, nullptr);
+            vmaDestroyImage(RenderEngine::_allocator, texture->_image._image, texture->_image._allocation);
+            });
+    }
+
+    // The cooked textures carry their whole mip chain, block compressed for the way the materials use them
+    if(cookData)
+    {
+        size_t firstTexture = cookData->textures.size();
+        cookData->textures.resize(firstTexture + uploads.size());
+
+        vkjobs::parallel_for(uploads.size(), [&](size_t i) {
+            std::vector<unsigned char> mipChain;
+            CookedTextureData& cookedTexture = cookData->textures[firstTexture + i];
+            cookedTexture.width = static_cast<uint32_t>(uploads[i].width);
+            cookedTexture.height = static_cast<uint32_t>(uploads[i].height);
+            const TextureRole role = i < roles.size() ? roles[i] : TEXTURE_ROLE_COLOR;
+            cookedTexture.mipLevels = vkutil::generate_mip_chain(uploads[i].pixels, uploads[i].width, uploads[i].height, mipChain, role == TEXTURE_ROLE_COLOR);
+            cookedTexture.format = vkbc::select_format(role, uploads[i].pixels, uploads[i].width, uploads[i].height);
+            vkbc::compress_mip_chain(mipChain.data(), uploads[i].width, uploads[i].height, cookedTexture.mipLevels, cookedTexture.format, cookedTexture.pixels);
+        });
+    }
+
+    for(DecodedImage& decoded : decodedImages)
+    {
+        if(decoded.pixels)
+        {
+            stbi_image_free(decoded.pixels);
+        }
     }
 }
 
-VKE::Prefab* load_glTF(std::string filename, float scale = 1.0f)
+// Texture a material refers to, nullptr without one
+VKE::Texture* get_texture(const cgltf_data& data, const cgltf_texture_view& view)
 {
-    VKE::Prefab* prefab = new VKE::Prefab();
+    int textureIndex = get_texture_index(data, view);
+    return textureIndex > -1 && static_cast<size_t>(textureIndex) < loadedData.textures.size() ? loadedData.textures[textureIndex] : nullptr;
+}
 
-    tinygltf::Model gltfModel;
-    tinygltf::TinyGLTF gltfContext;
-    std::string error;
-    std::string warning;
+void load_materials(const cgltf_data &data, bool shareMaterials)
+{
+    for(size_t i = 0; i < data.materials_count; i++)
+    {
+        const cgltf_material& mat = data.materials[i];
+        VKE::Material* material = new VKE::Material();
+        if(mat.has_pbr_metallic_roughness) {
+            const cgltf_pbr_metallic_roughness& pbr = mat.pbr_metallic_roughness;
+            material->_color_texture = get_texture(data, pbr.base_color_texture);
+            material->_metallic_roughness_texture = get_texture(data, pbr.metallic_roughness_texture);
+            material->_roughness_factor = pbr.roughness_factor;
+            material->_metallic_factor = pbr.metallic_factor;
+            material->_color = glm::make_vec4(pbr.base_color_factor);
+        }
+        material->_normal_texture = get_texture(data, mat.normal_texture);
+        material->_occlusion_texture = get_texture(data, mat.occlusion_texture);
 
-    bool binary = false;
-    size_t extpos = filename.rfind('.', filename.length());
-    if(extpos != std::string::npos) {
-        binary = (filename.substr(extpos + 1, filename.length() - extpos) == "glb");
+        material->_name = get_name(mat.name);
+
+        // Only materials of resources on the GPU are shared, the ones only made to be cooked belong to the caller
+        VKE::Material* cached = shareMaterials ? material->find_or_cache_content() : nullptr;
+        if(cached)
+        {
+            delete material;
+            material = cached;
+        }
+        loadedData.materials.push_back(material);
     }
+}
 
-    bool fileLoaded = binary ? gltfContext.LoadBinaryFromFile(&gltfModel, &error, &warning, filename.c_str()) : gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename.c_str());
-    
-    std::vector<uint32_t> indexBuffer;
-    std::vector<Vertex> vertexBuffer;
-    std::vector<rtVertex> rtVertexBuffer;
+VKE::Prefab* load_glTF(std::string filename, float scale, PrefabCookData* cookData, VertexFormat vertexFormat, bool createResources)
+{
+    assert(createResources || cookData);
+
+    VKE::Prefab* prefab = new VKE::Prefab();
 
+    // The file stays mapped while it is imported, images and accessors are read from it in place
+    GltfFile file;
+    bool fileLoaded = vkgltf::load_gltf_file(filename, file);
+    
     if(fileLoaded)
     {
-        load_textures(gltfModel);
-        load_materials(gltfModel);
+        const cgltf_data& data = *file.data;
 
-        const tinygltf::Scene& scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
-        for(size_t i = 0; i < scene.nodes.size(); i++) 
-        {
-            const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-            load_node(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, rtVertexBuffer, scale);
-        }
+        load_textures(file, cookData, createResources);
+        load_materials(data, createResources);
 
-        // Update textures and materials IDs to match the ones they should have in the engine list
-        for (VKE::Texture* texture : loadedData.textures)
+        const cgltf_scene* scene = data.scene ? data.scene : (data.scenes_count > 0 ? &data.scenes[0] : nullptr);
+        for(size_t i = 0; scene && i < scene->nodes_count; i++) 
         {
-            update_texture_id(&texture->_id);
-            if (texture->_name.empty()) { texture->_name = "default_name_" + std::to_string(texture->_id); }
-            texture->register_texture(texture->_name.c_str());
+            load_node(nullptr, *scene->nodes[i], data, scale);
         }
-        for(VKE::Material* material : loadedData.materials)
+
+        // Registering gives textures and materials the IDs they have in the engine lists, unnamed ones get a generated name.
+        // The shared ones are already registered and keep their slot.
+        if(createResources)
         {
-            update_material_id(&material->_id);
-            if (material->_name.empty()) { material->_name = "default_name_" + std::to_string(material->_id); }
-            material->register_material(material->_name.c_str());
+            for (VKE::Texture* texture : loadedData.textures)
+            {
+                if(!texture->_handle.is_valid())
+                    texture->register_texture(texture->_name.c_str());
+            }
+            for(VKE::Material* material : loadedData.materials)
+            {
+                if(!material->_handle.is_valid())
+                    material->register_material(material->_name.c_str());
+            }
         }
         
         if(loadedData.nodes.size() == 0)
         {
             std::cout << "[ERROR] No nodes were found!" << std::endl;
+            loadedData = sgltfData{};
+            delete prefab;
             return nullptr;
         }
             
         prefab->_roots = loadedData.nodes;
 
-        // The pointers to the data are no longer needed
-        loadedData.textures.clear();
-        loadedData.materials.clear();
-        loadedData.nodes.clear();
+        if(cookData)
+        {
+            cookData->textureHandles = loadedData.textures;
+            cookData->materials = loadedData.materials;
+        }
 
-        // TODO: DELETE THIS
-        prefab->_vertices.vertices = vertexBuffer;
-        prefab->_vertices.rtVertices = rtVertexBuffer;
-        
-        size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
-        size_t rtVertexBufferSize = vertexBuffer.size() * sizeof(rtVertex);
-        size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
-        prefab->_vertices.count = static_cast<uint32_t>(vertexBuffer.size());
-        prefab->_indices.count = static_cast<uint32_t>(indexBuffer.size());
-
-        assert(vertexBufferSize > 0);
-
-        AllocatedBuffer vertexStaging;
-        AllocatedBuffer rtvStaging;
-        AllocatedBuffer indexStaging;
-
-        // Create staging buffers
-        // Vertex data
-        vertexStaging = vkutil::create_buffer(RenderEngine::_allocator, vertexBufferSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VMA_MEMORY_USAGE_CPU_ONLY);
-
-        void* vertexData;
-        vmaMapMemory(RenderEngine::_allocator, vertexStaging._allocation, &vertexData);
-        memcpy(vertexData, vertexBuffer.data(), vertexBufferSize);
-        vmaUnmapMemory(RenderEngine::_allocator, vertexStaging._allocation);
-        
-        // RTVertex data
-        rtvStaging = vkutil::create_buffer(RenderEngine::_allocator, rtVertexBufferSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VMA_MEMORY_USAGE_CPU_ONLY);
-
-        void* rtVertexData;
-        vmaMapMemory(RenderEngine::_allocator, rtvStaging._allocation, &rtVertexData);
-        memcpy(rtVertexData, prefab->_vertices.rtVertices.data(), rtVertexBufferSize);
-        vmaUnmapMemory(RenderEngine::_allocator, rtvStaging._allocation);
-
-        // Create device local buffers
-        // Vertex buffer
-        prefab->_vertices.vertexBuffer = vkutil::create_buffer(RenderEngine::_allocator, vertexBufferSize,
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
-        // RTVertex buffer
-        prefab->_vertices.rtvBuffer = vkutil::create_buffer(RenderEngine::_allocator, rtVertexBufferSize,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
-        if(indexBufferSize > 0)
-        {
-            // Index data
-            indexStaging = vkutil::create_buffer(RenderEngine::_allocator, indexBufferSize,
-                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                VMA_MEMORY_USAGE_CPU_ONLY);
-
-            void* indexData;
-            vmaMapMemory(RenderEngine::_allocator, indexStaging._allocation, &indexData);
-            memcpy(indexData, indexBuffer.data(), indexBufferSize);
-            vmaUnmapMemory(RenderEngine::_allocator, indexStaging._allocation);
-
-            // Create device local buffers
-            // Index buffer
-            prefab->_indices.indexBuffer = vkutil::create_buffer(RenderEngine::_allocator, indexBufferSize,
-                VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-                | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-        }
-
-        vkupload::immediate_submit([=](VkCommandBuffer cmd)
+        // Files exported with quantized attributes are meant to stay compact
+        for(size_t i = 0; i < data.extensions_used_count; i++)
+        {
+            if(strcmp(data.extensions_used[i], "KHR_mesh_quantization") == 0)
             {
-                VkBufferCopy copyRegion;
-                copyRegion.dstOffset = 0;
-                copyRegion.srcOffset = 0;
-                copyRegion.size = vertexBufferSize;
+                vertexFormat = VERTEX_FORMAT_QUANTIZED;
+            }
+        }
 
-                vkCmdCopyBuffer(cmd, vertexStaging._buffer, prefab->_vertices.vertexBuffer._buffer, 1, &copyRegion);
+        // The quantized vertices could not be drawn, the cook gets full ones too and is still used once they can be
+        if(!RenderEngine::_quantizedVerticesSupported)
+        {
+            vertexFormat = VERTEX_FORMAT_FULL;
+        }
 
-                copyRegion.size = rtVertexBufferSize;
+        // loadedData belongs to this thread, the jobs get to the primitives through these
+        const std::vector<Primitive*>& primitives = loadedData.primitives;
+        const std::vector<const cgltf_primitive*>& sources = loadedData.sources;
+        const uint32_t vertexCount = loadedData.vertexCount;
+
+        // The geometry is converted and optimized in system memory, the staging memory is write combined and the
+        // optimizer reads and writes the vertices in random order. Full precision vertices being cooked are already
+        // where they are going to stay, the others are copied or quantized once their primitive is done.
+        std::vector<Vertex> fullVertices;
+        Vertex* convertedVertices = nullptr;
+        const bool convertInPlace = vertexFormat == VERTEX_FORMAT_FULL && cookData;
+        if(convertInPlace)
+        {
+            cookData->vertices.resize(vertexCount);
+            convertedVertices = cookData->vertices.data();
+        }
+        else
+        {
+            fullVertices.resize(vertexCount);
+            convertedVertices = fullVertices.data();
+        }
 
-                vkCmdCopyBuffer(cmd, rtvStaging._buffer, prefab->_vertices.rtvBuffer._buffer, 1, &copyRegion);
+        // The first pass gave every primitive its own range, so the jobs never write to the same bytes
+        struct VertexChunk
+        {
+            size_t primitive;
+            uint32_t first;
+            uint32_t count;
+        };
+        std::vector<VertexChunk> chunks;
+        for(size_t i = 0; i < primitives.size(); i++)
+        {
+            for(uint32_t first = 0; first < primitives[i]->vertexCount; first += VERTEX_CHUNK_SIZE)
+            {
+                chunks.push_back(VertexChunk{ i, first, std::min(VERTEX_CHUNK_SIZE, primitives[i]->vertexCount - first) });
+            }
+        }
 
-                if(indexBufferSize > 0)
-                {
-                    copyRegion.size = indexBufferSize;
-                    vkCmdCopyBuffer(cmd, indexStaging._buffer, prefab->_indices.indexBuffer._buffer, 1, &copyRegion);
-                }
-            });
+        vkjobs::parallel_for(chunks.size(), [&](size_t i) {
+            const VertexChunk& chunk = chunks[i];
+            convert_vertices(*sources[chunk.primitive], chunk.first, chunk.count, convertedVertices + primitives[chunk.primitive]->firstVertex);
+        });
 
-        prefab->_vertices.vertices.clear();
-        prefab->_vertices.rtVertices.clear();
+        std::vector<PrimitiveIndices> primitiveIndices(primitives.size());
+        std::vector<MeshOptimizationReport> reports(primitives.size());
+        vkjobs::parallel_for(primitives.size(), [&](size_t i) {
+            convert_indices(*sources[i], *primitives[i], convertedVertices + primitives[i]->firstVertex, primitiveIndices[i], reports[i]);
+        });
 
-        RenderEngine::_mainDeletionQueue.push_function([=]() {
-            vmaDestroyBuffer(RenderEngine::_allocator, prefab->_vertices.vertexBuffer._buffer, prefab->_vertices.vertexBuffer._allocation);
-            vmaDestroyBuffer(RenderEngine::_allocator, prefab->_vertices.rtvBuffer._buffer, prefab->_vertices.rtvBuffer._allocation);
-            if(indexBufferSize > 0)
+        // Only the LOD levels that were built take room in the index data
+        const size_t indexDataSize = layout_indices(primitives);
+
+        // Where the geometry is going to stay: the cooked data when cooking, which is uploaded from there, and
+        // otherwise the staging memory of the upload
+        void* vertexData = convertedVertices;
+        unsigned char* indexData = nullptr;
+        VKE::Prefab::GeometryStaging staging;
+
+        if(cookData)
+        {
+            cookData->vertexFormat = vertexFormat;
+            if(vertexFormat == VERTEX_FORMAT_QUANTIZED)
             {
-                vmaDestroyBuffer(RenderEngine::_allocator, prefab->_indices.indexBuffer._buffer, prefab->_indices.indexBuffer._allocation);
+                cookData->quantizedVertices.resize(vertexCount);
+                vertexData = cookData->quantizedVertices.data();
             }
-            });
+            cookData->indexData.resize(indexDataSize);
+            indexData = cookData->indexData.data();
+        }
+        else
+        {
+            if(!prefab->begin_geometry_upload(vertexFormat, vertexCount, indexDataSize, staging))
+            {
+                loadedData = sgltfData{};
+                delete prefab;
+                return nullptr;
+            }
+            vertexData = staging.vertices;
+            indexData = staging.indices;
+        }
 
-        vmaDestroyBuffer(RenderEngine::_allocator, vertexStaging._buffer, vertexStaging._allocation);
-        //vmaDestroyBuffer(RenderEngine::_allocator, rtvStaging._buffer, rtvStaging._allocation);
-        if(indexBufferSize > 0)
+        vkjobs::parallel_for(primitives.size(), [&](size_t i) {
+            Primitive& primitive = *primitives[i];
+            const PrimitiveIndices& indices = primitiveIndices[i];
+            write_indices(indices.indices, primitive.firstIndex, primitive.indexType, indexData);
+            for(size_t level = 0; level < indices.levels.size(); level++)
+            {
+                write_indices(indices.levels[level], primitive.lods[level].firstIndex, primitive.indexType, indexData);
+            }
+
+            const Vertex* vertices = convertedVertices + primitive.firstVertex;
+            if(vertexFormat == VERTEX_FORMAT_QUANTIZED)
+            {
+                QuantizedVertex* quantizedVertices = static_cast<QuantizedVertex*>(vertexData) + primitive.firstVertex;
+                primitive.dequantization = vkutil::compute_dequantization(vertices, primitive.vertexCount);
+                vkutil::quantize_vertices(vertices, primitive.vertexCount, primitive.dequantization, quantizedVertices);
+            }
+            else if(!convertInPlace)
+            {
+                memcpy(static_cast<Vertex*>(vertexData) + primitive.firstVertex, vertices, primitive.vertexCount * sizeof(Vertex));
+            }
+        });
+
+        for(const MeshOptimizationReport& report : reports)
+        {
+            loadedData.optimization.add(report);
+        }
+
+        loadedData.optimization.print(filename);
+
+        // The pointers to the data are no longer needed
+        loadedData = sgltfData{};
+
+        if(createResources)
         {
-            vmaDestroyBuffer(RenderEngine::_allocator, indexStaging._buffer, indexStaging._allocation);
+            if(!cookData)
+            {
+                prefab->end_geometry_upload(staging);
+            }
+            else if(!prefab->upload_geometry(vertexFormat, vertexData, vertexCount, indexData, indexDataSize))
+            {
+                delete prefab;
+                return nullptr;
+            }
         }
-  
+
         return prefab;
     }
 
+    delete prefab;
     return nullptr;
 }
\ No newline at end of file
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <string>
+#include "vk_mesh.h"
 
 namespace VKE {
 	class Prefab;
 };
 
+struct PrefabCookData;
+
 struct TextureSampler {
 	VkFilter magFilter;
 	VkFilter minFilter;
@@ -14,4 +17,8 @@ struct TextureSampler {
 	VkSamplerAddressMode addressModeW;
 };
 
-VKE::Prefab* load_glTF(std::string filename, float scale);
\ No newline at end of file
+// When cookData is not null the imported geometry, textures and materials are kept in it so the prefab can be cooked.
+// Without createResources nothing is uploaded or registered, the result only serves to cook it and it can be imported
+// from the worker threads. The caller owns the prefab, its nodes and the texture and material handles in cookData.
+VKE::Prefab* load_glTF(std::string filename, float scale = 1.0f, PrefabCookData* cookData = nullptr, VertexFormat vertexFormat = VERTEX_FORMAT_FULL,
+	bool createResources = true);
\ No newline at end of file
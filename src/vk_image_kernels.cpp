@@ -0,0 +1,194 @@
+#include "vk_image_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VKIMAGE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define VKIMAGE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+	// Box filter of a destination pixel with the clamped coordinates of the generic case
+	inline void downsample_pixel(const uint8_t* src, int srcWidth, int srcHeight, int x, int y, uint8_t* dst)
+	{
+		const int x0 = std::min(x * 2, srcWidth - 1);
+		const int x1 = std::min(x * 2 + 1, srcWidth - 1);
+		const int y0 = std::min(y * 2, srcHeight - 1);
+		const int y1 = std::min(y * 2 + 1, srcHeight - 1);
+		const uint8_t* p00 = src + (static_cast<size_t>(y0) * srcWidth + x0) * 4;
+		const uint8_t* p01 = src + (static_cast<size_t>(y0) * srcWidth + x1) * 4;
+		const uint8_t* p10 = src + (static_cast<size_t>(y1) * srcWidth + x0) * 4;
+		const uint8_t* p11 = src + (static_cast<size_t>(y1) * srcWidth + x1) * 4;
+		for (int c = 0; c < 4; c++)
+		{
+			dst[c] = static_cast<uint8_t>((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+		}
+	}
+
+	// Four destination pixels from two rows of eight source pixels
+	inline void downsample_4_pixels(const uint8_t* row0, const uint8_t* row1, uint8_t* dst)
+	{
+#if defined(VKIMAGE_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(2);
+		__m128i halves[2];
+		for (int h = 0; h < 2; h++)
+		{
+			const __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + h * 16));
+			const __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + h * 16));
+
+			// Vertical sums of the pixel pairs 0-1 and 2-3 as 16 bit channels, then the horizontal ones
+			const __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+			const __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+			const __m128i sums = _mm_unpacklo_epi64(_mm_add_epi16(low, _mm_srli_si128(low, 8)), _mm_add_epi16(high, _mm_srli_si128(high, 8)));
+
+			halves[h] = _mm_srli_epi16(_mm_add_epi16(sums, rounding), 2);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(halves[0], halves[1]));
+#elif defined(VKIMAGE_NEON)
+		for (int h = 0; h < 2; h++)
+		{
+			const uint8x16_t top = vld1q_u8(row0 + h * 16);
+			const uint8x16_t bottom = vld1q_u8(row1 + h * 16);
+
+			const uint16x8_t low = vaddl_u8(vget_low_u8(top), vget_low_u8(bottom));
+			const uint16x8_t high = vaddl_u8(vget_high_u8(top), vget_high_u8(bottom));
+			const uint16x8_t sums = vcombine_u16(vadd_u16(vget_low_u16(low), vget_high_u16(low)), vadd_u16(vget_low_u16(high), vget_high_u16(high)));
+
+			// Rounding shift, (sum + 2) >> 2
+			vst1_u8(dst + h * 8, vrshrn_n_u16(sums, 2));
+		}
+#else
+		for (int x = 0; x < 4; x++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				dst[x * 4 + c] = static_cast<uint8_t>((row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c] + 2) / 4);
+			}
+		}
+#endif
+	}
+
+	// sRGB to linear light with 16 bits, and back from the top 12 bits of that. Built on first use.
+	struct SrgbTables
+	{
+		uint16_t toLinear[256];
+		uint8_t fromLinear[4096];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				const double value = i / 255.0;
+				const double linear = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+				toLinear[i] = static_cast<uint16_t>(linear * 65535.0 + 0.5);
+			}
+
+			// Each entry covers a range of linear values, it holds the code of its center
+			for (int i = 0; i < 4096; i++)
+			{
+				const double linear = (i + 0.5) / 4096.0;
+				const double value = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+				fromLinear[i] = static_cast<uint8_t>(std::min(std::max(value * 255.0 + 0.5, 0.0), 255.0));
+			}
+		}
+	};
+
+	const SrgbTables& get_srgb_tables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+}
+
+const char* vkimage::get_simd_name()
+{
+#if defined(VKIMAGE_SSE2)
+	return "SSE2";
+#elif defined(VKIMAGE_NEON)
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
+
+void vkimage::downsample_rgba8(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst)
+{
+	const int dstWidth = std::max(1, srcWidth >> 1);
+	const int dstHeight = std::max(1, srcHeight >> 1);
+
+	// Images a single pixel wide or high clamp their coordinates, the vector path needs both source rows and columns
+	if (srcWidth < 2 || srcHeight < 2)
+	{
+		reference::downsample_rgba8(src, srcWidth, srcHeight, dst);
+		return;
+	}
+
+	for (int y = 0; y < dstHeight; y++)
+	{
+		const uint8_t* row0 = src + static_cast<size_t>(y * 2) * srcWidth * 4;
+		const uint8_t* row1 = row0 + static_cast<size_t>(srcWidth) * 4;
+		uint8_t* dstRow = dst + static_cast<size_t>(y) * dstWidth * 4;
+
+		int x = 0;
+		for (; x + 4 <= dstWidth; x += 4)
+		{
+			downsample_4_pixels(row0 + x * 8, row1 + x * 8, dstRow + x * 4);
+		}
+		for (; x < dstWidth; x++)
+		{
+			downsample_pixel(src, srcWidth, srcHeight, x, y, dstRow + x * 4);
+		}
+	}
+}
+
+void vkimage::downsample_rgba8_srgb(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst)
+{
+	const SrgbTables& tables = get_srgb_tables();
+	const int dstWidth = std::max(1, srcWidth >> 1);
+	const int dstHeight = std::max(1, srcHeight >> 1);
+
+	// Stays scalar: SSE2 has no gathers, and a version with scalar table loads and vector sums measured 0.6x to 1.1x
+	// of this loop, the 15 lookups per pixel bound it either way
+	for (int y = 0; y < dstHeight; y++)
+	{
+		const int y0 = std::min(y * 2, srcHeight - 1);
+		const int y1 = std::min(y * 2 + 1, srcHeight - 1);
+		for (int x = 0; x < dstWidth; x++)
+		{
+			const int x0 = std::min(x * 2, srcWidth - 1);
+			const int x1 = std::min(x * 2 + 1, srcWidth - 1);
+			const uint8_t* p00 = src + (static_cast<size_t>(y0) * srcWidth + x0) * 4;
+			const uint8_t* p01 = src + (static_cast<size_t>(y0) * srcWidth + x1) * 4;
+			const uint8_t* p10 = src + (static_cast<size_t>(y1) * srcWidth + x0) * 4;
+			const uint8_t* p11 = src + (static_cast<size_t>(y1) * srcWidth + x1) * 4;
+			uint8_t* out = dst + (static_cast<size_t>(y) * dstWidth + x) * 4;
+
+			for (int c = 0; c < 3; c++)
+			{
+				const uint32_t linear = (tables.toLinear[p00[c]] + tables.toLinear[p01[c]] + tables.toLinear[p10[c]] + tables.toLinear[p11[c]] + 2) / 4;
+				out[c] = tables.fromLinear[linear >> 4];
+			}
+			out[3] = static_cast<uint8_t>((p00[3] + p01[3] + p10[3] + p11[3] + 2) / 4);
+		}
+	}
+}
+
+void vkimage::reference::downsample_rgba8(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst)
+{
+	const int dstWidth = std::max(1, srcWidth >> 1);
+	const int dstHeight = std::max(1, srcHeight >> 1);
+
+	for (int y = 0; y < dstHeight; y++)
+	{
+		for (int x = 0; x < dstWidth; x++)
+		{
+			downsample_pixel(src, srcWidth, srcHeight, x, y, dst + (static_cast<size_t>(y) * dstWidth + x) * 4);
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+// CPU pixel loops of the texture loaders and the cook. Every kernel has a scalar reference the vectorized path
+// must match bit for bit, SSE2 on x86 and NEON on ARM are picked at compile time.
+namespace vkimage {
+
+	// Name of the vector instruction set the kernels were compiled with, "scalar" when there is none
+	const char* get_simd_name();
+
+	// Halves an RGBA8 image with a 2x2 box filter, rounding to nearest. The destination is max(1, size / 2) on
+	// each axis, the odd last row or column is dropped unless the source is a single pixel wide or high.
+	void downsample_rgba8(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst);
+
+	// Same filter in linear light for sRGB encoded color, alpha is averaged as it is
+	void downsample_rgba8_srgb(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst);
+
+	namespace reference {
+
+		void downsample_rgba8(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst);
+	}
+}
@@ -0,0 +1,470 @@
+#include "vk_impostor.h"
+#include "vk_prefab.h"
+#include "vk_material.h"
+#include "vk_textures.h"
+#include "vk_render_engine.h"
+#include "vk_initializers.h"
+#include "vk_thread_pool.h"
+
+#include <stb_image.h>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <map>
+
+namespace
+{
+	struct DecodedTexture
+	{
+		int width = 0;
+		int height = 0;
+		unsigned char* pixels = nullptr;
+
+		// Nearest texel, wrapping like the material sampler
+		const unsigned char* sample(const glm::vec2& uv) const
+		{
+			float u = uv.x - std::floor(uv.x);
+			float v = uv.y - std::floor(uv.y);
+			int x = std::min(static_cast<int>(u * width), width - 1);
+			int y = std::min(static_cast<int>(v * height), height - 1);
+			return pixels + (static_cast<size_t>(y) * width + x) * 4;
+		}
+	};
+
+	// What deferred.frag reads of a material: the color or its texture, and the occlusion mask it alpha tests with
+	struct BakeMaterial
+	{
+		glm::vec3 color;
+		float tilling;
+		const DecodedTexture* colorTexture;
+		const DecodedTexture* maskTexture;
+	};
+
+	struct BakeTriangle
+	{
+		glm::vec3 positions[3];
+		glm::vec3 normals[3];
+		glm::vec2 uvs[3];
+		uint32_t material;
+	};
+
+	struct BakeScene
+	{
+		std::vector<BakeTriangle> triangles;
+		std::vector<BakeMaterial> materials;
+		std::map<const VKE::Texture*, DecodedTexture> textures;
+
+		~BakeScene()
+		{
+			for (auto& texture : textures)
+			{
+				if (texture.second.pixels)
+				{
+					stbi_image_free(texture.second.pixels);
+				}
+			}
+		}
+
+		const DecodedTexture* decode(const VKE::Texture* texture)
+		{
+			if (!texture || texture->_sourceFile.empty())
+			{
+				return nullptr;
+			}
+
+			auto found = textures.find(texture);
+			if (found == textures.end())
+			{
+				DecodedTexture decoded;
+				void* pixels = nullptr;
+				if (vkutil::load_image_from_file(&texture->_sourceFile, decoded.width, decoded.height, &pixels))
+				{
+					decoded.pixels = static_cast<unsigned char*>(pixels);
+				}
+				found = textures.emplace(texture, decoded).first;
+			}
+			return found->second.pixels ? &found->second : nullptr;
+		}
+
+		uint32_t add_material(const VKE::Material& material)
+		{
+			BakeMaterial bakeMaterial;
+			bakeMaterial.color = glm::vec3(material._color);
+			bakeMaterial.tilling = material._tilling_factor;
+			bakeMaterial.colorTexture = decode(material._color_texture);
+			bakeMaterial.maskTexture = decode(material._occlusion_texture);
+			materials.push_back(bakeMaterial);
+			return static_cast<uint32_t>(materials.size() - 1);
+		}
+	};
+
+	bool collect_triangles(VKE::Node* node, BakeScene& scene)
+	{
+		bool complete = true;
+
+		if (node->_mesh && node->_mesh->_primitives.size() > 0)
+		{
+			const VKE::Mesh& mesh = *node->_mesh;
+			if (mesh._vertices.empty() || mesh._indices.empty())
+			{
+				return false;
+			}
+
+			const glm::mat4 model = node->get_global_matrix();
+			const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+
+			for (const Primitive* primitive : mesh._primitives)
+			{
+				const uint32_t material = scene.add_material(primitive->material);
+				for (uint32_t i = 0; i + 2 < primitive->indexCount; i += 3)
+				{
+					BakeTriangle triangle;
+					triangle.material = material;
+					for (int k = 0; k < 3; k++)
+					{
+						const Vertex& vertex = mesh._vertices[primitive->firstVertex + mesh._indices[primitive->firstIndex + i + k]];
+						triangle.positions[k] = glm::vec3(model * glm::vec4(vertex.position, 1.0f));
+						triangle.normals[k] = normalMatrix * vertex.normal;
+						triangle.uvs[k] = vertex.uv;
+					}
+					scene.triangles.push_back(triangle);
+				}
+			}
+		}
+
+		for (VKE::Node* child : node->_children)
+		{
+			complete &= collect_triangles(child, scene);
+		}
+		return complete;
+	}
+
+	unsigned char to_unorm8(float value)
+	{
+		return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+
+	float edge(const glm::vec2& a, const glm::vec2& b, const glm::vec2& p)
+	{
+		return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+	}
+
+	// Orthographic view of the bounding sphere along the frame direction, closest surface wins, both faces are drawn
+	void bake_frame(const BakeScene& scene, uint32_t frameX, uint32_t frameY, ImpostorAtlas& atlas)
+	{
+		const uint32_t size = atlas.frameSize;
+		const uint32_t atlasSize = atlas.get_size();
+		const glm::vec3 direction = vkimpostor::get_frame_direction(frameX, frameY, atlas.framesPerSide);
+
+		glm::vec3 right, up;
+		vkimpostor::get_frame_axes(direction, right, up);
+
+		std::vector<float> depths(size * size, -std::numeric_limits<float>::max());
+
+		for (const BakeTriangle& triangle : scene.triangles)
+		{
+			glm::vec2 screen[3];
+			float depth[3];
+			for (int k = 0; k < 3; k++)
+			{
+				glm::vec3 local = (triangle.positions[k] - atlas.center) / atlas.radius;
+				screen[k] = glm::vec2(glm::dot(local, right) * 0.5f + 0.5f, 0.5f - glm::dot(local, up) * 0.5f) * static_cast<float>(size);
+				depth[k] = glm::dot(local, direction);
+			}
+
+			const float area = edge(screen[0], screen[1], screen[2]);
+			if (std::fabs(area) < 1e-8f)
+			{
+				continue;
+			}
+
+			const int minX = std::max(0, static_cast<int>(std::floor(std::min(screen[0].x, std::min(screen[1].x, screen[2].x)))));
+			const int minY = std::max(0, static_cast<int>(std::floor(std::min(screen[0].y, std::min(screen[1].y, screen[2].y)))));
+			const int maxX = std::min(static_cast<int>(size) - 1, static_cast<int>(std::ceil(std::max(screen[0].x, std::max(screen[1].x, screen[2].x)))));
+			const int maxY = std::min(static_cast<int>(size) - 1, static_cast<int>(std::ceil(std::max(screen[0].y, std::max(screen[1].y, screen[2].y)))));
+
+			const BakeMaterial& material = scene.materials[triangle.material];
+
+			for (int y = minY; y <= maxY; y++)
+			{
+				for (int x = minX; x <= maxX; x++)
+				{
+					const glm::vec2 p(x + 0.5f, y + 0.5f);
+					const float w0 = edge(screen[1], screen[2], p) / area;
+					const float w1 = edge(screen[2], screen[0], p) / area;
+					const float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					{
+						continue;
+					}
+
+					const float z = w0 * depth[0] + w1 * depth[1] + w2 * depth[2];
+					float& storedDepth = depths[y * size + x];
+					if (z <= storedDepth)
+					{
+						continue;
+					}
+
+					const glm::vec2 uv = w0 * triangle.uvs[0] + w1 * triangle.uvs[1] + w2 * triangle.uvs[2];
+					if (material.maskTexture)
+					{
+						const unsigned char* mask = material.maskTexture->sample(uv);
+						if (mask[0] <= 2 && mask[1] <= 2 && mask[2] <= 2)
+						{
+							continue;
+						}
+					}
+
+					glm::vec3 color = material.color;
+					if (material.colorTexture)
+					{
+						const unsigned char* texel = material.colorTexture->sample(uv * material.tilling);
+						color = glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+					}
+
+					glm::vec3 normal = w0 * triangle.normals[0] + w1 * triangle.normals[1] + w2 * triangle.normals[2];
+					float length = glm::length(normal);
+					normal = length > 0.0f ? normal / length : direction;
+					if (glm::dot(normal, direction) < 0.0f)
+					{
+						normal = -normal;
+					}
+
+					storedDepth = z;
+
+					const size_t pixel = (static_cast<size_t>(frameY * size + y) * atlasSize + frameX * size + x) * 4;
+					atlas.albedoOpacity[pixel + 0] = to_unorm8(color.r);
+					atlas.albedoOpacity[pixel + 1] = to_unorm8(color.g);
+					atlas.albedoOpacity[pixel + 2] = to_unorm8(color.b);
+					atlas.albedoOpacity[pixel + 3] = 255;
+					atlas.normalDepth[pixel + 0] = to_unorm8(normal.x * 0.5f + 0.5f);
+					atlas.normalDepth[pixel + 1] = to_unorm8(normal.y * 0.5f + 0.5f);
+					atlas.normalDepth[pixel + 2] = to_unorm8(normal.z * 0.5f + 0.5f);
+					atlas.normalDepth[pixel + 3] = to_unorm8(z * 0.5f + 0.5f);
+				}
+			}
+		}
+	}
+
+	// Empty texels take the average of their covered neighbours so filtering does not darken the silhouettes
+	void dilate_frame(const std::vector<unsigned char>& albedo, uint32_t frameX, uint32_t frameY, ImpostorAtlas& atlas)
+	{
+		const int size = static_cast<int>(atlas.frameSize);
+		const size_t atlasSize = atlas.get_size();
+
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				const size_t pixel = ((frameY * size + y) * atlasSize + frameX * size + x) * 4;
+				if (albedo[pixel + 3] != 0) continue;
+
+				int sum[3] = { 0, 0, 0 };
+				int count = 0;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						const int nx = x + dx, ny = y + dy;
+						if (nx < 0 || ny < 0 || nx >= size || ny >= size) continue;
+
+						const size_t neighbour = ((frameY * size + ny) * atlasSize + frameX * size + nx) * 4;
+						if (albedo[neighbour + 3] == 0) continue;
+
+						for (int c = 0; c < 3; c++) sum[c] += albedo[neighbour + c];
+						count++;
+					}
+				}
+
+				if (count > 0)
+				{
+					for (int c = 0; c < 3; c++) atlas.albedoOpacity[pixel + c] = static_cast<unsigned char>(sum[c] / count);
+				}
+			}
+		}
+	}
+
+	VKE::Material* find_material(const std::vector<VKE::Node*>& nodes)
+	{
+		for (VKE::Node* node : nodes)
+		{
+			if (node->_mesh && node->_mesh->_primitives.size() > 0)
+			{
+				return &node->_mesh->_primitives[0]->material;
+			}
+
+			VKE::Material* material = find_material(node->_children);
+			if (material)
+			{
+				return material;
+			}
+		}
+		return nullptr;
+	}
+
+	VKE::Texture* create_atlas_texture(const std::vector<unsigned char>& pixels, uint32_t size, const std::string& name)
+	{
+		VKE::Texture* texture = new VKE::Texture();
+		if (!vkutil::create_image_from_pixels(pixels.data(), static_cast<int>(size), static_cast<int>(size), VK_FORMAT_R8G8B8A8_UNORM, texture->_image))
+		{
+			delete texture;
+			return nullptr;
+		}
+
+		VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_UNORM, texture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VK_CHECK(vkCreateImageView(RenderEngine::_device, &imageViewInfo, nullptr, &texture->_imageView));
+
+		AllocatedImage image = texture->_image;
+		VkImageView imageView = texture->_imageView;
+		RenderEngine::_mainDeletionQueue.push_function([=]() {
+			vkDestroyImageView(RenderEngine::_device, imageView, nullptr);
+			vmaDestroyImage(RenderEngine::_allocator, image._image, image._allocation);
+		});
+
+		texture->register_texture(name.c_str());
+		return texture;
+	}
+}
+
+glm::vec3 vkimpostor::get_frame_direction(uint32_t x, uint32_t y, uint32_t framesPerSide)
+{
+	const glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / static_cast<float>(framesPerSide) * 2.0f - 1.0f;
+	const glm::vec2 p((uv.x + uv.y) * 0.5f, (uv.x - uv.y) * 0.5f);
+	return glm::normalize(glm::vec3(p.x, 1.0f - std::fabs(p.x) - std::fabs(p.y), p.y));
+}
+
+glm::vec2 vkimpostor::encode_direction(const glm::vec3& direction)
+{
+	glm::vec3 d = direction;
+	d.y = std::max(d.y, 0.0f);
+	const float sum = std::fabs(d.x) + d.y + std::fabs(d.z);
+	const glm::vec2 p = sum > 0.0f ? glm::vec2(d.x, d.z) / sum : glm::vec2(0.0f);
+	return glm::vec2(p.x + p.y, p.x - p.y);
+}
+
+void vkimpostor::get_frame_axes(const glm::vec3& direction, glm::vec3& outRight, glm::vec3& outUp)
+{
+	const glm::vec3 reference = direction.y > 0.999f ? glm::vec3(0.0f, 0.0f, -1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	outRight = glm::normalize(glm::cross(reference, direction));
+	outUp = glm::cross(direction, outRight);
+}
+
+bool vkimpostor::bake_impostor(const std::vector<VKE::Prefab*>& prefabs, const ImpostorSettings& settings, ImpostorAtlas& outAtlas)
+{
+	BakeScene scene;
+	for (const VKE::Prefab* prefab : prefabs)
+	{
+		bool complete = true;
+		for (VKE::Node* root : prefab->_roots)
+		{
+			complete &= collect_triangles(root, scene);
+		}
+
+		if (!complete)
+		{
+			std::cout << "[ERROR] Prefab " << prefab->_name << " has no geometry in memory to bake an impostor from" << std::endl;
+			return false;
+		}
+	}
+
+	if (scene.triangles.empty())
+	{
+		std::cout << "[ERROR] No triangles to bake an impostor from" << std::endl;
+		return false;
+	}
+
+	glm::vec3 minimum(std::numeric_limits<float>::max());
+	glm::vec3 maximum(-std::numeric_limits<float>::max());
+	for (const BakeTriangle& triangle : scene.triangles)
+	{
+		for (const glm::vec3& position : triangle.positions)
+		{
+			minimum = glm::min(minimum, position);
+			maximum = glm::max(maximum, position);
+		}
+	}
+
+	outAtlas.framesPerSide = settings.framesPerSide;
+	outAtlas.frameSize = settings.frameSize;
+	outAtlas.center = (minimum + maximum) * 0.5f;
+	outAtlas.radius = 0.0f;
+	for (const BakeTriangle& triangle : scene.triangles)
+	{
+		for (const glm::vec3& position : triangle.positions)
+		{
+			outAtlas.radius = std::max(outAtlas.radius, glm::length(position - outAtlas.center));
+		}
+	}
+	outAtlas.radius = std::max(outAtlas.radius, 1e-4f);
+
+	const size_t atlasPixels = static_cast<size_t>(outAtlas.get_size()) * outAtlas.get_size();
+	outAtlas.albedoOpacity.assign(atlasPixels * 4, 0);
+	outAtlas.normalDepth.assign(atlasPixels * 4, 0);
+
+	// Frames do not overlap, each one is baked on its own worker
+	const uint32_t frameCount = settings.framesPerSide * settings.framesPerSide;
+	vkjobs::parallel_for(frameCount, [&](size_t frame) {
+		bake_frame(scene, static_cast<uint32_t>(frame % settings.framesPerSide), static_cast<uint32_t>(frame / settings.framesPerSide), outAtlas);
+	});
+
+	const std::vector<unsigned char> albedo = outAtlas.albedoOpacity;
+	vkjobs::parallel_for(frameCount, [&](size_t frame) {
+		dilate_frame(albedo, static_cast<uint32_t>(frame % settings.framesPerSide), static_cast<uint32_t>(frame / settings.framesPerSide), outAtlas);
+	});
+
+	return true;
+}
+
+Impostor* vkimpostor::create_impostor(const ImpostorAtlas& atlas, const ImpostorSettings& settings, const std::string& name)
+{
+	Impostor* impostor = new Impostor();
+	impostor->albedoOpacity = create_atlas_texture(atlas.albedoOpacity, atlas.get_size(), name + "_impostor_albedo");
+	impostor->normalDepth = create_atlas_texture(atlas.normalDepth, atlas.get_size(), name + "_impostor_normal");
+	impostor->center = atlas.center;
+	impostor->radius = atlas.radius;
+	impostor->framesPerSide = atlas.framesPerSide;
+	impostor->distance = atlas.radius * settings.distanceInRadii;
+
+	if (!impostor->albedoOpacity || !impostor->normalDepth)
+	{
+		std::cout << "[ERROR] Could not upload the impostor of " << name << std::endl;
+		delete impostor;
+		return nullptr;
+	}
+
+	return impostor;
+}
+
+Impostor* vkimpostor::create_impostor(const std::vector<VKE::Prefab*>& prefabs, const std::string& name, const ImpostorSettings& settings)
+{
+	ImpostorAtlas atlas;
+	if (prefabs.empty() || !bake_impostor(prefabs, settings, atlas))
+	{
+		return nullptr;
+	}
+
+	Impostor* impostor = create_impostor(atlas, settings, name);
+	if (!impostor)
+	{
+		return nullptr;
+	}
+
+	for (VKE::Prefab* prefab : prefabs)
+	{
+		if (!impostor->material)
+		{
+			impostor->material = find_material(prefab->_roots);
+		}
+		prefab->_impostor = impostor;
+	}
+	impostor->drawnBy = prefabs.front();
+	return impostor;
+}
+
+bool vkimpostor::replaces_prefab(const Impostor& impostor, const glm::mat4& model, const glm::vec3& cameraPosition)
+{
+	const glm::vec3 center = glm::vec3(model * glm::vec4(impostor.center, 1.0f));
+	const float scale = glm::length(glm::vec3(model[0]));
+	return glm::length(center - cameraPosition) > impostor.distance * scale;
+}
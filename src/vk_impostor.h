@@ -0,0 +1,80 @@
+#pragma once
+
+#include "vk_types.h"
+#include <string>
+#include <vector>
+
+namespace VKE
+{
+	class Prefab;
+	class Texture;
+	class Material;
+}
+
+struct ImpostorSettings
+{
+	uint32_t framesPerSide = 8; // the atlas holds framesPerSide x framesPerSide views
+	uint32_t frameSize = 64; // pixels of a view
+	float distanceInRadii = 20.0f; // objects further than this many bounding radii are drawn as impostors
+};
+
+// Views of a prefab from the upper hemisphere, laid out in a hemi-octahedral grid. The frame of a direction is
+// found by encoding it, so neighbouring frames are neighbouring directions.
+struct ImpostorAtlas
+{
+	uint32_t framesPerSide = 0;
+	uint32_t frameSize = 0;
+	glm::vec3 center = glm::vec3(0.0f); // of the bounding sphere the views are framed on, in prefab space
+	float radius = 0.0f;
+	std::vector<unsigned char> albedoOpacity; // RGBA8, alpha is the coverage after the alpha test
+	std::vector<unsigned char> normalDepth; // RGBA8, xyz prefab space normal, w depth towards the viewer in radii
+
+	uint32_t get_size() const { return framesPerSide * frameSize; }
+};
+
+// An impostor on the GPU, the raster path draws it as a single quad facing the closest baked view
+struct Impostor
+{
+	VKE::Texture* albedoOpacity = nullptr;
+	VKE::Texture* normalDepth = nullptr;
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+	uint32_t framesPerSide = 0;
+	float distance = 0.0f; // from the camera, beyond it the impostor replaces the prefab
+	VKE::Material* material = nullptr; // of the first primitive, the lighting pass shades the impostor with its type
+	const VKE::Prefab* drawnBy = nullptr; // the prefabs baked together switch at once, only this one draws the quad
+};
+
+// Per draw constants of the impostor pipeline
+struct ImpostorPushConstant
+{
+	glm::mat4 modelMatrix;
+	glm::vec4 center_radius;
+	glm::vec4 textures_frames_material; // x albedo texture, y normal texture, z frames per side, w material index
+};
+
+namespace vkimpostor {
+
+	// Direction the frame at (x, y) was baked from and its inverse, +Y is the pole of the hemisphere
+	glm::vec3 get_frame_direction(uint32_t x, uint32_t y, uint32_t framesPerSide);
+	glm::vec2 encode_direction(const glm::vec3& direction);
+
+	// Right and up of the view along the direction, the impostor shaders build the same ones
+	void get_frame_axes(const glm::vec3& direction, glm::vec3& outRight, glm::vec3& outUp);
+
+	// Rasterizes every view on the CPU, it needs no device so it also runs headless. Only the meshes that keep
+	// their vertices and indices in memory can be baked, textures are decoded again from their source file.
+	// The prefabs are the parts of one object, like the stem and the leaves of a tree, baked in the same views.
+	bool bake_impostor(const std::vector<VKE::Prefab*>& prefabs, const ImpostorSettings& settings, ImpostorAtlas& outAtlas);
+
+	// Uploads the atlas and registers its textures as <name>_impostor_albedo and <name>_impostor_normal
+	Impostor* create_impostor(const ImpostorAtlas& atlas, const ImpostorSettings& settings, const std::string& name);
+
+	// Bakes the parts together, uploads the result and gives it to every one of them. The parts have to be placed
+	// with the same model matrix. nullptr when they cannot be baked.
+	Impostor* create_impostor(const std::vector<VKE::Prefab*>& prefabs, const std::string& name, const ImpostorSettings& settings = ImpostorSettings());
+
+	// Whether the impostor is drawn instead of the prefab placed with this model. The raster path draws the quad
+	// then, and the shadows use the coarsest LOD level as a proxy.
+	bool replaces_prefab(const Impostor& impostor, const glm::mat4& model, const glm::vec3& cameraPosition);
+}
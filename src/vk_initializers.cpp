@@ -245,7 +245,7 @@ VkImageViewCreateInfo vkinit::imageview_create_info(VkFormat format, VkImage ima
 	info.image = image;
 	info.format = format;
 	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS; // the whole mip chain of textures, 1 for attachments
 	info.subresourceRange.baseArrayLayer = 0;
 	info.subresourceRange.layerCount = 1;
 	info.subresourceRange.aspectMask = aspectFlags;
@@ -318,7 +318,7 @@ VkSamplerCreateInfo vkinit::sampler_create_info(VkFilter filters, VkSamplerAddre
 	info.pNext = nullptr;
 
 	info.magFilter = filters;
-	info.magFilter = filters;
+	info.minFilter = filters;
 	info.addressModeU = samplerAdressMode;
 	info.addressModeV = samplerAdressMode;
 	info.addressModeW = samplerAdressMode;
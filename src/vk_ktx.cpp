@@ -0,0 +1,271 @@
+#include "vk_ktx.h"
+#include "vk_texture_compression.h"
+#include "vk_textures.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#define KTX2_EXTENSION ".ktx2"
+
+namespace
+{
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+	// Khronos data format descriptor color models and channels of the block formats
+	const uint8_t KHR_DF_MODEL_BC1A = 128;
+	const uint8_t KHR_DF_MODEL_BC4 = 131;
+	const uint8_t KHR_DF_MODEL_BC5 = 132;
+	const uint8_t KHR_DF_MODEL_BC7 = 134;
+	const uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+	const uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+
+	struct Ktx2Header
+	{
+		unsigned char identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+
+	struct Ktx2Level
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	struct DfdSample
+	{
+		uint16_t bitOffset;
+		uint8_t bitLength; // minus one
+		uint8_t channelType;
+		uint8_t samplePosition[4];
+		uint32_t sampleLower;
+		uint32_t sampleUpper;
+	};
+
+	// Basic descriptor block, the only one readers require
+	void build_dfd(VkFormat format, std::vector<uint32_t>& outDfd)
+	{
+		uint8_t colorModel = KHR_DF_MODEL_BC7;
+		std::vector<DfdSample> samples(1);
+		samples[0] = DfdSample{ 0, 127, 0, { 0, 0, 0, 0 }, 0, 0xFFFFFFFF };
+
+		switch (format)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			colorModel = KHR_DF_MODEL_BC1A;
+			samples[0].bitLength = 63;
+			break;
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			colorModel = KHR_DF_MODEL_BC4;
+			samples[0].bitLength = 63;
+			break;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			colorModel = KHR_DF_MODEL_BC5;
+			samples[0].bitLength = 63;
+			samples.push_back(DfdSample{ 64, 63, 1, { 0, 0, 0, 0 }, 0, 0xFFFFFFFF });
+			break;
+		default:
+			break;
+		}
+
+		const uint16_t blockSize = static_cast<uint16_t>(24 + samples.size() * sizeof(DfdSample));
+		std::vector<unsigned char> bytes(4 + blockSize, 0);
+		unsigned char* it = bytes.data();
+
+		const uint32_t totalSize = static_cast<uint32_t>(bytes.size());
+		const uint16_t versionNumber = 2;
+		memcpy(it, &totalSize, 4);
+		// vendorId and descriptorType are both 0 for the basic block
+		memcpy(it + 8, &versionNumber, 2);
+		memcpy(it + 10, &blockSize, 2);
+		it[12] = colorModel;
+		it[13] = KHR_DF_PRIMARIES_BT709;
+		it[14] = KHR_DF_TRANSFER_LINEAR;
+		it[15] = 0;
+		it[16] = 3; // 4x4 texel blocks, stored minus one
+		it[17] = 3;
+		it[20] = static_cast<unsigned char>(vkbc::get_block_size(format));
+		memcpy(it + 28, samples.data(), samples.size() * sizeof(DfdSample));
+
+		outDfd.resize(bytes.size() / 4);
+		memcpy(outDfd.data(), bytes.data(), bytes.size());
+	}
+}
+
+std::string vkktx::get_cooked_filename(const std::string& sourceFilename)
+{
+	size_t extpos = sourceFilename.rfind('.');
+	return (extpos != std::string::npos ? sourceFilename.substr(0, extpos) : sourceFilename) + KTX2_EXTENSION;
+}
+
+bool vkktx::load_ktx2(const std::string& filename, KtxTexture& outTexture)
+{
+	if (!outTexture.file.open(filename))
+	{
+		return false;
+	}
+
+	const MappedFile& file = outTexture.file;
+	if (file.size < sizeof(Ktx2Header))
+	{
+		std::cout << "[ERROR] KTX2 file " << filename << " is truncated" << std::endl;
+		return false;
+	}
+
+	const Ktx2Header& header = *reinterpret_cast<const Ktx2Header*>(file.data);
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		std::cout << "[ERROR] " << filename << " is not a KTX2 file" << std::endl;
+		return false;
+	}
+
+	const bool isCubemap = header.faceCount == 6 && header.pixelWidth == header.pixelHeight;
+	if (header.supercompressionScheme != 0 || header.pixelDepth > 1 || header.layerCount > 1 || (header.faceCount != 1 && !isCubemap) ||
+		header.pixelWidth == 0 || header.pixelHeight == 0)
+	{
+		std::cout << "[ERROR] KTX2 file " << filename << " is not a plain 2D texture or cubemap" << std::endl;
+		return false;
+	}
+
+	const VkFormat format = static_cast<VkFormat>(header.vkFormat);
+	if (!vkbc::is_block_compressed(format) && format != VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		std::cout << "[ERROR] KTX2 file " << filename << " uses an unsupported format " << header.vkFormat << std::endl;
+		return false;
+	}
+
+	const uint32_t levelCount = std::max(header.levelCount, 1u);
+	if (levelCount > vkutil::get_mip_levels(header.pixelWidth, header.pixelHeight) ||
+		file.size - sizeof(Ktx2Header) < levelCount * sizeof(Ktx2Level))
+	{
+		std::cout << "[ERROR] KTX2 file " << filename << " is corrupted" << std::endl;
+		return false;
+	}
+
+	const Ktx2Level* levels = reinterpret_cast<const Ktx2Level*>(file.data + sizeof(Ktx2Header));
+
+	uint64_t begin = file.size;
+	uint64_t end = 0;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const uint64_t expected = vkutil::get_mip_chain_size(header.pixelWidth >> level, header.pixelHeight >> level, 1, format) * header.faceCount;
+		if (levels[level].byteOffset > file.size || levels[level].byteLength > file.size - levels[level].byteOffset ||
+			levels[level].byteLength < expected)
+		{
+			std::cout << "[ERROR] KTX2 file " << filename << " has a corrupted level " << level << std::endl;
+			return false;
+		}
+
+		begin = std::min(begin, levels[level].byteOffset);
+		end = std::max(end, levels[level].byteOffset + levels[level].byteLength);
+	}
+
+	outTexture.format = format;
+	outTexture.width = header.pixelWidth;
+	outTexture.height = header.pixelHeight;
+	outTexture.mipLevels = levelCount;
+	outTexture.faceCount = header.faceCount;
+	outTexture.data = file.data + begin;
+	outTexture.dataSize = static_cast<size_t>(end - begin);
+	outTexture.levelOffsets.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		outTexture.levelOffsets[level] = levels[level].byteOffset - begin;
+	}
+
+	return true;
+}
+
+bool vkktx::write_ktx2(const std::string& filename, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels,
+	const std::vector<unsigned char>& data, uint32_t faceCount)
+{
+	if (!vkbc::is_block_compressed(format) || mipLevels == 0 || (faceCount != 1 && faceCount != 6))
+	{
+		return false;
+	}
+
+	std::vector<uint32_t> dfd;
+	build_dfd(format, dfd);
+
+	Ktx2Header header{};
+	memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.vkFormat = static_cast<uint32_t>(format);
+	header.typeSize = 1;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = faceCount;
+	header.levelCount = mipLevels;
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + mipLevels * sizeof(Ktx2Level));
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+	// Levels are stored from the smallest to the largest, each aligned to the block size
+	const uint32_t alignment = std::max(vkbc::get_block_size(format), 4u);
+	std::vector<size_t> sourceOffsets(mipLevels);
+	std::vector<Ktx2Level> levels(mipLevels);
+
+	size_t sourceOffset = 0;
+	for (uint32_t level = 0; level < mipLevels; level++)
+	{
+		sourceOffsets[level] = sourceOffset;
+		levels[level].byteLength = vkutil::get_mip_chain_size(width >> level, height >> level, 1, format) * faceCount;
+		levels[level].uncompressedByteLength = levels[level].byteLength;
+		sourceOffset += levels[level].byteLength;
+	}
+
+	if (sourceOffset > data.size())
+	{
+		return false;
+	}
+
+	uint64_t offset = vkutil::get_aligned_size(header.dfdByteOffset + header.dfdByteLength, alignment);
+	for (int32_t level = static_cast<int32_t>(mipLevels) - 1; level >= 0; level--)
+	{
+		levels[level].byteOffset = offset;
+		offset = vkutil::get_aligned_size(offset + levels[level].byteLength, alignment);
+	}
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "[ERROR] Could not write " << filename << std::endl;
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(Ktx2Header));
+	file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(Ktx2Level));
+	file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(uint32_t));
+
+	uint64_t written = header.dfdByteOffset + header.dfdByteLength;
+	static const char zeros[16] = {};
+	for (int32_t level = static_cast<int32_t>(mipLevels) - 1; level >= 0; level--)
+	{
+		file.write(zeros, levels[level].byteOffset - written);
+		file.write(reinterpret_cast<const char*>(data.data() + sourceOffsets[level]), levels[level].byteLength);
+		written = levels[level].byteOffset + levels[level].byteLength;
+	}
+
+	if (!file.good())
+	{
+		std::cout << "[ERROR] Failed writing " << filename << std::endl;
+		return false;
+	}
+
+	return true;
+}
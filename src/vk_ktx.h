@@ -0,0 +1,35 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_utils.h"
+#include <string>
+#include <vector>
+
+// A KTX2 file mapped in memory. Only 2D textures and cubemaps without supercompression are supported.
+struct KtxTexture
+{
+	MappedFile file;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t mipLevels = 0;
+	uint32_t faceCount = 1; // 6 for cubemaps, the faces of a level follow each other
+
+	// KTX2 stores the smallest level first, data spans every level and the offsets are relative to it, level 0 first
+	const unsigned char* data = nullptr;
+	size_t dataSize = 0;
+	std::vector<VkDeviceSize> levelOffsets;
+};
+
+namespace vkktx {
+
+	// Name of the cooked KTX2 file of a source image, next to it
+	std::string get_cooked_filename(const std::string& sourceFilename);
+
+	bool load_ktx2(const std::string& filename, KtxTexture& outTexture);
+
+	// Writes the levels of data, packed one after another starting with level 0, as a block compressed KTX2 file.
+	// A level of a cubemap holds its six faces one after another.
+	bool write_ktx2(const std::string& filename, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels,
+		const std::vector<unsigned char>& data, uint32_t faceCount = 1);
+}
@@ -1,8 +1,10 @@
 #include "vk_material.h"
+#include "vk_utils.h"
 
 using namespace VKE;
 
-std::map<std::string, Material*> Material::sMaterials;
+ResourceRegistry<Material> Material::sMaterials;
+ContentCache<Material> Material::sMaterialsByContent;
 
 Material::Material() : _type(UNDEFINED), _color{1.0f, 1.0f, 1.0f, 1.0f}, _roughness_factor(0), _metallic_factor(0), _tilling_factor(1)
 {
@@ -19,14 +21,46 @@ Material::Material(VKE::Texture* texture) : Material()
 Material* Material::get(const char* name)
 {
 	assert(name);
-	std::map<std::string, Material*>::iterator it = sMaterials.find(name);
-	if (it != sMaterials.end())
-		return it->second;
-	return nullptr;
+	return sMaterials.find(name);
+}
+
+Material* Material::get(RegistryHandle handle)
+{
+	return sMaterials.get(handle);
 }
 
 void Material::register_material(const char* name)
 {
 	_name = name;
-	sMaterials[name] = this;
+	_handle = sMaterials.insert(_name, this);
+	_id = static_cast<int>(_handle.index);
+}
+
+uint64_t Material::get_content_hash() const
+{
+	const float factors[11] = {
+		_color.x, _color.y, _color.z, _color.w,
+		_emissive_factor.x, _emissive_factor.y, _emissive_factor.z, _emissive_factor.w,
+		_roughness_factor, _metallic_factor, _tilling_factor
+	};
+	// Textures are already shared by content, the same pixels are the same texture
+	const VKE::Texture* textures[5] = { _color_texture, _emissive_texture, _metallic_roughness_texture, _occlusion_texture, _normal_texture };
+
+	uint64_t hash = vkutil::hash_bytes(factors, sizeof(factors), static_cast<uint64_t>(_type));
+	return vkutil::hash_bytes(textures, sizeof(textures), hash);
+}
+
+bool Material::has_same_content(const Material& other) const
+{
+	return _type == other._type && _color == other._color && _emissive_factor == other._emissive_factor &&
+		_roughness_factor == other._roughness_factor && _metallic_factor == other._metallic_factor && _tilling_factor == other._tilling_factor &&
+		_color_texture == other._color_texture && _emissive_texture == other._emissive_texture &&
+		_metallic_roughness_texture == other._metallic_roughness_texture && _occlusion_texture == other._occlusion_texture &&
+		_normal_texture == other._normal_texture;
+}
+
+Material* Material::find_or_cache_content()
+{
+	Material* cached = sMaterialsByContent.insert(get_content_hash(), this);
+	return cached != this && cached->has_same_content(*this) ? cached : nullptr;
 }
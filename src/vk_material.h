@@ -1,8 +1,8 @@
 #pragma once
 
 #include "vk_types.h"
+#include "vk_registry.h"
 #include <cassert>
-#include <map>
 #include <string>
 
 namespace VKE
@@ -21,11 +21,13 @@ namespace VKE
 	{
 	public:
 		std::string _name;
-		int _id;
+		int _id; // index in the material buffers, the slot of its handle
+		RegistryHandle _handle;
 
 		//static manager to reuse materials
-		static std::map<std::string, Material*> sMaterials;
+		static ResourceRegistry<Material> sMaterials;
 		static Material* get(const char* name);
+		static Material* get(RegistryHandle handle);
 
 		//material properties
 		MaterialType _type;
@@ -45,11 +47,16 @@ namespace VKE
 
 		Material();
 		Material(VKE::Texture* texture);
+		// Assigns the handle and _id, safe from the worker threads
 		void register_material(const char* name);
 
-		static bool ComparePtrToMaterial(const VKE::Material* l, const VKE::Material* r) {
-			return l->_id < r->_id;
-		}
+		// Materials by the hash of their properties and textures, identical materials of different prefabs are shared
+		static ContentCache<Material> sMaterialsByContent;
+		uint64_t get_content_hash() const;
+		bool has_same_content(const Material& other) const;
+
+		// The cached material identical to this one, nullptr when there is none and this one is cached instead
+		Material* find_or_cache_content();
 	};
 
 	struct MaterialToShader
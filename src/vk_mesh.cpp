@@ -1,15 +1,18 @@
 #include "vk_mesh.h"
 #include "vk_utils.h"
 #include "vk_material.h"
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include "vk_obj_loader.h"
+#include "vk_mesh_optimizer.h"
+#include "vk_mesh_simplifier.h"
+#include "vk_thread_pool.h"
 #include <iostream>
 #include "vk_render_engine.h"
-#include <unordered_map>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtx/transform.hpp>
 
 using namespace VKE;
 
-std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
+ResourceRegistry<Mesh> Mesh::sMeshesLoaded;
 
 VertexInputDescription Vertex::get_vertex_description(bool onlyPosition)
 {
@@ -60,147 +63,278 @@ VertexInputDescription Vertex::get_vertex_description(bool onlyPosition)
     return description;
 }
 
-using namespace VKE;
+VertexInputDescription QuantizedVertex::get_vertex_description(bool onlyPosition)
+{
+    VertexInputDescription description;
 
-Mesh::Mesh()
+    VkVertexInputBindingDescription mainBinding = {};
+    mainBinding.binding = 0;
+    mainBinding.stride = sizeof(QuantizedVertex);
+    mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    description.bindings.push_back(mainBinding);
+
+    VkVertexInputAttributeDescription positionAttribute = {};
+    positionAttribute.binding = 0;
+    positionAttribute.location = 0;
+    positionAttribute.format = VK_FORMAT_R16G16B16A16_SNORM;
+    positionAttribute.offset = offsetof(QuantizedVertex, position);
+
+    if(onlyPosition)
+    {
+        description.attributes.push_back(positionAttribute);
+        return description;
+    }
+
+    VkVertexInputAttributeDescription normalAttribute = {};
+    normalAttribute.binding = 0;
+    normalAttribute.location = 1;
+    normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+    normalAttribute.offset = offsetof(QuantizedVertex, normal);
+
+    // There is no color attribute, location 2 is not read by the quantized shaders
+    VkVertexInputAttributeDescription uvAttribute = {};
+    uvAttribute.binding = 0;
+    uvAttribute.location = 3;
+    uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;
+    uvAttribute.offset = offsetof(QuantizedVertex, uv);
+
+    description.attributes.push_back(positionAttribute);
+    description.attributes.push_back(normalAttribute);
+    description.attributes.push_back(uvAttribute);
+
+    return description;
+}
+
+uint64_t vkutil::hash_vertex(const Vertex& vertex)
+{
+    const float components[11] = {
+        vertex.position.x, vertex.position.y, vertex.position.z,
+        vertex.normal.x, vertex.normal.y, vertex.normal.z,
+        vertex.color.x, vertex.color.y, vertex.color.z,
+        vertex.uv.x, vertex.uv.y
+    };
+
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for(float component : components)
+    {
+        // Adding zero turns -0.0 into 0.0 so values that compare equal also hash equal
+        float value = component + 0.0f;
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        hash ^= bits;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+
+    // Final avalanche so the low bits can be used directly as a table index
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+VkIndexType vkutil::select_index_type(uint32_t vertexCount)
 {
+    return vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 }
 
-VKE::Mesh::~Mesh()
+uint32_t vkutil::get_index_size(VkIndexType indexType)
 {
+    return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
 }
 
-void Mesh::upload_to_gpu()
+size_t vkutil::get_vertex_size(VertexFormat format)
 {
-    if(_vertices.size() > 0 && _indices.size() > 0)
+    return format == VERTEX_FORMAT_QUANTIZED ? sizeof(QuantizedVertex) : sizeof(Vertex);
+}
+
+glm::vec4 vkutil::compute_dequantization(const Vertex* vertices, size_t count)
+{
+    if(count == 0)
     {
-        create_vertex_buffer();
-        create_index_buffer();
+        return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
     }
-    else
+
+    glm::vec3 posMin = vertices[0].position;
+    glm::vec3 posMax = vertices[0].position;
+    for(size_t i = 1; i < count; i++)
     {
-        std::cout << "Failed tu upload mesh to the gpu!" << std::endl;
+        posMin = glm::min(posMin, vertices[i].position);
+        posMax = glm::max(posMax, vertices[i].position);
     }
+
+    // A uniform scale keeps the normals valid when the dequantization is folded into the model matrix
+    glm::vec3 halfExtent = (posMax - posMin) * 0.5f;
+    float scale = glm::max(halfExtent.x, glm::max(halfExtent.y, halfExtent.z));
+
+    return glm::vec4((posMin + posMax) * 0.5f, scale > 0.0f ? scale : 1.0f);
 }
 
-void Mesh::create_vertex_buffer()
+static glm::vec2 encode_octahedral(glm::vec3 normal)
 {
-    const size_t bufferSize = _vertices.size() * sizeof(Vertex);
-
-    VkBufferCreateInfo stagingBufferInfo = {};
-    stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    stagingBufferInfo.pNext = nullptr;
-    stagingBufferInfo.size = bufferSize;
-    stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    float length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+    if(length == 0.0f)
+    {
+        return glm::vec2(0.0f);
+    }
 
-    VmaAllocationCreateInfo vmaAllocInfo = {};
-    vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    glm::vec2 octahedral = glm::vec2(normal.x, normal.y) / length;
+    if(normal.z < 0.0f)
+    {
+        glm::vec2 signs(octahedral.x >= 0.0f ? 1.0f : -1.0f, octahedral.y >= 0.0f ? 1.0f : -1.0f);
+        octahedral = (glm::vec2(1.0f) - glm::abs(glm::vec2(octahedral.y, octahedral.x))) * signs;
+    }
 
-    AllocatedBuffer stagingBuffer;
+    return octahedral;
+}
 
-    VK_CHECK(vmaCreateBuffer(RenderEngine::_allocator, &stagingBufferInfo, &vmaAllocInfo,
-        &stagingBuffer._buffer,
-        &stagingBuffer._allocation,
-        nullptr));
+void vkutil::quantize_vertices(const Vertex* vertices, size_t count, const glm::vec4& dequantization, QuantizedVertex* outVertices)
+{
+    const glm::vec3 offset = glm::vec3(dequantization);
+    const float invScale = 1.0f / dequantization.w;
 
-    void* data;
-    vmaMapMemory(RenderEngine::_allocator, stagingBuffer._allocation, &data);
-    memcpy(data, _vertices.data(), _vertices.size() * sizeof(Vertex));
-    vmaUnmapMemory(RenderEngine::_allocator, stagingBuffer._allocation);
+    for(size_t i = 0; i < count; i++)
+    {
+        const Vertex& vertex = vertices[i];
+        QuantizedVertex& quantized = outVertices[i];
 
-    VkBufferCreateInfo vertexBufferInfo = {};
-    vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    vertexBufferInfo.pNext = nullptr;
-    vertexBufferInfo.size = bufferSize;
-    vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-        | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        glm::vec3 position = (vertex.position - offset) * invScale;
+        quantized.position[0] = static_cast<int16_t>(glm::packSnorm1x16(position.x));
+        quantized.position[1] = static_cast<int16_t>(glm::packSnorm1x16(position.y));
+        quantized.position[2] = static_cast<int16_t>(glm::packSnorm1x16(position.z));
+        quantized.position[3] = 0;
 
-    vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        glm::vec2 normal = encode_octahedral(vertex.normal);
+        quantized.normal[0] = static_cast<int16_t>(glm::packSnorm1x16(normal.x));
+        quantized.normal[1] = static_cast<int16_t>(glm::packSnorm1x16(normal.y));
 
-    VK_CHECK(vmaCreateBuffer(RenderEngine::_allocator, &vertexBufferInfo, &vmaAllocInfo,
-        &_vertexBuffer._buffer,
-        &_vertexBuffer._allocation,
-        nullptr));
+        quantized.uv[0] = glm::packHalf1x16(vertex.uv.x);
+        quantized.uv[1] = glm::packHalf1x16(vertex.uv.y);
+    }
+}
 
-    vkupload::immediate_submit([=](VkCommandBuffer cmd)
-        {
-            VkBufferCopy copy;
-            copy.dstOffset = 0;
-            copy.srcOffset = 0;
-            copy.size = bufferSize;
+static glm::vec3 decode_octahedral(glm::vec2 octahedral)
+{
+    glm::vec3 normal(octahedral.x, octahedral.y, 1.0f - glm::abs(octahedral.x) - glm::abs(octahedral.y));
+    if(normal.z < 0.0f)
+    {
+        glm::vec2 signs(normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f);
+        glm::vec2 folded = (glm::vec2(1.0f) - glm::abs(glm::vec2(normal.y, normal.x))) * signs;
+        normal.x = folded.x;
+        normal.y = folded.y;
+    }
 
-            vkCmdCopyBuffer(cmd, stagingBuffer._buffer, _vertexBuffer._buffer, 1, &copy);
-        });
-    
-    RenderEngine::_mainDeletionQueue.push_function([=]() {
-        vmaDestroyBuffer(RenderEngine::_allocator, _vertexBuffer._buffer, _vertexBuffer._allocation);
-        });
-        
-    vmaDestroyBuffer(RenderEngine::_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+    float length = glm::length(normal);
+    return length > 0.0f ? normal / length : glm::vec3(0.0f);
 }
 
-void Mesh::create_index_buffer()
+void vkutil::dequantize_vertices(const QuantizedVertex* vertices, size_t count, const glm::vec4& dequantization, Vertex* outVertices)
 {
-    const size_t bufferSize = _indices.size() * sizeof(uint32_t);
+    const glm::vec3 offset = glm::vec3(dequantization);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        const QuantizedVertex& quantized = vertices[i];
+        Vertex& vertex = outVertices[i];
+
+        glm::vec3 position(glm::unpackSnorm1x16(static_cast<uint16_t>(quantized.position[0])),
+            glm::unpackSnorm1x16(static_cast<uint16_t>(quantized.position[1])),
+            glm::unpackSnorm1x16(static_cast<uint16_t>(quantized.position[2])));
+        vertex.position = position * dequantization.w + offset;
+
+        vertex.normal = decode_octahedral(glm::vec2(glm::unpackSnorm1x16(static_cast<uint16_t>(quantized.normal[0])),
+            glm::unpackSnorm1x16(static_cast<uint16_t>(quantized.normal[1]))));
+        vertex.color = glm::vec3(0.0f);
+        vertex.uv = glm::vec2(glm::unpackHalf1x16(quantized.uv[0]), glm::unpackHalf1x16(quantized.uv[1]));
+    }
+}
 
-    VkBufferCreateInfo stagingBufferInfo = {};
-    stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    stagingBufferInfo.pNext = nullptr;
-    stagingBufferInfo.size = bufferSize;
-    stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+glm::mat4 Primitive::get_dequantization_matrix() const
+{
+    if(!is_quantized())
+    {
+        return glm::mat4(1.0f);
+    }
 
-    VmaAllocationCreateInfo vmaAllocInfo = {};
-    vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    return glm::translate(glm::vec3(dequantization)) * glm::scale(glm::vec3(dequantization.w));
+}
 
-    AllocatedBuffer stagingBuffer;
+using namespace VKE;
 
-    VK_CHECK(vmaCreateBuffer(RenderEngine::_allocator, &stagingBufferInfo, &vmaAllocInfo,
-        &stagingBuffer._buffer,
-        &stagingBuffer._allocation,
-        nullptr));
+Mesh::Mesh()
+{
+}
 
-    void* data;
-    vmaMapMemory(RenderEngine::_allocator, stagingBuffer._allocation, &data);
-    memcpy(data, _indices.data(), _indices.size() * sizeof(uint32_t));
-    vmaUnmapMemory(RenderEngine::_allocator, stagingBuffer._allocation);
+VKE::Mesh::~Mesh()
+{
+}
 
-    VkBufferCreateInfo indexBufferInfo = {};
-    indexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    indexBufferInfo.pNext = nullptr;
-    indexBufferInfo.size = bufferSize;
-    indexBufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-        | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+void Mesh::upload_to_gpu()
+{
+    if(_vertices.size() > 0 && _indices.size() > 0)
+    {
+        create_vertex_buffer();
+        create_index_buffer();
+    }
+    else
+    {
+        std::cout << "Failed tu upload mesh to the gpu!" << std::endl;
+    }
+}
 
-    vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+void Mesh::create_vertex_buffer()
+{
+    const size_t bufferSize = _vertices.size() * sizeof(Vertex);
 
-    VK_CHECK(vmaCreateBuffer(RenderEngine::_allocator, &indexBufferInfo, &vmaAllocInfo,
-        &_indexBuffer._buffer,
-        &_indexBuffer._allocation,
-        nullptr));
+    // Aligned to the vertex size so the draws can address the vertices from the start of the arena
+    if(!RenderEngine::_vertexArena.allocate(bufferSize, sizeof(Vertex), _vertexRange))
+    {
+        return;
+    }
 
-    vkupload::immediate_submit([=](VkCommandBuffer cmd)
-        {
-            VkBufferCopy copy;
-            copy.dstOffset = 0;
-            copy.srcOffset = 0;
-            copy.size = bufferSize;
+    RenderEngine::_uploadBatcher.upload_buffer(RenderEngine::_vertexArena.get_buffer(), _vertexRange.offset, _vertices.data(), bufferSize);
+}
 
-            vkCmdCopyBuffer(cmd, stagingBuffer._buffer, _indexBuffer._buffer, 1, &copy);
-        });
+void Mesh::create_index_buffer()
+{
+    _indexType = vkutil::select_index_type(static_cast<uint32_t>(_vertices.size()));
+    const size_t bufferSize = _indices.size() * vkutil::get_index_size(_indexType);
 
-    RenderEngine::_mainDeletionQueue.push_function([=]() {
-            vmaDestroyBuffer(RenderEngine::_allocator, _indexBuffer._buffer, _indexBuffer._allocation);
-        });
+    if(!RenderEngine::_indexArena.allocate(bufferSize, sizeof(uint32_t), _indexRange))
+    {
+        return;
+    }
 
-    vmaDestroyBuffer(RenderEngine::_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+    if(_indexType == VK_INDEX_TYPE_UINT16)
+    {
+        std::vector<uint16_t> shortIndices(_indices.begin(), _indices.end());
+        RenderEngine::_uploadBatcher.upload_buffer(RenderEngine::_indexArena.get_buffer(), _indexRange.offset, shortIndices.data(), bufferSize);
+    }
+    else
+    {
+        RenderEngine::_uploadBatcher.upload_buffer(RenderEngine::_indexArena.get_buffer(), _indexRange.offset, _indices.data(), bufferSize);
+    }
 }
 
 void Mesh::destroy_buffers()
 {
-    vmaDestroyBuffer(RenderEngine::_allocator, _indexBuffer._buffer, _indexBuffer._allocation);
-    vmaDestroyBuffer(RenderEngine::_allocator, _vertexBuffer._buffer, _indexBuffer._allocation);
+    RenderEngine::_vertexArena.free(_vertexRange);
+    RenderEngine::_indexArena.free(_indexRange);
+    _vertexRange = GeometryRange{};
+    _indexRange = GeometryRange{};
+}
+
+int32_t Mesh::get_vertex_offset() const
+{
+    return static_cast<int32_t>(_vertexRange.offset / sizeof(Vertex));
+}
+
+uint32_t Mesh::get_first_index() const
+{
+    return static_cast<uint32_t>(_indexRange.offset / vkutil::get_index_size(_indexType));
 }
 
 void Mesh::create_quad()
@@ -292,17 +426,13 @@ void Mesh::create_cube()
 Mesh* VKE::Mesh::get(const char* name)
 {
     assert(name);
-    std::map<std::string, VKE::Mesh*>::iterator it = sMeshesLoaded.find(name);
-    if (it != sMeshesLoaded.end())
-        return it->second;
-    return nullptr;
-    
+    return sMeshesLoaded.find(name);
 }
 
 void VKE::Mesh::register_mesh(const char* name)
 {
     _name = name;
-    sMeshesLoaded[name] = this;
+    sMeshesLoaded.insert(_name, this);
 }
 
 void Primitive::primitive_to_vulkan_geometry(VkDeviceOrHostAddressConstKHR& vertexBufferDeviceAddress, VkDeviceOrHostAddressConstKHR& indexBufferDeviceAddress, std::vector<BlasInput>& inputVector)
@@ -317,11 +447,12 @@ void Primitive::primitive_to_vulkan_geometry(VkDeviceOrHostAddressConstKHR& vert
     accelerationStructureGeometry.flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR; // TODO: aserlo bien
     accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
     accelerationStructureGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-    accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    // Quantized positions are built as they are, the TLAS instance transform applies the dequantization
+    accelerationStructureGeometry.geometry.triangles.vertexFormat = is_quantized() ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
     accelerationStructureGeometry.geometry.triangles.vertexData = vertexBufferDeviceAddress;
     accelerationStructureGeometry.geometry.triangles.maxVertex = vertexCount;
-    accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(Vertex);
-    accelerationStructureGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+    accelerationStructureGeometry.geometry.triangles.vertexStride = is_quantized() ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    accelerationStructureGeometry.geometry.triangles.indexType = indexType;
     accelerationStructureGeometry.geometry.triangles.indexData = indexBufferDeviceAddress;
     // Warning: RIP transform matrix information
 
@@ -333,28 +464,62 @@ void Primitive::primitive_to_vulkan_geometry(VkDeviceOrHostAddressConstKHR& vert
     accelerationStructureBuildGeometryInfo.geometryCount = 1;
     accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
 
-    const uint32_t numTriangles = indexCount / 3;
-    VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo{};
-    accelerationStructureBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-    vkGetAccelerationStructureBuildSizesKHR(
-        RenderEngine::_device,
-        VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-        &accelerationStructureBuildGeometryInfo,
-        &numTriangles,
-        &accelerationStructureBuildSizesInfo);
-    
-    VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
-    accelerationStructureBuildRangeInfo.primitiveCount = numTriangles;
-    accelerationStructureBuildRangeInfo.primitiveOffset = firstIndex * sizeof(uint32_t);
-    accelerationStructureBuildRangeInfo.firstVertex = 0;
-    accelerationStructureBuildRangeInfo.transformOffset = 0;
-
-    input._accelerationStructureGeometry = accelerationStructureGeometry;
-    input._accelerationStructureBuildGeometryInfo = accelerationStructureBuildGeometryInfo;
-    input._accelerationStructureBuildSizesInfo = accelerationStructureBuildSizesInfo;
-    input._accelerationStructureBuildRangeInfo = accelerationStructureBuildRangeInfo;
-
-    inputVector.push_back(input);
+    // Every level gets its own BLAS over its index range, the TLAS instance of the primitive picks one each frame
+    for(uint32_t level = 0; level <= lods.size(); level++)
+    {
+        const uint32_t numTriangles = get_lod_index_count(level) / 3;
+        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo{};
+        accelerationStructureBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(
+            RenderEngine::_device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &accelerationStructureBuildGeometryInfo,
+            &numTriangles,
+            &accelerationStructureBuildSizesInfo);
+
+        VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
+        accelerationStructureBuildRangeInfo.primitiveCount = numTriangles;
+        accelerationStructureBuildRangeInfo.primitiveOffset = get_lod_first_index(level) * get_index_size();
+        accelerationStructureBuildRangeInfo.firstVertex = firstVertex;
+        accelerationStructureBuildRangeInfo.transformOffset = 0;
+
+        input._accelerationStructureGeometry = accelerationStructureGeometry;
+        input._accelerationStructureBuildGeometryInfo = accelerationStructureBuildGeometryInfo;
+        input._accelerationStructureBuildSizesInfo = accelerationStructureBuildSizesInfo;
+        input._accelerationStructureBuildRangeInfo = accelerationStructureBuildRangeInfo;
+
+        inputVector.push_back(input);
+    }
+}
+
+uint32_t Primitive::select_lod(const glm::mat4& model, const LodSelector* selector) const
+{
+    if(!selector || lods.empty())
+    {
+        return 0;
+    }
+    if(selector->coarsest)
+    {
+        return static_cast<uint32_t>(lods.size());
+    }
+    if(selector->pixelsPerUnit <= 0.0f)
+    {
+        return 0;
+    }
+
+    // Quantized primitives are centered on their dequantization offset, the others are measured from their origin
+    const glm::vec3 center = glm::vec3(model * glm::vec4(is_quantized() ? glm::vec3(dequantization) : glm::vec3(0.0f), 1.0f));
+    const float distance = glm::max(glm::length(center - selector->cameraPosition), 0.0001f);
+    const float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    const float pixelsPerError = scale * selector->pixelsPerUnit / distance;
+
+    // The errors grow along the chain, so the first level over the limit ends the search
+    uint32_t level = 0;
+    while(level < lods.size() && lods[level].error * pixelsPerError <= selector->maxPixelError)
+    {
+        level++;
+    }
+    return level;
 }
 
 
@@ -367,72 +532,46 @@ bool vkutil::load_meshes_from_obj(const std::string* filename, const std::string
 {
     assert(filename);
 
-    //VKE::Mesh* mesh = new VKE::Mesh();
-    //mesh->load_from_obj(filename->c_str());
-    //mesh->upload_to_gpu();
-    //return mesh;
-
-    tinyobj::attrib_t attrib;
-
-    std::vector<tinyobj::shape_t> shapes;
-
-    std::vector<tinyobj::material_t> materials;
+    std::vector<ObjShapeData> shapes;
+    if (!vkobj::parse_obj(*filename, shapes))
+    {
+        return false;
+    }
 
-    std::string warn;
-    std::string err;
+    // Shapes are optimized independently, the reports are summed once they are all done.
+    // The LOD chain of every shape is appended to its indices.
+    std::vector<MeshOptimizationReport> reports(shapes.size());
+    std::vector<std::vector<PrimitiveLod>> lods(shapes.size());
+    vkjobs::parallel_for(shapes.size(), [&shapes, &reports, &lods](size_t index) {
+        ObjShapeData& shape = shapes[index];
+        reports[index] = vkmeshopt::optimize_mesh(shape.vertices.data(), shape.vertices.size(), shape.indices.data(), shape.indices.size());
 
-    tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename->c_str(), nullptr);
+        std::vector<std::vector<uint32_t>> levels;
+        std::vector<float> errors;
+        vkmeshopt::build_lod_chain(shape.indices.data(), shape.indices.size(), shape.vertices.data(), shape.vertices.size(),
+            vkmeshopt::get_lod_targets(static_cast<uint32_t>(shape.indices.size())), levels, errors);
 
-    if (!warn.empty())
-    {
-        std::cout << "WARN: " << warn << std::endl;
-    }
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            lods[index].push_back(PrimitiveLod{ static_cast<uint32_t>(shape.indices.size()), static_cast<uint32_t>(levels[level].size()), errors[level] });
+            shape.indices.insert(shape.indices.end(), levels[level].begin(), levels[level].end());
+        }
+    });
 
-    if (!err.empty())
+    MeshOptimizationReport optimization;
+    for (const MeshOptimizationReport& report : reports)
     {
-        std::cerr << err << std::endl;
-        return false;
+        optimization.add(report);
     }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+    optimization.print(*filename);
 
     int i = 0;
-    for (const auto& shape : shapes)
+    for (ObjShapeData& shape : shapes)
     {
-        uniqueVertices.clear();
         VKE::Mesh* mesh = new VKE::Mesh();
-
-        for (const auto& index : shape.mesh.indices)
-        {
-            Vertex vertex{};
-
-            vertex.position = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
-
-            vertex.normal = {
-                attrib.normals[3 * index.normal_index + 0],
-                attrib.normals[3 * index.normal_index + 1],
-                attrib.normals[3 * index.normal_index + 2]
-            };
-
-            vertex.uv = {
-                attrib.texcoords[2 * index.texcoord_index + 0],
-                1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-            };
-
-            vertex.color = { 1.0f, 1.0f, 1.0f };
-
-            if (uniqueVertices.count(vertex) == 0)
-            {
-                uniqueVertices[vertex] = static_cast<uint32_t>(mesh->_vertices.size());
-                mesh->_vertices.push_back(vertex);
-            }
-
-            mesh->_indices.push_back(uniqueVertices[vertex]);
-        }
+        mesh->_vertices = std::move(shape.vertices);
+        mesh->_indices = std::move(shape.indices);
+        mesh->_lods = std::move(lods[i]);
 
         mesh->register_mesh((*customName + std::to_string(i)).c_str());
         mesh->upload_to_gpu();
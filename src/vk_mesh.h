@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vk_types.h>
+#include "vk_registry.h"
+#include "vk_geometry_arena.h"
 #include <vector>
 #include <map>
 
@@ -20,6 +22,8 @@ struct VertexInputDescription {
 };
 
 
+// Shared by the raster pipelines and the hit shaders, which read it with scalar block layout.
+// Keep it in sync with Vertex in shaders/shaderCommon.h
 struct Vertex {
 
 	glm::vec3 position;
@@ -30,30 +34,60 @@ struct Vertex {
 	static VertexInputDescription get_vertex_description(bool onlyPosition = false);
 	
 	bool operator==(const Vertex& other) const {
-		return position == other.position && normal == other.normal && uv == other.uv;
+		return position == other.position && normal == other.normal && color == other.color && uv == other.uv;
 	}
 };
 
-struct rtVertex {
-	glm::vec4 position;
-	glm::vec4 normal;
-	glm::vec4 uv;
+enum VertexFormat {
+	VERTEX_FORMAT_FULL,
+	VERTEX_FORMAT_QUANTIZED
+};
 
-	bool operator==(const rtVertex& other) const {
-		return position == other.position && normal == other.normal && uv == other.uv;
-	}
+// Compact version of Vertex: 16 bit normalized position, octahedral encoded normal and half float uv.
+// The position is decoded with the dequantization of the primitive that owns it and the color is dropped.
+// Keep it in sync with QuantizedVertex in shaders/shaderCommon.h
+struct QuantizedVertex {
+
+	int16_t position[4]; // w is padding
+	int16_t normal[2];
+	uint16_t uv[2];
+
+	static VertexInputDescription get_vertex_description(bool onlyPosition = false);
 };
 
+namespace vkutil
+{
+	// Mixes every component of the vertex, used to weld duplicated vertices
+	uint64_t hash_vertex(const Vertex& vertex);
+
+	// 16 bit indices for the primitives whose vertices they can all address, indices are relative to the first vertex
+	VkIndexType select_index_type(uint32_t vertexCount);
+	uint32_t get_index_size(VkIndexType indexType);
+}
+
 namespace std {
 	template<> struct hash<Vertex> {
 		size_t operator()(Vertex const& vertex) const {
-			return ((hash<glm::vec3>()(vertex.position) ^
-				(hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.uv) << 1);
+			return static_cast<size_t>(vkutil::hash_vertex(vertex));
 		}
 	};
 }
 
+// Coarser version of a primitive, a range of indices of the same type over the same vertices
+struct PrimitiveLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // in the units of the primitive's vertices, before any dequantization
+};
+
+// Picks the coarsest level of a primitive whose error stays under maxPixelError once projected on screen
+struct LodSelector {
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	float pixelsPerUnit = 0.0f; // on screen, of a unit at a distance of one. 0 keeps the full detail
+	float maxPixelError = 1.0f;
+	bool coarsest = false; // shadow proxy of a prefab an impostor replaces, the coarsest level whatever its error
+};
+
 struct Primitive {
 	uint32_t firstVertex;
 	uint32_t firstIndex;
@@ -61,18 +95,38 @@ struct Primitive {
 	uint32_t vertexCount;
 	VKE::Material& material;
 	bool hasIndices;
+	glm::vec4 dequantization; // xyz offset, w scale. w is 0 when the vertices are not quantized
+	// Indices are relative to firstVertex and firstIndex counts indices of this type from the start of the buffer
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	std::vector<PrimitiveLod> lods; // levels after the full detail one, the coarsest last
 
-	Primitive(uint32_t firstVertex, uint32_t firstIndex, uint32_t indexCount, uint32_t vertexCount, VKE::Material& material) : firstIndex(firstIndex), indexCount(indexCount), vertexCount(vertexCount), material(material) {
+	Primitive(uint32_t firstVertex, uint32_t firstIndex, uint32_t indexCount, uint32_t vertexCount, VKE::Material& material) : firstVertex(firstVertex), firstIndex(firstIndex), indexCount(indexCount), vertexCount(vertexCount), material(material), dequantization(0.0f) {
 		hasIndices = indexCount > 0;
 	};
 
+	bool is_quantized() const { return dequantization.w != 0.0f; }
+
+	uint32_t get_index_size() const { return vkutil::get_index_size(indexType); }
+
+	// 0 is the full detail, level l > 0 is lods[l - 1]. Without a selector the full detail is kept.
+	uint32_t select_lod(const glm::mat4& model, const LodSelector* selector) const;
+	uint32_t get_lod_first_index(uint32_t level) const { return level == 0 ? firstIndex : lods[level - 1].firstIndex; }
+	uint32_t get_lod_index_count(uint32_t level) const { return level == 0 ? indexCount : lods[level - 1].indexCount; }
+
+	// Takes the quantized positions to the primitive local space, identity for full precision vertices
+	glm::mat4 get_dequantization_matrix() const;
+
+	// One input per level, the full detail first
 	void primitive_to_vulkan_geometry(VkDeviceOrHostAddressConstKHR& vertexBufferDeviceAddress, VkDeviceOrHostAddressConstKHR& indexBufferDeviceAddress, std::vector<BlasInput>& input);
 
 	void draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout);
 };
 
+// First index and vertex count from the start of the geometry arenas, they would not fit in a float
 struct PrimitiveToShader {
-	glm::vec4 firstIdx_rndIdx_matIdx_transIdx;
+	glm::uvec4 firstIdx_rndIdx_matIdx_transIdx;
+	glm::vec4 dequantization;
+	glm::uvec4 firstVtx_idxSize; // zw unused
 };
 
 namespace VKE
@@ -81,15 +135,18 @@ namespace VKE
 	{
 	public:
 		std::string _name;
-		static std::map<std::string, Mesh*> sMeshesLoaded;
+		static ResourceRegistry<Mesh> sMeshesLoaded;
 		Mesh();
 		~Mesh();
 
 		std::vector<Vertex> _vertices;
 		std::vector<uint32_t> _indices;
+		std::vector<PrimitiveLod> _lods; // ranges of _indices after the full detail ones
 
-		AllocatedBuffer _vertexBuffer;
-		AllocatedBuffer _indexBuffer;
+		// In the geometry arenas of the render engine
+		GeometryRange _vertexRange;
+		GeometryRange _indexRange;
+		VkIndexType _indexType = VK_INDEX_TYPE_UINT32; // of _indexRange, _indices are always 32 bit
 
 		std::vector<Primitive*> _primitives;
 
@@ -100,6 +157,10 @@ namespace VKE
 
 		void destroy_buffers();
 
+		// Where the ranges start in the arenas, in vertices and in indices of _indexType
+		int32_t get_vertex_offset() const;
+		uint32_t get_first_index() const;
+
 		void create_quad();
 
 		void create_cube();
@@ -113,6 +174,16 @@ namespace VKE
 namespace vkutil
 {
 	bool load_meshes_from_obj(const std::string* filename, const std::string* customName);
+
+	size_t get_vertex_size(VertexFormat format);
+
+	// Offset and uniform scale that fit the positions of the given vertices in the [-1, 1] cube
+	glm::vec4 compute_dequantization(const Vertex* vertices, size_t count);
+
+	void quantize_vertices(const Vertex* vertices, size_t count, const glm::vec4& dequantization, QuantizedVertex* outVertices);
+
+	// Back to full precision for devices without the quantized pipelines, the colors are black as in a glTF without them
+	void dequantize_vertices(const QuantizedVertex* vertices, size_t count, const glm::vec4& dequantization, Vertex* outVertices);
 }
 
 
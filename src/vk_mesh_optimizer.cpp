@@ -0,0 +1,373 @@
+#include "vk_mesh_optimizer.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+namespace
+{
+	// Triangles using every vertex, packed in one list
+	struct VertexAdjacency
+	{
+		std::vector<uint32_t> counts;
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		VertexAdjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+			: counts(vertexCount, 0), offsets(vertexCount, 0), triangles(indexCount)
+		{
+			for (size_t i = 0; i < indexCount; i++)
+			{
+				counts[indices[i]]++;
+			}
+
+			uint32_t offset = 0;
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				offsets[v] = offset;
+				offset += counts[v];
+			}
+
+			std::vector<uint32_t> filled(vertexCount, 0);
+			for (size_t i = 0; i < indexCount; i++)
+			{
+				uint32_t vertex = indices[i];
+				triangles[offsets[vertex] + filled[vertex]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+
+	// FIFO cache simulated with timestamps, a vertex is still cached while less than cacheSize vertices went in after it
+	struct VertexCache
+	{
+		std::vector<uint32_t> times;
+		uint32_t timestamp;
+		uint32_t size;
+
+		VertexCache(size_t vertexCount, uint32_t cacheSize) : times(vertexCount, 0), timestamp(cacheSize + 1), size(cacheSize) {}
+
+		// Returns whether the vertex had to be transformed
+		bool use(uint32_t vertex)
+		{
+			if (timestamp - times[vertex] > size)
+			{
+				times[vertex] = timestamp++;
+				return true;
+			}
+			return false;
+		}
+
+		void flush()
+		{
+			timestamp += size + 1;
+		}
+	};
+
+	bool is_valid(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		if (indexCount % 3 != 0) return false;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			if (indices[i] >= vertexCount) return false;
+		}
+		return true;
+	}
+
+	float get_cluster_sort_key(const uint32_t* indices, uint32_t firstTriangle, uint32_t endTriangle, const Vertex* vertices, const glm::vec3& meshCentroid)
+	{
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+
+		for (uint32_t t = firstTriangle; t < endTriangle; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+
+			glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+			float triangleArea = glm::length(cross);
+
+			centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+			normal += cross;
+			area += triangleArea;
+		}
+
+		float normalLength = glm::length(normal);
+		if (area <= 0.0f || normalLength <= 0.0f)
+		{
+			return 0.0f;
+		}
+
+		return glm::dot(centroid / area - meshCentroid, normal / normalLength);
+	}
+}
+
+float VertexCacheStatistics::get_acmr() const
+{
+	return triangles > 0 ? static_cast<float>(transformedVertices) / triangles : 0.0f;
+}
+
+float VertexCacheStatistics::get_atvr() const
+{
+	return vertices > 0 ? static_cast<float>(transformedVertices) / vertices : 0.0f;
+}
+
+void VertexCacheStatistics::add(const VertexCacheStatistics& other)
+{
+	transformedVertices += other.transformedVertices;
+	triangles += other.triangles;
+	vertices += other.vertices;
+}
+
+void MeshOptimizationReport::add(const MeshOptimizationReport& other)
+{
+	before.add(other.before);
+	after.add(other.after);
+}
+
+void MeshOptimizationReport::print(const std::string& name) const
+{
+	if (before.triangles == 0)
+	{
+		return;
+	}
+
+	std::cout << std::fixed << std::setprecision(3) << "Optimized " << name << " (" << before.triangles << " triangles): ACMR "
+		<< before.get_acmr() << " -> " << after.get_acmr() << ", ATVR " << before.get_atvr() << " -> " << after.get_atvr()
+		<< std::defaultfloat << std::endl;
+}
+
+VertexCacheStatistics vkmeshopt::analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStatistics statistics;
+	statistics.triangles = indexCount / 3;
+	statistics.vertices = vertexCount;
+
+	VertexCache cache(vertexCount, cacheSize);
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		if (cache.use(indices[i]))
+		{
+			statistics.transformedVertices++;
+		}
+	}
+
+	return statistics;
+}
+
+void vkmeshopt::optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* outClusters, uint32_t cacheSize)
+{
+	if (outClusters)
+	{
+		outClusters->clear();
+	}
+	if (indexCount == 0 || vertexCount == 0)
+	{
+		return;
+	}
+
+	VertexAdjacency adjacency(indices, indexCount, vertexCount);
+	std::vector<uint32_t> liveTriangles = adjacency.counts;
+	std::vector<bool> emitted(indexCount / 3, false);
+	VertexCache cache(vertexCount, cacheSize);
+
+	std::vector<uint32_t> result;
+	result.reserve(indexCount);
+
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	uint32_t cursor = 0;
+
+	// Vertices that still have triangles, the recently used ones first
+	auto skip_dead_end = [&]() -> int64_t {
+		while (!deadEnds.empty())
+		{
+			uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0) return vertex;
+		}
+		while (cursor < vertexCount)
+		{
+			if (liveTriangles[cursor] > 0) return cursor;
+			cursor++;
+		}
+		return -1;
+	};
+
+	int64_t fanning = skip_dead_end();
+	while (fanning >= 0)
+	{
+		if (outClusters)
+		{
+			outClusters->push_back(static_cast<uint32_t>(result.size() / 3));
+		}
+
+		// Emit the fan of the vertex and continue with the candidate that stays in the cache the longest
+		while (fanning >= 0)
+		{
+			candidates.clear();
+
+			const uint32_t vertex = static_cast<uint32_t>(fanning);
+			for (uint32_t a = 0; a < adjacency.counts[vertex]; a++)
+			{
+				uint32_t triangle = adjacency.triangles[adjacency.offsets[vertex] + a];
+				if (emitted[triangle]) continue;
+
+				for (int k = 0; k < 3; k++)
+				{
+					uint32_t corner = indices[triangle * 3 + k];
+					result.push_back(corner);
+					deadEnds.push_back(corner);
+					candidates.push_back(corner);
+					liveTriangles[corner]--;
+					cache.use(corner);
+				}
+				emitted[triangle] = true;
+			}
+
+			int64_t best = -1;
+			int64_t bestPriority = -1;
+			for (uint32_t candidate : candidates)
+			{
+				if (liveTriangles[candidate] == 0) continue;
+
+				// A candidate whose fan would push its own vertices out of the cache is not worth more than any other
+				int64_t age = cache.timestamp - cache.times[candidate];
+				int64_t priority = age + 2 * liveTriangles[candidate] <= cacheSize ? age : 0;
+				if (priority > bestPriority)
+				{
+					best = candidate;
+					bestPriority = priority;
+				}
+			}
+			fanning = best;
+		}
+
+		fanning = skip_dead_end();
+	}
+
+	std::copy(result.begin(), result.end(), indices);
+}
+
+void vkmeshopt::optimize_overdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+	const std::vector<uint32_t>& clusters, float threshold, uint32_t cacheSize)
+{
+	const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	if (triangleCount == 0 || clusters.empty())
+	{
+		return;
+	}
+
+	const float targetAcmr = analyze_vertex_cache(indices, indexCount, vertexCount, cacheSize).get_acmr() * threshold;
+
+	// Cut the clusters where the cache has already amortized the cold start, each one restarts with an empty cache
+	// so reordering them costs at most the threshold
+	std::vector<uint32_t> boundaries;
+	VertexCache cache(vertexCount, cacheSize);
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		const uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+		uint32_t clusterStart = clusters[c];
+		uint32_t transformed = 0;
+		boundaries.push_back(clusterStart);
+		cache.flush();
+
+		for (uint32_t t = clusters[c]; t < end; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				transformed += cache.use(indices[t * 3 + k]) ? 1 : 0;
+			}
+
+			if (t + 1 < end && static_cast<float>(transformed) / (t + 1 - clusterStart) <= targetAcmr)
+			{
+				clusterStart = t + 1;
+				transformed = 0;
+				boundaries.push_back(clusterStart);
+				cache.flush();
+			}
+		}
+	}
+
+	glm::vec3 meshCentroid(0.0f);
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		meshCentroid += vertices[indices[i]].position;
+	}
+	meshCentroid /= static_cast<float>(indexCount);
+
+	std::vector<float> keys(boundaries.size());
+	std::vector<uint32_t> order(boundaries.size());
+	for (size_t c = 0; c < boundaries.size(); c++)
+	{
+		const uint32_t end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+		keys[c] = get_cluster_sort_key(indices, boundaries[c], end, vertices, meshCentroid);
+		order[c] = static_cast<uint32_t>(c);
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) {
+		return keys[a] > keys[b];
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(indexCount);
+	for (uint32_t c : order)
+	{
+		const uint32_t end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+		result.insert(result.end(), indices + boundaries[c] * 3, indices + end * 3);
+	}
+
+	std::copy(result.begin(), result.end(), indices);
+}
+
+void vkmeshopt::optimize_vertex_fetch(Vertex* vertices, size_t vertexCount, uint32_t* indices, size_t indexCount)
+{
+	const uint32_t UNUSED = 0xFFFFFFFF;
+	std::vector<uint32_t> remap(vertexCount, UNUSED);
+
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t& target = remap[indices[i]];
+		if (target == UNUSED)
+		{
+			target = next++;
+		}
+		indices[i] = target;
+	}
+
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] == UNUSED)
+		{
+			remap[v] = next++;
+		}
+	}
+
+	std::vector<Vertex> source(vertices, vertices + vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		vertices[remap[v]] = source[v];
+	}
+}
+
+MeshOptimizationReport vkmeshopt::optimize_mesh(Vertex* vertices, size_t vertexCount, uint32_t* indices, size_t indexCount)
+{
+	MeshOptimizationReport report;
+	if (!is_valid(indices, indexCount, vertexCount))
+	{
+		return report;
+	}
+
+	report.before = analyze_vertex_cache(indices, indexCount, vertexCount);
+
+	std::vector<uint32_t> clusters;
+	optimize_vertex_cache(indices, indexCount, vertexCount, &clusters);
+	optimize_overdraw(indices, indexCount, vertices, vertexCount, clusters);
+	optimize_vertex_fetch(vertices, vertexCount, indices, indexCount);
+
+	report.after = analyze_vertex_cache(indices, indexCount, vertexCount);
+	return report;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "vk_mesh.h"
+#include <string>
+#include <vector>
+
+// Post-transform vertex cache behaviour of an index list, measured on a FIFO cache
+struct VertexCacheStatistics
+{
+	uint64_t transformedVertices = 0;
+	uint64_t triangles = 0;
+	uint64_t vertices = 0;
+
+	// Vertices transformed per triangle, 0.5 at best and 3 at worst
+	float get_acmr() const;
+	// Vertices transformed per vertex of the mesh, 1 at best
+	float get_atvr() const;
+
+	void add(const VertexCacheStatistics& other);
+};
+
+struct MeshOptimizationReport
+{
+	VertexCacheStatistics before;
+	VertexCacheStatistics after;
+
+	void add(const MeshOptimizationReport& other);
+	void print(const std::string& name) const;
+};
+
+// Import time reordering of triangle lists. Nothing changes the geometry, only the order in which the triangles
+// and the vertices are stored.
+namespace vkmeshopt {
+
+	const uint32_t DEFAULT_CACHE_SIZE = 16;
+
+	VertexCacheStatistics analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	// Tipsify triangle order. outClusters gets the first triangle of every fan that did not continue from the
+	// previous one, the order is already broken there so those runs can be reordered for overdraw.
+	void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* outClusters = nullptr,
+		uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	// Splits the clusters further while their ACMR stays within threshold of the whole list and sorts them so the
+	// ones facing outwards are drawn first, which occludes the inner ones from most points of view
+	void optimize_overdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+		const std::vector<uint32_t>& clusters, float threshold = 1.05f, uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	// Reorders the vertices in the order the indices first use them, unreferenced vertices are moved to the end
+	void optimize_vertex_fetch(Vertex* vertices, size_t vertexCount, uint32_t* indices, size_t indexCount);
+
+	// The three passes above in order, triangle lists only
+	MeshOptimizationReport optimize_mesh(Vertex* vertices, size_t vertexCount, uint32_t* indices, size_t indexCount);
+}
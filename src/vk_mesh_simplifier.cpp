@@ -0,0 +1,390 @@
+#include "vk_mesh_simplifier.h"
+#include "vk_mesh_optimizer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+namespace
+{
+	LodSettings lodSettings;
+
+	// Sum of squared distances to a set of planes, weighted by the area of the triangles they come from
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		double a11 = 0, a12 = 0, a13 = 0;
+		double a22 = 0, a23 = 0;
+		double a33 = 0;
+		double weight = 0;
+
+		void add_plane(const glm::vec3& normal, float distance, float area)
+		{
+			const double x = normal.x, y = normal.y, z = normal.z, d = distance;
+			a00 += x * x * area; a01 += x * y * area; a02 += x * z * area; a03 += x * d * area;
+			a11 += y * y * area; a12 += y * z * area; a13 += y * d * area;
+			a22 += z * z * area; a23 += z * d * area;
+			a33 += d * d * area;
+			weight += area;
+		}
+
+		void add(const Quadric& other)
+		{
+			a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+			a11 += other.a11; a12 += other.a12; a13 += other.a13;
+			a22 += other.a22; a23 += other.a23;
+			a33 += other.a33;
+			weight += other.weight;
+		}
+
+		// Root mean square distance of the point to the planes
+		float get_error(const glm::vec3& p) const
+		{
+			if (weight <= 0.0)
+			{
+				return 0.0f;
+			}
+
+			const double x = p.x, y = p.y, z = p.z;
+			double sum = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + 2.0 * a03 * x
+				+ a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y
+				+ a22 * z * z + 2.0 * a23 * z
+				+ a33;
+			return static_cast<float>(std::sqrt(std::fabs(sum) / weight));
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		float error;
+	};
+
+	// Triangles of the current list using every vertex
+	struct TriangleAdjacency
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		void build(const std::vector<uint32_t>& indices, size_t vertexCount)
+		{
+			offsets.assign(vertexCount + 1, 0);
+			for (uint32_t index : indices)
+			{
+				offsets[index + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				offsets[v + 1] += offsets[v];
+			}
+
+			triangles.resize(indices.size());
+			std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				triangles[filled[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+	};
+
+	bool is_less(const glm::vec3& a, const glm::vec3& b)
+	{
+		if (a.x != b.x) return a.x < b.x;
+		if (a.y != b.y) return a.y < b.y;
+		return a.z < b.z;
+	}
+
+	// Vertices sharing their position with another one sit on a seam, vertices of edges that do not have exactly two
+	// triangles sit on a border. Neither can move without tearing the surface or sliding its UVs.
+	std::vector<bool> find_locked_vertices(const uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount)
+	{
+		std::vector<bool> locked(vertexCount, false);
+
+		std::vector<uint32_t> order(vertexCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [vertices](uint32_t a, uint32_t b) {
+			return is_less(vertices[a].position, vertices[b].position);
+		});
+
+		std::vector<uint32_t> canonical(vertexCount);
+		for (size_t begin = 0; begin < vertexCount;)
+		{
+			size_t end = begin + 1;
+			while (end < vertexCount && vertices[order[end]].position == vertices[order[begin]].position)
+			{
+				end++;
+			}
+			for (size_t i = begin; i < end; i++)
+			{
+				canonical[order[i]] = order[begin];
+				locked[order[i]] = end - begin > 1;
+			}
+			begin = end;
+		}
+
+		std::vector<uint64_t> edges;
+		edges.reserve(indexCount);
+		for (size_t t = 0; t + 2 < indexCount; t += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				uint64_t a = canonical[indices[t + e]];
+				uint64_t b = canonical[indices[t + (e + 1) % 3]];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		for (size_t begin = 0; begin < edges.size();)
+		{
+			size_t end = begin + 1;
+			while (end < edges.size() && edges[end] == edges[begin])
+			{
+				end++;
+			}
+			if (end - begin != 2)
+			{
+				locked[static_cast<uint32_t>(edges[begin] >> 32)] = true;
+				locked[static_cast<uint32_t>(edges[begin])] = true;
+			}
+			begin = end;
+		}
+
+		// Seam vertices are already locked, so only the canonical vertex of a border can be missing its lock
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			if (locked[canonical[v]]) locked[v] = true;
+		}
+
+		return locked;
+	}
+
+	// A collapse must not turn any of the triangles that keep existing around
+	bool keeps_orientation(const std::vector<uint32_t>& indices, const TriangleAdjacency& adjacency, const std::vector<glm::vec3>& positions,
+		uint32_t from, uint32_t to)
+	{
+		for (uint32_t a = adjacency.offsets[from]; a < adjacency.offsets[from + 1]; a++)
+		{
+			const uint32_t* triangle = &indices[adjacency.triangles[a] * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				continue;
+			}
+
+			glm::vec3 corners[3];
+			glm::vec3 moved[3];
+			for (int k = 0; k < 3; k++)
+			{
+				corners[k] = positions[triangle[k]];
+				moved[k] = triangle[k] == from ? positions[to] : corners[k];
+			}
+
+			glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+			if (glm::dot(before, after) <= 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Largest side of the bounding box, the errors of the simplifier are relative to it
+	float get_extent(const Vertex* vertices, size_t vertexCount, glm::vec3& outMinimum)
+	{
+		glm::vec3 minimum = vertices[0].position;
+		glm::vec3 maximum = vertices[0].position;
+		for (size_t v = 1; v < vertexCount; v++)
+		{
+			minimum = glm::min(minimum, vertices[v].position);
+			maximum = glm::max(maximum, vertices[v].position);
+		}
+		glm::vec3 size = maximum - minimum;
+		outMinimum = minimum;
+		return std::max(size.x, std::max(size.y, size.z));
+	}
+}
+
+void vkmeshopt::set_lod_settings(const LodSettings& settings)
+{
+	lodSettings = settings;
+}
+
+const LodSettings& vkmeshopt::get_lod_settings()
+{
+	return lodSettings;
+}
+
+float vkmeshopt::simplify(const uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+	size_t targetIndexCount, float targetError, std::vector<uint32_t>& outIndices)
+{
+	outIndices.assign(indices, indices + indexCount);
+	if (indexCount % 3 != 0 || vertexCount == 0 || indexCount <= targetIndexCount)
+	{
+		return 0.0f;
+	}
+
+	// Errors are measured in a unit cube so the same threshold works for a leaf and for a whole trunk
+	glm::vec3 minimum;
+	float extent = get_extent(vertices, vertexCount, minimum);
+	float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+	std::vector<glm::vec3> positions(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		positions[v] = (vertices[v].position - minimum) * scale;
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < indexCount; t += 3)
+	{
+		const glm::vec3& p0 = positions[indices[t + 0]];
+		const glm::vec3& p1 = positions[indices[t + 1]];
+		const glm::vec3& p2 = positions[indices[t + 2]];
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length <= 0.0f) continue;
+
+		normal /= length;
+		for (int k = 0; k < 3; k++)
+		{
+			quadrics[indices[t + k]].add_plane(normal, -glm::dot(normal, p0), length * 0.5f);
+		}
+	}
+
+	const std::vector<bool> locked = find_locked_vertices(indices, indexCount, vertices, vertexCount);
+
+	TriangleAdjacency adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<bool> touched(vertexCount);
+	std::vector<uint32_t> remap(vertexCount);
+	float error = 0.0f;
+
+	// Every pass collapses the cheapest edges that do not share vertices, then rebuilds the list
+	while (outIndices.size() > targetIndexCount)
+	{
+		adjacency.build(outIndices, vertexCount);
+
+		collapses.clear();
+		for (size_t t = 0; t < outIndices.size(); t += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				uint32_t a = outIndices[t + e];
+				uint32_t b = outIndices[t + (e + 1) % 3];
+
+				Quadric merged = quadrics[a];
+				merged.add(quadrics[b]);
+				if (!locked[a]) collapses.push_back(Collapse{ a, b, merged.get_error(positions[b]) });
+				if (!locked[b]) collapses.push_back(Collapse{ b, a, merged.get_error(positions[a]) });
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+			return a.error < b.error;
+		});
+
+		std::fill(touched.begin(), touched.end(), false);
+		std::iota(remap.begin(), remap.end(), 0);
+
+		const size_t trianglesToRemove = (outIndices.size() - targetIndexCount + 2) / 3;
+		size_t removed = 0;
+		size_t collapsed = 0;
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.error > targetError || removed >= trianglesToRemove) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+			if (!keeps_orientation(outIndices, adjacency, positions, collapse.from, collapse.to)) continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			error = std::max(error, collapse.error);
+			collapsed++;
+
+			// The triangles around the collapse changed, none of their vertices can take part in another one this pass
+			for (uint32_t a = adjacency.offsets[collapse.from]; a < adjacency.offsets[collapse.from + 1]; a++)
+			{
+				const uint32_t* triangle = &outIndices[adjacency.triangles[a] * 3];
+				bool degenerates = false;
+				for (int k = 0; k < 3; k++)
+				{
+					touched[triangle[k]] = true;
+					degenerates |= triangle[k] == collapse.to;
+				}
+				removed += degenerates ? 1 : 0;
+			}
+		}
+
+		if (collapsed == 0)
+		{
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t t = 0; t < outIndices.size(); t += 3)
+		{
+			uint32_t a = remap[outIndices[t + 0]];
+			uint32_t b = remap[outIndices[t + 1]];
+			uint32_t c = remap[outIndices[t + 2]];
+			if (a == b || b == c || a == c) continue;
+
+			outIndices[write++] = a;
+			outIndices[write++] = b;
+			outIndices[write++] = c;
+		}
+		outIndices.resize(write);
+	}
+
+	return error;
+}
+
+std::vector<uint32_t> vkmeshopt::get_lod_targets(uint32_t indexCount)
+{
+	std::vector<uint32_t> targets;
+	if (lodSettings.levelCount == 0 || indexCount / 3 < lodSettings.minTriangles)
+	{
+		return targets;
+	}
+
+	uint32_t triangles = indexCount / 3;
+	for (uint32_t level = 0; level < lodSettings.levelCount; level++)
+	{
+		triangles = static_cast<uint32_t>(triangles * lodSettings.reduction);
+		if (triangles == 0) break;
+		targets.push_back(triangles * 3);
+	}
+	return targets;
+}
+
+void vkmeshopt::build_lod_chain(const uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+	const std::vector<uint32_t>& targets, std::vector<std::vector<uint32_t>>& outLevels, std::vector<float>& outErrors)
+{
+	outLevels.clear();
+	outErrors.clear();
+
+	if (vertexCount == 0)
+	{
+		return;
+	}
+
+	glm::vec3 minimum;
+	const float extent = get_extent(vertices, vertexCount, minimum);
+
+	std::vector<uint32_t> level;
+	for (uint32_t target : targets)
+	{
+		// Every level starts from the full detail list, so its error is measured against the original surface
+		float error = simplify(indices, indexCount, vertices, vertexCount, target, lodSettings.maxError, level);
+		if (level.empty() || level.size() > target)
+		{
+			break;
+		}
+
+		optimize_vertex_cache(level.data(), level.size(), vertexCount);
+		outLevels.push_back(level);
+		outErrors.push_back(error * extent);
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "vk_mesh.h"
+#include <vector>
+
+// How the LOD chain of every imported primitive is built. Set it before loading anything, the loaders read it from
+// the worker threads and the cooked prefabs remember the settings they were built with.
+struct LodSettings
+{
+	uint32_t levelCount = 3; // levels after the full detail one, 0 disables the chain
+	float reduction = 0.5f; // triangles of a level relative to the previous one
+	float maxError = 0.02f; // deviation allowed on a level, relative to the size of the primitive
+	uint32_t minTriangles = 64; // smaller primitives get no chain
+};
+
+namespace vkmeshopt {
+
+	void set_lod_settings(const LodSettings& settings);
+	const LodSettings& get_lod_settings();
+
+	// Quadric error edge collapse down to targetIndexCount or until the next collapse would exceed targetError,
+	// relative to the size of the mesh. Vertices only collapse onto other vertices, so the result indexes the same
+	// vertex list and no attribute is interpolated. Vertices on open borders, like the outline of a leaf card,
+	// and vertices split by a UV or normal seam never move. Returns the error reached.
+	float simplify(const uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+		size_t targetIndexCount, float targetError, std::vector<uint32_t>& outIndices);
+
+	// Index count every level of the chain may use with the current settings, empty for primitives too small to get one
+	std::vector<uint32_t> get_lod_targets(uint32_t indexCount);
+
+	// Simplifies the triangle list once per target, each level is vertex cache ordered. The chain stops at the first
+	// level that cannot reach its target within the error of the settings, outLevels may be shorter than targets.
+	// outErrors are in the units of the vertex positions, so the renderer can project them on screen.
+	void build_lod_chain(const uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+		const std::vector<uint32_t>& targets, std::vector<std::vector<uint32_t>>& outLevels, std::vector<float>& outErrors);
+}
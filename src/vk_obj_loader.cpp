@@ -0,0 +1,458 @@
+#include "vk_obj_loader.h"
+#include "vk_utils.h"
+#include "vk_thread_pool.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <climits>
+
+namespace
+{
+	const size_t MIN_CHUNK_SIZE = 1 << 20;
+	const int32_t MISSING_INDEX = INT32_MIN;
+	const size_t MAX_SHAPE_CORNERS = size_t(1) << 30; // twice as many weld table slots still fit a uint32_t
+
+	// Index of a position, uv or normal. Relative (negative) indices are stored against the chunk
+	// and only become absolute once the amount of data in the previous chunks is known
+	struct ObjIndex
+	{
+		int32_t value = MISSING_INDEX;
+		bool relative = false;
+	};
+
+	struct ObjCorner
+	{
+		ObjIndex position;
+		ObjIndex uv;
+		ObjIndex normal;
+	};
+
+	struct ObjChunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec2> uvs;
+
+		std::vector<ObjCorner> corners; // three per triangle
+		std::vector<size_t> shapeBreaks; // corner offset of every 'o' or 'g' line
+		std::vector<std::string> shapeNames;
+
+		// Where the data of this chunk starts in the whole file, filled after parsing
+		int32_t positionBase = 0;
+		int32_t normalBase = 0;
+		int32_t uvBase = 0;
+	};
+
+	struct CornerRange
+	{
+		const ObjChunk* chunk;
+		size_t begin;
+		size_t end;
+	};
+
+	struct ShapeRanges
+	{
+		std::string name;
+		std::vector<CornerRange> ranges;
+		size_t cornerCount = 0;
+	};
+
+	inline bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline const char* skip_spaces(const char* it, const char* end)
+	{
+		while (it < end && is_space(*it)) it++;
+		return it;
+	}
+
+	inline const char* skip_line(const char* it, const char* end)
+	{
+		while (it < end && *it != '\n') it++;
+		return it < end ? it + 1 : end;
+	}
+
+	const char* parse_int(const char* it, const char* end, int32_t& outValue)
+	{
+		bool negative = false;
+		if (it < end && (*it == '-' || *it == '+'))
+		{
+			negative = *it == '-';
+			it++;
+		}
+
+		int32_t value = 0;
+		while (it < end && *it >= '0' && *it <= '9')
+		{
+			value = value * 10 + (*it - '0');
+			it++;
+		}
+
+		outValue = negative ? -value : value;
+		return it;
+	}
+
+	// Only handles what OBJ exporters write: optional sign, digits, fraction and exponent
+	const char* parse_float(const char* it, const char* end, float& outValue)
+	{
+		it = skip_spaces(it, end);
+
+		bool negative = false;
+		if (it < end && (*it == '-' || *it == '+'))
+		{
+			negative = *it == '-';
+			it++;
+		}
+
+		double value = 0.0;
+		while (it < end && *it >= '0' && *it <= '9')
+		{
+			value = value * 10.0 + (*it - '0');
+			it++;
+		}
+
+		if (it < end && *it == '.')
+		{
+			it++;
+			double scale = 0.1;
+			while (it < end && *it >= '0' && *it <= '9')
+			{
+				value += (*it - '0') * scale;
+				scale *= 0.1;
+				it++;
+			}
+		}
+
+		if (it < end && (*it == 'e' || *it == 'E'))
+		{
+			int32_t exponent = 0;
+			it = parse_int(it + 1, end, exponent);
+			value *= std::pow(10.0, exponent);
+		}
+
+		outValue = static_cast<float>(negative ? -value : value);
+		return it;
+	}
+
+	inline ObjIndex make_index(int32_t value, size_t localCount)
+	{
+		ObjIndex index;
+		if (value > 0)
+		{
+			index.value = value - 1;
+		}
+		else if (value < 0)
+		{
+			index.value = static_cast<int32_t>(localCount) + value;
+			index.relative = true;
+		}
+		return index;
+	}
+
+	const char* parse_corner(const char* it, const char* end, const ObjChunk& chunk, ObjCorner& outCorner)
+	{
+		int32_t value = 0;
+		it = parse_int(it, end, value);
+		outCorner.position = make_index(value, chunk.positions.size());
+
+		if (it < end && *it == '/')
+		{
+			it++;
+			if (it < end && *it != '/')
+			{
+				it = parse_int(it, end, value);
+				outCorner.uv = make_index(value, chunk.uvs.size());
+			}
+
+			if (it < end && *it == '/')
+			{
+				it = parse_int(it + 1, end, value);
+				outCorner.normal = make_index(value, chunk.normals.size());
+			}
+		}
+
+		return it;
+	}
+
+	void parse_chunk(ObjChunk& chunk)
+	{
+		std::vector<ObjCorner> polygon;
+		polygon.reserve(8);
+
+		const char* it = chunk.begin;
+		const char* end = chunk.end;
+
+		while (it < end)
+		{
+			it = skip_spaces(it, end);
+			if (it >= end) break;
+
+			const char* lineEnd = std::find(it, end, '\n');
+
+			if (it[0] == 'v' && it + 1 < lineEnd)
+			{
+				if (is_space(it[1]))
+				{
+					glm::vec3 position;
+					const char* cursor = parse_float(it + 1, lineEnd, position.x);
+					cursor = parse_float(cursor, lineEnd, position.y);
+					parse_float(cursor, lineEnd, position.z);
+					chunk.positions.push_back(position);
+				}
+				else if (it[1] == 'n')
+				{
+					glm::vec3 normal;
+					const char* cursor = parse_float(it + 2, lineEnd, normal.x);
+					cursor = parse_float(cursor, lineEnd, normal.y);
+					parse_float(cursor, lineEnd, normal.z);
+					chunk.normals.push_back(normal);
+				}
+				else if (it[1] == 't')
+				{
+					glm::vec2 uv;
+					const char* cursor = parse_float(it + 2, lineEnd, uv.x);
+					parse_float(cursor, lineEnd, uv.y);
+					chunk.uvs.push_back(uv);
+				}
+			}
+			else if (it[0] == 'f' && it + 1 < lineEnd && is_space(it[1]))
+			{
+				polygon.clear();
+
+				const char* cursor = skip_spaces(it + 1, lineEnd);
+				while (cursor < lineEnd)
+				{
+					ObjCorner corner;
+					cursor = parse_corner(cursor, lineEnd, chunk, corner);
+					if (corner.position.value != MISSING_INDEX)
+					{
+						polygon.push_back(corner);
+					}
+					cursor = skip_spaces(cursor, lineEnd);
+					if (cursor < lineEnd && !(*cursor == '-' || *cursor == '+' || (*cursor >= '0' && *cursor <= '9')))
+					{
+						break;
+					}
+				}
+
+				// Triangle fan, same as tinyobj did
+				for (size_t k = 2; k < polygon.size(); k++)
+				{
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[k - 1]);
+					chunk.corners.push_back(polygon[k]);
+				}
+			}
+			else if ((it[0] == 'o' || it[0] == 'g') && (it + 1 == lineEnd || is_space(it[1])))
+			{
+				const char* nameBegin = skip_spaces(it + 1, lineEnd);
+				const char* nameEnd = lineEnd;
+				while (nameEnd > nameBegin && is_space(nameEnd[-1])) nameEnd--;
+
+				chunk.shapeBreaks.push_back(chunk.corners.size());
+				chunk.shapeNames.emplace_back(nameBegin, nameEnd);
+			}
+
+			it = lineEnd < end ? lineEnd + 1 : end;
+		}
+	}
+
+	inline int32_t resolve(const ObjIndex& index, int32_t base, size_t count)
+	{
+		if (index.value == MISSING_INDEX) return -1;
+
+		int32_t value = index.relative ? base + index.value : index.value;
+		return value >= 0 && static_cast<size_t>(value) < count ? value : -1;
+	}
+
+	// Clamped to 2^31, the largest power of two a uint32_t holds
+	uint32_t next_power_of_two(size_t value)
+	{
+		const uint32_t largest = 1u << 31;
+		uint32_t result = 16;
+		while (result < value && result < largest) result <<= 1;
+		return result;
+	}
+
+	// Open addressing table with linear probing, the stored hash bits avoid most vertex comparisons
+	void weld_shape(const ShapeRanges& shape, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+		const std::vector<glm::vec2>& uvs, ObjShapeData& outShape)
+	{
+		struct Slot
+		{
+			uint32_t vertex;
+			uint32_t hash;
+		};
+
+		const uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+		const uint32_t capacity = next_power_of_two(shape.cornerCount * 2);
+		const uint32_t mask = capacity - 1;
+
+		std::vector<Slot> table(capacity, Slot{ EMPTY_SLOT, 0 });
+
+		outShape.name = shape.name;
+		outShape.vertices.clear();
+		outShape.vertices.reserve(shape.cornerCount);
+		outShape.indices.resize(shape.cornerCount);
+
+		size_t cornerIndex = 0;
+		for (const CornerRange& range : shape.ranges)
+		{
+			const ObjChunk& chunk = *range.chunk;
+			for (size_t c = range.begin; c < range.end; c++)
+			{
+				const ObjCorner& corner = chunk.corners[c];
+
+				int32_t position = resolve(corner.position, chunk.positionBase, positions.size());
+				int32_t normal = resolve(corner.normal, chunk.normalBase, normals.size());
+				int32_t uv = resolve(corner.uv, chunk.uvBase, uvs.size());
+
+				Vertex vertex{};
+				vertex.position = position >= 0 ? positions[position] : glm::vec3(0.0f);
+				vertex.normal = normal >= 0 ? normals[normal] : glm::vec3(0.0f);
+				vertex.uv = uv >= 0 ? glm::vec2(uvs[uv].x, 1.0f - uvs[uv].y) : glm::vec2(0.0f);
+				vertex.color = { 1.0f, 1.0f, 1.0f };
+
+				uint64_t hash = vkutil::hash_vertex(vertex);
+				uint32_t hashTag = static_cast<uint32_t>(hash >> 32);
+				uint32_t slot = static_cast<uint32_t>(hash) & mask;
+
+				while (table[slot].vertex != EMPTY_SLOT)
+				{
+					if (table[slot].hash == hashTag && outShape.vertices[table[slot].vertex] == vertex)
+					{
+						break;
+					}
+					slot = (slot + 1) & mask;
+				}
+
+				if (table[slot].vertex == EMPTY_SLOT)
+				{
+					table[slot].vertex = static_cast<uint32_t>(outShape.vertices.size());
+					table[slot].hash = hashTag;
+					outShape.vertices.push_back(vertex);
+				}
+
+				outShape.indices[cornerIndex++] = table[slot].vertex;
+			}
+		}
+
+		outShape.vertices.shrink_to_fit();
+	}
+}
+
+bool vkobj::parse_obj(const std::string& filename, std::vector<ObjShapeData>& outShapes)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		std::cout << "[ERROR] Could not open OBJ file " << filename << std::endl;
+		return false;
+	}
+
+	const char* data = reinterpret_cast<const char*>(file.data);
+	const char* dataEnd = data + file.size;
+
+	// Split the file in line aligned chunks, a few per thread so uneven chunks balance out
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(file.size / MIN_CHUNK_SIZE, vkjobs::get_thread_count() * 4));
+	size_t chunkSize = file.size / chunkCount;
+
+	std::vector<ObjChunk> chunks;
+	chunks.reserve(chunkCount);
+
+	const char* chunkBegin = data;
+	while (chunkBegin < dataEnd)
+	{
+		const char* chunkEnd = chunks.size() + 1 == chunkCount ? dataEnd : std::min(chunkBegin + chunkSize, dataEnd);
+		chunkEnd = skip_line(chunkEnd == chunkBegin ? chunkBegin : chunkEnd - 1, dataEnd);
+
+		chunks.emplace_back();
+		chunks.back().begin = chunkBegin;
+		chunks.back().end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	vkjobs::parallel_for(chunks.size(), [&chunks](size_t index) {
+		parse_chunk(chunks[index]);
+	});
+
+	// Concatenate the attributes and compute where every chunk starts
+	size_t positionCount = 0, normalCount = 0, uvCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionBase = static_cast<int32_t>(positionCount);
+		chunk.normalBase = static_cast<int32_t>(normalCount);
+		chunk.uvBase = static_cast<int32_t>(uvCount);
+		positionCount += chunk.positions.size();
+		normalCount += chunk.normals.size();
+		uvCount += chunk.uvs.size();
+	}
+
+	std::vector<glm::vec3> positions(positionCount);
+	std::vector<glm::vec3> normals(normalCount);
+	std::vector<glm::vec2> uvs(uvCount);
+
+	vkjobs::parallel_for(chunks.size(), [&](size_t index) {
+		ObjChunk& chunk = chunks[index];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+		std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + chunk.uvBase);
+	});
+
+	// Group the faces in shapes, shapes without faces are dropped like tinyobj did
+	std::vector<ShapeRanges> shapes(1);
+	for (const ObjChunk& chunk : chunks)
+	{
+		size_t begin = 0;
+		for (size_t b = 0; b <= chunk.shapeBreaks.size(); b++)
+		{
+			size_t end = b < chunk.shapeBreaks.size() ? chunk.shapeBreaks[b] : chunk.corners.size();
+			if (end > begin)
+			{
+				shapes.back().ranges.push_back(CornerRange{ &chunk, begin, end });
+				shapes.back().cornerCount += end - begin;
+			}
+
+			if (b < chunk.shapeBreaks.size())
+			{
+				if (shapes.back().cornerCount > 0)
+				{
+					shapes.emplace_back();
+				}
+				shapes.back().name = chunk.shapeNames[b];
+			}
+			begin = end;
+		}
+	}
+
+	if (shapes.back().cornerCount == 0)
+	{
+		shapes.pop_back();
+	}
+
+	// The weld table keeps a free slot for every corner and the indices are 32 bit
+	for (const ShapeRanges& shape : shapes)
+	{
+		if (shape.cornerCount > MAX_SHAPE_CORNERS)
+		{
+			std::cout << "[ERROR] OBJ shape " << shape.name << " has " << shape.cornerCount << " corners, at most " << MAX_SHAPE_CORNERS << " are supported" << std::endl;
+			return false;
+		}
+	}
+
+	outShapes.clear();
+	outShapes.resize(shapes.size());
+
+	vkjobs::parallel_for(shapes.size(), [&](size_t index) {
+		weld_shape(shapes[index], positions, normals, uvs, outShapes[index]);
+	});
+
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "vk_mesh.h"
+#include <string>
+#include <vector>
+
+struct ObjShapeData
+{
+	std::string name;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+namespace vkobj {
+
+	// Parses an OBJ file into one welded, triangulated vertex and index list per shape ('o' and 'g' start a new one).
+	// The file is split in chunks that are parsed on the worker pool, materials are ignored.
+	bool parse_obj(const std::string& filename, std::vector<ObjShapeData>& outShapes);
+}
@@ -3,14 +3,72 @@
 #include "vk_mesh.h"
 #include "vk_material.h"
 #include "vk_gltf_loader.h"
+#include "vk_prefab_cache.h"
 #include "vk_render_engine.h"
 #include <glm/gtx/transform.hpp>
 #include "vk_utils.h"
+#include "vk_thread_pool.h"
 #include <string>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
 
 using namespace VKE;
 
-std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
+ResourceRegistry<Prefab> Prefab::sPrefabsLoaded;
+
+namespace
+{
+    struct PendingPrefabLoad
+    {
+        Prefab* prefab;
+        std::string filename;
+        std::shared_ptr<MappedFile> cookedFile; // mapped and validated by the worker, empty if the import failed
+        std::future<void> job;
+    };
+
+    std::vector<PendingPrefabLoad> sPendingLoads;
+
+    // Used by the prefabs that are still loading so every descriptor and draw keeps pointing to valid geometry
+    GeometryRange sPlaceholderVertices;
+    GeometryRange sPlaceholderIndices;
+
+    bool set_placeholder_geometry(Prefab& prefab)
+    {
+        if(!sPlaceholderVertices.is_valid())
+        {
+            // One zeroed vertex and a degenerate triangle
+            const Vertex vertex{};
+            const uint32_t indices[3] = { 0, 0, 0 };
+            GeometryRange vertices;
+            GeometryRange triangle;
+            if(!RenderEngine::_vertexArena.allocate(sizeof(Vertex), sizeof(Vertex), vertices))
+            {
+                return false;
+            }
+            if(!RenderEngine::_indexArena.allocate(sizeof(indices), sizeof(uint32_t), triangle))
+            {
+                RenderEngine::_vertexArena.free(vertices);
+                return false;
+            }
+            sPlaceholderVertices = vertices;
+            sPlaceholderIndices = triangle;
+            RenderEngine::_uploadBatcher.upload_buffer(RenderEngine::_vertexArena.get_buffer(), sPlaceholderVertices.offset, &vertex, sizeof(Vertex));
+            RenderEngine::_uploadBatcher.upload_buffer(RenderEngine::_indexArena.get_buffer(), sPlaceholderIndices.offset, indices, sizeof(indices));
+        }
+
+        prefab._vertices.format = VERTEX_FORMAT_FULL;
+        prefab._vertices.count = 1;
+        prefab._vertices.range = sPlaceholderVertices;
+        prefab._vertices.shared = true;
+        prefab._indices.size = 3 * sizeof(uint32_t);
+        prefab._indices.range = sPlaceholderIndices;
+        prefab._indices.shared = true;
+        return true;
+    }
+}
 
 Node::Node() :_opaque(true), _parent(nullptr), _mesh(nullptr), _visible(true)
 {
@@ -29,15 +87,18 @@ Node::~Node()
     }
 }
 
-void VKE::Node::draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout)
+void VKE::Node::draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout, int32_t vertexOffset, VkDeviceSize indexOffset, VkIndexType& boundIndexType,
+    const LodSelector* lodSelector)
 {
     if(_mesh != nullptr && _mesh->_primitives.size() > 0)
     {
         VKE::Material* lastMaterial = nullptr;
         GPUObjectData objectData{};
+        const glm::mat4 globalMatrix = model * get_global_matrix();
         for(const auto& primitive : _mesh->_primitives)
         {
-            objectData.modelMatrix = model * get_global_matrix();
+            // Quantized positions are dequantized by the model matrix itself
+            objectData.modelMatrix = globalMatrix * primitive->get_dequantization_matrix();
 
             if(&primitive->material != lastMaterial)
             {
@@ -45,22 +106,32 @@ void VKE::Node::draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipeline
                 lastMaterial = &primitive->material;
             }
 
-            vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUObjectData), &objectData);
+            if(layout != VK_NULL_HANDLE)
+            {
+                vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUObjectData), &objectData);
+            }
                 
             if(primitive->hasIndices)
             {
-                vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+                if(primitive->indexType != boundIndexType)
+                {
+                    vkCmdBindIndexBuffer(commandBuffer, RenderEngine::_indexArena.get_buffer(), 0, primitive->indexType);
+                    boundIndexType = primitive->indexType;
+                }
+                const uint32_t level = primitive->select_lod(globalMatrix, lodSelector);
+                const uint32_t firstIndex = static_cast<uint32_t>(indexOffset / primitive->get_index_size()) + primitive->get_lod_first_index(level);
+                vkCmdDrawIndexed(commandBuffer, primitive->get_lod_index_count(level), 1, firstIndex, vertexOffset + primitive->firstVertex, 0);
             }
             else
             {
-                vkCmdDraw(commandBuffer, primitive->vertexCount, 1, 0, 0);
+                vkCmdDraw(commandBuffer, primitive->vertexCount, 1, vertexOffset + primitive->firstVertex, 0);
             }
         }
     }
 
     for(const auto& child : _children)
     {
-        child->draw(model, commandBuffer, layout);
+        child->draw(model, commandBuffer, layout, vertexOffset, indexOffset, boundIndexType, lodSelector);
     }
 }
 
@@ -100,49 +171,56 @@ void VKE::Node::node_to_vulkan_geometry(VkDeviceOrHostAddressConstKHR& vertexBuf
     }
 }
 
-void VKE::Node::node_to_TLAS_instance(const glm::mat4& prefabModel, std::vector<AccelerationStructure>& bottomLevelAS, std::vector<VkAccelerationStructureInstanceKHR>& instances)
+void VKE::Node::node_to_TLAS_instance(const glm::mat4& prefabModel, std::vector<AccelerationStructure>& bottomLevelAS, std::vector<VkAccelerationStructureInstanceKHR>& instances,
+    uint32_t& firstLevel, const LodSelector* lodSelector)
 {
     if (_children.size() > 0)
     {
         for (const auto& child : _children)
         {
-            child->node_to_TLAS_instance(prefabModel, bottomLevelAS, instances);
+            child->node_to_TLAS_instance(prefabModel, bottomLevelAS, instances, firstLevel, lodSelector);
         }
     }
 
     if (_mesh != nullptr && _mesh->_primitives.size() > 0)
     {
-        glm::mat4 model = prefabModel * get_global_matrix();
-        model = glm::transpose(model);
-
-        VkTransformMatrixKHR transformMatrix = {
-            model[0].x, model[0].y, model[0].z, model[0].w,
-            model[1].x, model[1].y, model[1].z, model[1].w,
-            model[2].x, model[2].y, model[2].z, model[2].w,
-        };
+        const glm::mat4 globalMatrix = prefabModel * get_global_matrix();
 
         for (int i = 0; i < _mesh->_primitives.size(); i++)
         {
+            const Primitive& primitive = *_mesh->_primitives[i];
+            const uint32_t level = firstLevel + primitive.select_lod(globalMatrix, lodSelector);
+            firstLevel += static_cast<uint32_t>(primitive.lods.size()) + 1;
+
+            // Every primitive has its own BLAS, so its dequantization goes in the instance transform
+            glm::mat4 model = glm::transpose(globalMatrix * primitive.get_dequantization_matrix());
+
+            VkTransformMatrixKHR transformMatrix = {
+                model[0].x, model[0].y, model[0].z, model[0].w,
+                model[1].x, model[1].y, model[1].z, model[1].w,
+                model[2].x, model[2].y, model[2].z, model[2].w,
+            };
+
             VkAccelerationStructureInstanceKHR instance{};
             instance.transform = transformMatrix;
-            instance.instanceCustomIndex = instances.size();
+            instance.instanceCustomIndex = level;
             instance.mask = _opaque ? 0x02 : 0x01; //FD, FE masks
             instance.instanceShaderBindingTableRecordOffset = 0;
             instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-            instance.accelerationStructureReference = bottomLevelAS[instances.size()]._deviceAddress;
+            instance.accelerationStructureReference = bottomLevelAS[level]._deviceAddress;
 
             instances.push_back(instance);
         }
     }
 }
 
-void VKE::Node::get_primitive_to_shader_info(const glm::mat4& model, std::vector<PrimitiveToShader>& primitivesInfo, std::vector<glm::mat4>& transforms, const int renderableIndex)
+void VKE::Node::get_primitive_to_shader_info(const glm::mat4& model, int32_t vertexOffset, VkDeviceSize indexOffset, std::vector<PrimitiveToShader>& primitivesInfo, std::vector<glm::mat4>& transforms, const int renderableIndex)
 {
     if (_children.size() > 0)
     {
         for (const auto& child : _children)
         {
-            child->get_primitive_to_shader_info(model, primitivesInfo, transforms, renderableIndex);
+            child->get_primitive_to_shader_info(model, vertexOffset, indexOffset, primitivesInfo, transforms, renderableIndex);
         }
     }
 
@@ -152,13 +230,20 @@ void VKE::Node::get_primitive_to_shader_info(const glm::mat4& model, std::vector
 
         for (const auto& primitive : _mesh->_primitives)
         {
-            PrimitiveToShader primitiveInfo{};
-            primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.x = primitive->firstIndex;
-            primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.y = renderableIndex;
-            primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.z = primitive->material._id;
-            primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.w = transforms.size();
-
-            primitivesInfo.push_back(primitiveInfo);
+            // The hit shaders index the whole arenas, the offsets of the prefab go in the first index and vertex.
+            // One per level, in the order of the BLASes, the TLAS instance picks the one it was built with.
+            for (uint32_t level = 0; level <= primitive->lods.size(); level++)
+            {
+                PrimitiveToShader primitiveInfo{};
+                primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.x = static_cast<uint32_t>(indexOffset / primitive->get_index_size()) + primitive->get_lod_first_index(level);
+                primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.y = renderableIndex;
+                primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.z = primitive->material._id;
+                primitiveInfo.firstIdx_rndIdx_matIdx_transIdx.w = static_cast<uint32_t>(transforms.size());
+                primitiveInfo.dequantization = primitive->dequantization;
+                primitiveInfo.firstVtx_idxSize = glm::uvec4(vertexOffset + primitive->firstVertex, primitive->get_index_size(), 0, 0);
+
+                primitivesInfo.push_back(primitiveInfo);
+            }
         }
 
         transforms.emplace_back(global_matrix);
@@ -185,57 +270,61 @@ void VKE::Node::get_nodes_transforms(const glm::mat4& model, std::vector<glm::ma
     }
 }
 
-Prefab::Prefab()
+void VKE::Node::get_materials(std::vector<Material*>& materials)
 {
+    for (const auto& child : _children)
+    {
+        child->get_materials(materials);
+    }
+
+    if (_mesh != nullptr)
+    {
+        for (const auto& primitive : _mesh->_primitives)
+        {
+            materials.push_back(&primitive->material);
+        }
+    }
 }
 
-Prefab::Prefab(Mesh& mesh, const std::string& materialName)
+Prefab::Prefab()
 {
-    _vertices.count = mesh._vertices.size();
-    _vertices.vertexBuffer = mesh._vertexBuffer;
-    _indices.count = mesh._indices.size();
-    _indices.indexBuffer = mesh._indexBuffer;
+}
 
-    std::vector<rtVertex> rtVertices;
-    rtVertices.reserve(_vertices.count);
+Prefab::Prefab(Mesh& mesh, const std::string& materialName, VertexFormat vertexFormat)
+{
+    glm::vec4 dequantization(0.0f);
 
-    for(const auto& vertex : mesh._vertices)
+    bool quantized = false;
+    if(vertexFormat == VERTEX_FORMAT_QUANTIZED && RenderEngine::_quantizedVerticesSupported)
     {
-        rtVertex rtv;
-        rtv.position = glm::vec4(vertex.position, 1.0f);
-        rtv.normal = glm::vec4(vertex.normal, 1.0f);
-        rtv.uv = glm::vec4(vertex.uv, 1.0f, 1.0f);
+        // The prefab gets its own compact copy of the vertices, the index buffer is still shared with the mesh
+        dequantization = vkutil::compute_dequantization(mesh._vertices.data(), mesh._vertices.size());
 
-        rtVertices.push_back(rtv);
-    }
+        std::vector<QuantizedVertex> quantizedVertices(mesh._vertices.size());
+        vkutil::quantize_vertices(mesh._vertices.data(), mesh._vertices.size(), dequantization, quantizedVertices.data());
 
-    size_t rtVertexBufferSize = sizeof(rtVertex) * rtVertices.size();
-
-    // RTVertex data
-    AllocatedBuffer rtvStaging = vkutil::create_buffer(RenderEngine::_allocator, rtVertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_CPU_ONLY);
-
-    void* rtVertexData;
-    vmaMapMemory(RenderEngine::_allocator, rtvStaging._allocation, &rtVertexData);
-    memcpy(rtVertexData, rtVertices.data(), rtVertexBufferSize);
-    vmaUnmapMemory(RenderEngine::_allocator, rtvStaging._allocation);
-
-    // RTVertex buffer
-    _vertices.rtvBuffer = vkutil::create_buffer(RenderEngine::_allocator, rtVertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        quantized = upload_geometry(VERTEX_FORMAT_QUANTIZED, quantizedVertices.data(), static_cast<uint32_t>(quantizedVertices.size()), nullptr, 0);
+    }
 
-    vkupload::immediate_submit([=](VkCommandBuffer cmd)
-        {
-            VkBufferCopy copyRegion;
-            copyRegion.dstOffset = 0;
-            copyRegion.srcOffset = 0;
-            copyRegion.size = rtVertexBufferSize;
+    // Also when there was no room for the quantized copy or it could not be drawn, the full vertices of the mesh are already in the arena
+    if(!quantized)
+    {
+        dequantization = glm::vec4(0.0f);
+        _vertices.format = VERTEX_FORMAT_FULL;
+        _vertices.count = mesh._vertices.size();
+        _vertices.range = mesh._vertexRange;
+        _vertices.shared = true;
+    }
 
-            vkCmdCopyBuffer(cmd, rtvStaging._buffer, _vertices.rtvBuffer._buffer, 1, &copyRegion);
-        });
+    _indices.size = mesh._indices.size() * vkutil::get_index_size(mesh._indexType);
+    _indices.range = mesh._indexRange;
+    _indices.shared = true;
 
-    Primitive* primitive = new Primitive(0, 0, _indices.count, _vertices.count, *VKE::Material::sMaterials[materialName]);
+    const uint32_t indexCount = static_cast<uint32_t>(mesh._lods.empty() ? mesh._indices.size() : mesh._lods.front().firstIndex);
+    Primitive* primitive = new Primitive(0, 0, indexCount, _vertices.count, *VKE::Material::get(materialName.c_str()));
+    primitive->dequantization = dequantization;
+    primitive->indexType = mesh._indexType;
+    primitive->lods = mesh._lods;
 
     Node* node = new Node();
     node->_opaque = primitive->material._type == DIFFUSE ? true : false;
@@ -247,30 +336,150 @@ Prefab::Prefab(Mesh& mesh, const std::string& materialName)
 
 Prefab::~Prefab()
 {
-    if(_name.size())
+    if(_name.size() && sPrefabsLoaded.find(_name) == this)
     {
-        auto it = sPrefabsLoaded.find(_name);
-        if (it != sPrefabsLoaded.end());
-        sPrefabsLoaded.erase(it);
+        sPrefabsLoaded.remove(_name);
     }
+
+    free_geometry();
 }
 
-void VKE::Prefab::draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout)
+void VKE::Prefab::draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout, VkIndexType* boundIndexType, const LodSelector* lodSelector)
 {
+    // Bound by the first indexed primitive, with the index type it needs
+    VkIndexType localIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    VkIndexType& indexType = boundIndexType ? *boundIndexType : localIndexType;
     for(const auto& node : _roots)
     {
-        node->draw(model, commandBuffer, layout);
+        node->draw(model, commandBuffer, layout, get_vertex_offset(), _indices.range.offset, indexType, lodSelector);
+    }
+}
+
+int32_t VKE::Prefab::get_vertex_offset() const
+{
+    return static_cast<int32_t>(_vertices.range.offset / vkutil::get_vertex_size(_vertices.format));
+}
+
+uint64_t VKE::Prefab::get_vertex_address() const
+{
+    return RenderEngine::_vertexArena.get_device_address() + _vertices.range.offset;
+}
+
+uint64_t VKE::Prefab::get_index_address() const
+{
+    return RenderEngine::_indexArena.get_device_address() + _indices.range.offset;
+}
+
+void VKE::Prefab::free_geometry()
+{
+    if(!_vertices.shared)
+    {
+        RenderEngine::_vertexArena.free(_vertices.range);
+    }
+    if(!_indices.shared)
+    {
+        RenderEngine::_indexArena.free(_indices.range);
+    }
+
+    _vertices.range = GeometryRange{};
+    _vertices.shared = false;
+    _indices.range = GeometryRange{};
+    _indices.shared = false;
+}
+
+bool VKE::Prefab::upload_geometry(VertexFormat format, const void* vertices, uint32_t vertexCount, const void* indexData, VkDeviceSize indexDataSize)
+{
+    GeometryStaging staging;
+    if(!begin_geometry_upload(format, vertexCount, indexDataSize, staging))
+    {
+        return false;
+    }
+
+    memcpy(staging.vertices, vertices, vertexCount * vkutil::get_vertex_size(format));
+    if(indexDataSize > 0)
+    {
+        memcpy(staging.indices, indexData, static_cast<size_t>(indexDataSize));
+    }
+
+    end_geometry_upload(staging);
+    return true;
+}
+
+bool VKE::Prefab::begin_geometry_upload(VertexFormat format, uint32_t vertexCount, VkDeviceSize indexDataSize, GeometryStaging& outStaging)
+{
+    size_t vertexBufferSize = vertexCount * vkutil::get_vertex_size(format);
+    // The hit shaders read the indices a uint at a time
+    size_t indexBufferSize = vkutil::get_aligned_size(static_cast<size_t>(indexDataSize), sizeof(uint32_t));
+
+    assert(vertexBufferSize > 0);
+
+    // Replaces the placeholder or a previous upload. The ranges are taken before the staging memory, growing an
+    // arena queues a copy on the upload batcher.
+    free_geometry();
+    _vertices.format = format;
+    _vertices.count = static_cast<int>(vertexCount);
+    _indices.size = indexBufferSize;
+
+    // Aligned to the vertex size so the draws can address the vertices from the start of the arena. The arenas
+    // already tried to grow when they fail, what is left of the prefab keeps drawing the placeholder.
+    if(!RenderEngine::_vertexArena.allocate(vertexBufferSize, vkutil::get_vertex_size(format), _vertices.range) ||
+        (indexBufferSize > 0 && !RenderEngine::_indexArena.allocate(indexBufferSize, sizeof(uint32_t), _indices.range)))
+    {
+        std::cout << "[ERROR] No room for the geometry of prefab " << _name << std::endl;
+        free_geometry();
+        set_placeholder_geometry(*this);
+        return false;
+    }
+
+    // A single reservation for both, a second one could make the batcher submit before the first is written
+    const size_t indicesOffset = vkutil::get_aligned_size(vertexBufferSize, sizeof(uint32_t));
+
+    unsigned char* data = static_cast<unsigned char*>(RenderEngine::_uploadBatcher.allocate_staging(indicesOffset + indexBufferSize, 16, outStaging.buffer, outStaging.offset));
+    outStaging.vertices = data;
+    outStaging.indices = indexBufferSize > 0 ? data + indicesOffset : nullptr;
+
+    return true;
+}
+
+void VKE::Prefab::end_geometry_upload(const GeometryStaging& staging)
+{
+    size_t vertexBufferSize = _vertices.count * vkutil::get_vertex_size(_vertices.format);
+    size_t indexBufferSize = static_cast<size_t>(_indices.size);
+    const size_t indicesOffset = vkutil::get_aligned_size(vertexBufferSize, sizeof(uint32_t));
+
+    RenderEngine::_uploadBatcher.copy_buffer(staging.buffer, staging.offset, RenderEngine::_vertexArena.get_buffer(), _vertices.range.offset, vertexBufferSize);
+    if(indexBufferSize > 0)
+    {
+        RenderEngine::_uploadBatcher.copy_buffer(staging.buffer, staging.offset + indicesOffset, RenderEngine::_indexArena.get_buffer(), _indices.range.offset, indexBufferSize);
     }
 }
 
-Prefab* Prefab::get(const char* filename)
+Prefab* Prefab::get(const char* filename, VertexFormat vertexFormat)
 {
     assert(filename);
-    std::map<std::string, Prefab*>::iterator it = sPrefabsLoaded.find(filename);
-    if (it != sPrefabsLoaded.end())
-        return it->second;
-    
-    Prefab* prefab = load_glTF(std::string(filename), 1.0f);
+    Prefab* prefab = sPrefabsLoaded.find(filename);
+    if (prefab)
+        return prefab;
+
+
+    // Use the cooked version of the prefab when it is up to date, otherwise import the glTF and cook it for the next run
+    const std::string cookedFilename = vkcook::get_cooked_filename(filename);
+    if(vkcook::is_cooked_prefab_up_to_date(filename, cookedFilename))
+    {
+        prefab = vkcook::load_cooked_prefab(cookedFilename, vertexFormat);
+    }
+
+    if(!prefab)
+    {
+        PrefabCookData cookData;
+        cookData.requestedVertexFormat = vertexFormat;
+        prefab = load_glTF(std::string(filename), 1.0f, &cookData, vertexFormat);
+        if(prefab)
+        {
+            vkcook::write_cooked_prefab(cookedFilename, *prefab, cookData);
+        }
+    }
+
     if(!prefab)
     {
         std::cout << "[ERROR]: Prefab not found" << std::endl;
@@ -285,5 +494,86 @@ Prefab* Prefab::get(const char* filename)
 void Prefab::register_prefab(const char* name)
 {
     _name = name;
-    sPrefabsLoaded[name] = this;
-}
\ No newline at end of file
+    sPrefabsLoaded.insert(_name, this);
+}
+
+Prefab* Prefab::get_async(const char* filename, VertexFormat vertexFormat)
+{
+    assert(filename);
+    Prefab* prefab = sPrefabsLoaded.find(filename);
+    if (prefab)
+        return prefab;
+
+    prefab = new Prefab();
+    prefab->_loadState = PREFAB_LOADING;
+    prefab->register_prefab(filename);
+
+    // Without the placeholder the prefab would have nothing valid to draw while it loads
+    if(!set_placeholder_geometry(*prefab))
+    {
+        std::cout << "[ERROR]: Prefab " << filename << " could not be loaded" << std::endl;
+        prefab->_loadState = PREFAB_FAILED;
+        return prefab;
+    }
+
+    PendingPrefabLoad load;
+    load.prefab = prefab;
+    load.filename = filename;
+    load.cookedFile = std::make_shared<MappedFile>();
+
+    // The worker only parses, decodes and cooks, everything that touches the device or the registries waits for update_pending_loads
+    std::shared_ptr<MappedFile> cookedFile = load.cookedFile;
+    const std::string sourceFilename = filename;
+    load.job = vkjobs::submit([cookedFile, sourceFilename, vertexFormat]() {
+        const std::string cookedFilename = vkcook::get_cooked_filename(sourceFilename);
+        if(vkcook::is_cooked_prefab_up_to_date(sourceFilename, cookedFilename) &&
+            vkcook::open_cooked_prefab(cookedFilename, vertexFormat, *cookedFile))
+        {
+            return;
+        }
+
+        if(vkcook::cook_prefab_offline(sourceFilename, vertexFormat))
+        {
+            vkcook::open_cooked_prefab(cookedFilename, vertexFormat, *cookedFile);
+        }
+    });
+
+    sPendingLoads.push_back(std::move(load));
+    return prefab;
+}
+
+bool Prefab::update_pending_loads()
+{
+    bool changed = false;
+
+    for(size_t i = 0; i < sPendingLoads.size();)
+    {
+        PendingPrefabLoad& load = sPendingLoads[i];
+        if(load.job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            i++;
+            continue;
+        }
+
+        if(load.cookedFile->data && vkcook::create_cooked_prefab(vkcook::get_cooked_filename(load.filename), *load.cookedFile, *load.prefab))
+        {
+            load.prefab->_loadState = PREFAB_LOADED;
+            changed = true;
+        }
+        else
+        {
+            std::cout << "[ERROR]: Prefab " << load.filename << " could not be loaded" << std::endl;
+            load.prefab->_loadState = PREFAB_FAILED;
+        }
+
+        // Blobs are copied to the staging memory as the resources are created, the mapping is not needed anymore
+        sPendingLoads.erase(sPendingLoads.begin() + i);
+    }
+
+    return changed;
+}
+
+bool Prefab::has_pending_loads()
+{
+    return !sPendingLoads.empty();
+}
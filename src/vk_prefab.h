@@ -1,13 +1,14 @@
 #pragma once
 
 #include "vk_types.h"
-#include <map>
+#include "vk_mesh.h"
+#include "vk_registry.h"
 #include <string>
 #include <cassert>
 
-struct rtVertex;
 struct Vertex;
 struct BlasInput;
+struct Impostor;
 struct PrimitiveToShader;
 
 namespace VKE
@@ -33,7 +34,11 @@ namespace VKE
 
 		virtual ~Node();
 
-		void draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout);
+		// Binds the index arena again only when a primitive uses another index type than the one bound. The offsets
+		// locate the geometry of the prefab in the arenas, in vertices and in bytes. The selector picks the LOD level
+		// of every primitive, the full detail is drawn without one.
+		void draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout, int32_t vertexOffset, VkDeviceSize indexOffset, VkIndexType& boundIndexType,
+			const LodSelector* lodSelector);
 
 		//add node to children list
 		void add_child(Node* child);
@@ -41,10 +46,22 @@ namespace VKE
 
 		void node_to_vulkan_geometry(VkDeviceOrHostAddressConstKHR& vertexBufferDeviceAddress, 
 			VkDeviceOrHostAddressConstKHR& indexBufferDeviceAddress, std::vector<BlasInput>& inputVector);
-		void node_to_TLAS_instance(const glm::mat4& prefabModel, std::vector<AccelerationStructure>& bottomLevelAS, std::vector<VkAccelerationStructureInstanceKHR>& instances);
-		void get_primitive_to_shader_info(const glm::mat4& model,
+		// Primitives have a BLAS and a primitive info per level, firstLevel counts them and each instance points to
+		// the level the selector picks
+		void node_to_TLAS_instance(const glm::mat4& prefabModel, std::vector<AccelerationStructure>& bottomLevelAS, std::vector<VkAccelerationStructureInstanceKHR>& instances,
+			uint32_t& firstLevel, const LodSelector* lodSelector);
+		void get_primitive_to_shader_info(const glm::mat4& model, int32_t vertexOffset, VkDeviceSize indexOffset,
 			std::vector<PrimitiveToShader>& primitivesInfo, std::vector<glm::mat4>& transforms, const int renderableIndex);
 		void get_nodes_transforms(const glm::mat4& model, std::vector<glm::mat4>& transforms);
+		// appends the materials of the primitives of the node and its children, repeated ones included
+		void get_materials(std::vector<Material*>& materials);
+	};
+
+	enum PrefabLoadState
+	{
+		PREFAB_LOADED,
+		PREFAB_LOADING, // still on the worker threads, it has no nodes and its buffers are a placeholder
+		PREFAB_FAILED,
 	};
 
 	class Prefab
@@ -52,35 +69,78 @@ namespace VKE
 	public:
 
 		std::string _name;
-		std::map<std::string, Node*> _nodes_by_name;
-
-		std::vector<rtVertex> _rtvs;
+		PrefabLoadState _loadState = PREFAB_LOADED;
 
+		// Ranges of the geometry arenas of the render engine. Shared ranges belong to a mesh or to the placeholder
+		// of the prefabs that are loading, the prefab does not free them.
 		struct Vertices {
+			VertexFormat format = VERTEX_FORMAT_FULL;
 			int count;
-			AllocatedBuffer vertexBuffer;
-			AllocatedBuffer rtvBuffer;
-			std::vector<Vertex> vertices;
-			std::vector<rtVertex> rtVertices;
+			GeometryRange range; // aligned to the vertex size of the format
+			bool shared = false;
 		} _vertices;
 
 		struct Indices {
-			int count;
-			AllocatedBuffer indexBuffer;
+			VkDeviceSize size = 0; // bytes, primitives with 16 and 32 bit indices are packed in the same range
+			GeometryRange range;
+			bool shared = false;
 		} _indices;
 
 		std::vector<Node*> _roots;
 
+		Impostor* _impostor = nullptr; // drawn instead of the nodes when far enough, none by default
+
 		Prefab();
-		Prefab(Mesh& mesh, const std::string& materialName = "default");
+		Prefab(Mesh& mesh, const std::string& materialName = "default", VertexFormat vertexFormat = VERTEX_FORMAT_FULL);
 		virtual ~Prefab();
 
-		void draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout);
+		// A null layout draws the primitives without pushing the per object constants. The vertex arena has to be
+		// bound already, pass the index type bound so far to keep the index arena bound from one prefab to the next.
+		void draw(glm::mat4& model, VkCommandBuffer commandBuffer, VkPipelineLayout layout, VkIndexType* boundIndexType = nullptr,
+			const LodSelector* lodSelector = nullptr);
+
+		// First vertex of the prefab in the vertex arena
+		int32_t get_vertex_offset() const;
+
+		// Device addresses of the geometry, for the acceleration structure builds
+		uint64_t get_vertex_address() const;
+		uint64_t get_index_address() const;
+
+		// Allocates the vertex and index ranges and fills them from the given data, vertices must be of the given format.
+		// The index data holds the indices of every primitive at the offset given by its firstIndex and index type.
+		// Returns false if the arenas can not fit the geometry, the prefab is then left with the placeholder geometry.
+		bool upload_geometry(VertexFormat format, const void* vertices, uint32_t vertexCount, const void* indexData, VkDeviceSize indexDataSize);
+
+		// Staging memory of the upload batcher the geometry is written into, vertices first and indices after them
+		struct GeometryStaging {
+			void* vertices = nullptr;
+			unsigned char* indices = nullptr;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+		};
+
+		// Same as upload_geometry for loaders that convert their data straight into the staging memory. Nothing else
+		// may be queued on the upload batcher until end_geometry_upload records the copies to the arenas.
+		bool begin_geometry_upload(VertexFormat format, uint32_t vertexCount, VkDeviceSize indexDataSize, GeometryStaging& outStaging);
+		void end_geometry_upload(const GeometryStaging& staging);
+
+		// Returns the ranges the prefab owns to the arenas
+		void free_geometry();
 
 		//Manager to cache loaded prefabs
-		static std::map<std::string, Prefab*> sPrefabsLoaded;
-		static Prefab* get(const char* filename);
+		static ResourceRegistry<Prefab> sPrefabsLoaded;
+		// Files that use KHR_mesh_quantization are always imported with quantized vertices
+		static Prefab* get(const char* filename, VertexFormat vertexFormat = VERTEX_FORMAT_FULL);
+		// Returns right away with a prefab that draws nothing, the file is imported and cooked on the worker threads
+		// and its resources are created by the update_pending_loads call that follows
+		static Prefab* get_async(const char* filename, VertexFormat vertexFormat = VERTEX_FORMAT_FULL);
+		// Swaps in the prefabs whose import finished, call it from the main thread at a frame boundary.
+		// Returns true when any of them changed, the acceleration structures and descriptors have to be updated then.
+		static bool update_pending_loads();
+		static bool has_pending_loads();
 		void register_prefab(const char* name);
+
+		bool is_loaded() const { return _loadState == PREFAB_LOADED; }
 	};
 }
 
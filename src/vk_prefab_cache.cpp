@@ -0,0 +1,724 @@
+#include "vk_prefab_cache.h"
+#include "vk_prefab.h"
+#include "vk_material.h"
+#include "vk_textures.h"
+#include "vk_gltf_loader.h"
+#include "vk_render_engine.h"
+#include "vk_initializers.h"
+#include "vk_utils.h"
+#include "vk_mesh_simplifier.h"
+#include <algorithm>
+#include <functional>
+
+#define COOKED_PREFAB_MAGIC 0x46504B56 // "VKPF"
+#define COOKED_SECTION_ALIGNMENT 16
+
+// All the structs below are written as they are in memory, they must stay POD
+struct CookedHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexFormat;
+	uint32_t requestedVertexFormat; // what the import was asked for, files using KHR_mesh_quantization are always quantized
+	uint32_t vertexSize;
+	uint32_t nodeCount;
+	uint32_t primitiveCount;
+	uint32_t materialCount;
+	uint32_t textureCount;
+	uint32_t vertexCount;
+	uint32_t indexDataSize; // bytes, the primitives mix 16 and 32 bit indices
+	uint32_t lodCount;
+	uint32_t lodLevels; // settings the chains were built with, they are built again when the settings change
+	uint32_t lodMinTriangles;
+	float lodReduction;
+	float lodMaxError;
+	uint64_t nodesOffset;
+	uint64_t primitivesOffset;
+	uint64_t materialsOffset;
+	uint64_t texturesOffset;
+	uint64_t verticesOffset;
+	uint64_t indicesOffset;
+	uint64_t lodsOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+};
+
+// Nodes are stored in depth first order so the parent is always written before its children
+struct CookedNode
+{
+	glm::mat4 model;
+	int32_t parent;
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint32_t hasMesh;
+	uint32_t firstPrimitive;
+	uint32_t primitiveCount;
+	uint32_t opaque;
+	uint32_t visible;
+};
+
+struct CookedPrimitive
+{
+	uint32_t firstVertex;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t vertexCount;
+	uint32_t indexType; // VkIndexType, firstIndex counts indices of this type
+	uint32_t firstLod;
+	uint32_t lodCount;
+	int32_t material;
+	glm::vec4 dequantization;
+};
+
+struct CookedLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
+
+struct CookedMaterial
+{
+	glm::vec4 color;
+	glm::vec4 emissiveFactor;
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	int32_t type;
+	float roughnessFactor;
+	float metallicFactor;
+	float tillingFactor;
+	int32_t colorTexture;
+	int32_t emissiveTexture;
+	int32_t metallicRoughnessTexture;
+	int32_t occlusionTexture;
+	int32_t normalTexture;
+};
+
+struct CookedTexture
+{
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t mipLevels;
+	uint64_t dataOffset;
+	uint64_t dataSize;
+	uint64_t contentHash; // of the cooked levels, lets the loader reuse a texture already on the GPU without reading them
+};
+
+static uint32_t add_string(std::string& strings, const std::string& str)
+{
+	uint32_t offset = static_cast<uint32_t>(strings.size());
+	strings += str;
+	return offset;
+}
+
+static int32_t find_index(const std::vector<VKE::Texture*>& textures, const VKE::Texture* texture)
+{
+	if (!texture) return -1;
+	auto it = std::find(textures.begin(), textures.end(), texture);
+	return it != textures.end() ? static_cast<int32_t>(it - textures.begin()) : -1;
+}
+
+static int32_t find_index(const std::vector<VKE::Material*>& materials, const VKE::Material* material)
+{
+	auto it = std::find(materials.begin(), materials.end(), material);
+	return it != materials.end() ? static_cast<int32_t>(it - materials.begin()) : -1;
+}
+
+static void collect_nodes(const VKE::Node* node, int32_t parent, const PrefabCookData& cookData, std::string& strings,
+	std::vector<CookedNode>& nodes, std::vector<CookedPrimitive>& primitives, std::vector<CookedLod>& lods)
+{
+	CookedNode cookedNode{};
+	cookedNode.model = node->_model;
+	cookedNode.parent = parent;
+	cookedNode.nameOffset = add_string(strings, node->_name);
+	cookedNode.nameLength = static_cast<uint32_t>(node->_name.size());
+	cookedNode.opaque = node->_opaque ? 1 : 0;
+	cookedNode.visible = node->_visible ? 1 : 0;
+	cookedNode.hasMesh = node->_mesh != nullptr ? 1 : 0;
+	cookedNode.firstPrimitive = static_cast<uint32_t>(primitives.size());
+
+	if (node->_mesh)
+	{
+		for (const Primitive* primitive : node->_mesh->_primitives)
+		{
+			CookedPrimitive cookedPrimitive{};
+			cookedPrimitive.firstVertex = primitive->firstVertex;
+			cookedPrimitive.firstIndex = primitive->firstIndex;
+			cookedPrimitive.indexCount = primitive->indexCount;
+			cookedPrimitive.vertexCount = primitive->vertexCount;
+			cookedPrimitive.indexType = static_cast<uint32_t>(primitive->indexType);
+			cookedPrimitive.firstLod = static_cast<uint32_t>(lods.size());
+			cookedPrimitive.lodCount = static_cast<uint32_t>(primitive->lods.size());
+			cookedPrimitive.material = find_index(cookData.materials, &primitive->material);
+			cookedPrimitive.dequantization = primitive->dequantization;
+			primitives.push_back(cookedPrimitive);
+
+			for (const PrimitiveLod& lod : primitive->lods)
+			{
+				lods.push_back(CookedLod{ lod.firstIndex, lod.indexCount, lod.error });
+			}
+		}
+	}
+
+	cookedNode.primitiveCount = static_cast<uint32_t>(primitives.size()) - cookedNode.firstPrimitive;
+
+	int32_t nodeIndex = static_cast<int32_t>(nodes.size());
+	nodes.push_back(cookedNode);
+
+	for (const VKE::Node* child : node->_children)
+	{
+		collect_nodes(child, nodeIndex, cookData, strings, nodes, primitives, lods);
+	}
+}
+
+static void write_padding(std::ofstream& file, uint64_t& offset)
+{
+	static const char zeros[COOKED_SECTION_ALIGNMENT] = {};
+	uint64_t aligned = vkutil::get_aligned_size(offset, COOKED_SECTION_ALIGNMENT);
+	file.write(zeros, aligned - offset);
+	offset = aligned;
+}
+
+static uint64_t write_section(std::ofstream& file, uint64_t& offset, const void* data, size_t size)
+{
+	write_padding(file, offset);
+	uint64_t sectionOffset = offset;
+	if (size > 0)
+	{
+		file.write(static_cast<const char*>(data), size);
+	}
+	offset += size;
+	return sectionOffset;
+}
+
+std::string vkcook::get_cooked_filename(const std::string& sourceFilename)
+{
+	size_t extpos = sourceFilename.rfind('.');
+	return (extpos != std::string::npos ? sourceFilename.substr(0, extpos) : sourceFilename) + COOKED_PREFAB_EXTENSION;
+}
+
+bool vkcook::is_cooked_prefab_up_to_date(const std::string& sourceFilename, const std::string& cookedFilename)
+{
+	// A cooked prefab without its source is still valid, that is how they are shipped
+	return vkutil::is_cooked_file_up_to_date(sourceFilename, cookedFilename);
+}
+
+bool vkcook::write_cooked_prefab(const std::string& cookedFilename, const VKE::Prefab& prefab, const PrefabCookData& cookData)
+{
+	std::string strings;
+	std::vector<CookedNode> nodes;
+	std::vector<CookedPrimitive> primitives;
+	std::vector<CookedLod> lods;
+	std::vector<CookedMaterial> materials;
+	std::vector<CookedTexture> textures;
+
+	for (const VKE::Node* root : prefab._roots)
+	{
+		collect_nodes(root, -1, cookData, strings, nodes, primitives, lods);
+	}
+
+	for (const VKE::Material* material : cookData.materials)
+	{
+		CookedMaterial cookedMaterial{};
+		cookedMaterial.nameOffset = add_string(strings, material->_name);
+		cookedMaterial.nameLength = static_cast<uint32_t>(material->_name.size());
+		cookedMaterial.type = static_cast<int32_t>(material->_type);
+		cookedMaterial.color = material->_color;
+		cookedMaterial.emissiveFactor = material->_emissive_factor;
+		cookedMaterial.roughnessFactor = material->_roughness_factor;
+		cookedMaterial.metallicFactor = material->_metallic_factor;
+		cookedMaterial.tillingFactor = material->_tilling_factor;
+		cookedMaterial.colorTexture = find_index(cookData.textureHandles, material->_color_texture);
+		cookedMaterial.emissiveTexture = find_index(cookData.textureHandles, material->_emissive_texture);
+		cookedMaterial.metallicRoughnessTexture = find_index(cookData.textureHandles, material->_metallic_roughness_texture);
+		cookedMaterial.occlusionTexture = find_index(cookData.textureHandles, material->_occlusion_texture);
+		cookedMaterial.normalTexture = find_index(cookData.textureHandles, material->_normal_texture);
+		materials.push_back(cookedMaterial);
+	}
+
+	assert(cookData.textures.size() == cookData.textureHandles.size());
+
+	std::ofstream file(cookedFilename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "[ERROR] Could not write cooked prefab " << cookedFilename << std::endl;
+		return false;
+	}
+
+	CookedHeader header{};
+	header.magic = COOKED_PREFAB_MAGIC;
+	header.version = COOKED_PREFAB_VERSION;
+	header.vertexFormat = static_cast<uint32_t>(cookData.vertexFormat);
+	header.requestedVertexFormat = static_cast<uint32_t>(cookData.requestedVertexFormat);
+	header.vertexSize = static_cast<uint32_t>(vkutil::get_vertex_size(cookData.vertexFormat));
+	header.nodeCount = static_cast<uint32_t>(nodes.size());
+	header.primitiveCount = static_cast<uint32_t>(primitives.size());
+	header.materialCount = static_cast<uint32_t>(materials.size());
+	header.textureCount = static_cast<uint32_t>(cookData.textures.size());
+	header.vertexCount = static_cast<uint32_t>(cookData.vertexFormat == VERTEX_FORMAT_QUANTIZED ? cookData.quantizedVertices.size() : cookData.vertices.size());
+	header.indexDataSize = static_cast<uint32_t>(cookData.indexData.size());
+	header.lodCount = static_cast<uint32_t>(lods.size());
+	const LodSettings& lodSettings = vkmeshopt::get_lod_settings();
+	header.lodLevels = lodSettings.levelCount;
+	header.lodMinTriangles = lodSettings.minTriangles;
+	header.lodReduction = lodSettings.reduction;
+	header.lodMaxError = lodSettings.maxError;
+
+	// The header is written again at the end once all the offsets are known
+	uint64_t offset = 0;
+	write_section(file, offset, &header, sizeof(CookedHeader));
+
+	// Texture payloads go first so the table can point to them
+	for (size_t i = 0; i < cookData.textures.size(); i++)
+	{
+		const CookedTextureData& texture = cookData.textures[i];
+		const std::string& name = cookData.textureHandles[i]->_name;
+
+		CookedTexture cookedTexture{};
+		cookedTexture.nameOffset = add_string(strings, name);
+		cookedTexture.nameLength = static_cast<uint32_t>(name.size());
+		cookedTexture.width = texture.width;
+		cookedTexture.height = texture.height;
+		cookedTexture.format = static_cast<uint32_t>(texture.format);
+		cookedTexture.mipLevels = texture.mipLevels;
+		cookedTexture.dataSize = texture.pixels.size();
+		cookedTexture.contentHash = vkutil::hash_image(texture.pixels.data(), texture.pixels.size(), texture.width, texture.height, texture.format, texture.mipLevels);
+		cookedTexture.dataOffset = write_section(file, offset, texture.pixels.data(), texture.pixels.size());
+		textures.push_back(cookedTexture);
+	}
+
+	if (cookData.vertexFormat == VERTEX_FORMAT_QUANTIZED)
+	{
+		header.verticesOffset = write_section(file, offset, cookData.quantizedVertices.data(), cookData.quantizedVertices.size() * sizeof(QuantizedVertex));
+	}
+	else
+	{
+		header.verticesOffset = write_section(file, offset, cookData.vertices.data(), cookData.vertices.size() * sizeof(Vertex));
+	}
+	header.indicesOffset = write_section(file, offset, cookData.indexData.data(), cookData.indexData.size());
+	header.nodesOffset = write_section(file, offset, nodes.data(), nodes.size() * sizeof(CookedNode));
+	header.primitivesOffset = write_section(file, offset, primitives.data(), primitives.size() * sizeof(CookedPrimitive));
+	header.lodsOffset = write_section(file, offset, lods.data(), lods.size() * sizeof(CookedLod));
+	header.materialsOffset = write_section(file, offset, materials.data(), materials.size() * sizeof(CookedMaterial));
+	header.texturesOffset = write_section(file, offset, textures.data(), textures.size() * sizeof(CookedTexture));
+	header.stringsOffset = write_section(file, offset, strings.data(), strings.size());
+	header.stringsSize = strings.size();
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(CookedHeader));
+
+	if (!file.good())
+	{
+		std::cout << "[ERROR] Failed writing cooked prefab " << cookedFilename << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool has_lod_settings(const CookedHeader& header, const LodSettings& settings)
+{
+	return header.lodLevels == settings.levelCount && header.lodMinTriangles == settings.minTriangles &&
+		header.lodReduction == settings.reduction && header.lodMaxError == settings.maxError;
+}
+
+static bool is_section_valid(const MappedFile& file, uint64_t offset, uint64_t size)
+{
+	return offset <= file.size && size <= file.size - offset;
+}
+
+bool vkcook::open_cooked_prefab(const std::string& cookedFilename, VertexFormat requestedVertexFormat, MappedFile& file)
+{
+	if (!file.open(cookedFilename))
+	{
+		return false;
+	}
+
+	if (file.size < sizeof(CookedHeader))
+	{
+		std::cout << "[ERROR] Cooked prefab " << cookedFilename << " is truncated" << std::endl;
+		file.close();
+		return false;
+	}
+
+	const CookedHeader& header = *reinterpret_cast<const CookedHeader*>(file.data);
+	if (header.magic != COOKED_PREFAB_MAGIC || header.version != COOKED_PREFAB_VERSION ||
+		header.vertexFormat > VERTEX_FORMAT_QUANTIZED || header.vertexSize != vkutil::get_vertex_size(static_cast<VertexFormat>(header.vertexFormat)) ||
+		header.requestedVertexFormat != static_cast<uint32_t>(requestedVertexFormat) || !has_lod_settings(header, vkmeshopt::get_lod_settings()))
+	{
+		// Written by an older version of the engine, it will be cooked again
+		file.close();
+		return false;
+	}
+
+	if (!is_section_valid(file, header.nodesOffset, header.nodeCount * sizeof(CookedNode)) ||
+		!is_section_valid(file, header.primitivesOffset, header.primitiveCount * sizeof(CookedPrimitive)) ||
+		!is_section_valid(file, header.lodsOffset, header.lodCount * sizeof(CookedLod)) ||
+		!is_section_valid(file, header.materialsOffset, header.materialCount * sizeof(CookedMaterial)) ||
+		!is_section_valid(file, header.texturesOffset, header.textureCount * sizeof(CookedTexture)) ||
+		!is_section_valid(file, header.verticesOffset, uint64_t(header.vertexCount) * header.vertexSize) ||
+		!is_section_valid(file, header.indicesOffset, header.indexDataSize) ||
+		!is_section_valid(file, header.stringsOffset, header.stringsSize) ||
+		header.vertexCount == 0 || header.nodeCount == 0)
+	{
+		std::cout << "[ERROR] Cooked prefab " << cookedFilename << " is corrupted" << std::endl;
+		file.close();
+		return false;
+	}
+
+	// Checked before creating anything, the prefab is imported again from the source when the device cannot sample them
+	const CookedTexture* cookedTextures = reinterpret_cast<const CookedTexture*>(file.data + header.texturesOffset);
+	for (uint32_t i = 0; i < header.textureCount; i++)
+	{
+		const CookedTexture& cookedTexture = cookedTextures[i];
+		VkFormat format = static_cast<VkFormat>(cookedTexture.format);
+		if (vkbc::is_block_compressed(format) && !vkbc::is_format_supported(format))
+		{
+			std::cout << "[ERROR] Cooked prefab " << cookedFilename << " uses texture formats this device cannot sample" << std::endl;
+			file.close();
+			return false;
+		}
+
+		if (!is_section_valid(file, cookedTexture.dataOffset, cookedTexture.dataSize) ||
+			cookedTexture.mipLevels == 0 || cookedTexture.mipLevels > vkutil::get_mip_levels(cookedTexture.width, cookedTexture.height) ||
+			cookedTexture.dataSize < vkutil::get_mip_chain_size(cookedTexture.width, cookedTexture.height, cookedTexture.mipLevels, format))
+		{
+			std::cout << "[ERROR] Cooked prefab " << cookedFilename << " has a corrupted texture" << std::endl;
+			file.close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// The levels of a cooked texture no material uses stay in the cooked file, they are read again if one ever does
+static void defer_cooked_texture(const std::string& cookedFilename, const CookedTexture& cookedTexture, VKE::Texture& texture)
+{
+	texture._pendingUpload = [cookedFilename, cookedTexture](VKE::Texture& target) {
+		MappedFile file;
+		if (!file.open(cookedFilename) || !is_section_valid(file, cookedTexture.dataOffset, cookedTexture.dataSize))
+		{
+			return false;
+		}
+
+		// The prefab may have been cooked again since it was loaded
+		const unsigned char* pixels = file.data + cookedTexture.dataOffset;
+		const VkFormat format = static_cast<VkFormat>(cookedTexture.format);
+		if (vkutil::hash_image(pixels, cookedTexture.dataSize, cookedTexture.width, cookedTexture.height, format, cookedTexture.mipLevels) != cookedTexture.contentHash)
+		{
+			return false;
+		}
+
+		ImageUploadData upload{ pixels, static_cast<int>(cookedTexture.width), static_cast<int>(cookedTexture.height), format, cookedTexture.mipLevels };
+		return vkutil::upload_texture(upload, target);
+	};
+}
+
+// Ranges are counted in vertices and in indices of the primitive's type, the draws would read other prefabs' geometry
+static bool is_primitive_valid(const CookedHeader& header, const CookedPrimitive& cookedPrimitive, const CookedLod* cookedLods)
+{
+	const uint64_t indexSize = cookedPrimitive.indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+	if (uint64_t(cookedPrimitive.firstVertex) + cookedPrimitive.vertexCount > header.vertexCount ||
+		(uint64_t(cookedPrimitive.firstIndex) + cookedPrimitive.indexCount) * indexSize > header.indexDataSize ||
+		uint64_t(cookedPrimitive.firstLod) + cookedPrimitive.lodCount > header.lodCount)
+	{
+		return false;
+	}
+
+	for (uint32_t l = 0; l < cookedPrimitive.lodCount; l++)
+	{
+		const CookedLod& cookedLod = cookedLods[cookedPrimitive.firstLod + l];
+		if ((uint64_t(cookedLod.firstIndex) + cookedLod.indexCount) * indexSize > header.indexDataSize)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool vkcook::create_cooked_prefab(const std::string& cookedFilename, const MappedFile& file, VKE::Prefab& prefab)
+{
+	const CookedHeader& header = *reinterpret_cast<const CookedHeader*>(file.data);
+
+	const CookedNode* cookedNodes = reinterpret_cast<const CookedNode*>(file.data + header.nodesOffset);
+	const CookedPrimitive* cookedPrimitives = reinterpret_cast<const CookedPrimitive*>(file.data + header.primitivesOffset);
+	const CookedLod* cookedLods = reinterpret_cast<const CookedLod*>(file.data + header.lodsOffset);
+	const CookedMaterial* cookedMaterials = reinterpret_cast<const CookedMaterial*>(file.data + header.materialsOffset);
+	const CookedTexture* cookedTextures = reinterpret_cast<const CookedTexture*>(file.data + header.texturesOffset);
+	const char* strings = reinterpret_cast<const char*>(file.data + header.stringsOffset);
+
+	auto get_string = [&](uint32_t offset, uint32_t length) {
+		if (uint64_t(offset) + length > header.stringsSize) return std::string();
+		return std::string(strings + offset, length);
+	};
+
+	// Geometry blobs go straight from the mapping to the staging buffers. First, so nothing else is created for
+	// a prefab the arenas have no room for.
+	const bool dequantize = header.vertexFormat == VERTEX_FORMAT_QUANTIZED && !RenderEngine::_quantizedVerticesSupported;
+	if (dequantize)
+	{
+		// Quantized vertices could not be drawn, they are expanded per primitive since each has its own dequantization
+		std::vector<Vertex> vertices(header.vertexCount, Vertex{});
+		const QuantizedVertex* quantizedVertices = reinterpret_cast<const QuantizedVertex*>(file.data + header.verticesOffset);
+		for (uint32_t i = 0; i < header.primitiveCount; i++)
+		{
+			const CookedPrimitive& cookedPrimitive = cookedPrimitives[i];
+			if (is_primitive_valid(header, cookedPrimitive, cookedLods))
+			{
+				vkutil::dequantize_vertices(quantizedVertices + cookedPrimitive.firstVertex, cookedPrimitive.vertexCount,
+					cookedPrimitive.dequantization, vertices.data() + cookedPrimitive.firstVertex);
+			}
+		}
+
+		if (!prefab.upload_geometry(VERTEX_FORMAT_FULL, vertices.data(), header.vertexCount, file.data + header.indicesOffset, header.indexDataSize))
+		{
+			return false;
+		}
+	}
+	else if (!prefab.upload_geometry(static_cast<VertexFormat>(header.vertexFormat), file.data + header.verticesOffset, header.vertexCount,
+		file.data + header.indicesOffset, header.indexDataSize))
+	{
+		return false;
+	}
+
+	// Only the textures of the materials are uploaded now
+	std::vector<bool> referenced(header.textureCount, false);
+	for (uint32_t i = 0; i < header.materialCount; i++)
+	{
+		const CookedMaterial& cookedMaterial = cookedMaterials[i];
+		for (int32_t index : { cookedMaterial.colorTexture, cookedMaterial.emissiveTexture, cookedMaterial.metallicRoughnessTexture,
+			cookedMaterial.occlusionTexture, cookedMaterial.normalTexture })
+		{
+			if (index >= 0 && index < static_cast<int32_t>(header.textureCount)) referenced[index] = true;
+		}
+	}
+
+	// Textures
+	std::vector<VKE::Texture*> textures;
+	textures.reserve(header.textureCount);
+	for (uint32_t i = 0; i < header.textureCount; i++)
+	{
+		const CookedTexture& cookedTexture = cookedTextures[i];
+		VkFormat format = static_cast<VkFormat>(cookedTexture.format);
+
+		// Another prefab already uploaded the same texture
+		ImageUploadData upload{ file.data + cookedTexture.dataOffset, static_cast<int>(cookedTexture.width), static_cast<int>(cookedTexture.height), format, cookedTexture.mipLevels };
+		VKE::Texture* cached = VKE::Texture::sTexturesByContent.find(cookedTexture.contentHash);
+		if (cached && vkutil::has_texture_description(upload, *cached))
+		{
+			textures.push_back(cached);
+			continue;
+		}
+
+		// Deferred textures get their description now too, later prefabs compare against it
+		VKE::Texture* texture = new VKE::Texture();
+		texture->_contentHash = cookedTexture.contentHash;
+		vkutil::set_texture_description(upload, *texture);
+		VKE::Texture::sTexturesByContent.insert(cookedTexture.contentHash, texture);
+
+		if (referenced[i])
+		{
+			vkutil::upload_texture(upload, *texture);
+		}
+		else
+		{
+			defer_cooked_texture(cookedFilename, cookedTexture, *texture);
+		}
+
+		// Names already taken get a generated one so the textures of other prefabs are not replaced
+		std::string name = get_string(cookedTexture.nameOffset, cookedTexture.nameLength);
+		texture->register_texture(VKE::Texture::get(name.c_str()) ? "" : name.c_str());
+		textures.push_back(texture);
+	}
+
+	auto get_texture = [&](int32_t index) {
+		return index >= 0 && index < static_cast<int32_t>(textures.size()) ? textures[index] : nullptr;
+	};
+
+	// Materials
+	std::vector<VKE::Material*> materials;
+	materials.reserve(header.materialCount);
+	for (uint32_t i = 0; i < header.materialCount; i++)
+	{
+		const CookedMaterial& cookedMaterial = cookedMaterials[i];
+
+		VKE::Material* material = new VKE::Material();
+		material->_type = static_cast<VKE::MaterialType>(cookedMaterial.type);
+		material->_color = cookedMaterial.color;
+		material->_emissive_factor = cookedMaterial.emissiveFactor;
+		material->_roughness_factor = cookedMaterial.roughnessFactor;
+		material->_metallic_factor = cookedMaterial.metallicFactor;
+		material->_tilling_factor = cookedMaterial.tillingFactor;
+		material->_color_texture = get_texture(cookedMaterial.colorTexture);
+		material->_emissive_texture = get_texture(cookedMaterial.emissiveTexture);
+		material->_metallic_roughness_texture = get_texture(cookedMaterial.metallicRoughnessTexture);
+		material->_occlusion_texture = get_texture(cookedMaterial.occlusionTexture);
+		material->_normal_texture = get_texture(cookedMaterial.normalTexture);
+
+		std::string name = get_string(cookedMaterial.nameOffset, cookedMaterial.nameLength);
+		material->_name = name;
+
+		VKE::Material* cached = material->find_or_cache_content();
+		if (cached)
+		{
+			delete material;
+			materials.push_back(cached);
+			continue;
+		}
+
+		material->register_material(VKE::Material::get(name.c_str()) ? "" : name.c_str());
+		materials.push_back(material);
+	}
+
+	// Node tree
+	std::vector<VKE::Node*> nodes(header.nodeCount, nullptr);
+	for (uint32_t i = 0; i < header.nodeCount; i++)
+	{
+		const CookedNode& cookedNode = cookedNodes[i];
+
+		VKE::Node* node = new VKE::Node();
+		node->_name = get_string(cookedNode.nameOffset, cookedNode.nameLength);
+		node->_model = cookedNode.model;
+		node->_opaque = cookedNode.opaque != 0;
+		node->_visible = cookedNode.visible != 0;
+
+		if (cookedNode.hasMesh)
+		{
+			node->_mesh = new VKE::Mesh();
+			for (uint32_t p = 0; p < cookedNode.primitiveCount && cookedNode.firstPrimitive + p < header.primitiveCount; p++)
+			{
+				const CookedPrimitive& cookedPrimitive = cookedPrimitives[cookedNode.firstPrimitive + p];
+				if (!is_primitive_valid(header, cookedPrimitive, cookedLods))
+				{
+					std::cout << "[ERROR] Cooked prefab " << cookedFilename << " has a primitive outside of its geometry" << std::endl;
+					continue;
+				}
+
+				VKE::Material* material = cookedPrimitive.material >= 0 && cookedPrimitive.material < static_cast<int32_t>(materials.size()) ?
+					materials[cookedPrimitive.material] : VKE::Material::get("default");
+
+				Primitive* primitive = new Primitive(cookedPrimitive.firstVertex, cookedPrimitive.firstIndex,
+					cookedPrimitive.indexCount, cookedPrimitive.vertexCount, *material);
+				primitive->indexType = cookedPrimitive.indexType == VK_INDEX_TYPE_UINT16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+				for (uint32_t l = 0; l < cookedPrimitive.lodCount; l++)
+				{
+					const CookedLod& cookedLod = cookedLods[cookedPrimitive.firstLod + l];
+					primitive->lods.push_back(PrimitiveLod{ cookedLod.firstIndex, cookedLod.indexCount, cookedLod.error });
+				}
+				primitive->dequantization = dequantize ? glm::vec4(0.0f) : cookedPrimitive.dequantization;
+				node->_mesh->_primitives.push_back(primitive);
+			}
+		}
+
+		// Parents are always written before their children
+		if (cookedNode.parent >= 0 && cookedNode.parent < static_cast<int32_t>(i))
+		{
+			node->_parent = nodes[cookedNode.parent];
+			nodes[cookedNode.parent]->_children.push_back(node);
+		}
+		else
+		{
+			prefab._roots.push_back(node);
+		}
+
+		nodes[i] = node;
+	}
+
+	return true;
+}
+
+VKE::Prefab* vkcook::load_cooked_prefab(const std::string& cookedFilename, VertexFormat requestedVertexFormat)
+{
+	MappedFile file;
+	if (!open_cooked_prefab(cookedFilename, requestedVertexFormat, file))
+	{
+		return nullptr;
+	}
+
+	VKE::Prefab* prefab = new VKE::Prefab();
+	if (!create_cooked_prefab(cookedFilename, file, *prefab))
+	{
+		delete prefab;
+		return nullptr;
+	}
+	return prefab;
+}
+
+bool vkcook::cook_prefab(const std::string& sourceFilename, VertexFormat vertexFormat)
+{
+	PrefabCookData cookData;
+	cookData.requestedVertexFormat = vertexFormat;
+	VKE::Prefab* prefab = load_glTF(sourceFilename, 1.0f, &cookData, vertexFormat);
+	if (!prefab)
+	{
+		std::cout << "[ERROR] Could not import " << sourceFilename << std::endl;
+		return false;
+	}
+
+	bool cooked = write_cooked_prefab(get_cooked_filename(sourceFilename), *prefab, cookData);
+
+	// The imported prefab is already on the GPU, keep it so it is not imported again
+	if (!VKE::Prefab::sPrefabsLoaded.contains(sourceFilename))
+	{
+		prefab->register_prefab(sourceFilename.c_str());
+	}
+
+	return cooked;
+}
+
+// Meshes and primitives of an import that was never registered, every node of a glTF file gets its own mesh
+static void delete_imported_meshes(VKE::Node& node)
+{
+	for (VKE::Node* child : node._children)
+	{
+		delete_imported_meshes(*child);
+	}
+
+	if (node._mesh)
+	{
+		for (Primitive* primitive : node._mesh->_primitives)
+		{
+			delete primitive;
+		}
+		delete node._mesh;
+		node._mesh = nullptr;
+	}
+}
+
+bool vkcook::cook_prefab_offline(const std::string& sourceFilename, VertexFormat vertexFormat)
+{
+	PrefabCookData cookData;
+	cookData.requestedVertexFormat = vertexFormat;
+	VKE::Prefab* prefab = load_glTF(sourceFilename, 1.0f, &cookData, vertexFormat, false);
+	if (!prefab)
+	{
+		std::cout << "[ERROR] Could not import " << sourceFilename << std::endl;
+		return false;
+	}
+
+	bool cooked = write_cooked_prefab(get_cooked_filename(sourceFilename), *prefab, cookData);
+
+	// Nothing of the import was registered, it is only needed to write the file. Nodes do not own their mesh.
+	for (VKE::Node* root : prefab->_roots)
+	{
+		delete_imported_meshes(*root);
+		delete root;
+	}
+	prefab->_roots.clear();
+	delete prefab;
+
+	for (VKE::Texture* texture : cookData.textureHandles)
+	{
+		delete texture;
+	}
+	for (VKE::Material* material : cookData.materials)
+	{
+		delete material;
+	}
+
+	return cooked;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+#include <string>
+#include <vector>
+
+struct MappedFile;
+
+namespace VKE
+{
+	class Prefab;
+	class Texture;
+	class Material;
+}
+
+// Increase it every time the layout of the cooked file or of the vertex structs changes, or the importer output does
+#define COOKED_PREFAB_VERSION 10
+#define COOKED_PREFAB_EXTENSION ".vkprefab"
+
+struct CookedTextureData
+{
+	uint32_t width;
+	uint32_t height;
+	VkFormat format;
+	uint32_t mipLevels = 1;
+	std::vector<unsigned char> pixels; // every mip level packed one after another, block compressed when the format is
+};
+
+// Everything the glTF importer produces that is needed to rebuild the prefab without the source file
+struct PrefabCookData
+{
+	VertexFormat requestedVertexFormat = VERTEX_FORMAT_FULL;
+	VertexFormat vertexFormat = VERTEX_FORMAT_FULL;
+	std::vector<Vertex> vertices; // only one of the vertex arrays is filled, depending on the format
+	std::vector<QuantizedVertex> quantizedVertices;
+	std::vector<unsigned char> indexData; // 16 and 32 bit indices of the primitives, each aligned to its index size
+
+	std::vector<CookedTextureData> textures;
+	std::vector<VKE::Texture*> textureHandles; // same order as textures
+	std::vector<VKE::Material*> materials;
+};
+
+namespace vkcook {
+
+	std::string get_cooked_filename(const std::string& sourceFilename);
+
+	bool is_cooked_prefab_up_to_date(const std::string& sourceFilename, const std::string& cookedFilename);
+
+	bool write_cooked_prefab(const std::string& cookedFilename, const VKE::Prefab& prefab, const PrefabCookData& cookData);
+
+	// Maps the cooked file and uploads its blobs directly, returns nullptr if the file is missing, outdated
+	// or was imported asking for a different vertex format
+	VKE::Prefab* load_cooked_prefab(const std::string& cookedFilename, VertexFormat requestedVertexFormat = VERTEX_FORMAT_FULL);
+
+	// The two halves of load_cooked_prefab. Opening maps and validates the file and is safe on the worker threads,
+	// creating the resources from a validated file has to happen on the main thread. Creating fails if the
+	// geometry arenas have no room for the prefab.
+	bool open_cooked_prefab(const std::string& cookedFilename, VertexFormat requestedVertexFormat, MappedFile& outFile);
+	bool create_cooked_prefab(const std::string& cookedFilename, const MappedFile& file, VKE::Prefab& prefab);
+
+	// Imports a glTF file and writes its cooked version next to it
+	bool cook_prefab(const std::string& sourceFilename, VertexFormat vertexFormat = VERTEX_FORMAT_FULL);
+
+	// Same as cook_prefab without creating or registering any resource, safe on the worker threads
+	bool cook_prefab_offline(const std::string& sourceFilename, VertexFormat vertexFormat = VERTEX_FORMAT_FULL);
+}
@@ -0,0 +1,132 @@
+#include "vk_profiler.h"
+#include "vk_image_kernels.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+namespace
+{
+	const char* STAGE_NAMES[IMPORT_STAGE_COUNT] = {
+		"file_read",
+		"json_parse",
+		"image_decode",
+		"format_conversion",
+		"accessor_conversion",
+		"staging_copy",
+		"gpu_submit",
+		"blas_build",
+	};
+
+	struct StageCounters
+	{
+		std::atomic<uint64_t> nanoseconds{ 0 };
+		std::atomic<uint64_t> bytes{ 0 };
+		std::atomic<uint64_t> calls{ 0 };
+	};
+
+	StageCounters sStages[IMPORT_STAGE_COUNT];
+}
+
+double ImportStageStatistics::get_throughput() const
+{
+	return seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+const char* vkprofile::get_stage_name(ImportStage stage)
+{
+	return stage < IMPORT_STAGE_COUNT ? STAGE_NAMES[stage] : "unknown";
+}
+
+void vkprofile::add(ImportStage stage, double seconds, uint64_t bytes)
+{
+	StageCounters& counters = sStages[stage];
+	counters.nanoseconds += static_cast<uint64_t>(seconds * 1e9);
+	counters.bytes += bytes;
+	counters.calls++;
+}
+
+ImportStageStatistics vkprofile::get_statistics(ImportStage stage)
+{
+	ImportStageStatistics statistics;
+	statistics.seconds = sStages[stage].nanoseconds.load() * 1e-9;
+	statistics.bytes = sStages[stage].bytes.load();
+	statistics.calls = sStages[stage].calls.load();
+	return statistics;
+}
+
+void vkprofile::reset()
+{
+	for (StageCounters& counters : sStages)
+	{
+		counters.nanoseconds = 0;
+		counters.bytes = 0;
+		counters.calls = 0;
+	}
+}
+
+void vkprofile::print()
+{
+	std::cout << "Import profile (" << vkimage::get_simd_name() << " pixel kernels):" << std::endl;
+	for (int stage = 0; stage < IMPORT_STAGE_COUNT; stage++)
+	{
+		const ImportStageStatistics statistics = get_statistics(static_cast<ImportStage>(stage));
+		std::cout << std::fixed << std::setprecision(2) << "  " << std::left << std::setw(20) << STAGE_NAMES[stage] << std::right
+			<< std::setw(10) << statistics.seconds * 1000.0 << " ms" << std::setw(10) << statistics.bytes / (1024.0 * 1024.0) << " MB"
+			<< std::setw(10) << statistics.get_throughput() << " MB/s" << std::setw(8) << statistics.calls << " calls"
+			<< std::defaultfloat << std::endl;
+	}
+}
+
+bool vkprofile::write_json(const std::string& filename)
+{
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "[ERROR] Could not write " << filename << std::endl;
+		return false;
+	}
+
+	file << "{\n  \"stages\": [\n";
+	for (int stage = 0; stage < IMPORT_STAGE_COUNT; stage++)
+	{
+		const ImportStageStatistics statistics = get_statistics(static_cast<ImportStage>(stage));
+		file << "    { \"name\": \"" << STAGE_NAMES[stage] << "\", \"seconds\": " << statistics.seconds << ", \"bytes\": " << statistics.bytes
+			<< ", \"calls\": " << statistics.calls << ", \"mb_per_second\": " << statistics.get_throughput() << " }"
+			<< (stage + 1 < IMPORT_STAGE_COUNT ? ",\n" : "\n");
+	}
+	file << "  ]\n}\n";
+
+	return file.good();
+}
+
+bool vkprofile::write_csv(const std::string& filename)
+{
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "[ERROR] Could not write " << filename << std::endl;
+		return false;
+	}
+
+	file << "stage,seconds,bytes,calls,mb_per_second\n";
+	for (int stage = 0; stage < IMPORT_STAGE_COUNT; stage++)
+	{
+		const ImportStageStatistics statistics = get_statistics(static_cast<ImportStage>(stage));
+		file << STAGE_NAMES[stage] << "," << statistics.seconds << "," << statistics.bytes << "," << statistics.calls << ","
+			<< statistics.get_throughput() << "\n";
+	}
+
+	return file.good();
+}
+
+ImportStageScope::ImportStageScope(ImportStage stage, uint64_t bytes) : stage(stage), bytes(bytes), start(std::chrono::steady_clock::now())
+{
+}
+
+ImportStageScope::~ImportStageScope()
+{
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	vkprofile::add(stage, elapsed.count(), bytes);
+}
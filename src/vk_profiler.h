@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Stages the asset import time is split into
+enum ImportStage
+{
+	IMPORT_STAGE_FILE_READ, // opening and mapping files, the pages are read by the stage that touches them first
+	IMPORT_STAGE_JSON_PARSE,
+	IMPORT_STAGE_IMAGE_DECODE,
+	IMPORT_STAGE_FORMAT_CONVERSION, // mip chains and block compression
+	IMPORT_STAGE_ACCESSOR_CONVERSION, // glTF accessors to engine vertices and indices
+	IMPORT_STAGE_STAGING_COPY,
+	IMPORT_STAGE_GPU_SUBMIT, // upload submissions and the waits for them
+	IMPORT_STAGE_BLAS_BUILD,
+	IMPORT_STAGE_COUNT
+};
+
+struct ImportStageStatistics
+{
+	double seconds = 0.0; // summed over the threads that ran the stage, parallel stages can exceed the wall time
+	uint64_t bytes = 0;
+	uint64_t calls = 0;
+
+	// Megabytes per second of a single thread
+	double get_throughput() const;
+};
+
+// Process wide counters of the import stages, the loaders add to them from any thread
+namespace vkprofile {
+
+	const char* get_stage_name(ImportStage stage);
+
+	void add(ImportStage stage, double seconds, uint64_t bytes);
+	ImportStageStatistics get_statistics(ImportStage stage);
+	void reset();
+
+	void print();
+	bool write_json(const std::string& filename);
+	bool write_csv(const std::string& filename);
+}
+
+// Adds the time from its construction to its destruction to a stage, with the bytes set by then
+struct ImportStageScope
+{
+	ImportStage stage;
+	uint64_t bytes;
+	std::chrono::steady_clock::time_point start;
+
+	ImportStageScope(ImportStage stage, uint64_t bytes = 0);
+	~ImportStageScope();
+};
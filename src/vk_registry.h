@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Refers to a slot of a ResourceRegistry. The generation tells apart the items that used the same slot,
+// so a handle to a removed item never resolves to the one that replaced it.
+struct RegistryHandle
+{
+	static const uint32_t INVALID_INDEX = UINT32_MAX;
+
+	uint32_t index = INVALID_INDEX;
+	uint32_t generation = 0;
+
+	bool is_valid() const { return index != INVALID_INDEX; }
+};
+
+// Named resources stored densely by slot, the slot being the index the GPU uses for them. Lookups by name are
+// hashed and every operation takes a lock, so the loaders can insert from the worker threads. The registry does not
+// own the items.
+template<typename T>
+class ResourceRegistry
+{
+public:
+
+	// Registers item under name, replacing the item already registered with it, whose slot it takes.
+	// An empty name is replaced with default_name_<index>.
+	RegistryHandle insert(std::string& name, T* item)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		uint32_t index;
+		typename std::unordered_map<std::string, uint32_t>::iterator it = name.empty() ? _indices.end() : _indices.find(name);
+		if (it != _indices.end())
+		{
+			index = it->second;
+		}
+		else if (!_freeSlots.empty())
+		{
+			index = _freeSlots.back();
+			_freeSlots.pop_back();
+		}
+		else
+		{
+			index = static_cast<uint32_t>(_slots.size());
+			_slots.push_back(Slot{});
+		}
+
+		if (name.empty())
+		{
+			name = "default_name_" + std::to_string(index);
+		}
+
+		Slot& slot = _slots[index];
+		if (slot.item != nullptr && slot.item != item)
+		{
+			slot.generation++;
+		}
+		slot.item = item;
+		slot.name = name;
+		_indices[name] = index;
+
+		RegistryHandle handle;
+		handle.index = index;
+		handle.generation = slot.generation;
+		return handle;
+	}
+
+	// Frees the slot of the item registered with name, handles to it stop resolving
+	bool remove(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		typename std::unordered_map<std::string, uint32_t>::iterator it = _indices.find(name);
+		if (it == _indices.end())
+			return false;
+
+		Slot& slot = _slots[it->second];
+		slot.item = nullptr;
+		slot.name.clear();
+		slot.generation++;
+		_freeSlots.push_back(it->second);
+		_indices.erase(it);
+		return true;
+	}
+
+	T* find(const std::string& name) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		typename std::unordered_map<std::string, uint32_t>::const_iterator it = _indices.find(name);
+		return it != _indices.end() ? _slots[it->second].item : nullptr;
+	}
+
+	RegistryHandle find_handle(const std::string& name) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		RegistryHandle handle;
+		typename std::unordered_map<std::string, uint32_t>::const_iterator it = _indices.find(name);
+		if (it != _indices.end())
+		{
+			handle.index = it->second;
+			handle.generation = _slots[it->second].generation;
+		}
+		return handle;
+	}
+
+	// nullptr when the item the handle refers to was removed
+	T* get(RegistryHandle handle) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (handle.index >= _slots.size() || _slots[handle.index].generation != handle.generation)
+			return nullptr;
+		return _slots[handle.index].item;
+	}
+
+	bool contains(const std::string& name) const
+	{
+		return find(name) != nullptr;
+	}
+
+	// Number of slots, free ones included. Every index below it is a valid GPU index.
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _slots.size();
+	}
+
+	// Number of registered items
+	size_t count() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _indices.size();
+	}
+
+	// The items in index order, free slots are nullptr. No sorting needed to fill the GPU arrays.
+	void copy_items(std::vector<T*>& outItems) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		outItems.resize(_slots.size());
+		for (size_t i = 0; i < _slots.size(); i++)
+		{
+			outItems[i] = _slots[i].item;
+		}
+	}
+
+private:
+
+	struct Slot
+	{
+		T* item = nullptr;
+		std::string name;
+		uint32_t generation = 0;
+	};
+
+	std::vector<Slot> _slots;
+	std::vector<uint32_t> _freeSlots;
+	std::unordered_map<std::string, uint32_t> _indices;
+	mutable std::mutex _mutex;
+};
+
+// Items keyed by a hash of their content, so loaders can reuse an identical resource instead of creating another.
+// Like the registry it does not own the items and every operation takes a lock.
+template<typename T>
+class ContentCache
+{
+public:
+
+	T* find(uint64_t hash) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		typename std::unordered_map<uint64_t, T*>::const_iterator it = _items.find(hash);
+		return it != _items.end() ? it->second : nullptr;
+	}
+
+	// Returns the item already cached with the hash, or item when it is the first one
+	T* insert(uint64_t hash, T* item)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		return _items.emplace(hash, item).first->second;
+	}
+
+private:
+
+	std::unordered_map<uint64_t, T*> _items;
+	mutable std::mutex _mutex;
+};
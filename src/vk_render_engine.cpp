@@ -10,18 +10,26 @@
 #include "vk_scene.h"
 #include "vk_textures.h"
 #include "vk_prefab.h"
+#include "vk_impostor.h"
+#include "vk_profiler.h"
 
 #include "VkBootstrap.h"
 
 #include <array>
+#include <algorithm>
 
 VkPhysicalDevice RenderEngine::_physicalDevice = VK_NULL_HANDLE;
 VkDevice RenderEngine::_device = VK_NULL_HANDLE;
 VkQueue RenderEngine::_graphicsQueue = VK_NULL_HANDLE;
 VkSampler RenderEngine::_defaultSampler = VK_NULL_HANDLE;
+VkSampler RenderEngine::_textureSampler = VK_NULL_HANDLE;
 DeletionQueue RenderEngine::_mainDeletionQueue{};
 VmaAllocator RenderEngine::_allocator = nullptr;
 UploadContext RenderEngine::_uploadContext;
+vkupload::UploadBatcher RenderEngine::_uploadBatcher;
+GeometryArena RenderEngine::_vertexArena;
+GeometryArena RenderEngine::_indexArena;
+bool RenderEngine::_quantizedVerticesSupported = false;
 VkDescriptorPool RenderEngine::_descriptorPool = VK_NULL_HANDLE;
 VkDescriptorSetLayout RenderEngine::_materialsSetLayout = VK_NULL_HANDLE;
 
@@ -73,6 +81,20 @@ void RenderEngine::init()
 	init_command_pools();
 	init_sync_structures();
 
+	// Checked before any prefab is loaded, the pipelines using these shaders are only built with the first frame
+	_quantizedVerticesSupported = true;
+	for (const char* path : { "../shaders/flat_quantized.vert.spv", "../shaders/deferred_quantized.vert.spv" })
+	{
+		VkShaderModule module;
+		if (!vkutil::load_shader_module(_device, path, &module))
+		{
+			std::cout << "[ERROR] " << path << " is missing, prefabs are loaded without quantized vertices" << std::endl;
+			_quantizedVerticesSupported = false;
+			continue;
+		}
+		vkDestroyShaderModule(_device, module, nullptr);
+	}
+
 	// Single Texture Set Layout
 	VkDescriptorSetLayoutBinding textureBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
 
@@ -132,6 +154,8 @@ void RenderEngine::init_vulkan()
 	VkPhysicalDeviceFeatures required_device_features{};
 	required_device_features.fragmentStoresAndAtomics = VK_TRUE;
 	required_device_features.shaderFloat64 = VK_TRUE;
+	required_device_features.samplerAnisotropy = VK_TRUE;
+	required_device_features.textureCompressionBC = VK_TRUE;
 	vkb::PhysicalDevice physicalDevice = selector
 		.set_minimum_version(1, 1)
 		.set_surface(_surface)
@@ -192,7 +216,18 @@ void RenderEngine::init_swapchain()
 
 	vkCreateSampler(_device, &samplerInfo, nullptr, &_defaultSampler);
 
+	// Reads the whole mip chain of the textures
+	VkSamplerCreateInfo textureSamplerInfo = vkinit::sampler_create_info(VK_FILTER_LINEAR);
+	textureSamplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	textureSamplerInfo.minLod = 0.0f;
+	textureSamplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	textureSamplerInfo.anisotropyEnable = VK_TRUE;
+	textureSamplerInfo.maxAnisotropy = std::min(8.0f, _gpuProperties.limits.maxSamplerAnisotropy);
+
+	vkCreateSampler(_device, &textureSamplerInfo, nullptr, &_textureSampler);
+
 	_mainDeletionQueue.push_function([=]() {
+		vkDestroySampler(_device, _textureSampler, nullptr);
 		vkDestroySampler(_device, _defaultSampler, nullptr);
 		vkDestroySwapchainKHR(_device, _swapchain, nullptr);
 		});
@@ -223,6 +258,23 @@ void RenderEngine::init_sync_structures()
 	_mainDeletionQueue.push_function([=]() {
 		vkDestroyFence(_device, _uploadContext._uploadFence, nullptr);
 		});
+
+	_uploadBatcher.init(_device, _allocator, _graphicsQueue, _graphicsQueueFamily);
+
+	_mainDeletionQueue.push_function([=]() {
+		_uploadBatcher.destroy();
+		});
+
+	// Both are read as storage buffers by the hit shaders too, they grow on demand
+	_vertexArena.init("vertices", VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VERTEX_ARENA_SIZE);
+	_indexArena.init("indices", VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, INDEX_ARENA_SIZE);
+
+	_mainDeletionQueue.push_function([=]() {
+		_vertexArena.print_statistics();
+		_indexArena.print_statistics();
+		_vertexArena.destroy();
+		_indexArena.destroy();
+		});
 }
 
 #pragma region RASTER
@@ -232,7 +284,7 @@ void RenderEngine::init_descriptor_set_pool()
 	{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
 	{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
 	{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
-	{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 50},
+	{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 50 + MAX_TEXTURES + MAX_TEXTURE_ARRAYS},
 	{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
 	{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10}
 	};
@@ -306,9 +358,13 @@ void RenderEngine::init_descriptor_set_layouts()
 
 	VkDescriptorSetLayoutBinding materialsBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
 	VkDescriptorSetLayoutBinding matTexturesBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1);
-	matTexturesBind.descriptorCount = VKE::Texture::sTexturesLoaded.size();
+	// Sized to the capacity, prefabs loaded later add textures without recreating the layout
+	matTexturesBind.descriptorCount = MAX_TEXTURES;
 
-	std::array<VkDescriptorSetLayoutBinding, 2> matBindings = { materialsBind, matTexturesBind };
+	VkDescriptorSetLayoutBinding matTextureArraysBind = vkinit::descriptorset_layout_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2);
+	matTextureArraysBind.descriptorCount = MAX_TEXTURE_ARRAYS;
+
+	std::array<VkDescriptorSetLayoutBinding, 3> matBindings = { materialsBind, matTexturesBind, matTextureArraysBind };
 
 	VkDescriptorSetLayoutCreateInfo materialsSetInfo = {};
 	materialsSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -781,12 +837,33 @@ void RenderEngine::init_pipelines()
 
 		_dsmPipeline = pipelineBuilder.build_pipeline(_device, _singleAttachmentRenderPass);
 
+		// Same pipeline for prefabs with quantized vertices, without the shader they are loaded with full ones
+		VkShaderModule flatQuantizedVertex = VK_NULL_HANDLE;
+		VertexInputDescription quantizedVertexDescription = QuantizedVertex::get_vertex_description();
+		if (!vkutil::load_shader_module(_device, "../shaders/flat_quantized.vert.spv", &flatQuantizedVertex))
+		{
+			std::cout << "Error when building the flat quantized vertex shader" << std::endl;
+		}
+		else
+		{
+			pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(quantizedVertexDescription.attributes.size());
+			pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = quantizedVertexDescription.attributes.data();
+			pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(quantizedVertexDescription.bindings.size());
+			pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = quantizedVertexDescription.bindings.data();
+
+			pipelineBuilder._shaderStages[0] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, flatQuantizedVertex);
+
+			_dsmQuantizedPipeline = pipelineBuilder.build_pipeline(_device, _singleAttachmentRenderPass);
+		}
+
 		//DELETIONS
 		vkDestroyShaderModule(_device, flatFrag, nullptr);
 		vkDestroyShaderModule(_device, flatVertex, nullptr);
+		vkDestroyShaderModule(_device, flatQuantizedVertex, nullptr);
 
 		_mainDeletionQueue.push_function([=]() {
 			vkDestroyPipeline(_device, _dsmPipeline, nullptr);
+			vkDestroyPipeline(_device, _dsmQuantizedPipeline, nullptr);
 			vkDestroyPipelineLayout(_device, _dsmPipelineLayout, nullptr);
 			});
 	}
@@ -928,13 +1005,75 @@ void RenderEngine::init_pipelines()
 
 		_gbuffersPipeline = pipelineBuilder.build_pipeline(_device, _gbuffersRenderPass);
 
+		// Same pipeline for prefabs with quantized vertices, without the shader they are loaded with full ones
+		VkShaderModule deferredQuantizedVertex = VK_NULL_HANDLE;
+		VertexInputDescription quantizedVertexDescription = QuantizedVertex::get_vertex_description();
+		if (!vkutil::load_shader_module(_device, "../shaders/deferred_quantized.vert.spv", &deferredQuantizedVertex))
+		{
+			std::cout << "Error when building the deferred quantized vertex shader" << std::endl;
+		}
+		else
+		{
+			pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(quantizedVertexDescription.attributes.size());
+			pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = quantizedVertexDescription.attributes.data();
+			pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(quantizedVertexDescription.bindings.size());
+			pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = quantizedVertexDescription.bindings.data();
+
+			pipelineBuilder._shaderStages[0] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, deferredQuantizedVertex);
+
+			_gbuffersQuantizedPipeline = pipelineBuilder.build_pipeline(_device, _gbuffersRenderPass);
+		}
+
+		// Impostors write the same G-buffers from a quad built in the vertex shader, without vertex buffers.
+		// Without their shaders every object is drawn with its full geometry.
+		VkShaderModule impostorVertex = VK_NULL_HANDLE;
+		VkShaderModule impostorFrag = VK_NULL_HANDLE;
+		bool impostorShadersLoaded = true;
+		if (!vkutil::load_shader_module(_device, "../shaders/impostor.vert.spv", &impostorVertex))
+		{
+			std::cout << "Error when building the impostor vertex shader" << std::endl;
+			impostorShadersLoaded = false;
+		}
+
+		if (!vkutil::load_shader_module(_device, "../shaders/impostor.frag.spv", &impostorFrag))
+		{
+			std::cout << "Error when building the impostor frag shader" << std::endl;
+			impostorShadersLoaded = false;
+		}
+
+		pushConstant.size = sizeof(ImpostorPushConstant);
+		pushConstants = { pushConstant };
+		layoutInfo.pPushConstantRanges = pushConstants.data();
+
+		VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, nullptr, &_impostorPipelineLayout));
+
+		if (impostorShadersLoaded)
+		{
+			pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = 0;
+			pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = nullptr;
+			pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = 0;
+			pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = nullptr;
+
+			pipelineBuilder._shaderStages[0] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, impostorVertex);
+			pipelineBuilder._shaderStages[1] = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, impostorFrag);
+			pipelineBuilder._pipelineLayout = _impostorPipelineLayout;
+
+			_impostorPipeline = pipelineBuilder.build_pipeline(_device, _gbuffersRenderPass);
+		}
+
 		//DELETIONS
 		vkDestroyShaderModule(_device, deferredFrag, nullptr);
 		vkDestroyShaderModule(_device, deferredVertex, nullptr);
+		vkDestroyShaderModule(_device, deferredQuantizedVertex, nullptr);
+		vkDestroyShaderModule(_device, impostorFrag, nullptr);
+		vkDestroyShaderModule(_device, impostorVertex, nullptr);
 
 		_mainDeletionQueue.push_function([=]() {
 			vkDestroyPipeline(_device, _gbuffersPipeline, nullptr);
+			vkDestroyPipeline(_device, _gbuffersQuantizedPipeline, nullptr);
+			vkDestroyPipeline(_device, _impostorPipeline, nullptr);
 			vkDestroyPipelineLayout(_device, _gbuffersPipelineLayout, nullptr);
+			vkDestroyPipelineLayout(_device, _impostorPipelineLayout, nullptr);
 		});
 	}
 }
@@ -1026,6 +1165,8 @@ void RenderEngine::init_raytracing_structures()
 	vkCreateRayTracingPipelinesKHR = reinterpret_cast<PFN_vkCreateRayTracingPipelinesKHR>(vkGetDeviceProcAddr(_device, "vkCreateRayTracingPipelinesKHR"));
 
 	_rayTracingPipelineProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+	_rayTracingPipelineProperties.pNext = &_accelerationStructureProperties;
+	_accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
 	VkPhysicalDeviceProperties2 deviceProperties2{};
 	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
 	deviceProperties2.pNext = &_rayTracingPipelineProperties;
@@ -1061,8 +1202,8 @@ void RenderEngine::create_bottom_level_acceleration_structure(const Scene& scene
 		VkDeviceOrHostAddressConstKHR vertexBufferDeviceAddress{};
 		VkDeviceOrHostAddressConstKHR indexBufferDeviceAddress{};
 
-		vertexBufferDeviceAddress.deviceAddress = vkutil::get_buffer_device_address(_device, renderable._prefab->_vertices.vertexBuffer._buffer);
-		indexBufferDeviceAddress.deviceAddress = vkutil::get_buffer_device_address(_device, renderable._prefab->_indices.indexBuffer._buffer);
+		vertexBufferDeviceAddress.deviceAddress = renderable._prefab->get_vertex_address();
+		indexBufferDeviceAddress.deviceAddress = renderable._prefab->get_index_address();
 
 		for(const auto& node : renderable._prefab->_roots)
 		{
@@ -1073,25 +1214,39 @@ void RenderEngine::create_bottom_level_acceleration_structure(const Scene& scene
 	build_blas(allBlas);
 }
 
-void RenderEngine::create_top_level_acceleration_structure(const Scene& scene, bool recreated)
+void RenderEngine::create_top_level_acceleration_structure(const Scene& scene, bool recreated, const LodSelector* lodSelector)
 {
 	if (scene._renderables.size() == 0) return;
 
 	std::vector<VkAccelerationStructureInstanceKHR> instances;
 	instances.reserve(scene._renderables.size());
 
+	// The BLASes of every level are in the order the primitives are visited. Prefabs the raster path replaces with
+	// their impostor are traced with their coarsest level, the shadow proxy of the impostor.
+	uint32_t firstLevel = 0;
 	for (const auto& renderable : scene._renderables)
 	{
+		const LodSelector* selector = lodSelector;
+		LodSelector proxySelector;
+		const Impostor* impostor = renderable._prefab->_impostor;
+		if (lodSelector && impostor && _impostorPipeline != VK_NULL_HANDLE &&
+			vkimpostor::replaces_prefab(*impostor, renderable._model, lodSelector->cameraPosition))
+		{
+			proxySelector = *lodSelector;
+			proxySelector.coarsest = true;
+			selector = &proxySelector;
+		}
+
 		for(const auto& node : renderable._prefab->_roots)
 		{
-			node->node_to_TLAS_instance(renderable._model, _bottomLevelAS, instances);
+			node->node_to_TLAS_instance(renderable._model, _bottomLevelAS, instances, firstLevel, selector);
 		}
 	}
 
-	// Buffer for instance data
+	// Buffer for instance data, never empty since every prefab may still be loading
 	AllocatedBuffer instancesBuffer;
 	instancesBuffer = vkutil::create_buffer(_allocator,
-		sizeof(VkAccelerationStructureInstanceKHR) * instances.size(),
+		sizeof(VkAccelerationStructureInstanceKHR) * std::max<size_t>(instances.size(), 1),
 		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
 		VMA_MEMORY_USAGE_CPU_TO_GPU);
 
@@ -1216,13 +1371,6 @@ void RenderEngine::create_top_level_acceleration_structure(const Scene& scene, b
 	accelerationDeviceAddressInfo.accelerationStructure = _topLevelAS._handle;
 	_topLevelAS._deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(_device, &accelerationDeviceAddressInfo);
 
-	if (!recreated)
-	{
-		_mainDeletionQueue.push_function([=]() {
-			vkDestroyAccelerationStructureKHR(_device, _topLevelAS._handle, nullptr);
-			});
-	}
-
 	delete_scratch_buffer(scratchBuffer);
 
 	vmaDestroyBuffer(_allocator, instancesBuffer._buffer, instancesBuffer._allocation);
@@ -1496,18 +1644,18 @@ void RenderEngine::create_raytracing_pipelines(const Scene& scene)
 	gbuffersLayoutBinding.descriptorCount = GBUFFER_NUM;
 	gbuffersLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
-	// Vertices
+	// Vertices, the whole vertex arena
 	VkDescriptorSetLayoutBinding vertexBufferBinding{};
 	vertexBufferBinding.binding = 3;
 	vertexBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	vertexBufferBinding.descriptorCount = static_cast<uint32_t>(scene._renderables.size());
+	vertexBufferBinding.descriptorCount = 1;
 	vertexBufferBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR;
 
-	// Indices
+	// Indices, the whole index arena
 	VkDescriptorSetLayoutBinding indexBufferBinding{};
 	indexBufferBinding.binding = 4;
 	indexBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	indexBufferBinding.descriptorCount = static_cast<uint32_t>(scene._renderables.size());
+	indexBufferBinding.descriptorCount = 1;
 	indexBufferBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR;
 
 	// Transforms
@@ -1542,9 +1690,16 @@ void RenderEngine::create_raytracing_pipelines(const Scene& scene)
 	VkDescriptorSetLayoutBinding textureBufferBinding{};
 	textureBufferBinding.binding = 9;
 	textureBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	textureBufferBinding.descriptorCount = VKE::Texture::sTexturesLoaded.size();
+	textureBufferBinding.descriptorCount = MAX_TEXTURES;
 	textureBufferBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR;
 
+	// Texture arrays, the packed foliage textures
+	VkDescriptorSetLayoutBinding textureArraysBinding{};
+	textureArraysBinding.binding = 13;
+	textureArraysBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	textureArraysBinding.descriptorCount = MAX_TEXTURE_ARRAYS;
+	textureArraysBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR;
+
 	{
 #pragma region Raytracing Shadow Pass
 		// Layout Bindings
@@ -1583,7 +1738,8 @@ void RenderEngine::create_raytracing_pipelines(const Scene& scene)
 			textureBufferBinding,
 			shadowImagesBinding,
 			deepShadowImageBinding,
-			deepShadowMapCamera
+			deepShadowMapCamera,
+			textureArraysBinding
 		};
 
 		VkDescriptorSetLayoutCreateInfo desc_set_layout_info{};
@@ -1803,6 +1959,7 @@ void RenderEngine::create_raytracing_pipelines(const Scene& scene)
 			textureBufferBinding,
 			resultImageLayoutBinding,
 			denoisedShadowsImagesBinding,
+			textureArraysBinding,
 			//skyboxImageLayoutBinding
 			});
 
@@ -2159,7 +2316,7 @@ void RenderEngine::create_raytracing_descriptor_pool()
 	{VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 2},
 	{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 100},
 	{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-	{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 20},
+	{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 20 + 2 * (MAX_TEXTURES + MAX_TEXTURE_ARRAYS)},
 	};
 
 	VkResult result;
@@ -2246,17 +2403,71 @@ void RenderEngine::create_acceleration_structure_buffer(AccelerationStructure& a
 
 	VK_CHECK(vkAllocateMemory(_device, &memoryAllocateInfo, nullptr, &accelerationStructure._memory));
 	VK_CHECK(vkBindBufferMemory(_device, accelerationStructure._buffer, accelerationStructure._memory, 0));
+}
 
-	_mainDeletionQueue.push_function([=]() {
-		vkFreeMemory(_device, accelerationStructure._memory, nullptr);
+void RenderEngine::destroy_acceleration_structure(AccelerationStructure& accelerationStructure)
+{
+	if (accelerationStructure._handle != VK_NULL_HANDLE)
+	{
+		vkDestroyAccelerationStructureKHR(_device, accelerationStructure._handle, nullptr);
+	}
+	if (accelerationStructure._buffer != VK_NULL_HANDLE)
+	{
 		vkDestroyBuffer(_device, accelerationStructure._buffer, nullptr);
-		});
+	}
+	if (accelerationStructure._memory != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(_device, accelerationStructure._memory, nullptr);
+	}
+	accelerationStructure = AccelerationStructure{};
+}
+
+void RenderEngine::destroy_scene_acceleration_structures()
+{
+	for (AccelerationStructure& blas : _bottomLevelAS)
+	{
+		destroy_acceleration_structure(blas);
+	}
+	_bottomLevelAS.clear();
+
+	destroy_acceleration_structure(_topLevelAS);
 }
 
 void RenderEngine::build_blas(const std::vector<BlasInput>& input, VkBuildAccelerationStructureFlagsKHR flags)
 {
+	if (input.empty())
+	{
+		_uploadBatcher.flush();
+		return;
+	}
+
+	// Builds on the device only record here, their GPU time shows up when the batch is waited on
+	ImportStageScope profile(IMPORT_STAGE_BLAS_BUILD);
+
+	// All the builds share one scratch buffer, each at its own aligned offset. Builds recorded in the same command
+	// must not overlap in it, so the inputs are split in batches that fit the budget and reuse it one after another
+	const uint32_t scratchAlignment = std::max(1u, _accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment);
+	VkDeviceSize largestScratchSize = 0;
+	VkDeviceSize totalScratchSize = 0;
 	for (const auto& blasInput : input)
 	{
+		const VkDeviceSize alignedSize = vkutil::get_aligned_size(blasInput._accelerationStructureBuildSizesInfo.buildScratchSize, scratchAlignment);
+		largestScratchSize = std::max(largestScratchSize, alignedSize);
+		totalScratchSize += alignedSize;
+	}
+	const VkDeviceSize scratchSize = std::max(largestScratchSize, std::min(totalScratchSize, BLAS_SCRATCH_BUDGET));
+	RayTracingScratchBuffer scratchBuffer = create_scratch_buffer(scratchSize);
+
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos(input.size());
+	std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRangeInfos(input.size());
+	std::vector<size_t> batchStarts;
+	VkDeviceSize scratchOffset = scratchSize;
+
+	for (size_t i = 0; i < input.size(); i++)
+	{
+		const BlasInput& blasInput = input[i];
+		profile.bytes += blasInput._accelerationStructureBuildSizesInfo.accelerationStructureSize;
+
 		AccelerationStructure newAccelerationStructure{};
 
 		create_acceleration_structure_buffer(newAccelerationStructure, blasInput._accelerationStructureBuildSizesInfo);
@@ -2269,54 +2480,106 @@ void RenderEngine::build_blas(const std::vector<BlasInput>& input, VkBuildAccele
 
 		vkCreateAccelerationStructureKHR(_device, &accelerationStructureCreateInfo, nullptr, &newAccelerationStructure._handle);
 
-		// Create a small scratch buffer used during build of the bottom level acceleration structure
-		RayTracingScratchBuffer scratchBuffer = create_scratch_buffer(blasInput._accelerationStructureBuildSizesInfo.buildScratchSize);
+		// A build that does not fit after the previous ones starts a new batch at the beginning of the scratch
+		const VkDeviceSize alignedScratchSize = vkutil::get_aligned_size(blasInput._accelerationStructureBuildSizesInfo.buildScratchSize, scratchAlignment);
+		if (scratchOffset + alignedScratchSize > scratchSize)
+		{
+			batchStarts.push_back(i);
+			scratchOffset = 0;
+		}
 
-		VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo{};
+		VkAccelerationStructureBuildGeometryInfoKHR& accelerationBuildGeometryInfo = buildGeometryInfos[i];
 		accelerationBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
 		accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-		accelerationBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+		accelerationBuildGeometryInfo.flags = flags;
 		accelerationBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
 		accelerationBuildGeometryInfo.dstAccelerationStructure = newAccelerationStructure._handle;
 		accelerationBuildGeometryInfo.geometryCount = 1;
 		accelerationBuildGeometryInfo.pGeometries = &blasInput._accelerationStructureGeometry;
-		accelerationBuildGeometryInfo.scratchData.deviceAddress = scratchBuffer._deviceAddress;
+		accelerationBuildGeometryInfo.scratchData.deviceAddress = scratchBuffer._deviceAddress + scratchOffset;
 
-		VkAccelerationStructureBuildRangeInfoKHR buildRangeInfo = blasInput._accelerationStructureBuildRangeInfo;
-		std::vector<VkAccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &buildRangeInfo };
+		buildRangeInfos[i] = blasInput._accelerationStructureBuildRangeInfo;
+		scratchOffset += alignedScratchSize;
 
-		if (_accelerationStructureFeatures.accelerationStructureHostCommands)
+		VkAccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo{};
+		accelerationDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+		accelerationDeviceAddressInfo.accelerationStructure = newAccelerationStructure._handle;
+		newAccelerationStructure._deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(_device, &accelerationDeviceAddressInfo);
+
+		_bottomLevelAS.push_back(newAccelerationStructure);
+	}
+	batchStarts.push_back(input.size());
+
+	if (_accelerationStructureFeatures.accelerationStructureHostCommands)
+	{
+		// Implementation supports building acceleration structure building on host, each call returns
+		// once its builds are done so the next batch can reuse the scratch
+		for (size_t batch = 0; batch + 1 < batchStarts.size(); batch++)
 		{
-			// Implementation supports building acceleration structure building on host
+			const size_t first = batchStarts[batch];
+			const size_t count = batchStarts[batch + 1] - first;
+
+			std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				rangeInfos[i] = &buildRangeInfos[first + i];
+			}
+
 			vkBuildAccelerationStructuresKHR(
 				_device,
 				VK_NULL_HANDLE,
-				1,
-				&accelerationBuildGeometryInfo,
-				accelerationBuildStructureRangeInfos.data());
+				static_cast<uint32_t>(count),
+				&buildGeometryInfos[first],
+				rangeInfos.data());
 		}
-		else
-		{
-			// Acceleration structure needs to be build on the device
-			vkupload::immediate_submit([&](VkCommandBuffer cmd)
+
+		delete_scratch_buffer(scratchBuffer);
+	}
+	else
+	{
+		// Acceleration structure needs to be build on the device. Every batch is a single build command in the
+		// same upload batch, pGeometries points into the input vector so it stays valid until the flush below
+		_uploadBatcher.record([=](VkCommandBuffer cmd)
+			{
+				for (size_t batch = 0; batch + 1 < batchStarts.size(); batch++)
 				{
+					// The previous batch has to be done with the scratch memory before this one writes it
+					if (batch > 0)
+					{
+						VkMemoryBarrier barrier{};
+						barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+						barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+						barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+						vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+							1, &barrier, 0, nullptr, 0, nullptr);
+					}
+
+					const size_t first = batchStarts[batch];
+					const size_t count = batchStarts[batch + 1] - first;
+
+					std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos(count);
+					for (size_t i = 0; i < count; i++)
+					{
+						rangeInfos[i] = &buildRangeInfos[first + i];
+					}
+
 					vkCmdBuildAccelerationStructuresKHR(
 						cmd,
-						1,
-						&accelerationBuildGeometryInfo,
-						accelerationBuildStructureRangeInfos.data());
-				});
+						static_cast<uint32_t>(count),
+						&buildGeometryInfos[first],
+						rangeInfos.data());
+				}
+			});
 
-		}
+		_uploadBatcher.on_complete([=]() {
+			RayTracingScratchBuffer usedScratchBuffer = scratchBuffer;
+			delete_scratch_buffer(usedScratchBuffer);
+		});
+	}
 
-		VkAccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo{};
-		accelerationDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-		accelerationDeviceAddressInfo.accelerationStructure = newAccelerationStructure._handle;
-		newAccelerationStructure._deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(_device, &accelerationDeviceAddressInfo);
+	std::cout << "Built " << input.size() << " BLAS in " << batchStarts.size() - 1 << " batches sharing " << scratchSize / 1024 << " KB of scratch" << std::endl;
 
-		_bottomLevelAS.push_back(newAccelerationStructure);
-		delete_scratch_buffer(scratchBuffer);
-	}
+	_uploadBatcher.flush();
 }
 
 void RenderEngine::get_enabled_features()
@@ -2340,6 +2603,8 @@ void RenderEngine::get_enabled_features()
 	_enabledAccelerationStructureFeatures.pNext = &_enabledRayTracingPipelineFeatures;
 
 	_enabledPhysicalDeviceFeatures.fragmentStoresAndAtomics = VK_TRUE;
+	_enabledPhysicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
+	_enabledPhysicalDeviceFeatures.textureCompressionBC = VK_TRUE;
 
 	deviceCreatepNextChain = &_enabledAccelerationStructureFeatures;
 }
@@ -2353,6 +2618,24 @@ void RenderEngine::create_raytracing_scene_structures(const Scene& scene)
 
 	create_bottom_level_acceleration_structure(scene);
 	create_top_level_acceleration_structure(scene, false);
+
+	// They can be rebuilt while the engine runs, whatever exists at exit is destroyed
+	_mainDeletionQueue.push_function([=]() {
+		destroy_scene_acceleration_structures();
+		});
+}
+
+void RenderEngine::rebuild_raytracing_scene_structures(const Scene& scene)
+{
+	// The caller makes sure no frame in flight uses them anymore
+	destroy_scene_acceleration_structures();
+
+	create_bottom_level_acceleration_structure(scene);
+
+	// The top level build reads the bottom level ones, which are built by the upload batcher
+	_uploadBatcher.flush_and_wait();
+
+	create_top_level_acceleration_structure(scene, false);
 }
 
 void RenderEngine::create_raster_scene_structures()
@@ -12,14 +12,20 @@
 
 #include "vk_types.h"
 #include "vk_mesh.h"
+#include "vk_geometry_arena.h"
 
 const int MAX_OBJECTS = 100;
 const int MAX_MATERIALS = 100;
-const int MAX_TEXTURES = 100;
+const int MAX_TEXTURES = 256;
+const int MAX_TEXTURE_ARRAYS = 16;
+const int MAX_TEXTURE_ARRAY_LAYERS = 64; // material indices from MAX_TEXTURES up address array * MAX_TEXTURE_ARRAY_LAYERS + layer
 const int GBUFFER_NUM = 5;
 const float SHADOW_BIAS = 0.65f;
 const float SHADOW_MAP_WIDTH = 1024.0f;
 const float SHADOW_MAP_HEIGHT = 1024.0f;
+const VkDeviceSize VERTEX_ARENA_SIZE = 64 * 1024 * 1024; // initial size, the arenas grow when they are full
+const VkDeviceSize INDEX_ARENA_SIZE = 32 * 1024 * 1024;
+const VkDeviceSize BLAS_SCRATCH_BUDGET = 128 * 1024 * 1024; // scratch shared by the BLAS builds of a batch, a larger single build gets its own size
 
 struct RenderObject;
 class Scene;
@@ -29,6 +35,11 @@ namespace VKE
 	class Node;
 };
 
+namespace vkupload
+{
+	class UploadBatcher;
+};
+
 enum RenderMode {
 	RENDER_MODE_FORWARD = 0,
 	RENDER_MODE_DEFERRED,
@@ -116,6 +127,7 @@ public:
 
 	// Samplers
 	static VkSampler	_defaultSampler;
+	static VkSampler	_textureSampler; // trilinear and anisotropic, for mipmapped material textures and the skybox
 
 	//Deletion
 	static DeletionQueue _mainDeletionQueue;
@@ -123,6 +135,14 @@ public:
 
 	// Upload Context for immediate submit
 	static UploadContext _uploadContext;
+	// Batched uploads, prefer it over immediate submits when loading resources
+	static vkupload::UploadBatcher _uploadBatcher;
+
+	// Vertices and indices of every prefab and mesh, suballocated from one buffer each
+	static GeometryArena _vertexArena;
+	static GeometryArena _indexArena;
+	// False when the quantized vertex shaders are missing, prefabs are then loaded with full precision vertices
+	static bool _quantizedVerticesSupported;
 
 	// Scene Descriptors
 	// - Descriptor Pool
@@ -142,12 +162,16 @@ public:
 	VkPipelineLayout _lightPipelineLayout;
 	VkPipelineLayout _skyboxPipelineLayout;
 	VkPipelineLayout _dsmPipelineLayout;
+	VkPipelineLayout _impostorPipelineLayout;
 
 	// Pipelines
 	VkPipeline	_texPipeline;
 	VkPipeline	_gbuffersPipeline;
+	VkPipeline	_gbuffersQuantizedPipeline = VK_NULL_HANDLE; // null when its shader is missing
+	VkPipeline	_impostorPipeline = VK_NULL_HANDLE;
 	VkPipeline	_skyboxPipeline;
 	VkPipeline	_dsmPipeline;
+	VkPipeline	_dsmQuantizedPipeline = VK_NULL_HANDLE;
 
 	//Depth Buffer
 	Image _depthImage;
@@ -187,6 +211,7 @@ public:
 
 	// - Properties and features
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR  _rayTracingPipelineProperties{};
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR _accelerationStructureProperties{};
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR _accelerationStructureFeatures{};
 	VkPhysicalDeviceFeatures _enabledPhysicalDeviceFeatures{};
 
@@ -249,9 +274,13 @@ public:
 	//create pipeline and acceleration structures for the current scene
 	void create_raytracing_scene_structures(const Scene& scene);
 
+	//builds the acceleration structures again after the scene geometry changed, nothing in flight may use them
+	void rebuild_raytracing_scene_structures(const Scene& scene);
+
 	void create_raster_scene_structures();
 
-	void create_top_level_acceleration_structure(const Scene& scene, bool recreated);
+	// Without a selector every primitive uses its full detail BLAS
+	void create_top_level_acceleration_structure(const Scene& scene, bool recreated, const LodSelector* lodSelector = nullptr);
 
 	void reset_imgui();
 
@@ -313,6 +342,10 @@ private:
 
 	void create_acceleration_structure_buffer(AccelerationStructure& accelerationStructure, VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo);
 
+	void destroy_acceleration_structure(AccelerationStructure& accelerationStructure);
+
+	void destroy_scene_acceleration_structures();
+
 	void build_blas(const std::vector<BlasInput>& input, VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 
 	//pnext features
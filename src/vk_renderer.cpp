@@ -3,7 +3,9 @@
 #include "vk_engine.h"
 #include "vk_material.h"
 #include "vk_textures.h"
+#include "vk_texture_array.h"
 #include "vk_prefab.h"
+#include "vk_impostor.h"
 #include "vk_utils.h"
 #include "Camera.h"
 #include <iostream>
@@ -105,6 +107,17 @@ void Renderer::draw_scene()
 		std::abort();
 	}
 
+	// Prefabs loaded asynchronously get their resources created here, between frames
+	bool prefabsChanged = VKE::Prefab::update_pending_loads();
+
+	// A grown arena is a new buffer, everything that points to the old one is updated with the structures
+	const uint32_t geometryGeneration = re->_vertexArena.get_generation() + re->_indexArena.get_generation();
+	if (geometryGeneration != _geometryGeneration)
+	{
+		_geometryGeneration = geometryGeneration;
+		prefabsChanged = true;
+	}
+
 	if(!isDeferredCommandInit)
 	{
 		re->create_raster_scene_structures();
@@ -129,10 +142,30 @@ void Renderer::draw_scene()
 		create_raytracing_descriptor_sets();
 		areAccelerationStructuresInit = true;
 	}
+	else if(prefabsChanged)
+	{
+		refresh_scene_structures();
+	}
 
 	render_raytracing();
 
-	re->create_top_level_acceleration_structure(*currentScene, true);
+	const LodSelector lodSelector = get_lod_selector();
+	re->create_top_level_acceleration_structure(*currentScene, true, &lodSelector);
+}
+
+LodSelector Renderer::get_lod_selector() const
+{
+	LodSelector selector;
+	Camera* camera = VulkanEngine::cinstance->camera;
+	selector.cameraPosition = camera->_position;
+
+	// Orthographic views keep the full detail, the size on screen does not depend on the distance there
+	if (camera->_type == PERSPECTIVE)
+	{
+		const glm::mat4 projection = camera->getProjection();
+		selector.pixelsPerUnit = glm::abs(projection[1][1]) * re->_windowExtent.height * 0.5f;
+	}
+	return selector;
 }
 
 void Renderer::reset_timers_count()
@@ -228,8 +261,6 @@ void Renderer::update_uniform_buffers()
 
 void Renderer::create_raytracing_descriptor_sets()
 {
-	std::vector<RenderObject>& renderables = currentScene->_renderables;
-
 	// RT SHARED DESCRIPTORS
 	// Binding 0 : Acceleration Structure Descriptor
 	VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo{};
@@ -284,13 +315,9 @@ void Renderer::create_raytracing_descriptor_sets()
 	};
 	
 	// ----------------------------------------------------
-	std::vector<VkDescriptorBufferInfo> verticesBufferInfos;
-	std::vector<VkDescriptorBufferInfo> indicesBufferInfos;
-
-	verticesBufferInfos.reserve(renderables.size());
-	indicesBufferInfos.reserve(renderables.size());
+	VkDescriptorBufferInfo verticesBufferInfo{};
+	VkDescriptorBufferInfo indicesBufferInfo{};
 	std::vector<PrimitiveToShader> primitivesInfo;
-	std::vector<glm::mat4> transforms;
 
 	// Binding 5: Transforms Descriptor
 	_transformBuffer = vkutil::create_buffer(_allocator, sizeof(glm::mat4) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
@@ -300,42 +327,11 @@ void Renderer::create_raytracing_descriptor_sets()
 	transformBufferInfo.buffer = _transformBuffer._buffer;
 	transformBufferInfo.range = sizeof(glm::mat4) * MAX_OBJECTS;
 
-	for (int i = 0; i < renderables.size(); i++)
-	{
-		// Binding 3: RTVertices Descriptor
-		VkDescriptorBufferInfo rtVertexBufferInfo{};
-		rtVertexBufferInfo.offset = 0;
-		rtVertexBufferInfo.buffer = renderables[i]._prefab->_vertices.rtvBuffer._buffer;
-		rtVertexBufferInfo.range = renderables[i]._prefab->_vertices.count * sizeof(rtVertex);
-
-		verticesBufferInfos.push_back(rtVertexBufferInfo);
-
-		// Binding 4: Vertex Indices Descriptor
-		VkDescriptorBufferInfo indexBufferInfo{};
-		indexBufferInfo.offset = 0;
-		indexBufferInfo.buffer = renderables[i]._prefab->_indices.indexBuffer._buffer;
-		indexBufferInfo.range = renderables[i]._prefab->_indices.count * sizeof(uint32_t);
-
-		indicesBufferInfos.push_back(indexBufferInfo);
-
-		// Binding 6: Primitives Descriptor
-		for (const auto& node : renderables[i]._prefab->_roots)
-		{
-			node->get_primitive_to_shader_info(renderables[i]._model, primitivesInfo, transforms, i);
-		}
-	}
+	// Bindings 3 and 4: Vertices and Vertex Indices Descriptors
+	get_geometry_infos(verticesBufferInfo, indicesBufferInfo, primitivesInfo);
 
-	_primitiveInfoBuffer = vkutil::create_buffer(_allocator, primitivesInfo.size() * sizeof(PrimitiveToShader), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	VkDescriptorBufferInfo primitivesBufferDescriptor{};
-	primitivesBufferDescriptor.offset = 0;
-	primitivesBufferDescriptor.buffer = _primitiveInfoBuffer._buffer;
-	primitivesBufferDescriptor.range = primitivesInfo.size() * sizeof(PrimitiveToShader);
-
-	void* primitivesData;
-	vmaMapMemory(_allocator, _primitiveInfoBuffer._allocation, &primitivesData);
-	memcpy(primitivesData, primitivesInfo.data(), primitivesInfo.size() * sizeof(PrimitiveToShader));
-	vmaUnmapMemory(_allocator, _primitiveInfoBuffer._allocation);
+	// Binding 6: Primitives Descriptor
+	VkDescriptorBufferInfo primitivesBufferDescriptor = create_primitive_info_buffer(primitivesInfo);
 
 	// Binding 7: Scene Lights Descriptor
 	_sceneBuffer = vkutil::create_buffer(_allocator, currentScene->_lights.size() * sizeof(LightToShader), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
@@ -345,109 +341,25 @@ void Renderer::create_raytracing_descriptor_sets()
 	sceneBufferDescriptor.buffer = _sceneBuffer._buffer;
 	sceneBufferDescriptor.range = currentScene->_lights.size() * sizeof(LightToShader);
 
-	// Binding 8: Materials Descriptor
-
-	// Create material infos vector
-	_materialInfos.resize(VKE::Material::sMaterials.size());
-
-	// Sort materials by their IDs
-	std::vector<VKE::Material*> materialsAux;
-	materialsAux.resize(VKE::Material::sMaterials.size());
-
-	int i = 0;
-	for (const auto& material : VKE::Material::sMaterials)
-	{
-		materialsAux[i] = material.second;
-		i++;
-	}
-
-	std::sort(materialsAux.begin(), materialsAux.end(), VKE::Material::ComparePtrToMaterial);
-
-	// Assign values to MaterialsToShader
-	i = 0;
-	for (const auto& material : materialsAux)
-	{
-		_materialInfos[i]._color_type = material->_color;
-		_materialInfos[i]._emissive_factor = material->_emissive_factor;
-		_materialInfos[i]._emissive_factor.w = material->_type;
-
-		glm::vec4* factors = &glm::vec4{
-			material->_roughness_factor, material->_metallic_factor,
-			material->_tilling_factor, -1 };
-
-		if (material->_color_texture == nullptr)
-		{
-			factors->w = VKE::Texture::sTexturesLoaded["default"]->_id;
-		}
-		else
-		{
-			factors->w = material->_color_texture->_id;
-		}
-
-		_materialInfos[i]._roughness_metallic_tilling_color_factors = glm::vec4{
-			factors->x ? factors->x : 0, factors->y ? factors->y : 0,
-			factors->z ? factors->z : 1, factors->w ? factors->w : 0
-		};
-
-		_materialInfos[i]._emissive_metRough_occlusion_normal_indices = glm::vec4{ -1, -1, -1, -1 };
-
-		if (material->_emissive_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.x = material->_emissive_texture->_id;
-		}
-		if (material->_metallic_roughness_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.y = material->_metallic_roughness_texture->_id;
-		}
-		if (material->_occlusion_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.z = material->_occlusion_texture->_id;
-		}
-		if (material->_normal_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.w = material->_normal_texture->_id;
-		}
-
-		i++;
-	}
+	// Binding 8: Materials Descriptor, sized to the capacity so materials of prefabs loaded later fit
+	update_material_infos();
 
-	_materialBuffer = vkutil::create_buffer(_allocator, _materialInfos.size() * sizeof(VKE::MaterialToShader), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	_materialBuffer = vkutil::create_buffer(_allocator, MAX_MATERIALS * sizeof(VKE::MaterialToShader), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
 	VkDescriptorBufferInfo materialBufferDescriptor{};
 	materialBufferDescriptor.offset = 0;
 	materialBufferDescriptor.buffer = _materialBuffer._buffer;
-	materialBufferDescriptor.range = _materialInfos.size() * sizeof(VKE::MaterialToShader);
+	materialBufferDescriptor.range = MAX_MATERIALS * sizeof(VKE::MaterialToShader);
 
-	void* materialData;
-	vmaMapMemory(_allocator, _materialBuffer._allocation, &materialData);
-	memcpy(materialData, _materialInfos.data(), _materialInfos.size() * sizeof(VKE::MaterialToShader));
-	vmaUnmapMemory(_allocator, _materialBuffer._allocation);
+	upload_material_infos(_materialBuffer);
 
 	// Binding 9: Textures Descriptor
-	// Pass the texture data from a map to a vector, and order it by idx
 	std::vector<VkDescriptorImageInfo> textureImageInfos;
-	int texCount = VKE::Texture::textureCount;
-	textureImageInfos.reserve(texCount);
+	get_texture_image_infos(textureImageInfos);
 
-	std::vector<VKE::Texture*> orderedTexVec;
-
-	for (auto const& texture : VKE::Texture::sTexturesLoaded)
-	{
-		orderedTexVec.push_back(texture.second);
-	}
-
-	// Order tex idx vector
-	std::sort(orderedTexVec.begin(), orderedTexVec.end(), VKE::Texture::ComparePtrToTexture);
-
-	for (auto const& texture : orderedTexVec)
-	{
-		VkDescriptorImageInfo textureImageDescriptor{};
-		textureImageDescriptor.sampler = re->_defaultSampler;
-		textureImageDescriptor.imageView = texture->_imageView;
-		textureImageDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-		textureImageInfos.push_back(textureImageDescriptor);
-	}
+	// Binding 13: Texture Arrays Descriptor
+	std::vector<VkDescriptorImageInfo> textureArrayImageInfos;
+	get_texture_array_image_infos(textureArrayImageInfos);
 
 	// RT SHADOWS PASS DESCRIPTORS
 	{
@@ -500,16 +412,17 @@ void Renderer::create_raytracing_descriptor_sets()
 
 		VkWriteDescriptorSet uniformBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _rtShadowsDescriptorSet, &uboBufferDescriptor, 1);
 		VkWriteDescriptorSet gbuffersWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtShadowsDescriptorSet, gbuffersImageInfos.data(), 2, static_cast<uint32_t>(gbuffersImageInfos.size()));
-		VkWriteDescriptorSet vertexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, verticesBufferInfos.data(), 3, renderables.size());
-		VkWriteDescriptorSet indexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, indicesBufferInfos.data(), 4, renderables.size());
+		VkWriteDescriptorSet vertexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, &verticesBufferInfo, 3);
+		VkWriteDescriptorSet indexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, &indicesBufferInfo, 4);
 		VkWriteDescriptorSet transformBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, &transformBufferInfo, 5);
 		VkWriteDescriptorSet primitivesInfoWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, &primitivesBufferDescriptor, 6);
 		VkWriteDescriptorSet sceneBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _rtShadowsDescriptorSet, &sceneBufferDescriptor, 7);
 		VkWriteDescriptorSet materialBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtShadowsDescriptorSet, &materialBufferDescriptor, 8);
-		VkWriteDescriptorSet textureImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtShadowsDescriptorSet, textureImageInfos.data(), 9, textureImageInfos.size());
+		VkWriteDescriptorSet textureImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtShadowsDescriptorSet, textureImageInfos.data(), 9, static_cast<uint32_t>(textureImageInfos.size()));
 		VkWriteDescriptorSet shadowImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _rtShadowsDescriptorSet, shadowImageInfos.data(), 10, static_cast<uint32_t>(shadowImageInfos.size()));
 		VkWriteDescriptorSet deepShadowImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtShadowsDescriptorSet, &deepShadowDescriptor, 11);
 		VkWriteDescriptorSet deepShadowMapCamWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _rtShadowsDescriptorSet, &deepShadowMapCameraDescriptor, 12);
+		VkWriteDescriptorSet textureArraysWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtShadowsDescriptorSet, textureArrayImageInfos.data(), 13, static_cast<uint32_t>(textureArrayImageInfos.size()));
 
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
 			accelerationStructureWrite,
@@ -524,7 +437,8 @@ void Renderer::create_raytracing_descriptor_sets()
 			textureImagesWrite,
 			shadowImagesWrite,
 			deepShadowImagesWrite,
-			deepShadowMapCamWrite
+			deepShadowMapCamWrite,
+			textureArraysWrite
 		};
 
 		vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, VK_NULL_HANDLE);
@@ -609,7 +523,7 @@ void Renderer::create_raytracing_descriptor_sets()
 
 		// Binding 12: Skybox Image
 		VkDescriptorImageInfo cubeMapInfo{};
-		cubeMapInfo.sampler = re->_defaultSampler;
+		cubeMapInfo.sampler = re->_textureSampler;
 		cubeMapInfo.imageView = currentScene->_skybox._cubeMap->_imageView;
 		cubeMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
@@ -627,15 +541,16 @@ void Renderer::create_raytracing_descriptor_sets()
 
 		VkWriteDescriptorSet uniformBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _rtFinalDescriptorSet, &uboBufferDescriptor, 1);
 		VkWriteDescriptorSet gbuffersWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtFinalDescriptorSet, gbuffersImageInfos.data(), 2, static_cast<uint32_t>(gbuffersImageInfos.size()));
-		VkWriteDescriptorSet vertexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, verticesBufferInfos.data(), 3, renderables.size());
-		VkWriteDescriptorSet indexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, indicesBufferInfos.data(), 4, renderables.size());
+		VkWriteDescriptorSet vertexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, &verticesBufferInfo, 3);
+		VkWriteDescriptorSet indexBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, &indicesBufferInfo, 4);
 		VkWriteDescriptorSet transformBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, &transformBufferInfo, 5);
 		VkWriteDescriptorSet primitivesInfoWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, &primitivesBufferDescriptor, 6);
 		VkWriteDescriptorSet sceneBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _rtFinalDescriptorSet, &sceneBufferDescriptor, 7);
 		VkWriteDescriptorSet materialBufferWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _rtFinalDescriptorSet, &materialBufferDescriptor, 8);
-		VkWriteDescriptorSet textureImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtFinalDescriptorSet, textureImageInfos.data(), 9, textureImageInfos.size());
+		VkWriteDescriptorSet textureImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtFinalDescriptorSet, textureImageInfos.data(), 9, static_cast<uint32_t>(textureImageInfos.size()));
 		VkWriteDescriptorSet resultImageWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _rtFinalDescriptorSet, &storageImageDescriptor, 10);
 		VkWriteDescriptorSet denoisedShadowImagesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, _rtFinalDescriptorSet, denoisedShadowImageInfos.data(), 11, static_cast<uint32_t>(denoisedShadowImageInfos.size()));
+		VkWriteDescriptorSet textureArraysWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtFinalDescriptorSet, textureArrayImageInfos.data(), 13, static_cast<uint32_t>(textureArrayImageInfos.size()));
 		//VkWriteDescriptorSet cubeMapWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _rtFinalDescriptorSet, &cubeMapInfo, 12);
 
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
@@ -651,6 +566,7 @@ void Renderer::create_raytracing_descriptor_sets()
 			textureImagesWrite,		
 			resultImageWrite,
 			denoisedShadowImagesWrite,
+			textureArraysWrite,
 			//cubeMapWrite
 		};
 
@@ -695,6 +611,314 @@ void Renderer::create_raytracing_descriptor_sets()
 	});
 }
 
+void Renderer::refresh_scene_structures()
+{
+	// Descriptors and acceleration structures can't change while a frame still uses them
+	VK_CHECK(vkQueueWaitIdle(_graphicsQueue));
+	RenderEngine::_uploadBatcher.flush_and_wait();
+
+	// Nothing uses the buffers the arenas replaced nor the ranges of the prefabs freed since anymore
+	re->_vertexArena.release_unused();
+	re->_indexArena.release_unused();
+	VKE::TextureArray::release_unused();
+	record_skybox_command_buffer();
+
+	re->rebuild_raytracing_scene_structures(*currentScene);
+
+	// Binding 0: Acceleration Structure Descriptor
+	VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo{};
+	descriptorAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+	descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
+	descriptorAccelerationStructureInfo.pAccelerationStructures = &re->_topLevelAS._handle;
+
+	// Bindings 3, 4 and 6: Geometry Descriptors, the arenas may have grown and the loaded prefabs replace the placeholder
+	VkDescriptorBufferInfo verticesBufferInfo{};
+	VkDescriptorBufferInfo indicesBufferInfo{};
+	std::vector<PrimitiveToShader> primitivesInfo;
+	get_geometry_infos(verticesBufferInfo, indicesBufferInfo, primitivesInfo);
+
+	vmaDestroyBuffer(_allocator, _primitiveInfoBuffer._buffer, _primitiveInfoBuffer._allocation);
+	VkDescriptorBufferInfo primitivesBufferDescriptor = create_primitive_info_buffer(primitivesInfo);
+
+	// Binding 8: Materials Descriptor, the buffer already has room for every material
+	update_material_infos();
+	upload_material_infos(_materialBuffer);
+
+	VkDescriptorBufferInfo materialBufferDescriptor{};
+	materialBufferDescriptor.offset = 0;
+	materialBufferDescriptor.buffer = _materialBuffer._buffer;
+	materialBufferDescriptor.range = MAX_MATERIALS * sizeof(VKE::MaterialToShader);
+
+	// Binding 9: Textures Descriptor
+	std::vector<VkDescriptorImageInfo> textureImageInfos;
+	get_texture_image_infos(textureImageInfos);
+
+	// Binding 13: Texture Arrays Descriptor, the materials may have packed more textures
+	std::vector<VkDescriptorImageInfo> textureArrayImageInfos;
+	get_texture_array_image_infos(textureArrayImageInfos);
+
+	std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+
+	for (VkDescriptorSet set : { _rtShadowsDescriptorSet, _rtFinalDescriptorSet })
+	{
+		VkWriteDescriptorSet accelerationStructureWrite{};
+		accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		accelerationStructureWrite.pNext = &descriptorAccelerationStructureInfo;
+		accelerationStructureWrite.dstSet = set;
+		accelerationStructureWrite.dstBinding = 0;
+		accelerationStructureWrite.descriptorCount = 1;
+		accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+		writeDescriptorSets.push_back(accelerationStructureWrite);
+		writeDescriptorSets.push_back(vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &verticesBufferInfo, 3));
+		writeDescriptorSets.push_back(vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &indicesBufferInfo, 4));
+		writeDescriptorSets.push_back(vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &primitivesBufferDescriptor, 6));
+		writeDescriptorSets.push_back(vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &materialBufferDescriptor, 8));
+		writeDescriptorSets.push_back(vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set, textureImageInfos.data(), 9, static_cast<uint32_t>(textureImageInfos.size())));
+		writeDescriptorSets.push_back(vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set, textureArrayImageInfos.data(), 13, static_cast<uint32_t>(textureArrayImageInfos.size())));
+	}
+
+	// Raster material textures
+	writeDescriptorSets.push_back(vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _materialsDescriptorSet, textureImageInfos.data(), 1, static_cast<uint32_t>(textureImageInfos.size())));
+	writeDescriptorSets.push_back(vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _materialsDescriptorSet, textureArrayImageInfos.data(), 2, static_cast<uint32_t>(textureArrayImageInfos.size())));
+
+	vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, VK_NULL_HANDLE);
+}
+
+void Renderer::get_geometry_infos(VkDescriptorBufferInfo& verticesBufferInfo, VkDescriptorBufferInfo& indicesBufferInfo, std::vector<PrimitiveToShader>& primitivesInfo)
+{
+	std::vector<RenderObject>& renderables = currentScene->_renderables;
+	std::vector<glm::mat4> transforms;
+
+	// The same arenas the raster pipelines bind, the primitives locate their geometry in them
+	verticesBufferInfo.offset = 0;
+	verticesBufferInfo.buffer = re->_vertexArena.get_buffer();
+	verticesBufferInfo.range = VK_WHOLE_SIZE;
+
+	indicesBufferInfo.offset = 0;
+	indicesBufferInfo.buffer = re->_indexArena.get_buffer();
+	indicesBufferInfo.range = VK_WHOLE_SIZE;
+
+	for (int i = 0; i < renderables.size(); i++)
+	{
+		const VKE::Prefab* prefab = renderables[i]._prefab;
+		for (const auto& node : prefab->_roots)
+		{
+			node->get_primitive_to_shader_info(renderables[i]._model, prefab->get_vertex_offset(), prefab->_indices.range.offset, primitivesInfo, transforms, i);
+		}
+	}
+}
+
+VkDescriptorBufferInfo Renderer::create_primitive_info_buffer(const std::vector<PrimitiveToShader>& primitivesInfo)
+{
+	// Never empty, every prefab of the scene may still be loading
+	const size_t bufferSize = std::max<size_t>(primitivesInfo.size(), 1) * sizeof(PrimitiveToShader);
+
+	_primitiveInfoBuffer = vkutil::create_buffer(_allocator, bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+	void* primitivesData;
+	vmaMapMemory(_allocator, _primitiveInfoBuffer._allocation, &primitivesData);
+	memcpy(primitivesData, primitivesInfo.data(), primitivesInfo.size() * sizeof(PrimitiveToShader));
+	vmaUnmapMemory(_allocator, _primitiveInfoBuffer._allocation);
+
+	VkDescriptorBufferInfo primitivesBufferDescriptor{};
+	primitivesBufferDescriptor.offset = 0;
+	primitivesBufferDescriptor.buffer = _primitiveInfoBuffer._buffer;
+	primitivesBufferDescriptor.range = bufferSize;
+
+	return primitivesBufferDescriptor;
+}
+
+void Renderer::update_material_infos()
+{
+	// The registry keeps the materials in ID order, free slots are left null
+	std::vector<VKE::Material*> materials;
+	VKE::Material::sMaterials.copy_items(materials);
+
+	VKE::Material* defaultMaterial = VKE::Material::get("default");
+	_materialInfos.resize(materials.size());
+
+	// Textures are uploaded the first time a material drawn by the scene refers to them, the others stay deferred
+	std::vector<VKE::Material*> usedMaterials;
+	if (currentScene)
+	{
+		for (const RenderObject& renderable : currentScene->_renderables)
+		{
+			for (const auto& node : renderable._prefab->_roots)
+			{
+				node->get_materials(usedMaterials);
+			}
+			const Impostor* impostor = renderable._prefab->_impostor;
+			if (impostor && impostor->material)
+			{
+				usedMaterials.push_back(impostor->material);
+			}
+		}
+		std::sort(usedMaterials.begin(), usedMaterials.end());
+		usedMaterials.erase(std::unique(usedMaterials.begin(), usedMaterials.end()), usedMaterials.end());
+	}
+
+	bool uploaded = false;
+	for (VKE::Material* material : usedMaterials)
+	{
+		for (VKE::Texture* texture : { material->_color_texture, material->_emissive_texture, material->_metallic_roughness_texture,
+			material->_occlusion_texture, material->_normal_texture })
+		{
+			if (texture && !texture->is_resident() && texture->make_resident())
+			{
+				uploaded = true;
+			}
+		}
+	}
+
+	// Alpha tested materials are the foliage ones, their same size leaf and mask variants are sampled from arrays
+	std::vector<VKE::Texture*> foliageTextures;
+	for (VKE::Material* material : materials)
+	{
+		if (material && material->_occlusion_texture)
+		{
+			foliageTextures.push_back(material->_color_texture);
+			foliageTextures.push_back(material->_occlusion_texture);
+		}
+	}
+	if (VKE::TextureArray::pack(foliageTextures))
+	{
+		uploaded = true;
+	}
+
+	if (uploaded)
+	{
+		RenderEngine::_uploadBatcher.flush_and_wait();
+	}
+
+	// Assign values to MaterialsToShader
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		const VKE::Material* material = materials[i] ? materials[i] : defaultMaterial;
+
+		_materialInfos[i]._color_type = material->_color;
+		_materialInfos[i]._emissive_factor = material->_emissive_factor;
+		_materialInfos[i]._emissive_factor.w = material->_type;
+
+		glm::vec4* factors = &glm::vec4{
+			material->_roughness_factor, material->_metallic_factor,
+			material->_tilling_factor, -1 };
+
+		if (material->_color_texture == nullptr)
+		{
+			factors->w = VKE::Texture::get("default")->_id;
+		}
+		else
+		{
+			factors->w = VKE::TextureArray::get_shader_index(material->_color_texture);
+		}
+
+		_materialInfos[i]._roughness_metallic_tilling_color_factors = glm::vec4{
+			factors->x ? factors->x : 0, factors->y ? factors->y : 0,
+			factors->z ? factors->z : 1, factors->w ? factors->w : 0
+		};
+
+		_materialInfos[i]._emissive_metRough_occlusion_normal_indices = glm::vec4{ -1, -1, -1, -1 };
+
+		if (material->_emissive_texture)
+		{
+			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.x = VKE::TextureArray::get_shader_index(material->_emissive_texture);
+		}
+		if (material->_metallic_roughness_texture)
+		{
+			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.y = VKE::TextureArray::get_shader_index(material->_metallic_roughness_texture);
+		}
+		if (material->_occlusion_texture)
+		{
+			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.z = VKE::TextureArray::get_shader_index(material->_occlusion_texture);
+		}
+		if (material->_normal_texture)
+		{
+			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.w = VKE::TextureArray::get_shader_index(material->_normal_texture);
+		}
+	}
+
+	if (_materialInfos.size() > MAX_MATERIALS)
+	{
+		std::cout << "[ERROR]: " << _materialInfos.size() << " materials loaded, only the first " << MAX_MATERIALS << " fit in the material buffers" << std::endl;
+		_materialInfos.resize(MAX_MATERIALS);
+	}
+}
+
+void Renderer::upload_material_infos(AllocatedBuffer& buffer, bool applyTilling)
+{
+	void* materialData;
+	vmaMapMemory(_allocator, buffer._allocation, &materialData);
+	memcpy(materialData, _materialInfos.data(), _materialInfos.size() * sizeof(VKE::MaterialToShader));
+	if (!applyTilling)
+	{
+		VKE::MaterialToShader* materialInfos = static_cast<VKE::MaterialToShader*>(materialData);
+		for (size_t i = 0; i < _materialInfos.size(); i++)
+		{
+			materialInfos[i]._roughness_metallic_tilling_color_factors.z = 1;
+		}
+	}
+	vmaUnmapMemory(_allocator, buffer._allocation);
+}
+
+void Renderer::get_texture_image_infos(std::vector<VkDescriptorImageInfo>& textureImageInfos)
+{
+	// The registry keeps the textures in ID order, free slots are left null
+	std::vector<VKE::Texture*> orderedTexVec;
+	VKE::Texture::sTexturesLoaded.copy_items(orderedTexVec);
+
+	if (orderedTexVec.size() > MAX_TEXTURES)
+	{
+		std::cout << "[ERROR]: " << orderedTexVec.size() << " textures loaded, only the first " << MAX_TEXTURES << " fit in the texture descriptors" << std::endl;
+		orderedTexVec.resize(MAX_TEXTURES);
+	}
+
+	// The unused slots of the array still need a valid image
+	VkDescriptorImageInfo defaultImageDescriptor{};
+	defaultImageDescriptor.sampler = re->_textureSampler;
+	defaultImageDescriptor.imageView = VKE::Texture::get("default")->_imageView;
+	defaultImageDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	textureImageInfos.clear();
+	textureImageInfos.reserve(MAX_TEXTURES);
+
+	for (const auto& texture : orderedTexVec)
+	{
+		if (texture == nullptr || !texture->is_resident())
+		{
+			textureImageInfos.push_back(defaultImageDescriptor);
+			continue;
+		}
+
+		VkDescriptorImageInfo textureImageDescriptor{};
+		textureImageDescriptor.sampler = re->_textureSampler;
+		textureImageDescriptor.imageView = texture->_imageView;
+		textureImageDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		textureImageInfos.push_back(textureImageDescriptor);
+	}
+
+	textureImageInfos.resize(MAX_TEXTURES, defaultImageDescriptor);
+}
+
+void Renderer::get_texture_array_image_infos(std::vector<VkDescriptorImageInfo>& textureArrayImageInfos)
+{
+	VkDescriptorImageInfo defaultImageDescriptor{};
+	defaultImageDescriptor.sampler = re->_textureSampler;
+	defaultImageDescriptor.imageView = VKE::TextureArray::get_default_view();
+	defaultImageDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	textureArrayImageInfos.assign(MAX_TEXTURE_ARRAYS, defaultImageDescriptor);
+
+	for (const VKE::TextureArray* textureArray : VKE::TextureArray::sTextureArrays)
+	{
+		if (textureArray)
+		{
+			textureArrayImageInfos[textureArray->_id].imageView = textureArray->_imageView;
+		}
+	}
+}
+
 void Renderer::record_deep_shadow_map_command_buffer(RenderObject* first, int count)
 {
 	VkCommandBufferBeginInfo dsmCmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
@@ -725,22 +949,39 @@ void Renderer::record_deep_shadow_map_command_buffer(RenderObject* first, int co
 
 	vkCmdBindDescriptorSets(_dsmCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, re->_dsmPipelineLayout, 2, 1, &_deepShadowMapDescriptorSet, 0, nullptr);
 
-	VKE::Prefab* lastPrefab = nullptr;
+	// Every prefab draws from the arenas, the index arena is bound by the first indexed primitive with the type it needs
+	const VkBuffer vertexArena = re->_vertexArena.get_buffer();
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(_dsmCommandBuffer, 0, 1, &vertexArena, &offset);
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+	// Shadows are cast by the geometry, impostors face the camera and not the light. The LOD levels are the ones the
+	// camera sees, so the shadows match the surfaces that receive them, and a prefab an impostor replaces casts with
+	// its coarsest level as a proxy, like in the TLAS.
+	const glm::vec3 cameraPosition = VulkanEngine::cinstance->camera->_position;
+	const LodSelector lodSelector = get_lod_selector();
+	LodSelector proxySelector = lodSelector;
+	proxySelector.coarsest = true;
+	VertexFormat boundFormat = VERTEX_FORMAT_FULL;
 	for (int i = 0; i < count; i++)
 	{
 		RenderObject& object = first[i];
+		const Impostor* impostor = object._prefab->_impostor;
+		const bool proxy = impostor && re->_impostorPipeline != VK_NULL_HANDLE && vkimpostor::replaces_prefab(*impostor, object._model, cameraPosition);
 
-		if (object._prefab != lastPrefab)
+		// Quantized prefabs need the pipeline with the matching vertex input. Without its shader the loaders already fell
+		// back to full vertices, so this only skips them when the pipeline itself failed to build
+		if (object._prefab->_vertices.format == VERTEX_FORMAT_QUANTIZED && re->_dsmQuantizedPipeline == VK_NULL_HANDLE)
 		{
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(_dsmCommandBuffer, 0, 1, &object._prefab->_vertices.vertexBuffer._buffer, &offset);
-			if (object._prefab->_indices.count > 0)
-			{
-				vkCmdBindIndexBuffer(_dsmCommandBuffer, object._prefab->_indices.indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
-			}
+			continue;
+		}
+		if (object._prefab->_vertices.format != boundFormat)
+		{
+			boundFormat = object._prefab->_vertices.format;
+			vkCmdBindPipeline(_dsmCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, boundFormat == VERTEX_FORMAT_QUANTIZED ? re->_dsmQuantizedPipeline : re->_dsmPipeline);
 		}
 
-		object._prefab->draw(object._model, _dsmCommandBuffer, re->_dsmPipelineLayout);
+		object._prefab->draw(object._model, _dsmCommandBuffer, re->_dsmPipelineLayout, &boundIndexType, proxy ? &proxySelector : &lodSelector);
 	}
 
 	vkCmdEndRenderPass(_dsmCommandBuffer);
@@ -769,12 +1010,12 @@ void Renderer::record_skybox_command_buffer()
 
 	Skybox& skybox = currentScene->_skybox;
 
+	const VkBuffer vertexArena = re->_vertexArena.get_buffer();
 	VkDeviceSize offset = 0;
-	vkCmdBindVertexBuffers(_skyboxCommandBuffer, 0, 1, &skybox._renderable->_prefab->_vertices.vertexBuffer._buffer, &offset);
-
-	vkCmdBindIndexBuffer(_skyboxCommandBuffer, skybox._renderable->_prefab->_indices.indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindVertexBuffers(_skyboxCommandBuffer, 0, 1, &vertexArena, &offset);
 
-	vkCmdDrawIndexed(_skyboxCommandBuffer, skybox._renderable->_prefab->_indices.count, 1, 0, 0, 0);
+	// Without a layout the prefab only draws its primitives, the skybox shaders take no per object data
+	skybox._renderable->_prefab->draw(skybox._renderable->_model, _skyboxCommandBuffer, VK_NULL_HANDLE);
 
 	vkCmdEndRenderPass(_skyboxCommandBuffer);
 
@@ -835,22 +1076,65 @@ void Renderer::record_gbuffers_command_buffers(RenderObject* first, int count)
 
 	vkCmdBindDescriptorSets(_gbuffersCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, re->_gbuffersPipelineLayout, 1, 1, &_materialsDescriptorSet, 0, nullptr);
 
-	VKE::Prefab* lastPrefab = nullptr;
+	const glm::vec3 cameraPosition = VulkanEngine::cinstance->camera->_position;
+	const LodSelector lodSelector = get_lod_selector();
+	std::vector<RenderObject*> impostors;
+
+	// Every prefab draws from the arenas, the index arena is bound by the first indexed primitive with the type it needs
+	const VkBuffer vertexArena = re->_vertexArena.get_buffer();
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(_gbuffersCommandBuffer, 0, 1, &vertexArena, &offset);
+	VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+	VertexFormat boundFormat = VERTEX_FORMAT_FULL;
 	for (int i = 0; i < count; i++)
 	{
 		RenderObject& object = first[i];
 
-		if (object._prefab != lastPrefab)
+		// Far objects are drawn after the rest with a single quad, once for all the parts baked in the impostor
+		const Impostor* impostor = object._prefab->_impostor;
+		if (impostor && re->_impostorPipeline != VK_NULL_HANDLE && vkimpostor::replaces_prefab(*impostor, object._model, cameraPosition))
 		{
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(_gbuffersCommandBuffer, 0, 1, &object._prefab->_vertices.vertexBuffer._buffer, &offset);
-			if (object._prefab->_indices.count > 0)
+			if (impostor->drawnBy == object._prefab)
 			{
-				vkCmdBindIndexBuffer(_gbuffersCommandBuffer, object._prefab->_indices.indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+				impostors.push_back(&object);
 			}
+			continue;
+		}
+
+		// Quantized prefabs need the pipeline with the matching vertex input. Without its shader the loaders already fell
+		// back to full vertices, so this only skips them when the pipeline itself failed to build
+		if (object._prefab->_vertices.format == VERTEX_FORMAT_QUANTIZED && re->_gbuffersQuantizedPipeline == VK_NULL_HANDLE)
+		{
+			continue;
 		}
+		if (object._prefab->_vertices.format != boundFormat)
+		{
+			boundFormat = object._prefab->_vertices.format;
+			vkCmdBindPipeline(_gbuffersCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, boundFormat == VERTEX_FORMAT_QUANTIZED ? re->_gbuffersQuantizedPipeline : re->_gbuffersPipeline);
+		}
+
+		object._prefab->draw(object._model, _gbuffersCommandBuffer, re->_gbuffersPipelineLayout, &boundIndexType, &lodSelector);
+	}
+
+	if (!impostors.empty())
+	{
+		vkCmdBindPipeline(_gbuffersCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, re->_impostorPipeline);
+		vkCmdBindDescriptorSets(_gbuffersCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, re->_impostorPipelineLayout, 0, 1, &_camDescriptorSet, 0, nullptr);
+		vkCmdBindDescriptorSets(_gbuffersCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, re->_impostorPipelineLayout, 1, 1, &_materialsDescriptorSet, 0, nullptr);
+
+		for (RenderObject* object : impostors)
+		{
+			const Impostor* impostor = object->_prefab->_impostor;
 
-		object._prefab->draw(object._model, _gbuffersCommandBuffer, re->_gbuffersPipelineLayout);
+			ImpostorPushConstant constants;
+			constants.modelMatrix = object->_model;
+			constants.center_radius = glm::vec4(impostor->center, impostor->radius);
+			constants.textures_frames_material = glm::vec4(impostor->albedoOpacity->_id, impostor->normalDepth->_id, impostor->framesPerSide, impostor->material ? impostor->material->_id : 0);
+
+			vkCmdPushConstants(_gbuffersCommandBuffer, re->_impostorPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ImpostorPushConstant), &constants);
+			vkCmdDraw(_gbuffersCommandBuffer, 6, 1, 0, 0);
+		}
 	}
 
 	vkCmdEndRenderPass(_gbuffersCommandBuffer);
@@ -1138,11 +1422,12 @@ void Renderer::record_pospo_command_buffer(VkCommandBuffer cmd, uint32_t swapcha
 
 	vkCmdPushConstants(cmd, re->pospo._pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(FlagsPushConstant), &_shaderFlags);
 
+	const VkBuffer vertexArena = re->_vertexArena.get_buffer();
 	VkDeviceSize offset = 0;
-	vkCmdBindVertexBuffers(cmd, 0, 1, &render_quad._vertexBuffer._buffer, &offset);
-	vkCmdBindIndexBuffer(cmd, render_quad._indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vertexArena, &offset);
+	vkCmdBindIndexBuffer(cmd, re->_indexArena.get_buffer(), 0, render_quad._indexType);
 
-	vkCmdDrawIndexed(cmd, static_cast<uint32_t>(render_quad._indices.size()), 1, 0, 0, 0);
+	vkCmdDrawIndexed(cmd, static_cast<uint32_t>(render_quad._indices.size()), 1, render_quad.get_first_index(), render_quad.get_vertex_offset(), 0);
 
 	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
 
@@ -1333,7 +1618,7 @@ void Renderer::init_descriptors()
 	camBufferInfo.range = sizeof(GPUCameraData);
 
 	VkDescriptorImageInfo cubeMapInfo = {};
-	cubeMapInfo.sampler = re->_defaultSampler;
+	cubeMapInfo.sampler = re->_textureSampler;
 	cubeMapInfo.imageView = currentScene->_skybox._cubeMap->_imageView;
 	cubeMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
@@ -1370,111 +1655,30 @@ void Renderer::init_descriptors()
 	materialBufferInfo.offset = 0;
 	materialBufferInfo.range = sizeof(VKE::MaterialToShader) * MAX_MATERIALS;
 
-	// Pass the texture data from a map to a vector, and order it by idx
+	// Materials first, they pack the textures of the arrays written below
+	update_material_infos();
+
 	// Material Textures
 	std::vector<VkDescriptorImageInfo> textureImageInfos;
-	textureImageInfos.reserve(VKE::Texture::sTexturesLoaded.size());
-
-	std::vector<VKE::Texture*> orderedTexVec;
-	orderedTexVec.reserve(VKE::Texture::sTexturesLoaded.size());
-
-	for (auto const& texture : VKE::Texture::sTexturesLoaded)
-	{
-		orderedTexVec.push_back(texture.second);
-	}
+	get_texture_image_infos(textureImageInfos);
 
-	// Order tex idx vector
-	std::sort(orderedTexVec.begin(), orderedTexVec.end(), VKE::Texture::ComparePtrToTexture);
-
-	for(const auto& texture : orderedTexVec)
-	{
-		VkDescriptorImageInfo textureImageDescriptor;
-		textureImageDescriptor.sampler = re->_defaultSampler;
-		textureImageDescriptor.imageView = texture->_imageView;
-		textureImageDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-		textureImageInfos.push_back(textureImageDescriptor);
-	}
+	std::vector<VkDescriptorImageInfo> textureArrayImageInfos;
+	get_texture_array_image_infos(textureArrayImageInfos);
 
 	VkWriteDescriptorSet camWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _camDescriptorSet, &camBufferInfo, 0);
 	VkWriteDescriptorSet materialsWrite = vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _materialsDescriptorSet, &materialBufferInfo, 0);
 	VkWriteDescriptorSet texturesWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _materialsDescriptorSet, textureImageInfos.data(), 1, static_cast<uint32_t>(textureImageInfos.size()));
+	VkWriteDescriptorSet textureArraysWrite = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, _materialsDescriptorSet, textureArrayImageInfos.data(), 2, static_cast<uint32_t>(textureArrayImageInfos.size()));
 
 	std::vector<VkWriteDescriptorSet> deferredWrites = {
 		camWrite,
 		materialsWrite,
-		texturesWrite
+		texturesWrite,
+		textureArraysWrite
 	};
 
 	vkUpdateDescriptorSets(_device, static_cast<uint32_t>(deferredWrites.size()), deferredWrites.data(), 0, nullptr);
 
-	// UPLOAD MATERIAL INFO TO GPU
-	// Create material infos vector
-	_materialInfos.resize(VKE::Material::sMaterials.size());
-
-	// Sort materials by their IDs
-	std::vector<VKE::Material*> materialsAux;
-	materialsAux.resize(VKE::Material::sMaterials.size());
-
-	int i = 0;
-	for(const auto& material : VKE::Material::sMaterials)
-	{
-		materialsAux[i] = material.second;
-		i++;
-	}
-
-	std::sort(materialsAux.begin(), materialsAux.end(), VKE::Material::ComparePtrToMaterial);
-
-	// Assign values to MaterialsToShader
-	i = 0;
-	for(const auto& material : materialsAux)
-	{
-		_materialInfos[i]._color_type = material->_color;
-		_materialInfos[i]._emissive_factor = material->_emissive_factor;
-		_materialInfos[i]._emissive_factor.w = material->_type;
-
-		glm::vec4* factors = &glm::vec4{
-			material->_roughness_factor, material->_metallic_factor,
-			material->_tilling_factor, -1 };
-
-		if (material->_color_texture == nullptr)
-		{
-			factors->w = VKE::Texture::sTexturesLoaded["default"]->_id;
-		}
-		else
-		{
-			factors->w = material->_color_texture->_id;
-		}
-
-		factors->z = 1;
-
-		_materialInfos[i]._roughness_metallic_tilling_color_factors = glm::vec4{
-			factors->x ? factors->x : 0, factors->y ? factors->y : 0,
-			factors->z ? factors->z : 1, factors->w ? factors->w : 0
-		};
-
-		_materialInfos[i]._emissive_metRough_occlusion_normal_indices = glm::vec4{ -1, -1, -1, -1 };
-
-		if(material->_emissive_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.x = material->_emissive_texture->_id;
-		}
-		if (material->_metallic_roughness_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.x = material->_metallic_roughness_texture->_id;
-		}
-		if (material->_occlusion_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.x = material->_occlusion_texture->_id;
-		}
-		if (material->_normal_texture)
-		{
-			_materialInfos[i]._emissive_metRough_occlusion_normal_indices.x = material->_normal_texture->_id;
-		}
-
-		i++;
-	}
-
 	// Deep shadow map descriptors
 
 	VkDescriptorSetAllocateInfo dsmSetAllocInfo = {};
@@ -1552,12 +1756,7 @@ void Renderer::update_descriptors(RenderObject* first, size_t count)
 
 	vmaUnmapMemory(_allocator, _sceneParameterBuffer._allocation);
 
-	void* objectData;
-	vmaMapMemory(_allocator, _objectBuffer._allocation, &objectData);
-
-	memcpy(objectData, _materialInfos.data(), sizeof(VKE::MaterialToShader) * _materialInfos.size());
-
-	vmaUnmapMemory(_allocator, _objectBuffer._allocation);
+	upload_material_infos(_objectBuffer, false);
 }
 
 int Renderer::get_current_frame_index()
@@ -129,6 +129,7 @@ private:
 
 	bool isDeferredCommandInit = false;
 	bool areAccelerationStructuresInit = false;
+	uint32_t _geometryGeneration = 0; // of the arenas the descriptors and the skybox commands point to
 
 	//Queues
 	VkQueue _graphicsQueue;
@@ -157,6 +158,26 @@ private:
 
 	void create_raytracing_descriptor_sets();
 
+	//rebuilds the acceleration structures and rewrites the scene descriptors after prefabs finished loading
+	void refresh_scene_structures();
+
+	//LOD levels the draws and the TLAS use this frame, picked from the main camera
+	LodSelector get_lod_selector() const;
+
+	void get_geometry_infos(VkDescriptorBufferInfo& verticesBufferInfo, VkDescriptorBufferInfo& indicesBufferInfo, std::vector<PrimitiveToShader>& primitivesInfo);
+
+	VkDescriptorBufferInfo create_primitive_info_buffer(const std::vector<PrimitiveToShader>& primitivesInfo);
+
+	void update_material_infos();
+
+	//the raster passes sample without tilling, as before the material tables were shared
+	void upload_material_infos(AllocatedBuffer& buffer, bool applyTilling = true);
+
+	//texture descriptors, padded up to MAX_TEXTURES with the default texture
+	void get_texture_image_infos(std::vector<VkDescriptorImageInfo>& textureImageInfos);
+	//texture array descriptors, padded up to MAX_TEXTURE_ARRAYS with an array view of the default texture
+	void get_texture_array_image_infos(std::vector<VkDescriptorImageInfo>& textureArrayImageInfos);
+
 	void record_deep_shadow_map_command_buffer(RenderObject* first, int count);
 
 	void record_skybox_command_buffer();
@@ -4,6 +4,7 @@
 #include <array>
 #include "vk_material.h"
 #include "vk_textures.h"
+#include "vk_impostor.h"
 #include <cstdlib>
 #include <ctime>
 
@@ -21,20 +22,17 @@ void Scene::load_resources()
 	// Material generation
 	VKE::Material* mapleStemMaterial = new VKE::Material(Texture::get("maple_bark"));
 	mapleStemMaterial->_type = VKE::DIFFUSE;
-	mapleStemMaterial->_id = VKE::Material::sMaterials.size();
 	mapleStemMaterial->_color = glm::vec4{ 1.0, 1.0, 1.0, 1.0 };
 	mapleStemMaterial->register_material("maple_stem");
 
 	VKE::Material* mapleLeavesMaterial = new VKE::Material(Texture::get("maple_leaf"));
 	mapleLeavesMaterial->_type = VKE::REFRACTIVE;
 	mapleLeavesMaterial->_occlusion_texture = Texture::get("maple_leaf_occlusion");
-	mapleLeavesMaterial->_id = VKE::Material::sMaterials.size();
 	mapleLeavesMaterial->_color = glm::vec4{ 1.0, 1.0, 1.0, 0.5 };
 	mapleLeavesMaterial->register_material("maple_leaves");
 
 	VKE::Material* grassMaterial = new VKE::Material(Texture::get("grass"));
 	grassMaterial->_tilling_factor = 10.0f;
-	grassMaterial->_id = VKE::Material::sMaterials.size();
 	grassMaterial->_color = glm::vec4{ 1.0f, 1.0f, 1.0f, 1.0f };
 	grassMaterial->_tilling_factor = 150.0f;
 	grassMaterial->register_material("grass");
@@ -54,6 +52,9 @@ void Scene::load_resources()
 	mapleLeavesPrefab->register_prefab("maple_leaves");
 	Prefab* mapleLeaves2Prefab = new VKE::Prefab(*mapleLeaves2Mesh, "maple_leaves");
 	mapleLeaves2Prefab->register_prefab("maple_leaves2");
+
+	// Distant trees are drawn as impostors, one for the three parts so the whole tree switches at once
+	vkimpostor::create_impostor({ mapleStemPrefab, mapleLeavesPrefab, mapleLeaves2Prefab }, "maple");
 	Prefab* planePrefab = new VKE::Prefab(*planeMesh, "grass");
 	planePrefab->register_prefab("plane");
 }
@@ -196,9 +197,10 @@ void Scene::generate_sample_scene()
 	// Skybox
 	VKE::Texture* cubeMap = new VKE::Texture();
 
-	vkutil::load_cubemap(&std::string("../assets/cube_maps/bluecloud"), VK_FORMAT_R8G8B8A8_UNORM, cubeMap->_image, cubeMap->_imageView);
+	vkutil::load_cubemap("../assets/cube_maps/bluecloud", VK_FORMAT_R8G8B8A8_UNORM, cubeMap->_image, cubeMap->_imageView);
 
-	Prefab* boxPrefab = Prefab::get("../assets/Box.glb");
+	// Imported on the worker threads, the skybox is recorded again once it is loaded
+	Prefab* boxPrefab = Prefab::get_async("../assets/Box.glb");
 	boxPrefab->register_prefab("box");
 
 	RenderObject* box = new RenderObject();
@@ -294,9 +296,10 @@ void Scene::generate_random_sample_scene()
 	// Skybox
 	VKE::Texture* cubeMap = new VKE::Texture();
 
-	vkutil::load_cubemap(&std::string("../assets/cube_maps/bluecloud"), VK_FORMAT_R8G8B8A8_UNORM, cubeMap->_image, cubeMap->_imageView);
+	vkutil::load_cubemap("../assets/cube_maps/bluecloud", VK_FORMAT_R8G8B8A8_UNORM, cubeMap->_image, cubeMap->_imageView);
 
-	Prefab* boxPrefab = Prefab::get("../assets/Box.glb");
+	// Imported on the worker threads, the skybox is recorded again once it is loaded
+	Prefab* boxPrefab = Prefab::get_async("../assets/Box.glb");
 	boxPrefab->register_prefab("box");
 
 	RenderObject* box = new RenderObject();
@@ -0,0 +1,294 @@
+#include "vk_texture_array.h"
+#include "vk_textures.h"
+#include "vk_initializers.h"
+#include "vk_render_engine.h"
+#include "vk_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <map>
+
+std::vector<VKE::TextureArray*> VKE::TextureArray::sTextureArrays;
+std::vector<VKE::TextureArray*> VKE::TextureArray::sRetiredArrays;
+VkImageView VKE::TextureArray::sDefaultView = VK_NULL_HANDLE;
+
+namespace
+{
+	typedef std::array<uint32_t, 4> TextureDescription;
+
+	TextureDescription get_description(const VKE::Texture& texture)
+	{
+		return TextureDescription{ static_cast<uint32_t>(texture._format), texture._width, texture._height, texture._mipLevels };
+	}
+}
+
+bool VKE::TextureArray::pack(const std::vector<Texture*>& textures)
+{
+	// Only resident textures can be copied, the ones created without an upload have no description
+	std::map<TextureDescription, std::vector<Texture*>> groups;
+	for (Texture* texture : textures)
+	{
+		if (!texture || !texture->is_resident() || texture->_format == VK_FORMAT_UNDEFINED || texture->_arrayId >= 0)
+		{
+			continue;
+		}
+
+		std::vector<Texture*>& group = groups[get_description(*texture)];
+		if (std::find(group.begin(), group.end(), texture) == group.end())
+		{
+			group.push_back(texture);
+		}
+	}
+
+	bool changed = false;
+	for (auto& group : groups)
+	{
+		// A full array is left as it is, the textures that do not fit go to the next array with room or a new one
+		std::vector<Texture*>& pending = group.second;
+		while (!pending.empty())
+		{
+			TextureArray* existing = nullptr;
+			for (TextureArray* textureArray : sTextureArrays)
+			{
+				if (textureArray && textureArray->_layers.size() < static_cast<size_t>(MAX_TEXTURE_ARRAY_LAYERS) && get_description(*textureArray->_layers[0]) == group.first)
+				{
+					existing = textureArray;
+					break;
+				}
+			}
+
+			// Textures already packed keep their layer, a texture without another of its size stays on its own
+			std::vector<Texture*> layers = existing ? existing->_layers : std::vector<Texture*>();
+			const size_t added = std::min(pending.size(), static_cast<size_t>(MAX_TEXTURE_ARRAY_LAYERS) - layers.size());
+			layers.insert(layers.end(), pending.begin(), pending.begin() + added);
+			pending.erase(pending.begin(), pending.begin() + added);
+			if (layers.size() < 2)
+			{
+				break;
+			}
+
+			int id = existing ? existing->_id : -1;
+			for (size_t i = 0; id < 0 && i < sTextureArrays.size(); i++)
+			{
+				if (!sTextureArrays[i]) id = static_cast<int>(i);
+			}
+			if (id < 0)
+			{
+				if (sTextureArrays.size() >= MAX_TEXTURE_ARRAYS)
+				{
+					std::cout << "[ERROR] No texture array left for " << layers.size() << " textures of " << group.first[1] << "x" << group.first[2] << std::endl;
+					break;
+				}
+				id = static_cast<int>(sTextureArrays.size());
+				sTextureArrays.push_back(nullptr);
+			}
+
+			TextureArray* textureArray = create(layers, id);
+			if (!textureArray)
+			{
+				break;
+			}
+
+			// The replaced array may still be in the descriptors of a recorded frame
+			if (existing)
+			{
+				sRetiredArrays.push_back(existing);
+			}
+			sTextureArrays[id] = textureArray;
+			for (size_t layer = 0; layer < layers.size(); layer++)
+			{
+				layers[layer]->_arrayId = id;
+				layers[layer]->_arrayLayer = static_cast<uint32_t>(layer);
+			}
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+int VKE::TextureArray::get_shader_index(const Texture* texture)
+{
+	if (!texture)
+	{
+		return -1;
+	}
+	if (texture->_arrayId >= 0)
+	{
+		return MAX_TEXTURES + texture->_arrayId * MAX_TEXTURE_ARRAY_LAYERS + static_cast<int>(texture->_arrayLayer);
+	}
+	return texture->_id;
+}
+
+VkImageView VKE::TextureArray::get_default_view()
+{
+	if (sDefaultView == VK_NULL_HANDLE)
+	{
+		const Texture* defaultTexture = Texture::get("default");
+
+		// A 2D image can be viewed as an array of one layer
+		VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(defaultTexture->_format, defaultTexture->_image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+		imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		VK_CHECK(vkCreateImageView(RenderEngine::_device, &imageViewInfo, nullptr, &sDefaultView));
+
+		queue_destruction();
+	}
+	return sDefaultView;
+}
+
+void VKE::TextureArray::release_unused()
+{
+	for (TextureArray* textureArray : sRetiredArrays)
+	{
+		destroy(textureArray);
+	}
+	sRetiredArrays.clear();
+}
+
+VKE::TextureArray* VKE::TextureArray::create(const std::vector<Texture*>& layers, int id)
+{
+	const Texture& first = *layers[0];
+	const uint32_t layerCount = static_cast<uint32_t>(layers.size());
+
+	VkExtent3D extent = { first._width, first._height, 1 };
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(first._format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, extent);
+	imageInfo.mipLevels = first._mipLevels;
+	imageInfo.arrayLayers = layerCount;
+
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	AllocatedImage image;
+	if (vmaCreateImage(RenderEngine::_allocator, &imageInfo, &allocInfo, &image._image, &image._allocation, nullptr) != VK_SUCCESS)
+	{
+		std::cout << "[ERROR] Could not create a texture array of " << layerCount << " layers" << std::endl;
+		return nullptr;
+	}
+
+	TextureArray* textureArray = new TextureArray();
+	textureArray->_id = id;
+	textureArray->_image = image;
+	textureArray->_layers = layers;
+
+	VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(first._format, image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+	imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	imageViewInfo.subresourceRange.layerCount = layerCount;
+	VK_CHECK(vkCreateImageView(RenderEngine::_device, &imageViewInfo, nullptr, &textureArray->_imageView));
+
+	queue_destruction();
+
+	// Every level of every texture is copied as it is, block compressed ones included
+	std::vector<VkImage> sources;
+	for (const Texture* texture : layers)
+	{
+		sources.push_back(texture->_image._image);
+	}
+	const uint32_t mipLevels = first._mipLevels;
+
+	RenderEngine::_uploadBatcher.record([=](VkCommandBuffer cmd) {
+		VkImageSubresourceRange range = {};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.levelCount = mipLevels;
+		range.layerCount = 1;
+
+		std::vector<VkImageMemoryBarrier> barriers(sources.size() + 1);
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			barriers[i] = {};
+			barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barriers[i].image = sources[i];
+			barriers[i].subresourceRange = range;
+			barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[i].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		}
+
+		VkImageMemoryBarrier& arrayBarrier = barriers.back();
+		arrayBarrier = {};
+		arrayBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		arrayBarrier.image = image._image;
+		arrayBarrier.subresourceRange = range;
+		arrayBarrier.subresourceRange.layerCount = layerCount;
+		arrayBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		arrayBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		arrayBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		arrayBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		arrayBarrier.srcAccessMask = 0;
+		arrayBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+		std::vector<VkImageCopy> regions(mipLevels);
+		for (uint32_t layer = 0; layer < sources.size(); layer++)
+		{
+			for (uint32_t level = 0; level < mipLevels; level++)
+			{
+				regions[level] = {};
+				regions[level].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				regions[level].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, layer, 1 };
+				regions[level].extent = { std::max(1u, extent.width >> level), std::max(1u, extent.height >> level), 1 };
+			}
+			vkCmdCopyImage(cmd, sources[layer], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				mipLevels, regions.data());
+		}
+
+		// Sources and array are sampled from here on
+		for (VkImageMemoryBarrier& barrier : barriers)
+		{
+			barrier.oldLayout = barrier.newLayout;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = barrier.dstAccessMask;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+			0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+	});
+
+	std::cout << "Packed " << layerCount << " textures of " << first._width << "x" << first._height << " into texture array " << id << std::endl;
+	return textureArray;
+}
+
+void VKE::TextureArray::destroy(TextureArray* textureArray)
+{
+	vkDestroyImageView(RenderEngine::_device, textureArray->_imageView, nullptr);
+	vmaDestroyImage(RenderEngine::_allocator, textureArray->_image._image, textureArray->_image._allocation);
+	delete textureArray;
+}
+
+void VKE::TextureArray::destroy_all()
+{
+	release_unused();
+
+	for (TextureArray*& textureArray : sTextureArrays)
+	{
+		if (textureArray)
+		{
+			destroy(textureArray);
+			textureArray = nullptr;
+		}
+	}
+	sTextureArrays.clear();
+
+	if (sDefaultView != VK_NULL_HANDLE)
+	{
+		vkDestroyImageView(RenderEngine::_device, sDefaultView, nullptr);
+		sDefaultView = VK_NULL_HANDLE;
+	}
+}
+
+void VKE::TextureArray::queue_destruction()
+{
+	// Queued after the default texture was loaded, so its view is destroyed before its image
+	static bool queued = false;
+	if (!queued)
+	{
+		RenderEngine::_mainDeletionQueue.push_function([]() { destroy_all(); });
+		queued = true;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vk_types.h"
+#include <vector>
+
+namespace VKE
+{
+	class Texture;
+
+	// Textures of the same size, format and mip count copied into the layers of one 2D array image. The many leaf
+	// variants of the alpha tested materials are packed this way, so the hit shaders sample a single descriptor
+	// whichever variant a ray hits. The textures keep their own image too, textures[] still holds them.
+	class TextureArray
+	{
+	public:
+		int _id = -1; // index in the texture array descriptors
+		AllocatedImage _image{};
+		VkImageView _imageView = VK_NULL_HANDLE;
+		std::vector<Texture*> _layers;
+
+		// Indexed by _id, free slots are left null
+		static std::vector<TextureArray*> sTextureArrays;
+
+		// Packs the resident textures with others of the same description, an array that gains textures is copied
+		// again with them added after its layers. Once it is full they go to another array. Returns whether an array changed, the copies are queued on the
+		// upload batcher. Main thread only.
+		static bool pack(const std::vector<Texture*>& textures);
+
+		// Index the materials give the shaders: the slot in textures[] or, for packed textures,
+		// MAX_TEXTURES + array * MAX_TEXTURE_ARRAY_LAYERS + layer. -1 without a texture.
+		static int get_shader_index(const Texture* texture);
+
+		// View of the default texture for the unused slots of the descriptor array
+		static VkImageView get_default_view();
+
+		// Destroys the arrays replaced since the last call, nothing on the device may still use them
+		static void release_unused();
+
+	private:
+		static TextureArray* create(const std::vector<Texture*>& layers, int id);
+		static void destroy(TextureArray* textureArray);
+		static void destroy_all();
+		static void queue_destruction();
+
+		static std::vector<TextureArray*> sRetiredArrays;
+		static VkImageView sDefaultView;
+	};
+}
@@ -0,0 +1,417 @@
+#include "vk_texture_compression.h"
+#include "vk_profiler.h"
+#include "vk_render_engine.h"
+#include "vk_textures.h"
+#include "vk_thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+namespace
+{
+	typedef uint8_t BlockPixels[16][4];
+
+	// Reads a 4x4 block, blocks over the edge of the image repeat the last row and column
+	void fetch_block(const unsigned char* pixels, int width, int height, int blockX, int blockY, BlockPixels& outBlock)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			const int sourceY = std::min(blockY * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				const int sourceX = std::min(blockX * 4 + x, width - 1);
+				const unsigned char* pixel = pixels + (static_cast<size_t>(sourceY) * width + sourceX) * 4;
+				for (int c = 0; c < 4; c++)
+				{
+					outBlock[y * 4 + x][c] = pixel[c];
+				}
+			}
+		}
+	}
+
+	// Endpoints at both ends of the principal axis of the first channelCount channels of the block
+	void find_endpoints(const BlockPixels& block, int channelCount, float outLow[4], float outHigh[4])
+	{
+		float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < channelCount; c++) mean[c] += block[i][c];
+		}
+		for (int c = 0; c < channelCount; c++) mean[c] /= 16.0f;
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float delta[4];
+			for (int c = 0; c < channelCount; c++) delta[c] = block[i][c] - mean[c];
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = 0; b < channelCount; b++) covariance[a][b] += delta[a] * delta[b];
+			}
+		}
+
+		// A few power iterations are enough to find the dominant direction
+		float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float largest = 0.0f;
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = 0; b < channelCount; b++) next[a] += covariance[a][b] * axis[b];
+				largest = std::max(largest, std::abs(next[a]));
+			}
+
+			if (largest < 1e-6f) break;
+			for (int c = 0; c < channelCount; c++) axis[c] = next[c] / largest;
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channelCount; c++) length += axis[c] * axis[c];
+		length = std::sqrt(length);
+
+		float minProjection = 0.0f;
+		float maxProjection = 0.0f;
+		if (length > 1e-6f)
+		{
+			for (int c = 0; c < channelCount; c++) axis[c] /= length;
+
+			minProjection = 1e9f;
+			maxProjection = -1e9f;
+			for (int i = 0; i < 16; i++)
+			{
+				float projection = 0.0f;
+				for (int c = 0; c < channelCount; c++) projection += (block[i][c] - mean[c]) * axis[c];
+				minProjection = std::min(minProjection, projection);
+				maxProjection = std::max(maxProjection, projection);
+			}
+		}
+
+		for (int c = 0; c < 4; c++)
+		{
+			outLow[c] = c < channelCount ? std::min(std::max(mean[c] + axis[c] * minProjection, 0.0f), 255.0f) : 255.0f;
+			outHigh[c] = c < channelCount ? std::min(std::max(mean[c] + axis[c] * maxProjection, 0.0f), 255.0f) : 255.0f;
+		}
+	}
+
+	template<int CHANNELS>
+	int find_closest(const uint8_t pixel[4], const int palette[][4], int paletteSize)
+	{
+		int best = 0;
+		int bestError = INT32_MAX;
+		for (int i = 0; i < paletteSize; i++)
+		{
+			int error = 0;
+			for (int c = 0; c < CHANNELS; c++)
+			{
+				const int delta = pixel[c] - palette[i][c];
+				error += delta * delta;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	uint16_t to_565(const float color[4])
+	{
+		const uint16_t r = static_cast<uint16_t>(color[0] * 31.0f / 255.0f + 0.5f);
+		const uint16_t g = static_cast<uint16_t>(color[1] * 63.0f / 255.0f + 0.5f);
+		const uint16_t b = static_cast<uint16_t>(color[2] * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void from_565(uint16_t color, int outColor[4])
+	{
+		const int r = (color >> 11) & 31;
+		const int g = (color >> 5) & 63;
+		const int b = color & 31;
+		outColor[0] = (r << 3) | (r >> 2);
+		outColor[1] = (g << 2) | (g >> 4);
+		outColor[2] = (b << 3) | (b >> 2);
+		outColor[3] = 255;
+	}
+
+	void encode_bc1(const BlockPixels& block, uint8_t* out)
+	{
+		float low[4], high[4];
+		find_endpoints(block, 3, low, high);
+
+		// color0 > color1 selects the four color mode
+		uint16_t color0 = to_565(high);
+		uint16_t color1 = to_565(low);
+		if (color0 < color1) std::swap(color0, color1);
+
+		uint32_t indices = 0;
+		if (color0 != color1)
+		{
+			int palette[4][4];
+			from_565(color0, palette[0]);
+			from_565(color1, palette[1]);
+			for (int c = 0; c < 3; c++)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				indices |= static_cast<uint32_t>(find_closest<3>(block[i], palette, 4)) << (2 * i);
+			}
+		}
+
+		out[0] = static_cast<uint8_t>(color0 & 0xFF);
+		out[1] = static_cast<uint8_t>(color0 >> 8);
+		out[2] = static_cast<uint8_t>(color1 & 0xFF);
+		out[3] = static_cast<uint8_t>(color1 >> 8);
+		for (int b = 0; b < 4; b++) out[4 + b] = static_cast<uint8_t>(indices >> (8 * b));
+	}
+
+	void encode_bc4(const BlockPixels& block, int channel, uint8_t* out)
+	{
+		int low = 255;
+		int high = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			low = std::min(low, static_cast<int>(block[i][channel]));
+			high = std::max(high, static_cast<int>(block[i][channel]));
+		}
+
+		// red0 > red1 selects the mode with six interpolated values
+		out[0] = static_cast<uint8_t>(high);
+		out[1] = static_cast<uint8_t>(low);
+
+		uint64_t indices = 0;
+		if (high != low)
+		{
+			int palette[8];
+			palette[0] = high;
+			palette[1] = low;
+			for (int i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * high + i * low + 3) / 7;
+
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0;
+				int bestError = INT32_MAX;
+				for (int p = 0; p < 8; p++)
+				{
+					const int error = std::abs(block[i][channel] - palette[p]);
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+				indices |= static_cast<uint64_t>(best) << (3 * i);
+			}
+		}
+
+		for (int b = 0; b < 6; b++) out[2 + b] = static_cast<uint8_t>(indices >> (8 * b));
+	}
+
+	struct BitWriter
+	{
+		uint8_t* data;
+		uint32_t position = 0;
+
+		void write(uint32_t value, uint32_t bitCount)
+		{
+			for (uint32_t i = 0; i < bitCount; i++, position++)
+			{
+				if (value & (1u << i)) data[position >> 3] |= static_cast<uint8_t>(1u << (position & 7));
+			}
+		}
+	};
+
+	// 7 bits per channel plus a shared lowest bit, the p-bit giving the smallest error is kept
+	void quantize_bc7_endpoint(const float endpoint[4], int outQuantized[4], int& outPBit)
+	{
+		float bestError = 1e30f;
+		for (int pBit = 0; pBit < 2; pBit++)
+		{
+			int quantized[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				quantized[c] = std::min(std::max(static_cast<int>((endpoint[c] - pBit) / 2.0f + 0.5f), 0), 127);
+				const float delta = static_cast<float>((quantized[c] << 1) | pBit) - endpoint[c];
+				error += delta * delta;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				outPBit = pBit;
+				std::copy(quantized, quantized + 4, outQuantized);
+			}
+		}
+	}
+
+	// Mode 6 only: one subset, RGBA endpoints and 4 bit indices
+	void encode_bc7(const BlockPixels& block, uint8_t* out)
+	{
+		static const int WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+		float low[4], high[4];
+		find_endpoints(block, 4, low, high);
+
+		int quantized[2][4];
+		int pBits[2];
+		quantize_bc7_endpoint(low, quantized[0], pBits[0]);
+		quantize_bc7_endpoint(high, quantized[1], pBits[1]);
+
+		int palette[16][4];
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				const int endpoint0 = (quantized[0][c] << 1) | pBits[0];
+				const int endpoint1 = (quantized[1][c] << 1) | pBits[1];
+				palette[i][c] = ((64 - WEIGHTS[i]) * endpoint0 + WEIGHTS[i] * endpoint1 + 32) >> 6;
+			}
+		}
+
+		int indices[16];
+		for (int i = 0; i < 16; i++)
+		{
+			indices[i] = find_closest<4>(block[i], palette, 16);
+		}
+
+		// The anchor index only has 3 bits, swapping the endpoints keeps its top bit at 0
+		if (indices[0] >= 8)
+		{
+			std::swap(quantized[0], quantized[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+		}
+
+		std::fill(out, out + 16, static_cast<uint8_t>(0));
+		BitWriter writer{ out };
+		writer.write(1u << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write(static_cast<uint32_t>(quantized[0][c]), 7);
+			writer.write(static_cast<uint32_t>(quantized[1][c]), 7);
+		}
+		writer.write(static_cast<uint32_t>(pBits[0]), 1);
+		writer.write(static_cast<uint32_t>(pBits[1]), 1);
+		writer.write(static_cast<uint32_t>(indices[0]), 3);
+		for (int i = 1; i < 16; i++)
+		{
+			writer.write(static_cast<uint32_t>(indices[i]), 4);
+		}
+	}
+
+	void encode_block(const BlockPixels& block, VkFormat format, uint8_t* out)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+			encode_bc1(block, out);
+			break;
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			encode_bc4(block, 0, out);
+			break;
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+			encode_bc4(block, 0, out);
+			encode_bc4(block, 1, out + 8);
+			break;
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+			encode_bc7(block, out);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+bool vkbc::is_block_compressed(VkFormat format)
+{
+	return get_block_size(format) != 0;
+}
+
+uint32_t vkbc::get_block_size(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+VkFormat vkbc::select_format(TextureRole role, const void* pixels, int width, int height)
+{
+	switch (role)
+	{
+	case TEXTURE_ROLE_MASK:
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	case TEXTURE_ROLE_NORMAL:
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	default:
+		break;
+	}
+
+	const unsigned char* data = static_cast<const unsigned char*>(pixels);
+	const size_t pixelCount = static_cast<size_t>(width) * height;
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		if (data[i * 4 + 3] != 255) return VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+	return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+}
+
+bool vkbc::is_format_supported(VkFormat format)
+{
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(RenderEngine::_physicalDevice, format, &formatProperties);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (formatProperties.optimalTilingFeatures & required) == required;
+}
+
+void vkbc::compress_mip_chain(const unsigned char* chain, int width, int height, uint32_t mipLevels, VkFormat format,
+	std::vector<unsigned char>& outData)
+{
+	const uint32_t blockSize = get_block_size(format);
+	outData.clear();
+	if (blockSize == 0) return;
+
+	ImportStageScope profile(IMPORT_STAGE_FORMAT_CONVERSION, vkutil::get_mip_chain_size(width, height, mipLevels));
+
+	size_t sourceOffset = 0;
+	for (uint32_t level = 0; level < mipLevels; level++)
+	{
+		const int levelWidth = std::max(1, width >> level);
+		const int levelHeight = std::max(1, height >> level);
+		const int blocksX = (levelWidth + 3) / 4;
+		const int blocksY = (levelHeight + 3) / 4;
+
+		const unsigned char* source = chain + sourceOffset;
+		const size_t destinationOffset = outData.size();
+		outData.resize(destinationOffset + static_cast<size_t>(blocksX) * blocksY * blockSize);
+		unsigned char* destination = outData.data() + destinationOffset;
+
+		// Rows of blocks are independent
+		vkjobs::parallel_for(static_cast<size_t>(blocksY), [&](size_t blockY) {
+			BlockPixels block;
+			for (int blockX = 0; blockX < blocksX; blockX++)
+			{
+				fetch_block(source, levelWidth, levelHeight, blockX, static_cast<int>(blockY), block);
+				encode_block(block, format, destination + (blockY * blocksX + blockX) * blockSize);
+			}
+		});
+
+		sourceOffset += static_cast<size_t>(levelWidth) * levelHeight * 4;
+	}
+}
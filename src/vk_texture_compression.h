@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vk_types.h"
+#include <vector>
+
+// What the texture is used for, decides the block format it is cooked to
+enum TextureRole
+{
+	TEXTURE_ROLE_COLOR,
+	TEXTURE_ROLE_NORMAL,
+	TEXTURE_ROLE_MASK, // single channel, read from red
+};
+
+// Offline block compression of 4 byte per pixel data. The encoders favour speed over quality, they run when
+// an asset is cooked and never while rendering.
+namespace vkbc {
+
+	bool is_block_compressed(VkFormat format);
+
+	// Bytes of a 4x4 block, 0 for formats that are not block compressed
+	uint32_t get_block_size(VkFormat format);
+
+	// BC4 for masks, BC5 for normals, BC1 for opaque color and BC7 when the alpha channel is used
+	VkFormat select_format(TextureRole role, const void* pixels, int width, int height);
+
+	// Whether the device can sample the format, the uncompressed pixels have to be used otherwise
+	bool is_format_supported(VkFormat format);
+
+	// Encodes every level of a chain produced by vkutil::generate_mip_chain, levels are packed one after another
+	void compress_mip_chain(const unsigned char* chain, int width, int height, uint32_t mipLevels, VkFormat format,
+		std::vector<unsigned char>& outData);
+}
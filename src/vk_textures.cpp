@@ -3,15 +3,21 @@
 
 #include "vk_initializers.h"
 #include "vk_utils.h"
+#include "vk_ktx.h"
+#include "vk_thread_pool.h"
+#include "vk_profiler.h"
+#include "vk_image_kernels.h"
 
 #include <stb_image.h>
 #include "vk_render_engine.h"
 #include <cassert>
+#include <algorithm>
+#include <array>
 
 using namespace VKE;
 
-int VKE::Texture::textureCount = 0;
-std::map<std::string, VKE::Texture*> VKE::Texture::sTexturesLoaded;
+ResourceRegistry<VKE::Texture> VKE::Texture::sTexturesLoaded;
+ContentCache<VKE::Texture> VKE::Texture::sTexturesByContent;
 
 bool vkutil::load_image_from_file(const std::string* file, AllocatedImage& outImage)
 {
@@ -24,101 +30,201 @@ bool vkutil::load_image_from_file(const std::string* file, AllocatedImage& outIm
         return false;
     }
 
-    void* pixel_ptr = pixels;
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    AllocatedImage newImage;
+    create_image_from_pixels(pixels, texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, newImage);
 
-    VkFormat image_format = VK_FORMAT_R8G8B8A8_UNORM;
+    stbi_image_free(pixels);
 
-    AllocatedBuffer stagingBuffer = vkutil::create_buffer(RenderEngine::_allocator, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    RenderEngine::_mainDeletionQueue.push_function([=]() {
+        vmaDestroyImage(RenderEngine::_allocator, newImage._image, newImage._allocation);
+    });
 
+    outImage = newImage;
 
-    void* data;
-    vmaMapMemory(RenderEngine::_allocator, stagingBuffer._allocation, &data);
-    memcpy(data, pixel_ptr, static_cast<size_t>(imageSize));
-    vmaUnmapMemory(RenderEngine::_allocator, stagingBuffer._allocation);
+    return true;
+}
 
-    stbi_image_free(pixels);
+bool vkutil::create_image_from_pixels(const void* pixels, int width, int height, VkFormat format, AllocatedImage& outImage)
+{
+    std::vector<ImageUploadData> images(1);
+    images[0].pixels = pixels;
+    images[0].width = width;
+    images[0].height = height;
+    images[0].format = format;
+
+    std::vector<AllocatedImage> newImages;
+    if(!create_images_from_pixels(images, newImages))
+    {
+        return false;
+    }
 
-    VkExtent3D imageExtent;
-    imageExtent.width = static_cast<uint32_t>(texWidth);
-    imageExtent.height = static_cast<uint32_t>(texHeight);
-    imageExtent.depth = 1;
+    outImage = newImages[0];
 
-    VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+    return true;
+}
 
-    AllocatedImage newImage;
+bool vkutil::create_images_from_pixels(const std::vector<ImageUploadData>& images, std::vector<AllocatedImage>& outImages)
+{
+    if(images.empty())
+    {
+        return false;
+    }
+
+    struct MipBlit
+    {
+        VkImage image;
+        int width;
+        int height;
+        uint32_t mipLevels;
+    };
+
+    outImages.resize(images.size());
+    std::vector<MipBlit> blits;
+
+    // The copies and layout transitions end up in the batcher's current submission
+    for(size_t i = 0; i < images.size(); i++)
+    {
+        const int width = images[i].width;
+        const int height = images[i].height;
+
+        // Block compressed images only get the levels they come with
+        const void* pixels = images[i].pixels;
+        uint32_t uploadedLevels = std::min(images[i].mipLevels, get_mip_levels(width, height));
+        const uint32_t mipLevels = get_image_mip_levels(images[i]);
+
+        // Formats that cannot be blitted get their chain on the cpu instead, and so does sRGB color since a blit of
+        // the UNORM image would average it in gamma space
+        std::vector<unsigned char> mipChain;
+        std::vector<VkDeviceSize> levelOffsets = images[i].levelOffsets;
+        if(uploadedLevels < mipLevels && (images[i].srgb || !supports_mip_blits(images[i].format)))
+        {
+            uploadedLevels = generate_mip_chain(pixels, width, height, mipChain, images[i].srgb);
+            pixels = mipChain.data();
+            levelOffsets.clear();
+        }
+
+        VkExtent3D imageExtent;
+        imageExtent.width = static_cast<uint32_t>(width);
+        imageExtent.height = static_cast<uint32_t>(height);
+        imageExtent.depth = 1;
 
-    VmaAllocationCreateInfo dimg_allocinfo = {};
-    dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        VkImageCreateInfo dimg_info = vkinit::image_create_info(images[i].format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, imageExtent);
+        dimg_info.mipLevels = mipLevels;
 
-    vmaCreateImage(RenderEngine::_allocator, &dimg_info, &dimg_allocinfo, &newImage._image, &newImage._allocation, nullptr);
+        VmaAllocationCreateInfo dimg_allocinfo = {};
+        dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        vmaCreateImage(RenderEngine::_allocator, &dimg_info, &dimg_allocinfo, &outImages[i]._image, &outImages[i]._allocation, nullptr);
 
-    vkupload::immediate_submit([&](VkCommandBuffer cmd) {
         VkImageSubresourceRange range;
         range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         range.baseMipLevel = 0;
-        range.levelCount = 1;
+        range.levelCount = mipLevels;
         range.baseArrayLayer = 0;
         range.layerCount = 1;
 
-        VkImageMemoryBarrier imageBarrier_toTransfer = {};
-        imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toTransfer.image = newImage._image;
-        imageBarrier_toTransfer.subresourceRange = range;
-        imageBarrier_toTransfer.srcAccessMask = 0;
-        imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &imageBarrier_toTransfer);
-
-        VkBufferImageCopy copyRegion = {};
-        copyRegion.bufferOffset = 0;
-        copyRegion.bufferRowLength = 0;
-        copyRegion.bufferImageHeight = 0;
-        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        copyRegion.imageSubresource.mipLevel = 0;
-        copyRegion.imageSubresource.baseArrayLayer = 0;
-        copyRegion.imageSubresource.layerCount = 1;
-        copyRegion.imageExtent = imageExtent;
-
-        vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, newImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-    
-        
-        VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
-        imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &imageBarrier_toReadable);
-    });
+        std::vector<VkBufferImageCopy> copyRegions(uploadedLevels);
+        VkDeviceSize offset = 0;
+        VkDeviceSize dataSize = 0;
+        for(uint32_t level = 0; level < uploadedLevels; level++)
+        {
+            const uint32_t levelWidth = std::max(1u, imageExtent.width >> level);
+            const uint32_t levelHeight = std::max(1u, imageExtent.height >> level);
+            const VkDeviceSize levelSize = get_mip_chain_size(levelWidth, levelHeight, 1, images[i].format);
+            if(level < levelOffsets.size())
+            {
+                offset = levelOffsets[level];
+            }
+
+            copyRegions[level] = {};
+            copyRegions[level].bufferOffset = offset;
+            copyRegions[level].bufferRowLength = 0;
+            copyRegions[level].bufferImageHeight = 0;
+            copyRegions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegions[level].imageSubresource.mipLevel = level;
+            copyRegions[level].imageSubresource.baseArrayLayer = 0;
+            copyRegions[level].imageSubresource.layerCount = 1;
+            copyRegions[level].imageExtent = { levelWidth, levelHeight, 1 };
+
+            offset += levelSize;
+            dataSize = std::max(dataSize, offset);
+        }
+
+        // The levels left out stay in transfer layout until the blits below fill them
+        const bool needsBlits = uploadedLevels < mipLevels;
+        RenderEngine::_uploadBatcher.upload_image(outImages[i]._image, pixels, dataSize, copyRegions, range,
+            needsBlits ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        if(needsBlits)
+        {
+            blits.push_back(MipBlit{ outImages[i]._image, width, height, mipLevels });
+        }
+    }
+
+    // One barrier after all the copies, then every chain is blitted in the same submission
+    if(!blits.empty())
+    {
+        RenderEngine::_uploadBatcher.record([blits](VkCommandBuffer cmd) {
+            for(const MipBlit& blit : blits)
+            {
+                generate_mipmaps(cmd, blit.image, blit.width, blit.height, blit.mipLevels);
+            }
+        });
+    }
+
+    return true;
+}
+
+bool vkutil::upload_texture(const ImageUploadData& image, VKE::Texture& outTexture)
+{
+    std::vector<ImageUploadData> images(1, image);
+    std::vector<AllocatedImage> newImages;
+    if(!create_images_from_pixels(images, newImages))
+    {
+        return false;
+    }
 
+    outTexture._image = newImages[0];
+    set_texture_description(image, outTexture);
+
+    VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(image.format, outTexture._image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    VK_CHECK(vkCreateImageView(RenderEngine::_device, &imageViewInfo, nullptr, &outTexture._imageView));
+
+    AllocatedImage newImage = outTexture._image;
+    VkImageView imageView = outTexture._imageView;
     RenderEngine::_mainDeletionQueue.push_function([=]() {
+        vkDestroyImageView(RenderEngine::_device, imageView, nullptr);
         vmaDestroyImage(RenderEngine::_allocator, newImage._image, newImage._allocation);
     });
 
-    vmaDestroyBuffer(RenderEngine::_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+    return true;
+}
 
-    outImage = newImage;
+uint32_t vkutil::get_image_mip_levels(const ImageUploadData& image)
+{
+    const uint32_t fullChain = get_mip_levels(image.width, image.height);
+    return vkbc::is_block_compressed(image.format) ? std::min(image.mipLevels, fullChain) : fullChain;
+}
 
-    return true;
+void vkutil::set_texture_description(const ImageUploadData& image, VKE::Texture& outTexture)
+{
+    outTexture._format = image.format;
+    outTexture._width = static_cast<uint32_t>(image.width);
+    outTexture._height = static_cast<uint32_t>(image.height);
+    outTexture._mipLevels = get_image_mip_levels(image);
+}
+
+bool vkutil::has_texture_description(const ImageUploadData& image, const VKE::Texture& texture)
+{
+    return texture._format == image.format && texture._width == static_cast<uint32_t>(image.width) &&
+        texture._height == static_cast<uint32_t>(image.height) && texture._mipLevels == get_image_mip_levels(image);
 }
 
 bool vkutil::load_image_from_file(const std::string* file, int& width, int& height, void** data)
 {
     int texChannels;
 
+    ImportStageScope profile(IMPORT_STAGE_IMAGE_DECODE);
     stbi_uc* pixels = stbi_load(file->c_str(), &width, &height, &texChannels, STBI_rgb_alpha);
 
     if (!pixels) {
@@ -129,55 +235,230 @@ bool vkutil::load_image_from_file(const std::string* file, int& width, int& heig
     void* pixel_ptr = (void*)pixels;
     *data = pixel_ptr;
 
+    profile.bytes = static_cast<uint64_t>(width) * height * 4;
     return true;
 }
 
-bool vkutil::load_cubemap(const std::string* filename, VkFormat format, AllocatedImage& outImage, VkImageView& outImageView)
+bool vkutil::load_texture_from_file(const std::string& file, TextureRole role, VKE::Texture& outTexture)
 {
-    void* textureData[6];
+    const std::string cookedFile = vkktx::get_cooked_filename(file);
 
-    int width{ 0 };
-    int height{ 0 };
+    std::vector<ImageUploadData> upload(1);
+    KtxTexture ktx;
+    std::vector<unsigned char> mipChain;
+    std::vector<unsigned char> compressedChain;
 
-    const std::string baseName = *filename;
+    // The compressed mips are uploaded straight from the mapped file
+    if(is_cooked_file_up_to_date(file, cookedFile) && vkktx::load_ktx2(cookedFile, ktx) && ktx.faceCount == 1 && vkbc::is_format_supported(ktx.format))
+    {
+        upload[0].pixels = ktx.data;
+        upload[0].width = static_cast<int>(ktx.width);
+        upload[0].height = static_cast<int>(ktx.height);
+        upload[0].format = ktx.format;
+        upload[0].mipLevels = ktx.mipLevels;
+        upload[0].levelOffsets = ktx.levelOffsets;
+    }
+    else
+    {
+        int width, height;
+        void* pixels;
+        if(!load_image_from_file(&file, width, height, &pixels))
+        {
+            return false;
+        }
 
-    // Load 6 faces separately and copy them into a staging buffer
-    load_image_from_file(&std::string(baseName + std::string("_ft.jpg")), width, height, &textureData[0]);
-    load_image_from_file(&std::string(baseName + std::string("_bk.jpg")), width, height, &textureData[1]);
-    load_image_from_file(&std::string(baseName + std::string("_up.jpg")), width, height, &textureData[2]);
-    load_image_from_file(&std::string(baseName + std::string("_dn.jpg")), width, height, &textureData[3]);
-    load_image_from_file(&std::string(baseName + std::string("_rt.jpg")), width, height, &textureData[4]);
-    load_image_from_file(&std::string(baseName + std::string("_lf.jpg")), width, height, &textureData[5]);
+        const uint32_t mipLevels = generate_mip_chain(pixels, width, height, mipChain, role == TEXTURE_ROLE_COLOR);
+        const VkFormat format = vkbc::select_format(role, pixels, width, height);
+        stbi_image_free(pixels);
 
-    const VkDeviceSize imageSize = width * height * 4 * 6.0f;
-    const VkDeviceSize layerSize = imageSize / 6.0f;
+        // Cooked now so the next runs skip the decoding and the encoding
+        vkbc::compress_mip_chain(mipChain.data(), width, height, mipLevels, format, compressedChain);
+        vkktx::write_ktx2(cookedFile, format, width, height, mipLevels, compressedChain);
 
-    AllocatedBuffer stagingBuffer = vkutil::create_buffer(RenderEngine::_allocator, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-    
-    void* data;
-    vmaMapMemory(RenderEngine::_allocator, stagingBuffer._allocation, &data);
+        const bool useCompressed = vkbc::is_format_supported(format);
+        upload[0].pixels = useCompressed ? compressedChain.data() : mipChain.data();
+        upload[0].width = width;
+        upload[0].height = height;
+        upload[0].format = useCompressed ? format : VK_FORMAT_R8G8B8A8_UNORM;
+        upload[0].mipLevels = mipLevels;
+    }
+
+    std::vector<AllocatedImage> images;
+    if(!create_images_from_pixels(upload, images))
+    {
+        return false;
+    }
+
+    outTexture._image = images[0];
+    set_texture_description(upload[0], outTexture);
+
+    VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(upload[0].format, outTexture._image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    VK_CHECK(vkCreateImageView(RenderEngine::_device, &imageViewInfo, nullptr, &outTexture._imageView));
+
+    AllocatedImage image = outTexture._image;
+    VkImageView imageView = outTexture._imageView;
+    RenderEngine::_mainDeletionQueue.push_function([=]() {
+        vkDestroyImageView(RenderEngine::_device, imageView, nullptr);
+        vmaDestroyImage(RenderEngine::_allocator, image._image, image._allocation);
+    });
+
+    outTexture._sourceFile = file;
+
+    return true;
+}
+
+bool vkutil::load_cubemap(const std::string& baseName, VkFormat format, AllocatedImage& outImage, VkImageView& outImageView)
+{
+    static const char* const FACE_SUFFIXES[6] = { "_ft.jpg", "_bk.jpg", "_up.jpg", "_dn.jpg", "_rt.jpg", "_lf.jpg" };
+
+    // The six faces and their mips are cooked together next to them
+    const std::string cookedFile = baseName + ".ktx2";
+
+    bool upToDate = true;
+    for(uint32_t face = 0; face < 6; face++)
+    {
+        upToDate = upToDate && is_cooked_file_up_to_date(baseName + FACE_SUFFIXES[face], cookedFile);
+    }
+
+    KtxTexture ktx;
+    std::vector<unsigned char> levels;
+
+    int width{ 0 };
+    int height{ 0 };
+    uint32_t mipLevels{ 0 };
+    VkFormat uploadFormat = format;
+    const unsigned char* pixels = nullptr;
+    std::vector<VkDeviceSize> levelOffsets;
 
-    for(int i = 0; i < 6; i++)
+    // The compressed faces are uploaded straight from the mapped file
+    if(upToDate && vkktx::load_ktx2(cookedFile, ktx) && ktx.faceCount == 6 && vkbc::is_format_supported(ktx.format))
     {
-        memcpy((void*)((char*)data + layerSize * i), textureData[i], static_cast<size_t>(layerSize));
+        width = static_cast<int>(ktx.width);
+        height = static_cast<int>(ktx.height);
+        mipLevels = ktx.mipLevels;
+        uploadFormat = ktx.format;
+        pixels = ktx.data;
+        levelOffsets = ktx.levelOffsets;
     }
+    else
+    {
+        struct CubemapFace
+        {
+            int width = 0;
+            int height = 0;
+            VkFormat format = VK_FORMAT_UNDEFINED;
+            std::vector<unsigned char> mipChain;
+            std::vector<unsigned char> compressedChain;
+        };
+
+        // Every face is decoded and filtered on its own worker
+        std::array<CubemapFace, 6> faces;
+        vkjobs::parallel_for(faces.size(), [&](size_t face) {
+            const std::string faceFile = baseName + FACE_SUFFIXES[face];
+            void* facePixels;
+            if(!load_image_from_file(&faceFile, faces[face].width, faces[face].height, &facePixels))
+            {
+                return;
+            }
+
+            generate_mip_chain(facePixels, faces[face].width, faces[face].height, faces[face].mipChain, true);
+            faces[face].format = vkbc::select_format(TEXTURE_ROLE_COLOR, facePixels, faces[face].width, faces[face].height);
+            stbi_image_free(facePixels);
+        });
+
+        width = faces[0].width;
+        height = faces[0].height;
+        VkFormat compressedFormat = faces[0].format;
+        for(const CubemapFace& face : faces)
+        {
+            if(face.mipChain.empty() || face.width != width || face.height != height || width != height)
+            {
+                std::cout << "[ERROR] The faces of cubemap " << baseName << " are missing or differ in size" << std::endl;
+                return false;
+            }
+
+            // One face with alpha makes the whole cubemap keep it
+            if(face.format == VK_FORMAT_BC7_UNORM_BLOCK)
+            {
+                compressedFormat = face.format;
+            }
+        }
 
-    vmaUnmapMemory(RenderEngine::_allocator, stagingBuffer._allocation);
+        mipLevels = get_mip_levels(width, height);
+        vkjobs::parallel_for(faces.size(), [&](size_t face) {
+            vkbc::compress_mip_chain(faces[face].mipChain.data(), width, height, mipLevels, compressedFormat, faces[face].compressedChain);
+        });
+
+        // KTX2 layout, the six faces of a level one after another from level 0
+        auto pack_levels = [&](bool compressed, VkFormat levelFormat, std::vector<unsigned char>& outLevels) {
+            outLevels.clear();
+            for(uint32_t level = 0; level < mipLevels; level++)
+            {
+                const size_t offset = get_mip_chain_size(width, height, level, levelFormat);
+                const size_t size = get_mip_chain_size(width >> level, height >> level, 1, levelFormat);
+                for(const CubemapFace& face : faces)
+                {
+                    const unsigned char* chain = compressed ? face.compressedChain.data() : face.mipChain.data();
+                    outLevels.insert(outLevels.end(), chain + offset, chain + offset + size);
+                }
+            }
+        };
+
+        // Cooked now so the next runs skip the decoding and the encoding
+        pack_levels(true, compressedFormat, levels);
+        vkktx::write_ktx2(cookedFile, compressedFormat, width, height, mipLevels, levels, 6);
+
+        if(vkbc::is_format_supported(compressedFormat))
+        {
+            uploadFormat = compressedFormat;
+        }
+        else
+        {
+            pack_levels(false, format, levels);
+        }
+        pixels = levels.data();
+    }
 
-    for(int i = 0; i < 6; i++)
+    // Every level of every face goes in the same upload
+    std::vector<VkBufferImageCopy> bufferCopyRegions;
+    VkDeviceSize offset = 0;
+    VkDeviceSize dataSize = 0;
+    for(uint32_t level = 0; level < mipLevels; level++)
     {
-        stbi_image_free(textureData[i]);
+        const uint32_t levelWidth = std::max(1u, static_cast<uint32_t>(width) >> level);
+        const uint32_t levelHeight = std::max(1u, static_cast<uint32_t>(height) >> level);
+        const VkDeviceSize faceSize = get_mip_chain_size(levelWidth, levelHeight, 1, uploadFormat);
+        if(level < levelOffsets.size())
+        {
+            offset = levelOffsets[level];
+        }
+
+        for(uint32_t face = 0; face < 6; face++)
+        {
+            VkBufferImageCopy bufferCopyRegion = {};
+            bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            bufferCopyRegion.imageSubresource.mipLevel = level;
+            bufferCopyRegion.imageSubresource.baseArrayLayer = face;
+            bufferCopyRegion.imageSubresource.layerCount = 1;
+            bufferCopyRegion.imageExtent = { levelWidth, levelHeight, 1 };
+            bufferCopyRegion.bufferOffset = offset;
+            bufferCopyRegions.push_back(bufferCopyRegion);
+
+            offset += faceSize;
+        }
+        dataSize = std::max(dataSize, offset);
     }
     
     VkExtent3D imageExtent
     {
-        width,
-        height,
+        static_cast<uint32_t>(width),
+        static_cast<uint32_t>(height),
         1
     };
 
     // Create the cube image
-    VkImageCreateInfo cube_img_info = vkinit::image_create_info(format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent );
+    VkImageCreateInfo cube_img_info = vkinit::image_create_info(uploadFormat, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent );
+    cube_img_info.mipLevels = mipLevels;
     cube_img_info.arrayLayers = 6;
     cube_img_info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
 
@@ -191,95 +472,221 @@ bool vkutil::load_cubemap(const std::string* filename, VkFormat format, Allocate
     VkImageView imageView;
 
     // Create cube image view
-    VkImageViewCreateInfo view = vkinit::imageview_create_info(format, newImage._image, VK_IMAGE_ASPECT_COLOR_BIT);
+    VkImageViewCreateInfo view = vkinit::imageview_create_info(uploadFormat, newImage._image, VK_IMAGE_ASPECT_COLOR_BIT);
     view.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
     view.subresourceRange.layerCount = 6;
 
     VK_CHECK(vkCreateImageView(RenderEngine::_device, &view, nullptr, &imageView));
 
-    vkupload::immediate_submit([&](VkCommandBuffer cmd) {
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = mipLevels;
+    subresourceRange.layerCount = 6;
 
-        std::vector<VkBufferImageCopy> bufferCopyRegions;
+    RenderEngine::_uploadBatcher.upload_image(newImage._image, pixels, dataSize, bufferCopyRegions, subresourceRange,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-        for(uint32_t face = 0; face < 6; face++)
+    RenderEngine::_mainDeletionQueue.push_function([=]() {
+        vkDestroyImageView(RenderEngine::_device, imageView, nullptr);
+        vmaDestroyImage(RenderEngine::_allocator, newImage._image, newImage._allocation);
+    });
+
+    outImage = newImage;
+    outImageView = imageView;
+
+    return true;
+}
+
+uint32_t vkutil::get_mip_levels(int width, int height)
+{
+    uint32_t levels = 1;
+    uint32_t size = static_cast<uint32_t>(std::max(width, height));
+    while(size > 1)
+    {
+        size >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+size_t vkutil::get_mip_chain_size(int width, int height, uint32_t mipLevels, VkFormat format)
+{
+    const uint32_t blockSize = vkbc::get_block_size(format);
+
+    size_t size = 0;
+    for(uint32_t level = 0; level < mipLevels; level++)
+    {
+        const size_t levelWidth = static_cast<size_t>(std::max(1, width >> level));
+        const size_t levelHeight = static_cast<size_t>(std::max(1, height >> level));
+        size += blockSize != 0 ? ((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockSize : levelWidth * levelHeight * 4;
+    }
+    return size;
+}
+
+uint32_t vkutil::generate_mip_chain(const void* pixels, int width, int height, std::vector<unsigned char>& outChain, bool srgb)
+{
+    const uint32_t mipLevels = get_mip_levels(width, height);
+    outChain.resize(get_mip_chain_size(width, height, mipLevels));
+
+    ImportStageScope profile(IMPORT_STAGE_FORMAT_CONVERSION, outChain.size());
+
+    memcpy(outChain.data(), pixels, static_cast<size_t>(width) * height * 4);
+
+    size_t srcOffset = 0;
+    int srcWidth = width;
+    int srcHeight = height;
+    for(uint32_t level = 1; level < mipLevels; level++)
+    {
+        const int dstWidth = std::max(1, srcWidth >> 1);
+        const int dstHeight = std::max(1, srcHeight >> 1);
+        const size_t dstOffset = srcOffset + static_cast<size_t>(srcWidth) * srcHeight * 4;
+
+        const unsigned char* src = outChain.data() + srcOffset;
+        unsigned char* dst = outChain.data() + dstOffset;
+
+        if(srgb)
         {
-            // Calculate offset for current face
-            VkBufferImageCopy bufferCopyRegion = {};
-            bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            bufferCopyRegion.imageSubresource.mipLevel = 0;
-            bufferCopyRegion.imageSubresource.baseArrayLayer = face;
-            bufferCopyRegion.imageSubresource.layerCount = 1;
-            bufferCopyRegion.imageExtent = imageExtent;
-            bufferCopyRegion.bufferOffset = layerSize * face;
-            bufferCopyRegions.push_back(bufferCopyRegion);
+            vkimage::downsample_rgba8_srgb(src, srcWidth, srcHeight, dst);
+        }
+        else
+        {
+            vkimage::downsample_rgba8(src, srcWidth, srcHeight, dst);
         }
 
-        // Image barrier
-        VkImageSubresourceRange subresourceRange = {};
-        subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subresourceRange.baseMipLevel = 0;
-        subresourceRange.levelCount = 1;
-        subresourceRange.layerCount = 6;
-
-        VkImageMemoryBarrier imageBarrier_toTransfer = {};
-        imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toTransfer.image = newImage._image;
-        imageBarrier_toTransfer.subresourceRange = subresourceRange;
-        imageBarrier_toTransfer.srcAccessMask = 0;
-        imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &imageBarrier_toTransfer);
+        srcOffset = dstOffset;
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
 
-        vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, newImage._image, 
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-            static_cast<uint32_t>(bufferCopyRegions.size()), bufferCopyRegions.data());
+    return mipLevels;
+}
 
-        VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
-        imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+bool vkutil::supports_mip_blits(VkFormat format)
+{
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(RenderEngine::_physicalDevice, format, &formatProperties);
 
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            0,
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (formatProperties.optimalTilingFeatures & required) == required;
+}
+
+void vkutil::generate_mipmaps(VkCommandBuffer cmd, VkImage image, int width, int height, uint32_t mipLevels, uint32_t layerCount)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = layerCount;
+    barrier.subresourceRange.levelCount = 1;
+
+    int32_t mipWidth = width;
+    int32_t mipHeight = height;
+
+    for(uint32_t level = 1; level < mipLevels; level++)
+    {
+        // The previous level has been written, read it for this blit
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
             0, nullptr,
             0, nullptr,
-            1, &imageBarrier_toReadable);
-
-    });
-
-    RenderEngine::_mainDeletionQueue.push_function([=]() {
-        vkDestroyImageView(RenderEngine::_device, imageView, nullptr);
-        vmaDestroyImage(RenderEngine::_allocator, newImage._image, newImage._allocation);
-    });
-
-    vmaDestroyBuffer(RenderEngine::_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+            1, &barrier);
+
+        const int32_t nextWidth = std::max(1, mipWidth / 2);
+        const int32_t nextHeight = std::max(1, mipHeight / 2);
+
+        VkImageBlit blit = {};
+        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = layerCount;
+        blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = layerCount;
+
+        vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        // Done reading it, hand it over to the shaders
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier);
 
-    outImage = newImage;
-    outImageView = imageView;
+        mipWidth = nextWidth;
+        mipHeight = nextHeight;
+    }
 
-    return true;
+    // The last level was only written to
+    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
 }
 
 VKE::Texture* VKE::Texture::get(const char* name)
 {
     assert(name);
-    std::map<std::string, VKE::Texture*>::iterator it = sTexturesLoaded.find(name);
-    if (it != sTexturesLoaded.end())
-        return it->second;
-    return nullptr;
+    return sTexturesLoaded.find(name);
+}
+
+VKE::Texture* VKE::Texture::get(RegistryHandle handle)
+{
+    return sTexturesLoaded.get(handle);
 }
 
 void VKE::Texture::register_texture(const char* name)
 {
     _name = name;
-    sTexturesLoaded[name] = this;
+    _handle = sTexturesLoaded.insert(_name, this);
+    _id = static_cast<int>(_handle.index);
+}
+
+bool VKE::Texture::make_resident()
+{
+    if(is_resident())
+    {
+        return true;
+    }
+    if(!_pendingUpload)
+    {
+        return false;
+    }
+
+    // Only tried once, a texture that fails keeps sampling the default one
+    std::function<bool(Texture&)> upload = std::move(_pendingUpload);
+    _pendingUpload = nullptr;
+    if(!upload(*this))
+    {
+        std::cout << "[ERROR] Could not upload texture " << _name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+uint64_t vkutil::hash_image(const void* pixels, size_t size, int width, int height, VkFormat format, uint32_t mipLevels)
+{
+    const uint32_t description[4] = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), static_cast<uint32_t>(format), mipLevels };
+    return vkutil::hash_bytes(pixels, size, vkutil::hash_bytes(description, sizeof(description)));
 }
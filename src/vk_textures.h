@@ -2,7 +2,9 @@
 
 #include "vk_types.h"
 #include "vk_engine.h"
-#include <map>
+#include "vk_texture_compression.h"
+#include "vk_registry.h"
+#include <functional>
 
 namespace VKE
 {
@@ -10,29 +12,108 @@ namespace VKE
 	{
 	public:
 		std::string _name;
-		int _id;
+		int _id; // index in the texture arrays of the shaders, the slot of its handle
+		RegistryHandle _handle;
 		AllocatedImage _image;
-		VkImageView _imageView;
+		VkImageView _imageView = VK_NULL_HANDLE;
 		VkDescriptorSet _descriptorSet;
 
+		// Description of the image, textures arrays only pack textures whose descriptions match
+		VkFormat _format = VK_FORMAT_UNDEFINED;
+		uint32_t _width = 0;
+		uint32_t _height = 0;
+		uint32_t _mipLevels = 0;
+
+		// Texture array holding a copy of the image, -1 when it is not packed
+		int _arrayId = -1;
+		uint32_t _arrayLayer = 0;
+
 		//Manager to cache loaded textures
-		static int textureCount;
-		static std::map<std::string, Texture*> sTexturesLoaded;
+		static ResourceRegistry<Texture> sTexturesLoaded;
 		static VKE::Texture* get(const char* name);
+		static VKE::Texture* get(RegistryHandle handle);
+		// Assigns the handle and _id, safe from the worker threads
 		void register_texture(const char* name);
 
-		static bool ComparePtrToTexture(const VKE::Texture* l, const VKE::Texture* r) {	
-			return l->_id < r->_id;
-		}
+		// Textures on the GPU by the hash of their pixels, prefabs sharing an image share the texture
+		static ContentCache<Texture> sTexturesByContent;
+		uint64_t _contentHash = 0;
+
+		std::string _sourceFile; // image it was loaded from, empty for the ones made in memory
+
+		// Textures no material uses yet wait for one with their image still encoded, the renderer uploads them
+		// when a material referring to them reaches the material table. Until then they sample the default texture.
+		std::function<bool(Texture&)> _pendingUpload;
+		bool is_resident() const { return _imageView != VK_NULL_HANDLE; }
+		// Runs the pending upload once, returns whether the texture has an image. Main thread only, the copies
+		// are queued on the upload batcher.
+		bool make_resident();
 	};
 }
 
+struct ImageUploadData
+{
+	const void* pixels;
+	int width;
+	int height;
+	VkFormat format;
+	uint32_t mipLevels = 1; // levels already in pixels, the missing ones are generated unless the format is block compressed
+	std::vector<VkDeviceSize> levelOffsets; // where each level starts in pixels, empty when they are packed from level 0
+	bool srgb = false; // sRGB encoded color in a UNORM format, its missing mips are filtered in linear light on the cpu
+};
+
 namespace vkutil {
 
 	bool load_image_from_file(const std::string* file, AllocatedImage& outImage);
 
 	bool load_image_from_file(const std::string* file, int& width, int& height, void** data);
 
-	bool load_cubemap(const std::string* filename, VkFormat format, AllocatedImage& outImage, VkImageView& outImageView);
+	// Loads the KTX2 file cooked from the image, cooking it first when it is missing or older than the image.
+	// Creates the image and its view, both destroyed with the engine.
+	bool load_texture_from_file(const std::string& file, TextureRole role, VKE::Texture& outTexture);
+
+	// Uploads tightly packed 4 byte per pixel data into a new sampled image. The caller owns the image.
+	// The pixels are copied to staging memory right away, so they can be freed once this returns.
+	bool create_image_from_pixels(const void* pixels, int width, int height, VkFormat format, AllocatedImage& outImage);
+
+	// Same as above for many images at once, the copies are queued on the upload batcher
+	bool create_images_from_pixels(const std::vector<ImageUploadData>& images, std::vector<AllocatedImage>& outImages);
+
+	// Creates the image and view of a texture, both destroyed with the engine
+	bool upload_texture(const ImageUploadData& image, VKE::Texture& outTexture);
+
+	// Levels of the image created for the upload, the missing ones are generated unless it is block compressed
+	uint32_t get_image_mip_levels(const ImageUploadData& image);
+
+	// Fills the description of a texture from the upload its image is created from
+	void set_texture_description(const ImageUploadData& image, VKE::Texture& outTexture);
+
+	// Whether the texture has the description of the upload. Checked when a content hash is found in the cache,
+	// a collision of the 64 bit hashes must not hand out an image of another size or format
+	bool has_texture_description(const ImageUploadData& image, const VKE::Texture& texture);
+
+	// Loads the six <baseName>_ft/_bk/_up/_dn/_rt/_lf.jpg faces through the KTX2 cubemap cooked from them, cooking
+	// it first when it is missing or older than a face. format is used when the device cannot sample the cooked one.
+	bool load_cubemap(const std::string& baseName, VkFormat format, AllocatedImage& outImage, VkImageView& outImageView);
+
+	// Content hash of the pixels of an image, its size and format are part of it
+	uint64_t hash_image(const void* pixels, size_t size, int width, int height, VkFormat format, uint32_t mipLevels = 1);
+
+	// Number of levels of a full mip chain down to 1x1
+	uint32_t get_mip_levels(int width, int height);
+
+	// Size of the first mipLevels levels of an image packed one after another
+	size_t get_mip_chain_size(int width, int height, uint32_t mipLevels, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM);
+
+	// Box filters 4 byte per pixel data into a full mip chain (level 0 included), returns the level count.
+	// Used when the chain is baked offline or the format cannot be blitted. Color is filtered in linear light with srgb.
+	uint32_t generate_mip_chain(const void* pixels, int width, int height, std::vector<unsigned char>& outChain, bool srgb = false);
+
+	// Whether the GPU can generate the mips of images of this format with linear blits
+	bool supports_mip_blits(VkFormat format);
+
+	// Records the blits that fill levels 1..mipLevels-1 from level 0. Every level must be in TRANSFER_DST_OPTIMAL,
+	// they all end in SHADER_READ_ONLY_OPTIMAL.
+	void generate_mipmaps(VkCommandBuffer cmd, VkImage image, int width, int height, uint32_t mipLevels, uint32_t layerCount = 1);
 }
 
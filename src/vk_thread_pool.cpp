@@ -0,0 +1,160 @@
+#include "vk_thread_pool.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+
+namespace
+{
+	class ThreadPool
+	{
+	public:
+		ThreadPool()
+		{
+			uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+			// Leave the main thread out, it takes part in parallel_for anyway
+			for (uint32_t i = 0; i < hardwareThreads - 1; i++)
+			{
+				_workers.emplace_back([this]() { worker_loop(); });
+			}
+		}
+
+		~ThreadPool()
+		{
+			stop();
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (_stopping) return;
+				_stopping = true;
+			}
+			_condition.notify_all();
+
+			for (std::thread& worker : _workers)
+			{
+				worker.join();
+			}
+			_workers.clear();
+		}
+
+		void push(std::function<void()>&& job)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_jobs.push_back(std::move(job));
+			}
+			_condition.notify_one();
+		}
+
+		uint32_t worker_count() const { return static_cast<uint32_t>(_workers.size()); }
+
+	private:
+		void worker_loop()
+		{
+			while (true)
+			{
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_condition.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+
+					if (_jobs.empty()) return;
+
+					job = std::move(_jobs.front());
+					_jobs.pop_front();
+				}
+
+				job();
+			}
+		}
+
+		std::vector<std::thread> _workers;
+		std::deque<std::function<void()>> _jobs;
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		bool _stopping = false;
+	};
+
+	ThreadPool& get_pool()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+}
+
+uint32_t vkjobs::get_thread_count()
+{
+	return get_pool().worker_count() + 1;
+}
+
+void vkjobs::parallel_for(size_t count, const std::function<void(size_t index)>& job)
+{
+	if (count == 0) return;
+
+	if (count == 1)
+	{
+		job(0);
+		return;
+	}
+
+	// Every participant keeps grabbing the next index until there are none left
+	struct Batch
+	{
+		std::atomic<size_t> next{ 0 };
+		std::atomic<size_t> done{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+
+	auto run = [batch, count, &job]() {
+		size_t processed = 0;
+		for (size_t i = batch->next++; i < count; i = batch->next++)
+		{
+			job(i);
+			processed++;
+		}
+
+		if (processed > 0 && batch->done.fetch_add(processed) + processed == count)
+		{
+			std::lock_guard<std::mutex> lock(batch->mutex);
+			batch->finished.notify_all();
+		}
+	};
+
+	uint32_t helpers = std::min<uint32_t>(get_pool().worker_count(), static_cast<uint32_t>(count - 1));
+	for (uint32_t i = 0; i < helpers; i++)
+	{
+		get_pool().push(run);
+	}
+
+	run();
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->finished.wait(lock, [&]() { return batch->done.load() == count; });
+}
+
+std::future<void> vkjobs::submit(std::function<void()>&& job)
+{
+	std::shared_ptr<std::packaged_task<void()>> task = std::make_shared<std::packaged_task<void()>>(std::move(job));
+	std::future<void> future = task->get_future();
+
+	get_pool().push([task]() { (*task)(); });
+
+	return future;
+}
+
+void vkjobs::shutdown()
+{
+	get_pool().stop();
+}
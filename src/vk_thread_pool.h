@@ -0,0 +1,21 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <cstdint>
+
+// Small pool of worker threads shared by the loaders. Jobs must not touch Vulkan queues, those stay on the main thread.
+namespace vkjobs {
+
+	// Number of worker threads plus the calling thread
+	uint32_t get_thread_count();
+
+	// Runs job(i) for every i in [0, count) across the workers and the calling thread, returns once all of them finished
+	void parallel_for(size_t count, const std::function<void(size_t index)>& job);
+
+	// Queues a job and returns a future that becomes ready when it has run
+	std::future<void> submit(std::function<void()>&& job);
+
+	// Joins the workers, call it before exiting
+	void shutdown();
+}
@@ -1,5 +1,23 @@
 #include "vk_utils.h"
 #include "vk_initializers.h"
+#include "vk_profiler.h"
+
+#include <sys/stat.h>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 uint32_t vkutil::find_memory_type_index(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
 {
@@ -97,8 +115,74 @@ AllocatedBuffer vkutil::create_buffer(VmaAllocator allocator, size_t allocSize,
 	return newBuffer;
 }
 
+int64_t vkutil::get_file_timestamp(const std::string& filename)
+{
+#ifdef _WIN32
+	struct _stat64 fileInfo;
+	if (_stat64(filename.c_str(), &fileInfo) != 0)
+	{
+		return 0;
+	}
+#else
+	struct stat fileInfo;
+	if (stat(filename.c_str(), &fileInfo) != 0)
+	{
+		return 0;
+	}
+#endif
+
+	return static_cast<int64_t>(fileInfo.st_mtime);
+}
+
+bool vkutil::is_cooked_file_up_to_date(const std::string& sourceFilename, const std::string& cookedFilename)
+{
+	int64_t cookedTimestamp = get_file_timestamp(cookedFilename);
+	if (cookedTimestamp == 0)
+	{
+		return false;
+	}
+
+	int64_t sourceTimestamp = get_file_timestamp(sourceFilename);
+	return sourceTimestamp == 0 || cookedTimestamp >= sourceTimestamp;
+}
+
+uint64_t vkutil::hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed ^ (0x9E3779B97F4A7C15ull + size);
+
+	auto mix = [&](uint64_t value) {
+		hash ^= value;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 32;
+	};
+
+	// Eight bytes at a time, the tail is padded with zeros
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t value;
+		memcpy(&value, bytes + i, sizeof(value));
+		mix(value);
+	}
+	if (i < size)
+	{
+		uint64_t value = 0;
+		memcpy(&value, bytes + i, size - i);
+		mix(value);
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
 void vkupload::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function)
 {
+	RenderEngine::_uploadBatcher.flush_and_wait();
+
 	VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(RenderEngine::_uploadContext._commandPool, 1);
 
 	VkCommandBuffer cmd;
@@ -123,6 +207,370 @@ void vkupload::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& funct
 	vkResetCommandPool(RenderEngine::_device, RenderEngine::_uploadContext._commandPool, 0);
 }
 
+vkupload::UploadBatcher::UploadBatcher() :
+	_device(VK_NULL_HANDLE), _allocator(VK_NULL_HANDLE), _queue(VK_NULL_HANDLE), _commandPool(VK_NULL_HANDLE),
+	_stagingBuffer{}, _stagingData(nullptr), _capacity(0), _head(0), _used(0), _current{},
+	_recording(false), _pendingCopies(false), _nextValue(1), _completedValue(0)
+{
+}
+
+void vkupload::UploadBatcher::init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, VkDeviceSize stagingSize)
+{
+	_device = device;
+	_allocator = allocator;
+	_queue = queue;
+	_capacity = stagingSize;
+
+	VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_commandPool));
+
+	_stagingBuffer = vkutil::create_buffer(_allocator, _capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+	void* data;
+	VK_CHECK(vmaMapMemory(_allocator, _stagingBuffer._allocation, &data));
+	_stagingData = static_cast<unsigned char*>(data);
+}
+
+void vkupload::UploadBatcher::destroy()
+{
+	flush_and_wait();
+
+	for (Submission& submission : _freeSubmissions)
+	{
+		vkDestroyFence(_device, submission.fence, nullptr);
+	}
+	_freeSubmissions.clear();
+
+	vkDestroyCommandPool(_device, _commandPool, nullptr);
+
+	vmaUnmapMemory(_allocator, _stagingBuffer._allocation);
+	vmaDestroyBuffer(_allocator, _stagingBuffer._buffer, _stagingBuffer._allocation);
+	_stagingData = nullptr;
+}
+
+VkCommandBuffer vkupload::UploadBatcher::get_command_buffer()
+{
+	if (_recording)
+	{
+		return _current.cmd;
+	}
+
+	if (!_freeSubmissions.empty())
+	{
+		_current = std::move(_freeSubmissions.back());
+		_freeSubmissions.pop_back();
+
+		VK_CHECK(vkResetFences(_device, 1, &_current.fence));
+		VK_CHECK(vkResetCommandBuffer(_current.cmd, 0));
+	}
+	else
+	{
+		_current = Submission{};
+
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_current.cmd));
+
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_current.fence));
+	}
+
+	_current.ringBytes = 0;
+	_current.stagedBytes = 0;
+
+	VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(_current.cmd, &cmdBeginInfo));
+
+	_recording = true;
+	_pendingCopies = false;
+
+	return _current.cmd;
+}
+
+void* vkupload::UploadBatcher::allocate_staging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer& outBuffer, VkDeviceSize& outOffset)
+{
+	get_command_buffer();
+	_current.stagedBytes += size;
+
+	// Bigger than the whole ring, it gets its own buffer freed with the batch
+	if (size > _capacity)
+	{
+		AllocatedBuffer dedicated = vkutil::create_buffer(_allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+		VmaAllocationInfo allocationInfo;
+		vmaGetAllocationInfo(_allocator, dedicated._allocation, &allocationInfo);
+
+		_current.dedicatedBuffers.push_back(dedicated);
+		outBuffer = dedicated._buffer;
+		outOffset = 0;
+		return allocationInfo.pMappedData;
+	}
+
+	VkDeviceSize offset;
+	VkDeviceSize needed;
+	while (true)
+	{
+		offset = vkutil::get_aligned_size(_head, static_cast<uint32_t>(alignment));
+		needed = offset - _head + size;
+
+		// Not enough room until the end of the ring, skip the tail and start again from the beginning
+		if (offset + size > _capacity)
+		{
+			offset = 0;
+			needed = _capacity - _head + size;
+		}
+
+		if (_capacity - _used >= needed)
+		{
+			break;
+		}
+
+		if (_inFlight.empty())
+		{
+			// The batch being recorded holds the space, submit it and wait for it
+			wait(flush());
+			get_command_buffer();
+		}
+		else
+		{
+			retire_oldest();
+		}
+	}
+
+	_used += needed;
+	_current.ringBytes += needed;
+	_head = offset + size;
+
+	outBuffer = _stagingBuffer._buffer;
+	outOffset = offset;
+	return _stagingData + offset;
+}
+
+void vkupload::UploadBatcher::upload_buffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	if (size == 0) return;
+
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset;
+	void* staging = allocate_staging(size, 16, stagingBuffer, stagingOffset);
+	{
+		ImportStageScope profile(IMPORT_STAGE_STAGING_COPY, size);
+		memcpy(staging, data, static_cast<size_t>(size));
+	}
+
+	copy_buffer(stagingBuffer, stagingOffset, dstBuffer, dstOffset, size);
+}
+
+void vkupload::UploadBatcher::copy_buffer(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size)
+{
+	VkCommandBuffer cmd = get_command_buffer();
+
+	VkBufferCopy copyRegion;
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+
+	vkCmdCopyBuffer(cmd, srcBuffer, dstBuffer, 1, &copyRegion);
+	_pendingCopies = true;
+}
+
+void vkupload::UploadBatcher::upload_image(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions,
+	const VkImageSubresourceRange& range, VkImageLayout finalLayout)
+{
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset;
+	void* staging = allocate_staging(size, 16, stagingBuffer, stagingOffset);
+	{
+		ImportStageScope profile(IMPORT_STAGE_STAGING_COPY, size);
+		memcpy(staging, data, static_cast<size_t>(size));
+	}
+
+	VkCommandBuffer cmd = get_command_buffer();
+
+	VkImageMemoryBarrier imageBarrier_toTransfer = {};
+	imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier_toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier_toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier_toTransfer.image = image;
+	imageBarrier_toTransfer.subresourceRange = range;
+	imageBarrier_toTransfer.srcAccessMask = 0;
+	imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &imageBarrier_toTransfer);
+
+	std::vector<VkBufferImageCopy> stagingRegions = regions;
+	for (VkBufferImageCopy& region : stagingRegions)
+	{
+		region.bufferOffset += stagingOffset;
+	}
+
+	vkCmdCopyBufferToImage(cmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(stagingRegions.size()), stagingRegions.data());
+
+	if (finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+	{
+		VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+		imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier_toReadable.newLayout = finalLayout;
+		imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &imageBarrier_toReadable);
+	}
+	else
+	{
+		_pendingCopies = true;
+	}
+}
+
+void vkupload::UploadBatcher::record(std::function<void(VkCommandBuffer cmd)>&& function)
+{
+	VkCommandBuffer cmd = get_command_buffer();
+
+	if (_pendingCopies)
+	{
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+
+		_pendingCopies = false;
+	}
+
+	function(cmd);
+}
+
+void vkupload::UploadBatcher::on_complete(std::function<void()>&& function)
+{
+	get_command_buffer();
+	_current.completions.push_back(std::move(function));
+}
+
+uint64_t vkupload::UploadBatcher::flush()
+{
+	if (!_recording)
+	{
+		return _nextValue - 1;
+	}
+
+	ImportStageScope profile(IMPORT_STAGE_GPU_SUBMIT, _current.stagedBytes);
+
+	// Make the copies visible to whatever the frames submitted after this one do with the buffers
+	if (_pendingCopies)
+	{
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+		vkCmdPipelineBarrier(_current.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+
+		_pendingCopies = false;
+	}
+
+	VK_CHECK(vkEndCommandBuffer(_current.cmd));
+
+	VkSubmitInfo submit = vkinit::submit_info(&_current.cmd);
+	VK_CHECK(vkQueueSubmit(_queue, 1, &submit, _current.fence));
+
+	_current.value = _nextValue++;
+	_inFlight.push_back(std::move(_current));
+	_current = Submission{};
+	_recording = false;
+
+	retire_completed();
+
+	return _nextValue - 1;
+}
+
+void vkupload::UploadBatcher::wait(uint64_t value)
+{
+	if (_recording && value >= _nextValue)
+	{
+		flush();
+	}
+
+	ImportStageScope profile(IMPORT_STAGE_GPU_SUBMIT);
+	while (!_inFlight.empty() && _inFlight.front().value <= value)
+	{
+		retire_oldest();
+	}
+}
+
+void vkupload::UploadBatcher::flush_and_wait()
+{
+	wait(flush());
+}
+
+uint64_t vkupload::UploadBatcher::get_completed_value()
+{
+	retire_completed();
+	return _completedValue;
+}
+
+void vkupload::UploadBatcher::retire_oldest()
+{
+	Submission submission = std::move(_inFlight.front());
+	_inFlight.pop_front();
+
+	VK_CHECK(vkWaitForFences(_device, 1, &submission.fence, true, UINT64_MAX));
+
+	for (std::function<void()>& completion : submission.completions)
+	{
+		completion();
+	}
+	submission.completions.clear();
+
+	for (AllocatedBuffer& buffer : submission.dedicatedBuffers)
+	{
+		vmaDestroyBuffer(_allocator, buffer._buffer, buffer._allocation);
+	}
+	submission.dedicatedBuffers.clear();
+
+	_used -= submission.ringBytes;
+	_completedValue = submission.value;
+
+	// Nothing is left in the ring, start again from the beginning to keep the free space contiguous
+	if (_used == 0 && !_recording)
+	{
+		_head = 0;
+	}
+
+	_freeSubmissions.push_back(std::move(submission));
+}
+
+void vkupload::UploadBatcher::retire_completed()
+{
+	while (!_inFlight.empty() && vkGetFenceStatus(_device, _inFlight.front().fence) == VK_SUCCESS)
+	{
+		retire_oldest();
+	}
+}
+
 Timer::Timer(const std::string& name)
 {
 	_name = name;
@@ -161,3 +609,115 @@ void Timer::print_average_duration()
 	float ms = totalDuration * 1000.0f / timerCount;
 	std::cout << "TIMER: " << _name << " took an average of " << ms << "ms " << "after " << timerCount << " samples\n";
 }
+
+MappedFile::MappedFile() : data(nullptr), size(0)
+{
+#ifdef _WIN32
+	_fileHandle = INVALID_HANDLE_VALUE;
+	_mappingHandle = nullptr;
+#else
+	_fileDescriptor = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+	close();
+
+	ImportStageScope profile(IMPORT_STAGE_FILE_READ);
+
+#ifdef _WIN32
+	_fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(_fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	_mappingHandle = CreateFileMappingA(_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!_mappingHandle)
+	{
+		close();
+		return false;
+	}
+
+	data = static_cast<const unsigned char*>(MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	_fileDescriptor = ::open(filename.c_str(), O_RDONLY);
+	if (_fileDescriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat fileInfo;
+	if (fstat(_fileDescriptor, &fileInfo) != 0 || fileInfo.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, _fileDescriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	data = static_cast<const unsigned char*>(mapping);
+	size = static_cast<size_t>(fileInfo.st_size);
+#endif
+
+	if (!data)
+	{
+		close();
+		return false;
+	}
+
+	profile.bytes = size;
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (data)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (_mappingHandle)
+	{
+		CloseHandle(_mappingHandle);
+		_mappingHandle = nullptr;
+	}
+	if (_fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(_fileHandle);
+		_fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (data)
+	{
+		munmap(const_cast<unsigned char*>(data), size);
+	}
+	if (_fileDescriptor >= 0)
+	{
+		::close(_fileDescriptor);
+		_fileDescriptor = -1;
+	}
+#endif
+
+	data = nullptr;
+	size = 0;
+}
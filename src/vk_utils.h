@@ -25,6 +25,31 @@ struct Timer
 	void print_average_duration();
 };
 
+// Read-only view of a whole file mapped into memory. The data stays valid until close() or destruction.
+struct MappedFile
+{
+	const unsigned char* data;
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+
+	// Owns the mapping, a copy would unmap it twice
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& filename);
+	void close();
+
+private:
+#ifdef _WIN32
+	void* _fileHandle;
+	void* _mappingHandle;
+#else
+	int _fileDescriptor;
+#endif
+};
+
 namespace vkutil {
 
 	uint32_t find_memory_type_index(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties);
@@ -36,11 +61,96 @@ namespace vkutil {
 	bool load_shader_module(VkDevice device, const char* filePath, VkShaderModule* outShaderModule);
 
 	AllocatedBuffer create_buffer(VmaAllocator allocator, size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlags flags = 0);
+
+	// Returns the last modification time of a file, or 0 if it does not exist
+	int64_t get_file_timestamp(const std::string& filename);
+
+	// A cooked file is valid when it is newer than its source or when the source is not shipped
+	bool is_cooked_file_up_to_date(const std::string& sourceFilename, const std::string& cookedFilename);
+
+	// 64 bit hash of a block of memory, used to find resources with the same content
+	uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
 }
 
 #include "vk_render_engine.h"
 
+#include <deque>
+
 namespace vkupload {
 
+	// Submits the commands and waits for them. Pending batched uploads are flushed first so the commands see them.
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
+
+	const VkDeviceSize DEFAULT_STAGING_SIZE = 64 * 1024 * 1024;
+
+	// Collects many buffer and image uploads (and any extra commands such as BLAS builds) into a single submission.
+	// Staging memory comes from a persistently mapped ring that is recycled as the submissions complete.
+	class UploadBatcher
+	{
+	public:
+		UploadBatcher();
+
+		void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+		void destroy();
+
+		// Reserves staging memory for the caller to write into. It stays valid until the batch that uses it completes.
+		void* allocate_staging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer& outBuffer, VkDeviceSize& outOffset);
+
+		void upload_buffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+		void copy_buffer(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size);
+
+		// Copies the regions from the pixel data (offsets are relative to data) and leaves the range in finalLayout
+		void upload_image(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions,
+			const VkImageSubresourceRange& range, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		// Records commands after everything queued so far, copies are made visible to them
+		void record(std::function<void(VkCommandBuffer cmd)>&& function);
+
+		// Called once the batch that is being recorded has completed on the GPU
+		void on_complete(std::function<void()>&& function);
+
+		// Submits the current batch and returns the value to wait for it
+		uint64_t flush();
+		void wait(uint64_t value);
+		void flush_and_wait();
+
+		uint64_t get_completed_value();
+		bool is_recording() const { return _recording; }
+
+	private:
+		struct Submission
+		{
+			VkCommandBuffer cmd;
+			VkFence fence;
+			uint64_t value;
+			VkDeviceSize ringBytes;
+			VkDeviceSize stagedBytes = 0; // copied to staging memory, reported with the submission
+			std::vector<AllocatedBuffer> dedicatedBuffers;
+			std::vector<std::function<void()>> completions;
+		};
+
+		VkCommandBuffer get_command_buffer();
+		void retire_oldest();
+		void retire_completed();
+
+		VkDevice _device;
+		VmaAllocator _allocator;
+		VkQueue _queue;
+		VkCommandPool _commandPool;
+
+		AllocatedBuffer _stagingBuffer;
+		unsigned char* _stagingData;
+		VkDeviceSize _capacity;
+		VkDeviceSize _head;
+		VkDeviceSize _used;
+
+		Submission _current;
+		bool _recording;
+		bool _pendingCopies;
+		std::deque<Submission> _inFlight;
+		std::vector<Submission> _freeSubmissions;
+
+		uint64_t _nextValue;
+		uint64_t _completedValue;
+	};
 }
\ No newline at end of file